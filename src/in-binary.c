@@ -0,0 +1,486 @@
+/*
+    reading binary scan files
+
+    The "masscan/1.1" format is a series of TLV records, described in
+    util/scan2text.c. The type and length fields are variable length,
+    where the high-order bit means another byte follows. The file header
+    (and trailer) is itself such a record, of type 'm' (109) and length
+    'a' (97), so we parse it like any other record, then skip it.
+
+    The "masscan/2.0" format is parsed by the reader in out-binary2.c.
+*/
+#include "in-binary.h"
+#include "masscan.h"
+#include "output.h"
+#include "pixie-mmap.h"
+#include "proto-banner1.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ScanFile {
+    enum ScanFileFormat format;
+
+    /* either a memory-mapped file, a buffer from the caller, or a FILE */
+    const unsigned char *mem;
+    size_t mem_length;
+    size_t mem_offset;
+    int is_mapped;
+    FILE *fp;
+    int is_fp_owned;
+    uint64_t size;
+
+    /* for reading through stdio */
+    unsigned char *iobuf;
+    size_t iobuf_max;
+
+    struct Binary2Reader *v2;
+};
+
+
+/***************************************************************************
+ * Get the next 'length' bytes, either pointing into the mapped file, or
+ * read into our buffer.
+ ***************************************************************************/
+static const unsigned char *
+scanfile_get(struct ScanFile *f, size_t length)
+{
+    if (f->fp == NULL) {
+        const unsigned char *px;
+        if (length > f->mem_length - f->mem_offset)
+            return NULL;
+        px = f->mem + f->mem_offset;
+        f->mem_offset += length;
+        return px;
+    }
+
+    if (length > f->iobuf_max) {
+        unsigned char *new_buf = (unsigned char *)realloc(f->iobuf, length);
+        if (new_buf == NULL)
+            return NULL;
+        f->iobuf = new_buf;
+        f->iobuf_max = length;
+    }
+    if (fread(f->iobuf, 1, length, f->fp) != length)
+        return NULL;
+    return f->iobuf;
+}
+
+/***************************************************************************
+ * Read the variable-length [TYPE] or [LENGTH] fields
+ ***************************************************************************/
+static int
+scanfile_get_varlen(struct ScanFile *f, unsigned *r_x)
+{
+    const unsigned char *px;
+    unsigned x;
+    unsigned i;
+
+    px = scanfile_get(f, 1);
+    if (px == NULL)
+        return -1;
+    x = px[0] & 0x7F;
+    for (i=0; (px[0] & 0x80) && i<4; i++) {
+        px = scanfile_get(f, 1);
+        if (px == NULL)
+            return -1;
+        x = (x << 7) | (px[0] & 0x7F);
+    }
+    *r_x = x;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+scanfile_next_v1(struct ScanFile *f, struct ScanRecord *rec)
+{
+    for (;;) {
+        unsigned type;
+        unsigned length;
+        const unsigned char *px;
+
+        if (scanfile_get_varlen(f, &type) != 0)
+            return 0; /* end of file */
+        if (scanfile_get_varlen(f, &length) != 0)
+            return -1;
+        px = scanfile_get(f, length);
+        if (px == NULL)
+            return -1;
+
+        memset(rec, 0, sizeof(*rec));
+        switch (type) {
+        case 1: /* STATUS: open */
+        case 2: /* STATUS: closed */
+            if (length < 12)
+                return -1;
+            rec->kind = (type == 1) ? Port_Open : Port_Closed;
+            rec->timestamp = px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+            rec->ip        = px[4]<<24 | px[5]<<16 | px[6]<<8 | px[7];
+            rec->port      = px[8]<<8 | px[9];
+            rec->reason    = px[10];
+            rec->ttl       = px[11];
+            return 1;
+        case 3: /* BANNER */
+            if (length < 12)
+                return -1;
+            rec->kind = SCAN_KIND_BANNER;
+            rec->timestamp = px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+            rec->ip        = px[4]<<24 | px[5]<<16 | px[6]<<8 | px[7];
+            rec->ip_proto  = 6;
+            rec->port      = px[8]<<8 | px[9];
+            rec->proto     = px[10]<<8 | px[11];
+            rec->banner    = px + 12;
+            rec->banner_length = length - 12;
+            return 1;
+        case 5: /* BANNER, over UDP, etc. */
+            if (length < 13)
+                return -1;
+            rec->kind = SCAN_KIND_BANNER;
+            rec->timestamp = px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+            rec->ip        = px[4]<<24 | px[5]<<16 | px[6]<<8 | px[7];
+            rec->ip_proto  = px[8];
+            rec->port      = px[9]<<8 | px[10];
+            rec->proto     = px[11]<<8 | px[12];
+            rec->banner    = px + 13;
+            rec->banner_length = length - 13;
+            return 1;
+        default:
+            /* FILEHEADER ('m'), or record types from newer versions,
+             * which the TLV format lets us skip */
+            continue;
+        }
+    }
+}
+
+/***************************************************************************
+ * Look at the start of the file to figure out which format it is
+ ***************************************************************************/
+static struct ScanFile *
+scanfile_detect(struct ScanFile *f)
+{
+    unsigned char header[16];
+
+    memset(header, 0, sizeof(header));
+    if (f->fp) {
+        size_t count = fread(header, 1, sizeof(header), f->fp);
+        if (count < 11 || fseek(f->fp, 0, SEEK_SET) != 0)
+            goto fail;
+    } else {
+        if (f->mem_length < 16)
+            goto fail;
+        memcpy(header, f->mem, sizeof(header));
+    }
+
+    if (memcmp(header, "masscan/1.1", 11) == 0) {
+        f->format = ScanFile_V1;
+    } else if (binary2_is_format(header, sizeof(header))) {
+        f->format = ScanFile_V2;
+        if (f->fp)
+            f->v2 = binary2_reader_create(f->fp);
+        else
+            f->v2 = binary2_reader_create_mem(f->mem, f->mem_length);
+        if (f->v2 == NULL)
+            goto fail;
+    } else
+        goto fail;
+
+    return f;
+fail:
+    scanfile_close(f);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct ScanFile *
+scanfile_open_mem(const unsigned char *px, size_t length)
+{
+    struct ScanFile *f;
+
+    f = (struct ScanFile *)malloc(sizeof(*f));
+    if (f == NULL)
+        return NULL;
+    memset(f, 0, sizeof(*f));
+    f->mem = px;
+    f->mem_length = length;
+    f->size = length;
+    return scanfile_detect(f);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct ScanFile *
+scanfile_open_fp(FILE *fp)
+{
+    struct ScanFile *f;
+
+    f = (struct ScanFile *)malloc(sizeof(*f));
+    if (f == NULL)
+        return NULL;
+    memset(f, 0, sizeof(*f));
+    f->fp = fp;
+    return scanfile_detect(f);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct ScanFile *
+scanfile_open(const char *filename)
+{
+    struct ScanFile *f;
+    const unsigned char *px;
+    uint64_t length;
+
+    px = pixie_mmap_file(filename, &length);
+    if (px) {
+        f = scanfile_open_mem(px, (size_t)length);
+        if (f == NULL) {
+            pixie_munmap(px, length);
+            fprintf(stderr, "%s: unknown file format\n", filename);
+            return NULL;
+        }
+        f->is_mapped = 1;
+    } else {
+        /* Fall back to stdio, such as for pipes, or for files too big
+         * to map on 32-bit systems */
+        FILE *fp;
+        int err;
+
+        err = fopen_s(&fp, filename, "rb");
+        if (err || fp == NULL) {
+            fprintf(stderr, "%s: %s\n", filename, strerror_x(err));
+            return NULL;
+        }
+        f = scanfile_open_fp(fp);
+        if (f == NULL) {
+            fclose(fp);
+            fprintf(stderr, "%s: unknown file format\n", filename);
+            return NULL;
+        }
+        f->is_fp_owned = 1;
+        if (fseek(fp, 0, SEEK_END) == 0) {
+            f->size = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+        }
+    }
+
+    LOG(1, "%s: opened %s format, %llu bytes%s\n", filename,
+        (f->format == ScanFile_V1) ? "masscan/1.1" : "masscan/2.0",
+        (unsigned long long)f->size,
+        f->is_mapped ? " (mapped)" : "");
+    return f;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scanfile_next(struct ScanFile *f, struct ScanRecord *rec)
+{
+    switch (f->format) {
+    case ScanFile_V1:
+        return scanfile_next_v1(f, rec);
+    case ScanFile_V2:
+        return binary2_reader_next(f->v2, rec);
+    default:
+        return -1;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scanfile_seek(struct ScanFile *f, uint64_t offset)
+{
+    switch (f->format) {
+    case ScanFile_V1:
+        if (f->fp)
+            return fseek(f->fp, (long)offset, SEEK_SET);
+        if (offset > f->mem_length)
+            return -1;
+        f->mem_offset = (size_t)offset;
+        return 0;
+    case ScanFile_V2:
+        return binary2_reader_seek(f->v2, offset);
+    default:
+        return -1;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scanfile_index(struct ScanFile *f, struct Binary2Index **r_index,
+               unsigned *r_count)
+{
+    if (f->format != ScanFile_V2)
+        return -1;
+    if (f->fp)
+        return binary2_index_load_file(f->fp, r_index, r_count);
+    else
+        return binary2_index_load(f->mem, f->mem_length, r_index, r_count);
+}
+
+/***************************************************************************
+ * Records with the same IP address and port are the same "thing" if they
+ * are the same sort of thing: the TCP status (open or closed), the UDP
+ * status, the SCTP status, the ICMP status, or a banner of the same
+ * protocol, over the same IP protocol.
+ ***************************************************************************/
+static unsigned
+scanrecord_group(const struct ScanRecord *rec)
+{
+    switch (rec->kind) {
+    case Port_Open:
+    case Port_Closed:
+        return 0;
+    case Port_UdpOpen:
+    case Port_UdpClosed:
+        return 1;
+    case Port_IcmpEchoResponse:
+        return 2;
+    case Port_SctpOpen:
+    case Port_SctpClosed:
+        return 3;
+    case SCAN_KIND_BANNER:
+        return 0x10000 + (rec->ip_proto << 16) + rec->proto;
+    default:
+        return 0x100 + rec->kind;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scanrecord_compare_key(const struct ScanRecord *a, const struct ScanRecord *b)
+{
+    unsigned ga, gb;
+
+    if (a->ip != b->ip)
+        return (a->ip < b->ip) ? -1 : 1;
+    if (a->port != b->port)
+        return (a->port < b->port) ? -1 : 1;
+    ga = scanrecord_group(a);
+    gb = scanrecord_group(b);
+    if (ga != gb)
+        return (ga < gb) ? -1 : 1;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+scanfile_size(const struct ScanFile *f)
+{
+    return f->size;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+enum ScanFileFormat
+scanfile_format(const struct ScanFile *f)
+{
+    return f->format;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scanfile_close(struct ScanFile *f)
+{
+    if (f == NULL)
+        return;
+    binary2_reader_destroy(f->v2);
+    if (f->is_mapped)
+        pixie_munmap(f->mem, f->mem_length);
+    if (f->is_fp_owned)
+        fclose(f->fp);
+    free(f->iobuf);
+    free(f);
+}
+
+
+/***************************************************************************
+ * Write some records with the original binary writer, then make sure
+ * we read back the same thing, both from memory and through stdio.
+ ***************************************************************************/
+int
+scanfile_selftest(void)
+{
+    static const unsigned char banner[] = "SSH-2.0-OpenSSH_5.9p1";
+    struct Output out[1];
+    struct ScanFile *f = NULL;
+    struct ScanRecord rec;
+    unsigned char *buf = NULL;
+    FILE *fp;
+    long length;
+    time_t saved_now = global_now;
+    unsigned pass;
+
+    fp = tmpfile();
+    if (fp == NULL)
+        return 0; /* can't test without a temporary file */
+
+    memset(out, 0, sizeof(out[0]));
+    out->funcs = &binary_output;
+    global_now = 1381000000;
+    binary_output.open(out, fp);
+    binary_output.status(out, fp, Port_Open, 0x0a000001, 80, 0x12, 64);
+    binary_output.banner(out, fp, 0x0a000002, 6, 22, 2, banner, sizeof(banner)-1);
+    binary_output.banner(out, fp, 0x0a000003, 17, 161, PROTO_SNMP,
+                         banner, 4);
+    binary_output.status(out, fp, Port_Closed, 0xc0a80001, 443, 0x14, 128);
+    binary_output.close(out, fp);
+    global_now = saved_now;
+
+    length = ftell(fp);
+    buf = (unsigned char *)malloc(length);
+    rewind(fp);
+    if (buf == NULL || fread(buf, 1, length, fp) != (size_t)length)
+        goto fail;
+
+    for (pass=0; pass<2; pass++) {
+        if (pass == 0)
+            f = scanfile_open_mem(buf, length);
+        else {
+            rewind(fp);
+            f = scanfile_open_fp(fp);
+        }
+        if (f == NULL || scanfile_format(f) != ScanFile_V1)
+            goto fail;
+
+        if (scanfile_next(f, &rec) != 1 || rec.kind != Port_Open
+            || rec.ip != 0x0a000001 || rec.port != 80 || rec.reason != 0x12
+            || rec.ttl != 64 || rec.timestamp != 1381000000)
+            goto fail;
+        if (scanfile_next(f, &rec) != 1 || rec.kind != SCAN_KIND_BANNER
+            || rec.ip != 0x0a000002 || rec.ip_proto != 6 || rec.port != 22
+            || rec.proto != 2 || rec.banner_length != sizeof(banner)-1
+            || memcmp(rec.banner, banner, rec.banner_length) != 0)
+            goto fail;
+        if (scanfile_next(f, &rec) != 1 || rec.kind != SCAN_KIND_BANNER
+            || rec.ip != 0x0a000003 || rec.ip_proto != 17 || rec.port != 161
+            || rec.proto != PROTO_SNMP || rec.banner_length != 4
+            || memcmp(rec.banner, banner, 4) != 0)
+            goto fail;
+        if (scanfile_next(f, &rec) != 1 || rec.kind != Port_Closed
+            || rec.ip != 0xc0a80001 || rec.port != 443 || rec.ttl != 128)
+            goto fail;
+        if (scanfile_next(f, &rec) != 0)
+            goto fail;
+        scanfile_close(f);
+        f = NULL;
+    }
+
+    free(buf);
+    fclose(fp);
+    return 0;
+fail:
+    global_now = saved_now;
+    fprintf(stderr, "scanfile: selftest failed\n");
+    scanfile_close(f);
+    free(buf);
+    fclose(fp);
+    return 1;
+}
@@ -0,0 +1,81 @@
+/*
+    reading binary scan files
+
+    This reads files produced by either "--output-format binary" (the
+    "masscan/1.1" format) or "--output-format binary2" ("masscan/2.0"),
+    returning one record at a time. Files are memory-mapped when possible
+    and parsed in place, otherwise they are read with stdio.
+*/
+#ifndef IN_BINARY_H
+#define IN_BINARY_H
+#include "out-binary2.h"
+#include <stdio.h>
+#include <stdint.h>
+
+struct ScanFile;
+
+enum ScanFileFormat {
+    ScanFile_Unknown,
+    ScanFile_V1,            /* "masscan/1.1", from out-binary.c */
+    ScanFile_V2,            /* "masscan/2.0", from out-binary2.c */
+};
+
+/**
+ * Open a scan file, detecting its format.
+ * @return
+ *      NULL if the file can't be opened, or isn't a scan file, in
+ *      which case an error message has already been printed
+ */
+struct ScanFile *scanfile_open(const char *filename);
+
+/**
+ * Parse a scan file already in memory, or one that's already open.
+ */
+struct ScanFile *scanfile_open_mem(const unsigned char *px, size_t length);
+struct ScanFile *scanfile_open_fp(FILE *fp);
+
+/**
+ * Get the next record. Any banner in the record points into the
+ * ScanFile's buffers, and is only valid until the next call.
+ * @return
+ *      1 if a record was returned, 0 at end-of-file, -1 on corruption
+ */
+int scanfile_next(struct ScanFile *f, struct ScanRecord *rec);
+
+/**
+ * Move to a file offset, such as the start of a block from the index
+ */
+int scanfile_seek(struct ScanFile *f, uint64_t offset);
+
+/**
+ * Load the block index of a "masscan/2.0" file. This moves the read
+ * position of a stdio file, so seek afterwards. The caller must free()
+ * the returned array.
+ * @return
+ *      0 on success, -1 if the file has no index
+ */
+int scanfile_index(struct ScanFile *f, struct Binary2Index **r_index,
+                   unsigned *r_count);
+
+/**
+ * Compare the keys of two records: the IP address, the port, and the
+ * sort of record (TCP status, UDP status, ICMP status, or banner of a
+ * given protocol). Records with equal keys are duplicates of each other,
+ * such as the same port found open in two scans.
+ * @return
+ *      <0, 0, or >0, like memcmp()
+ */
+int scanrecord_compare_key(const struct ScanRecord *a, const struct ScanRecord *b);
+
+/**
+ * The size of the file, or zero if unknown, for reporting throughput
+ */
+uint64_t scanfile_size(const struct ScanFile *f);
+
+enum ScanFileFormat scanfile_format(const struct ScanFile *f);
+
+void scanfile_close(struct ScanFile *f);
+
+int scanfile_selftest(void);
+
+#endif
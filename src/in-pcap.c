@@ -0,0 +1,587 @@
+/*
+    reading packet captures
+
+    The original reader, pcapfile_readframe() in rawsock-pcapfile.c, does
+    two fread()s per frame, copying every frame into the caller's buffer.
+    For multi-gigabyte captures, most of the time is spent in stdio.
+
+    Instead, we map the file into memory, and hand back pointers to the
+    frames in place, a batch at a time. As we work through the mapping,
+    we ask the operating system to start reading the next part of the
+    file from disk, so that we aren't waiting on page faults.
+
+    Like the original, a corrupt frame header doesn't end the file: we
+    search forward for two consecutive headers that look valid, and
+    continue from there.
+
+    When the file can't be mapped (pipes, or files too big to map on
+    32-bit systems), we fall back to pcapfile_readframe(), copying a
+    batch of frames into our own buffer.
+*/
+#include "in-pcap.h"
+#include "rawsock-pcapfile.h"
+#include "pixie-mmap.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Frames bigger than this must be corruption. This is the largest
+ * snaplen that tcpdump uses */
+#define PCAP_MAX_FRAME 262144
+
+/* How far ahead of the reader to ask for the file to be read from disk */
+#define PCAP_PREFETCH_SIZE (16*1024*1024)
+
+/* The buffer for the stdio fallback. The fallback only reads another
+ * frame while there's room for the largest that pcapfile_readframe()
+ * accepts */
+#define PCAP_STDIO_BUFFER_SIZE (2*1024*1024)
+#define PCAPFILE_MAX_FRAME 160000
+
+struct PcapReader {
+    char filename[256];
+    unsigned linktype;
+    uint64_t frame_number;
+
+    /* the mapped file, or memory buffer */
+    const unsigned char *px;
+    size_t length;
+    size_t offset;
+    size_t prefetched;
+    unsigned is_big_endian:1;
+    unsigned is_nanoseconds:1;
+    unsigned is_mapped:1;
+
+    /* the stdio fallback */
+    struct PcapFile *cap;
+    unsigned char *buf;
+};
+
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+get32(const struct PcapReader *r, const unsigned char *px)
+{
+    if (r->is_big_endian)
+        return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+    else
+        return px[3]<<24 | px[2]<<16 | px[1]<<8 | px[0];
+}
+
+/***************************************************************************
+ * Whether a frame header looks reasonable when searching for a good
+ * frame after corruption. This is stricter than when reading normally,
+ * because random data could otherwise pass.
+ ***************************************************************************/
+static int
+looks_like_frame(const struct PcapReader *r, size_t offset)
+{
+    const unsigned char *p = r->px + offset;
+    unsigned usecs, captured_length, original_length;
+
+    if (offset + 16 > r->length)
+        return 0;
+    usecs = get32(r, p + 4);
+    captured_length = get32(r, p + 8);
+    original_length = get32(r, p + 12);
+
+    if (usecs >= (r->is_nanoseconds ? 1000000000 : 1000000))
+        return 0;
+    if (captured_length == 0 || captured_length > PCAP_MAX_FRAME)
+        return 0;
+    if (original_length < captured_length || original_length > PCAP_MAX_FRAME)
+        return 0;
+    if (offset + 16 + captured_length > r->length)
+        return 0;
+    return 1;
+}
+
+/***************************************************************************
+ * Move forward to the next place where two frames in a row look valid,
+ * or where the last frame in the file ends exactly at the end
+ ***************************************************************************/
+static void
+resync(struct PcapReader *r)
+{
+    size_t offset;
+
+    LOG(0, "%s(%llu): corruption found at 0x%08llx\n", r->filename,
+        (unsigned long long)r->frame_number, (unsigned long long)r->offset);
+
+    for (offset = r->offset + 1; offset + 16 <= r->length; offset++) {
+        size_t next;
+
+        if (!looks_like_frame(r, offset))
+            continue;
+        next = offset + 16 + get32(r, r->px + offset + 8);
+        if (next != r->length && !looks_like_frame(r, next))
+            continue;
+
+        LOG(0, "%s(%llu): good packet found at 0x%08llx\n", r->filename,
+            (unsigned long long)r->frame_number, (unsigned long long)offset);
+        r->offset = offset;
+        return;
+    }
+
+    LOG(0, "%s: no valid packet found after corruption\n", r->filename);
+    r->offset = r->length;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+next_mapped(struct PcapReader *r, struct PcapFrame *frames, unsigned max)
+{
+    unsigned count = 0;
+
+    while (count < max) {
+        size_t remaining = r->length - r->offset;
+        const unsigned char *p = r->px + r->offset;
+        struct PcapFrame *frame = &frames[count];
+
+        if (remaining == 0)
+            break;
+        if (remaining < 16) {
+            LOG(0, "%s: premature end of file\n", r->filename);
+            r->offset = r->length;
+            break;
+        }
+
+        frame->secs = get32(r, p + 0);
+        frame->usecs = get32(r, p + 4);
+        frame->length = get32(r, p + 8);
+        frame->original_length = get32(r, p + 12);
+
+        /* Some programs pad with empty headers */
+        if (frame->secs == 0 && frame->usecs == 0
+            && frame->length == 0 && frame->original_length == 0) {
+            r->offset += 16;
+            continue;
+        }
+
+        if (frame->length > PCAP_MAX_FRAME
+            || frame->original_length < frame->length) {
+            resync(r);
+            continue;
+        }
+        if (frame->length > remaining - 16) {
+            LOG(0, "%s: premature end of file\n", r->filename);
+            r->offset = r->length;
+            break;
+        }
+
+        if (r->is_nanoseconds)
+            frame->usecs /= 1000;
+        frame->px = p + 16;
+        r->offset += 16 + frame->length;
+        r->frame_number++;
+        count++;
+    }
+
+    /* Keep the disk reading ahead of us */
+    if (r->is_mapped && r->prefetched < r->length
+        && r->offset + PCAP_PREFETCH_SIZE/2 > r->prefetched) {
+        size_t length = r->length - r->prefetched;
+        if (length > PCAP_PREFETCH_SIZE)
+            length = PCAP_PREFETCH_SIZE;
+        pixie_mmap_prefetch(r->px + r->prefetched, length);
+        r->prefetched += length;
+    }
+
+    return count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+next_stdio(struct PcapReader *r, struct PcapFrame *frames, unsigned max)
+{
+    unsigned count = 0;
+    size_t used = 0;
+
+    while (count < max && used + PCAPFILE_MAX_FRAME <= PCAP_STDIO_BUFFER_SIZE) {
+        struct PcapFrame *frame = &frames[count];
+        int x;
+
+        x = pcapfile_readframe(r->cap,
+                               &frame->secs, &frame->usecs,
+                               &frame->original_length, &frame->length,
+                               r->buf + used,
+                               (unsigned)(PCAP_STDIO_BUFFER_SIZE - used));
+        if (x == 0)
+            break;
+
+        frame->px = r->buf + used;
+        used += frame->length;
+        r->frame_number++;
+        count++;
+    }
+
+    return count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+pcapreader_next(struct PcapReader *r, struct PcapFrame *frames, unsigned max)
+{
+    if (r->cap)
+        return next_stdio(r, frames, max);
+    else
+        return next_mapped(r, frames, max);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PcapReader *
+pcapreader_open_mem(const unsigned char *px, size_t length)
+{
+    struct PcapReader *r;
+    unsigned is_big_endian;
+    unsigned is_nanoseconds;
+
+    if (length < 24)
+        return NULL;
+
+    switch (px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3]) {
+    case 0xa1b2c3d4: is_big_endian = 1; is_nanoseconds = 0; break;
+    case 0xd4c3b2a1: is_big_endian = 0; is_nanoseconds = 0; break;
+    case 0xa1b23c4d: is_big_endian = 1; is_nanoseconds = 1; break;
+    case 0x4d3cb2a1: is_big_endian = 0; is_nanoseconds = 1; break;
+    default:
+        return NULL;
+    }
+
+    r = (struct PcapReader *)malloc(sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    strcpy_s(r->filename, sizeof(r->filename), "<memory>");
+    r->px = px;
+    r->length = length;
+    r->offset = 24;
+    r->is_big_endian = is_big_endian;
+    r->is_nanoseconds = is_nanoseconds;
+    r->linktype = get32(r, px + 20);
+    if (r->linktype == 0)
+        r->linktype = 1;
+    return r;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PcapReader *
+pcapreader_open(const char *filename)
+{
+    struct PcapReader *r;
+    const unsigned char *px;
+    uint64_t length;
+
+    px = pixie_mmap_file(filename, &length);
+    if (px) {
+        r = pcapreader_open_mem(px, (size_t)length);
+        if (r == NULL) {
+            pixie_munmap(px, length);
+            fprintf(stderr, "%s: unknown file format\n", filename);
+            return NULL;
+        }
+        r->is_mapped = 1;
+    } else {
+        /* Fall back to stdio, such as for pipes */
+        struct PcapFile *cap;
+
+        cap = pcapfile_openread(filename);
+        if (cap == NULL)
+            return NULL;
+        r = (struct PcapReader *)malloc(sizeof(*r));
+        if (r)
+            memset(r, 0, sizeof(*r));
+        if (r)
+            r->buf = (unsigned char *)malloc(PCAP_STDIO_BUFFER_SIZE);
+        if (r == NULL || r->buf == NULL) {
+            free(r);
+            pcapfile_close(cap);
+            return NULL;
+        }
+        r->cap = cap;
+        r->linktype = pcapfile_datalink(cap);
+    }
+
+    if (strlen(filename) < sizeof(r->filename))
+        strcpy_s(r->filename, sizeof(r->filename), filename);
+
+    LOG(1, "%s: opened capture, link type %u%s\n", filename, r->linktype,
+        r->is_mapped ? " (mapped)" : "");
+    return r;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+pcapreader_datalink(const struct PcapReader *r)
+{
+    return r->linktype;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pcapreader_is_mapped(const struct PcapReader *r)
+{
+    return r->is_mapped;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pcapreader_close(struct PcapReader *r)
+{
+    if (r == NULL)
+        return;
+    if (r->is_mapped)
+        pixie_munmap(r->px, r->length);
+    if (r->cap)
+        pcapfile_close(r->cap);
+    free(r->buf);
+    free(r);
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+test_header(unsigned char *px, int is_big_endian, unsigned secs,
+            unsigned captured_length, unsigned original_length)
+{
+    unsigned fields[4];
+    unsigned i;
+
+    fields[0] = secs;
+    fields[1] = 500000;
+    fields[2] = captured_length;
+    fields[3] = original_length;
+    for (i=0; i<4; i++) {
+        unsigned char *p = px + i*4;
+        if (is_big_endian) {
+            p[0] = (unsigned char)(fields[i] >> 24);
+            p[1] = (unsigned char)(fields[i] >> 16);
+            p[2] = (unsigned char)(fields[i] >> 8);
+            p[3] = (unsigned char)(fields[i] >> 0);
+        } else {
+            p[0] = (unsigned char)(fields[i] >> 0);
+            p[1] = (unsigned char)(fields[i] >> 8);
+            p[2] = (unsigned char)(fields[i] >> 16);
+            p[3] = (unsigned char)(fields[i] >> 24);
+        }
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static size_t
+test_frame(unsigned char *px, int is_big_endian, unsigned secs,
+           unsigned captured_length, unsigned original_length, unsigned char c)
+{
+    test_header(px, is_big_endian, secs, captured_length, original_length);
+    memset(px + 16, c, captured_length);
+    return 16 + captured_length;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pcapreader_selftest(void)
+{
+    static const unsigned char header_le[24] =
+        "\xd4\xc3\xb2\xa1\x02\x00\x04\x00"
+        "\x00\x00\x00\x00\x00\x00\x00\x00"
+        "\xff\xff\x00\x00\x01\x00\x00";
+    static const unsigned char header_be[24] =
+        "\xa1\xb2\xc3\xd4\x00\x02\x00\x04"
+        "\x00\x00\x00\x00\x00\x00\x00\x00"
+        "\x00\x00\xff\xff\x00\x00\x00";
+    unsigned char buf[1024];
+    struct PcapFrame frames[4];
+    struct PcapReader *r;
+    size_t length;
+    unsigned total = 0;
+    unsigned count;
+    int saved_verbosity = verbosity;
+
+    /*
+     * Little-endian: three frames, an empty header, then garbage, then
+     * two good frames and a truncated one
+     */
+    memcpy(buf, header_le, 24);
+    length = 24;
+    length += test_frame(buf + length, 0, 1000, 60, 60, 'a');
+    length += test_frame(buf + length, 0, 1001, 80, 1500, 'b');
+    length += test_frame(buf + length, 0, 1002, 60, 60, 'c');
+    memset(buf + length, 0, 16);
+    length += 16;
+    test_header(buf + length, 0, 1003, 70000000, 60);
+    length += 16;
+    memset(buf + length, 0xFF, 13);
+    length += 13;
+    length += test_frame(buf + length, 0, 1004, 64, 64, 'd');
+    length += test_frame(buf + length, 0, 1005, 64, 64, 'e');
+    length += test_frame(buf + length, 0, 1006, 64, 64, 'f') - 10;
+
+    r = pcapreader_open_mem(buf, length);
+    if (r == NULL || pcapreader_datalink(r) != 1)
+        goto fail;
+
+    verbosity = -1; /* quiet the corruption messages */
+    while ((count = pcapreader_next(r, frames, 2)) != 0) {
+        unsigned i;
+        for (i=0; i<count; i++) {
+            static const char expected[] = "abcde";
+            if (total >= 5)
+                goto fail;
+            if (frames[i].px[0] != expected[total]
+                || frames[i].px[frames[i].length-1] != expected[total]
+                || frames[i].secs != 1000 + total + (total >= 3)
+                || frames[i].usecs != 500000)
+                goto fail;
+            total++;
+        }
+    }
+    verbosity = saved_verbosity;
+    if (total != 5 || frames[0].length != 64)
+        goto fail;
+    pcapreader_close(r);
+
+    /*
+     * Big-endian
+     */
+    memcpy(buf, header_be, 24);
+    length = 24;
+    length += test_frame(buf + length, 1, 2000, 100, 200, 'z');
+    r = pcapreader_open_mem(buf, length);
+    if (r == NULL)
+        goto fail;
+    count = pcapreader_next(r, frames, 4);
+    if (count != 1 || frames[0].length != 100
+        || frames[0].original_length != 200 || frames[0].secs != 2000)
+        goto fail;
+    if (pcapreader_next(r, frames, 4) != 0)
+        goto fail;
+    pcapreader_close(r);
+
+    /* Not a capture file */
+    if (pcapreader_open_mem((const unsigned char *)"masscan/1.1\0\0\0\0\0"
+                            "\0\0\0\0\0\0\0\0", 24) != NULL)
+        goto fail;
+
+    return 0;
+fail:
+    verbosity = saved_verbosity;
+    fprintf(stderr, "pcapreader: selftest failed\n");
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static double
+benchmark_stdio(const char *filename, uint64_t *r_bytes, uint64_t *r_frames)
+{
+    static unsigned char buf[PCAPFILE_MAX_FRAME];
+    struct PcapFile *cap;
+    uint64_t start, elapsed;
+    unsigned checksum = 0;
+
+    cap = pcapfile_openread(filename);
+    if (cap == NULL)
+        return 0;
+
+    start = pixie_gettime();
+    for (;;) {
+        unsigned secs, usecs, original_length, length;
+
+        if (!pcapfile_readframe(cap, &secs, &usecs, &original_length,
+                                &length, buf, sizeof(buf)))
+            break;
+        checksum += buf[length/2];
+        *r_bytes += length;
+        (*r_frames)++;
+    }
+    elapsed = pixie_gettime() - start;
+    pcapfile_close(cap);
+
+    if (checksum == 1)
+        fprintf(stderr, "\n"); /* so the loop isn't optimized away */
+    return elapsed ? elapsed/1000000.0 : 0.000001;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static double
+benchmark_mapped(const char *filename, uint64_t *r_bytes, uint64_t *r_frames)
+{
+    struct PcapReader *r;
+    struct PcapFrame frames[64];
+    uint64_t start, elapsed;
+    unsigned checksum = 0;
+    unsigned count;
+
+    r = pcapreader_open(filename);
+    if (r == NULL)
+        return 0;
+    if (!pcapreader_is_mapped(r))
+        fprintf(stderr, "pcap: %s: can't be mapped, using stdio\n", filename);
+
+    start = pixie_gettime();
+    while ((count = pcapreader_next(r, frames, 64)) != 0) {
+        unsigned i;
+        for (i=0; i<count; i++) {
+            checksum += frames[i].px[frames[i].length/2];
+            *r_bytes += frames[i].length;
+        }
+        *r_frames += count;
+    }
+    elapsed = pixie_gettime() - start;
+    pcapreader_close(r);
+
+    if (checksum == 1)
+        fprintf(stderr, "\n");
+    return elapsed ? elapsed/1000000.0 : 0.000001;
+}
+
+/***************************************************************************
+ * Reads the file once each way. The first pass also pulls the file into
+ * the page cache, so run the benchmark twice to compare without disk
+ * reads, or on a file bigger than memory to compare with them.
+ ***************************************************************************/
+void
+pcapreader_benchmark(const char *filename)
+{
+    unsigned i;
+
+    if (filename == NULL) {
+        fprintf(stderr, "pcap:    no capture file given "
+                        "(masscan --benchmark <file.pcap>)\n");
+        return;
+    }
+
+    for (i=0; i<2; i++) {
+        uint64_t bytes = 0;
+        uint64_t frames = 0;
+        double seconds;
+
+        if (i == 0)
+            seconds = benchmark_stdio(filename, &bytes, &frames);
+        else
+            seconds = benchmark_mapped(filename, &bytes, &frames);
+        if (seconds == 0)
+            return;
+
+        fprintf(stderr, "%-8s read:   %10.0f frames/sec, %8.1f MB/sec\n",
+                i ? "pcap-map" : "pcap-io",
+                frames / seconds,
+                bytes / seconds / 1000000.0);
+    }
+}
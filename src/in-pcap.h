@@ -0,0 +1,67 @@
+/*
+    reading packet captures
+
+    This reads libpcap files a batch of frames at a time. Files are
+    memory-mapped when possible, and the frames returned point directly
+    into the mapping, so nothing is copied. Otherwise (such as for pipes),
+    frames are read with stdio using pcapfile_readframe() from
+    rawsock-pcapfile.c into an internal buffer.
+*/
+#ifndef IN_PCAP_H
+#define IN_PCAP_H
+#include <stdint.h>
+#include <stddef.h>
+
+struct PcapReader;
+
+struct PcapFrame {
+    const unsigned char *px;
+    unsigned length;            /* captured length */
+    unsigned original_length;   /* length on the wire */
+    unsigned secs;
+    unsigned usecs;
+};
+
+/**
+ * Open a capture file.
+ * @return
+ *      NULL if the file can't be opened, or isn't a capture file, in
+ *      which case an error message has already been printed
+ */
+struct PcapReader *pcapreader_open(const char *filename);
+
+/**
+ * Parse a capture file that's already in memory
+ */
+struct PcapReader *pcapreader_open_mem(const unsigned char *px, size_t length);
+
+/**
+ * The link type from the file header, such as 1 for Ethernet
+ */
+unsigned pcapreader_datalink(const struct PcapReader *r);
+
+/**
+ * Get the next batch of frames. The frames are only valid until the
+ * next call.
+ * @return
+ *      the number of frames filled in, up to 'max', or 0 at the end of
+ *      the file
+ */
+unsigned pcapreader_next(struct PcapReader *r, struct PcapFrame *frames,
+                         unsigned max);
+
+/**
+ * Whether the file is memory-mapped, rather than read with stdio
+ */
+int pcapreader_is_mapped(const struct PcapReader *r);
+
+void pcapreader_close(struct PcapReader *r);
+
+int pcapreader_selftest(void);
+
+/**
+ * Compare reading a capture file with stdio and with the mapped reader
+ */
+void pcapreader_benchmark(const char *filename);
+
+#endif
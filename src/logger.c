@@ -7,66 +7,303 @@
     Details about the running of the program go to <stderr>.
     Details about scan results go to <stdout>, so that they can easily
     be redirected to a file.
+
+    The LOG() macros in the header check the level first, so that a
+    disabled message costs one comparison. When debugging with "-vv" or
+    more, the transmit and receive threads can log several messages per
+    packet, so messages then go through a "sink": the thread formats the
+    message into a buffer taken from a free ring, then puts it on a
+    pending ring, both of which are lock-free. A background thread writes
+    the pending messages to <stderr>. If it falls behind, messages are
+    dropped rather than slowing down the scan, and the number dropped is
+    printed.
 */
 #include "logger.h"
+#include "packet-queue.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
 #include "string_s.h"
+#include "string-fmt.h"
+#include "unusedparm.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 int verbosity = 0; /* yea! a global variable!! */
 
+#define LOG_MESSAGE_COUNT 4096
+
+struct LogMessage {
+    unsigned length;
+    char text[252];
+};
+
+static struct LogSink {
+    PACKET_QUEUE *free_queue;   /* any thread takes, the writer returns */
+    PACKET_QUEUE *pending;      /* any thread adds, the writer takes */
+    FILE *fp;
+    unsigned is_atexit;
+    volatile unsigned is_running;
+    volatile unsigned is_closing;
+    volatile unsigned is_done;
+    volatile unsigned dropped;
+} sink;
+
 
 /***************************************************************************
+ * Get an empty message buffer, if the sink is running and has one
  ***************************************************************************/
-void
-vLOG(int level, const char *fmt, va_list marker)
+static struct LogMessage *
+sink_alloc(void)
 {
-    if (level <= verbosity) {
-        vfprintf(stderr, fmt, marker);
-        fflush(stderr);
+    struct LogMessage *msg;
+
+    if (!sink.is_running)
+        return NULL;
+    if (rte_ring_mc_dequeue(sink.free_queue, (void**)&msg) != 0) {
+        pixie_locked_add_u32(&sink.dropped, 1);
+        return NULL;
     }
+    return msg;
 }
 
+/***************************************************************************
+ * There are as many slots in the pending ring as there are messages, so
+ * this can't fail.
+ ***************************************************************************/
+static void
+sink_queue(struct LogMessage *msg)
+{
+    rte_ring_mp_enqueue(sink.pending, msg);
+}
+
+/***************************************************************************
+ * Format the rest of the message after whatever is already in it,
+ * truncating if it doesn't fit
+ ***************************************************************************/
+static void
+sink_vformat(struct LogMessage *msg, const char *fmt, va_list marker)
+{
+    size_t remaining = sizeof(msg->text) - msg->length;
+    int x;
+
+    x = vsprintf_s(msg->text + msg->length, remaining, fmt, marker);
+    if (x < 0 || (size_t)x >= remaining)
+        x = (int)remaining - 1;
+    msg->length += x;
+}
+
+/***************************************************************************
+ * The background thread that writes out the messages
+ ***************************************************************************/
+static void
+sink_thread(void *v)
+{
+    unsigned dropped = 0;
+
+    UNUSEDPARM(v);
+    for (;;) {
+        struct LogMessage *msg;
+
+        if (rte_ring_sc_dequeue(sink.pending, (void**)&msg) == 0) {
+            fwrite(msg->text, 1, msg->length, sink.fp);
+            rte_ring_sp_enqueue(sink.free_queue, msg);
+            continue;
+        }
+
+        /* Nothing to write, so flush what we have */
+        if (dropped != sink.dropped) {
+            fprintf(sink.fp, "[log: dropped %u messages]\n",
+                    sink.dropped - dropped);
+            dropped = sink.dropped;
+        }
+        fflush(sink.fp);
+
+        /* Something may have been queued after we looked, just before
+         * we were told to close, so only stop once it's empty */
+        if (sink.is_closing && rte_ring_empty(sink.pending))
+            break;
+        pixie_usleep(1000);
+    }
+    sink.is_done = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+sink_start(FILE *fp)
+{
+    if (sink.is_running)
+        return;
+
+    /* The buffers are kept after the sink stops, in case some thread is
+     * still holding one */
+    if (sink.free_queue == NULL) {
+        struct LogMessage *messages;
+        unsigned i;
+
+        sink.free_queue = rte_ring_create(LOG_MESSAGE_COUNT, RING_F_SP_ENQ);
+        sink.pending = rte_ring_create(LOG_MESSAGE_COUNT, RING_F_SC_DEQ);
+        messages = (struct LogMessage *)malloc(LOG_MESSAGE_COUNT * sizeof(*messages));
+        if (sink.free_queue == NULL || sink.pending == NULL || messages == NULL)
+            return;
+
+        /* A ring holds one less than its size */
+        for (i=0; i<LOG_MESSAGE_COUNT - 1; i++)
+            rte_ring_sp_enqueue(sink.free_queue, &messages[i]);
+    }
+
+    sink.fp = fp;
+    sink.is_closing = 0;
+    sink.is_done = 0;
+    rte_wmb();
+    sink.is_running = 1;
+    pixie_begin_thread(sink_thread, 0, 0);
+}
 
 /***************************************************************************
- * Prints the message if the global "verbosity" flag exceeds this level.
  ***************************************************************************/
 void
-LOG(int level, const char *fmt, ...)
+logger_buffered_start(void)
 {
-    va_list marker;
+    if (!sink.is_atexit) {
+        atexit(logger_buffered_stop);
+        sink.is_atexit = 1;
+    }
+    sink_start(stderr);
+}
 
-    va_start(marker, fmt);
-    vLOG(level, fmt, marker);
-    va_end(marker);
+/***************************************************************************
+ ***************************************************************************/
+void
+logger_buffered_stop(void)
+{
+    if (!sink.is_running)
+        return;
+    sink.is_running = 0;
+    sink.is_closing = 1;
+    while (!sink.is_done)
+        pixie_usleep(1000);
 }
 
+
 /***************************************************************************
+ * Prints the message. The LOG() macro has already checked the global
+ * "verbosity" level.
  ***************************************************************************/
 void
-vLOGip(int level, unsigned ip, unsigned port, const char *fmt, va_list marker)
+logger_printf(const char *fmt, ...)
 {
-    if (level <= verbosity) {
-        char sz_ip[16];
-        
-        sprintf_s(sz_ip, sizeof(sz_ip), "%u.%u.%u.%u", 
-            (ip>>24)&0xFF, (ip>>16)&0xFF, (ip>>8)&0xFF, (ip>>0)&0xFF);
-        fprintf(stderr, "%-15s:%5u: ", sz_ip, port);
+    struct LogMessage *msg;
+    va_list marker;
+
+    va_start(marker, fmt);
+    msg = sink_alloc();
+    if (msg) {
+        msg->length = 0;
+        sink_vformat(msg, fmt, marker);
+        sink_queue(msg);
+    } else if (!sink.is_running) {
         vfprintf(stderr, fmt, marker);
         fflush(stderr);
     }
+    va_end(marker);
 }
 
-
 /***************************************************************************
+ * Same as logger_printf(), but first prints the IP address and port
  ***************************************************************************/
 void
-LOGip(int level, unsigned ip, unsigned port, const char *fmt, ...)
+logger_printf_ip(unsigned ip, unsigned port, const char *fmt, ...)
 {
+    struct LogMessage local;
+    struct LogMessage *msg;
+    struct FmtBuf fb[1];
     va_list marker;
 
+    msg = sink_alloc();
+    if (msg == NULL && sink.is_running)
+        return;
+
+    /* same as printf("%-15s:%5u: ") */
+    if (msg == NULL)
+        msg = &local;
+    fmt_init(fb, msg->text, sizeof(msg->text));
+    fmt_ipv4(fb, ip);
+    if (fb->length < 15)
+        fmt_pad(fb, ' ', 15 - fb->length);
+    fmt_char(fb, ':');
+    fmt_unsigned_width(fb, port, 5);
+    fmt_literal(fb, ": ");
+    msg->length = (unsigned)fb->length;
+
     va_start(marker, fmt);
-    vLOGip(level, ip, port, fmt, marker);
+    if (msg != &local) {
+        sink_vformat(msg, fmt, marker);
+        sink_queue(msg);
+    } else {
+        fwrite(msg->text, 1, msg->length, stderr);
+        vfprintf(stderr, fmt, marker);
+        fflush(stderr);
+    }
     va_end(marker);
 }
 
+/***************************************************************************
+ ***************************************************************************/
+int
+logger_selftest(void)
+{
+    int saved_verbosity = verbosity;
+    unsigned evaluated = 0;
+    /* what's left when built with a lower MAX_LOG_LEVEL */
+    static const char expected[] =
+#if MAX_LOG_LEVEL >= 1
+        "one 1\n"
+#endif
+#if MAX_LOG_LEVEL >= LOG_DEBUG
+        "10.0.0.1       :   80: two\n"
+#endif
+        "";
+    char buf[256];
+    size_t length;
+    FILE *fp;
+
+    /* Arguments aren't evaluated unless the message is printed */
+    verbosity = 0;
+    LOG(1, "%u\n", ++evaluated);
+    LOGip(LOG_DEBUG, 0x0A000001, 80, "%u\n", ++evaluated);
+    if (evaluated != 0)
+        goto fail;
+
+    /* Messages go through the sink in order, and come out when it
+     * stops */
+    fp = tmpfile();
+    if (fp == NULL)
+        return 0; /* can't test this here */
+    sink_start(fp);
+    verbosity = LOG_DEBUG;
+    LOG(1, "one %u\n", ++evaluated);
+    LOGip(LOG_DEBUG, 0x0A000001, 80, "two\n");
+    LOG(LOG_DEBUG + 1, "three\n");
+    logger_buffered_stop();
+    verbosity = saved_verbosity;
+
+    fseek(fp, 0, SEEK_SET);
+    length = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[length] = '\0';
+    fclose(fp);
+    if (strcmp(buf, expected) != 0)
+        goto fail;
+#if MAX_LOG_LEVEL >= 1
+    if (evaluated != 1)
+        goto fail;
+#endif
+
+    return 0;
+fail:
+    verbosity = saved_verbosity;
+    fprintf(stderr, "logger: selftest failed\n");
+    return 1;
+}
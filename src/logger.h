@@ -3,7 +3,51 @@
 
 extern int verbosity; /* defined in logger.c */
 
-void LOG(int level, const char *fmt, ...);
-void LOGip(int level, unsigned ip, unsigned port, const char *fmt, ...);
+/**
+ * Messages at this level and above are for debugging, and may come from
+ * the transmit and receive threads for every packet
+ */
+#define LOG_DEBUG 2
+
+/**
+ * The most verbose level compiled in. Build with something like
+ * "make DEFINES=-DMAX_LOG_LEVEL=1" to remove the messages above that
+ * level from the whole program, not just the transmit, receive, and TCP
+ * code where they matter, so "-vv" and above then print nothing.
+ */
+#ifndef MAX_LOG_LEVEL
+#define MAX_LOG_LEVEL 100
+#endif
+
+#define LOG_ENABLED(level) ((level) <= MAX_LOG_LEVEL && (level) <= verbosity)
+
+/*
+ * These check the level before evaluating the arguments, so that the
+ * arguments (such as calls to format a string) cost nothing unless the
+ * message is printed.
+ */
+#define LOG(level, ...) \
+    do {if (LOG_ENABLED(level)) logger_printf(__VA_ARGS__);} while (0)
+#define LOGip(level, ip, port, ...) \
+    do {if (LOG_ENABLED(level)) logger_printf_ip(ip, port, __VA_ARGS__);} while (0)
+
+void logger_printf(const char *fmt, ...);
+void logger_printf_ip(unsigned ip, unsigned port, const char *fmt, ...);
+
+/**
+ * Send messages through a buffer that a background thread writes to
+ * <stderr>, so that the transmit and receive threads neither wait for the
+ * console nor contend for a lock. Messages are dropped, and counted,
+ * when the buffer is full. Used when debugging with "-vv" or more.
+ */
+void logger_buffered_start(void);
+
+/**
+ * Write out whatever is in the buffer, and go back to writing directly.
+ * This is also called at exit.
+ */
+void logger_buffered_stop(void);
+
+int logger_selftest(void);
 
 #endif
@@ -0,0 +1,265 @@
+/*
+    "--checkpoint": saving the "--resume" information as we go
+
+    On POSIX, rename() replaces the old file in one step, but neither the
+    new contents nor the rename are on the disk until they're synced, so
+    we sync the file before the rename, and the directory after it. On
+    Windows, MoveFileEx() does the same, with "write-through".
+
+    With "--checkpoint-responders", the bitmap can be up to 512-megabytes,
+    and the main thread, which also does "--adaptive-rate" and the stats,
+    can't stop for as long as that takes to write and sync. So during the
+    scan, a background thread saves it, and the resume file only points
+    to it once it's been saved completely. If the last save is still
+    going when the next checkpoint is due, that one skips the bitmap.
+    The resume file may then point to a bitmap that's a checkpoint or two
+    older, which only means that a few more targets are retried.
+*/
+#include "main-checkpoint.h"
+#include "main-scheduler.h"
+#include "main-responders.h"
+#include "masscan.h"
+#include "logger.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "pixie-tmp.h"
+#include "string_s.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32)
+#include <Windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+/* The background save of the responders, see above */
+static struct {
+    const struct Responders *responders;
+    char filename[512];
+    volatile unsigned is_busy;
+    volatile unsigned is_saved; /* the last save succeeded */
+} saver;
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+temp_name(char *buf, size_t sizeof_buf, const char *filename)
+{
+    sprintf_s(buf, sizeof_buf, "%s.tmp", filename);
+}
+
+/***************************************************************************
+ * Sync the directory that 'filename' is in, so that the rename is on the
+ * disk too
+ ***************************************************************************/
+static void
+sync_directory(const char *filename)
+{
+#if !defined(WIN32)
+    char dirname[512];
+    const char *slash = strrchr(filename, '/');
+    int fd;
+
+    if (slash == NULL)
+        strcpy_s(dirname, sizeof(dirname), ".");
+    else if (slash == filename)
+        strcpy_s(dirname, sizeof(dirname), "/");
+    else if ((size_t)(slash - filename) < sizeof(dirname)) {
+        memcpy(dirname, filename, slash - filename);
+        dirname[slash - filename] = '\0';
+    } else
+        return;
+
+    fd = open(dirname, O_RDONLY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+#else
+    (void)filename;
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+checkpoint_create(const char *filename)
+{
+    char tmp[512];
+    FILE *fp;
+    int err;
+
+    temp_name(tmp, sizeof(tmp), filename);
+    err = fopen_s(&fp, tmp, "wb");
+    if (err || fp == NULL) {
+        LOG(0, "checkpoint: %s: %s\n", tmp, strerror_x(errno));
+        return NULL;
+    }
+    return fp;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+checkpoint_commit(FILE *fp, const char *filename)
+{
+    char tmp[512];
+    int is_error;
+
+    temp_name(tmp, sizeof(tmp), filename);
+
+    /* Everything we wrote must be on the disk before the new name is */
+    is_error = fflush(fp) != 0 || ferror(fp);
+#if defined(WIN32)
+    if (!is_error)
+        is_error = _commit(_fileno(fp)) != 0;
+#else
+    if (!is_error)
+        is_error = fsync(fileno(fp)) != 0;
+#endif
+    if (fclose(fp) != 0)
+        is_error = 1;
+    if (is_error) {
+        LOG(0, "checkpoint: %s: %s\n", tmp, strerror_x(errno));
+        remove(tmp);
+        return -1;
+    }
+
+#if defined(WIN32)
+    if (!MoveFileExA(tmp, filename,
+                     MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)) {
+#else
+    if (rename(tmp, filename) != 0) {
+#endif
+        LOG(0, "checkpoint: rename(\"%s\", \"%s\"): failed\n", tmp, filename);
+        remove(tmp);
+        return -1;
+    }
+    sync_directory(filename);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+responders_thread(void *v)
+{
+    (void)v;
+    saver.is_saved = responders_save(saver.responders, saver.filename) == 0;
+    saver.is_busy = 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+checkpoint_save(struct Masscan *masscan, struct Scheduler *scheduler,
+                const struct Responders *responders, unsigned is_periodic,
+                unsigned is_background)
+{
+    /* Everything below the low water mark is done, and some of the chunks
+     * above it. The chunks the transmit threads are in the middle of are
+     * done again after resuming. */
+    masscan->resume.index = scheduler_low_water(scheduler);
+    masscan->resume.chunk_size = scheduler->chunk_size;
+    rangelist_free(&masscan->resume.chunks);
+    scheduler_get_done(scheduler, &masscan->resume.chunks);
+
+    /* The file pointing to the bitmap is only written once the bitmap
+     * has been saved */
+    if (responders && masscan->checkpoint.is_responders) {
+        char filename[512];
+
+        sprintf_s(filename, sizeof(filename), "%s.responders",
+                  masscan->checkpoint.filename);
+        if (is_background) {
+            if (!saver.is_busy) {
+                if (saver.is_saved)
+                    strcpy_s(masscan->resume.responders,
+                             sizeof(masscan->resume.responders), filename);
+                saver.responders = responders;
+                strcpy_s(saver.filename, sizeof(saver.filename), filename);
+                saver.is_busy = 1;
+                pixie_begin_thread(responders_thread, 0, 0);
+            }
+        } else {
+            while (saver.is_busy)
+                pixie_usleep(10000);
+            if (responders_save(responders, filename) == 0)
+                strcpy_s(masscan->resume.responders,
+                         sizeof(masscan->resume.responders), filename);
+        }
+    }
+
+    if (is_periodic) {
+        if (masscan_write_state(masscan, masscan->checkpoint.filename) == 0)
+            LOG(1, "checkpoint: %s: index %llu\n",
+                masscan->checkpoint.filename, masscan->resume.index);
+    } else
+        masscan_save_state(masscan);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+checkpoint_selftest(void)
+{
+    char filename[512];
+    char tmp[512];
+    char buf[64];
+    FILE *fp;
+    FILE *out;
+    size_t count;
+    int err;
+
+    pixie_tmp_filename(filename, sizeof(filename), "masscan-checkpoint");
+    temp_name(tmp, sizeof(tmp), filename);
+
+    /* Written twice, the second replaces the first, with nothing left
+     * behind */
+    fp = checkpoint_create(filename);
+    if (fp == NULL)
+        goto fail;
+    fprintf(fp, "first version, which is longer\n");
+    if (checkpoint_commit(fp, filename) != 0)
+        goto fail;
+    out = checkpoint_create(filename);
+    if (out == NULL)
+        goto fail;
+    fprintf(out, "second\n");
+    fflush(out);
+
+    /* Until it's committed, the first is still there */
+    err = fopen_s(&fp, filename, "rb");
+    if (err || fp == NULL)
+        goto fail;
+    count = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    if (count != 31)
+        goto fail;
+
+    if (checkpoint_commit(out, filename) != 0)
+        goto fail;
+    err = fopen_s(&fp, filename, "rb");
+    if (err || fp == NULL)
+        goto fail;
+    count = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    if (count != 7 || memcmp(buf, "second\n", 7) != 0)
+        goto fail;
+    if (fopen_s(&fp, tmp, "rb") == 0 && fp != NULL) {
+        fclose(fp);
+        goto fail;
+    }
+
+    remove(filename);
+    return 0;
+fail:
+    fprintf(stderr, "checkpoint: selftest failed\n");
+    remove(filename);
+    remove(tmp);
+    return 1;
+}
@@ -0,0 +1,54 @@
+/*
+    "--checkpoint": saving the "--resume" information as we go
+
+    Rather than only when <ctrl-c> is pressed, the main thread saves the
+    resume information every few seconds, so that after a crash, or the
+    power going out, "--resume" starts from the last checkpoint instead of
+    from the beginning.
+
+    The file is written under a temporary name, synced to the disk, then
+    renamed over the old one, so that whenever we die, there's a complete
+    checkpoint, either the old one or the new one, never half of one.
+*/
+#ifndef MAIN_CHECKPOINT_H
+#define MAIN_CHECKPOINT_H
+#include <stdio.h>
+struct Masscan;
+struct Scheduler;
+struct Responders;
+
+/**
+ * Save the "--resume" information: the chunks the scheduler has done,
+ * and with "--checkpoint-responders", the targets that have answered
+ * @param is_periodic
+ *      for "--checkpoint", quietly, rather than the "saving resume file"
+ *      message on <ctrl-c>
+ * @param is_background
+ *      during the scan, save the responders on a background thread, and
+ *      don't wait for it. Otherwise, as at the end of the scan, wait for
+ *      any background save to finish, then save them here.
+ */
+void
+checkpoint_save(struct Masscan *masscan, struct Scheduler *scheduler,
+                const struct Responders *responders, unsigned is_periodic,
+                unsigned is_background);
+
+/**
+ * Start writing a new version of 'filename', which is written to a
+ * temporary file next to it until checkpoint_commit()
+ * @return
+ *      NULL on error, after logging it
+ */
+FILE *checkpoint_create(const char *filename);
+
+/**
+ * Sync the new version to the disk, and replace 'filename' with it. If
+ * anything went wrong writing it, the old version is kept.
+ * @return
+ *      0 on success, -1 on error, after logging it
+ */
+int checkpoint_commit(FILE *fp, const char *filename);
+
+int checkpoint_selftest(void);
+
+#endif
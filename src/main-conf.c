@@ -17,6 +17,8 @@
 #include "logger.h"
 #include "proto-banner1.h"
 #include "templ-payloads.h"
+#include "main-lease.h"
+#include "main-checkpoint.h"
 
 #include <ctype.h>
 #include <limits.h>
@@ -50,6 +52,10 @@ print_nmap_help(void)
 "  --randomize-hosts: Randomize order of hosts (default)\n"
 "HOST DISCOVERY:\n"
 "  -Pn: Treat all hosts as online (default)\n"
+"  --discover: Ping, and SYN ports 80 and 443, then scan the -p ports only\n"
+"      on hosts that respond\n"
+"  --discover-ports <port ranges>: Probe these instead, like --ports, or\n"
+"      A:0 for ARP on the local network\n"
 "  -n: Never do DNS resolution (default)\n"
 "SCAN TECHNIQUES:\n"
 "  -sS: TCP SYN (always on, default)\n"
@@ -58,6 +64,15 @@ print_nmap_help(void)
 "    Ex: -p22; -p1-65535; -p 111,137,80,139,8080\n"
 "TIMING AND PERFORMANCE:\n"
 "  --max-rate <number>: Send packets no faster than <number> per second\n"
+"  --adaptive-rate: Start at --min-rate, speeding up to --max-rate for as\n"
+"      long as the network keeps up\n"
+"  --retries <n>: Retry targets that haven't answered, up to <n> times\n"
+"  --retry-delay <secs>: Wait this long for an answer before retrying\n"
+"  --coordinator <[ip:]port>: Instead of scanning, hand out the scan to\n"
+"      workers, and write their results (only on 127.0.0.1 without the ip)\n"
+"  --worker <ip:port>: Scan the parts of the scan the coordinator gives us\n"
+"  --lease-key <secret>: Only coordinate with workers that know this\n"
+"  --lease-timeout <secs>: Give a silent worker's parts to the others\n"
 "FIREWALL/IDS EVASION AND SPOOFING:\n"
 "  -S/--source-ip <IP_Address>: Spoof source address\n"
 "  -e <iface>: Use specified interface\n"
@@ -74,6 +89,9 @@ print_nmap_help(void)
 "  --iflist: Print host interfaces and routes (for debugging)\n"
 "  --append-output: Append to rather than clobber specified output files\n"
 "  --resume <filename>: Resume an aborted scan\n"
+"  --checkpoint <secs>: Save where we are this often, not just on ctrl-c,\n"
+"      to --checkpoint-file <filename> (default paused.conf)\n"
+"  --checkpoint-responders: Also save which targets answered --retries\n"
 "MISC:\n"
 "  --send-eth: Send using raw ethernet frames (default)\n"
 "  -V: Print version number\n"
@@ -126,6 +144,27 @@ masscan_echo_nic(struct Masscan *masscan, FILE *fp, unsigned i)
 
 }
 
+/***************************************************************************
+ * Echoes a list of ports, the way the transmit thread numbers them
+ ***************************************************************************/
+static void
+masscan_echo_ports(FILE *fp, const char *name, const struct RangeList *ports)
+{
+    unsigned i;
+
+    fprintf(fp, "%s = ", name);
+    for (i=0; i<ports->count; i++) {
+        struct Range range = ports->list[i];
+        if (range.begin == range.end)
+            fprintf(fp, "%u", range.begin);
+        else
+            fprintf(fp, "%u-%u", range.begin, range.end);
+        if (i+1 < ports->count)
+            fprintf(fp, ",");
+    }
+    fprintf(fp, "\n");
+}
+
 /***************************************************************************
  * Prints the current configuration to the command-line then exits.
  * Use#1: create a template file of all setable parameters.
@@ -137,11 +176,36 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     unsigned i;
 
     fprintf(fp, "rate = %10.2f\n", masscan->max_rate);
+    if (masscan->min_rate)
+        fprintf(fp, "min-rate = %10.2f\n", masscan->min_rate);
+    if (masscan->is_adaptive_rate)
+        fprintf(fp, "adaptive-rate = true\n");
+    if (masscan->retries) {
+        fprintf(fp, "retries = %u\n", masscan->retries);
+        fprintf(fp, "retry-delay = %.3f\n", masscan->retry_delay);
+    }
     fprintf(fp, "randomize-hosts = true\n");
     fprintf(fp, "seed = %llu\n", masscan->seed);
     fprintf(fp, "shard = %u/%u\n", masscan->shard.one, masscan->shard.of);
+    if (masscan->op == Operation_Coordinator || masscan->lease.is_worker) {
+        unsigned ip = masscan->lease.ip;
+
+        fprintf(fp, "%s = ",
+                masscan->lease.is_worker ? "worker" : "coordinator");
+        fprintf(fp, "%u.%u.%u.%u:%u\n", (ip>>24)&0xFF, (ip>>16)&0xFF,
+                (ip>>8)&0xFF, (ip>>0)&0xFF, masscan->lease.port);
+        fprintf(fp, "lease-timeout = %u\n", masscan->lease.timeout);
+        if (masscan->lease.key[0])
+            fprintf(fp, "lease-key = %s\n", masscan->lease.key);
+    }
     if (masscan->is_banners)
         fprintf(fp, "banners = true\n");
+    if (masscan->checkpoint.interval) {
+        fprintf(fp, "checkpoint = %u\n", masscan->checkpoint.interval);
+        fprintf(fp, "checkpoint-file = %s\n", masscan->checkpoint.filename);
+        if (masscan->checkpoint.is_responders)
+            fprintf(fp, "checkpoint-responders = true\n");
+    }
 
     fprintf(fp, "# ADAPTER SETTINGS\n");
     if (masscan->nic_count == 0)
@@ -150,6 +214,15 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
         for (i=0; i<masscan->nic_count; i++)
             masscan_echo_nic(masscan, fp, i);
     }
+    for (i=0; i<masscan->nic_count || i==0; i++) {
+        if (simnet_is_name(masscan->nic[i].ifname)) {
+            fprintf(fp, "sim-open = %f\n", masscan->sim.open);
+            fprintf(fp, "sim-closed = %f\n", masscan->sim.closed);
+            fprintf(fp, "sim-loss = %f\n", masscan->sim.loss);
+            fprintf(fp, "sim-rtt = %uus\n", masscan->sim.rtt);
+            break;
+        }
+    }
 
 
     /*
@@ -161,6 +234,7 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     case Output_List:       fprintf(fp, "output-format = list\n"); break;
     case Output_XML:        fprintf(fp, "output-format = xml\n"); break;
     case Output_Binary:     fprintf(fp, "output-format = binary\n"); break;
+    case Output_Binary2:    fprintf(fp, "output-format = binary2\n"); break;
     case Output_JSON:       fprintf(fp, "output-format = json\n"); break;
     default:
         fprintf(fp, "output-format = unknown(%u)\n", masscan->nmap.format);
@@ -174,23 +248,35 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
     fprintf(fp, "rotate = %u\n", masscan->rotate_output);
     fprintf(fp, "rotate-dir = %s\n", masscan->rotate_directory);
     fprintf(fp, "rotate-offset = %u\n", masscan->rotate_offset);
+    if (masscan->rotate_size)
+        fprintf(fp, "rotate-size = %llu\n", (unsigned long long)masscan->rotate_size);
+    if (masscan->rotate_count)
+        fprintf(fp, "rotate-count = %llu\n", (unsigned long long)masscan->rotate_count);
+    if (masscan->is_rotate_compress)
+        fprintf(fp, "rotate-compress = true\n");
+    if (masscan->is_rotate_fsync)
+        fprintf(fp, "rotate-fsync = true\n");
     fprintf(fp, "pcap = %s\n", masscan->pcap_filename);
+    if (masscan->pcap_snaplen)
+        fprintf(fp, "pcap-snaplen = %u\n", masscan->pcap_snaplen);
+    if (masscan->pcap_max_size)
+        fprintf(fp, "pcap-max-size = %llu\n", (unsigned long long)masscan->pcap_max_size);
+    if (masscan->stats_filename[0])
+        fprintf(fp, "stats-file = %s\n", masscan->stats_filename);
+    if (masscan->stats_listen[0])
+        fprintf(fp, "stats-listen = %s\n", masscan->stats_listen);
+    if (masscan->stats_interval)
+        fprintf(fp, "stats-interval = %u\n", masscan->stats_interval);
+    if (masscan->is_profile)
+        fprintf(fp, "profile = true\n");
 
     /*
      * Targets
      */
     fprintf(fp, "# TARGET SELECTION (IP, PORTS, EXCLUDES)\n");
-    fprintf(fp, "ports = ");
-    for (i=0; i<masscan->ports.count; i++) {
-        struct Range range = masscan->ports.list[i];
-        if (range.begin == range.end)
-            fprintf(fp, "%u", range.begin);
-        else
-            fprintf(fp, "%u-%u", range.begin, range.end);
-        if (i+1 < masscan->ports.count)
-            fprintf(fp, ",");
-    }
-    fprintf(fp, "\n");
+    masscan_echo_ports(fp, "ports", &masscan->ports);
+    if (masscan->is_discover)
+        masscan_echo_ports(fp, "discover-ports", &masscan->discover_ports);
     for (i=0; i<masscan->targets.count; i++) {
         struct Range range = masscan->targets.list[i];
         fprintf(fp, "range = ");
@@ -227,33 +313,97 @@ masscan_echo(struct Masscan *masscan, FILE *fp)
 }
 
 /***************************************************************************
+ * The file is written under another name, then renamed over the old one,
+ * so that if we crash while writing it (see main-checkpoint.c), the last
+ * one is still there
  ***************************************************************************/
-void
-masscan_save_state(struct Masscan *masscan)
+int
+masscan_write_state(struct Masscan *masscan, const char *filename)
 {
-    char filename[512];
     FILE *fp;
-    int err;
 
+    fp = checkpoint_create(filename);
+    if (fp == NULL)
+        return -1;
+
+    fprintf(fp, "\n# resume information\n");
+    fprintf(fp, "resume-seed = %llu\n", masscan->resume.seed);
+    fprintf(fp, "resume-index = %llu\n", masscan->resume.index);
+    if (masscan->resume.chunk_size) {
+        unsigned i;
+
+        fprintf(fp, "resume-chunk-size = %llu\n", masscan->resume.chunk_size);
+        for (i=0; i<masscan->resume.chunks.count; i++) {
+            struct Range range = masscan->resume.chunks.list[i];
+
+            /* several lines, so that none are too long to read back */
+            if (i % 64 == 0)
+                fprintf(fp, "%sresume-chunks = ", i ? "\n" : "");
+            else
+                fprintf(fp, ",");
+            if (range.begin == range.end)
+                fprintf(fp, "%u", range.begin);
+            else
+                fprintf(fp, "%u-%u", range.begin, range.end);
+        }
+        if (masscan->resume.chunks.count)
+            fprintf(fp, "\n");
+    }
+
+    if (masscan->resume.responders[0])
+        fprintf(fp, "resume-responders = %s\n", masscan->resume.responders);
+
+    masscan_echo(masscan, fp);
+
+    return checkpoint_commit(fp, filename);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+masscan_save_state(struct Masscan *masscan)
+{
+    const char *filename = masscan->checkpoint.filename;
 
-    strcpy_s(filename, sizeof(filename), "paused.conf");
     fprintf(stderr, "                                   "
                     "                                   \r");
     fprintf(stderr, "saving resume file to: %s\n", filename);
 
-    err = fopen_s(&fp, filename, "wt");
-    if (err) {
-        perror(filename);
-        return;
-    }
+    masscan_write_state(masscan, filename);
+}
 
-    fprintf(fp, "\n# resume information\n");
-    fprintf(fp, "resume-seed = %llu\n", masscan->resume.seed);
-    fprintf(fp, "resume-index = %llu\n", masscan->resume.index);
+/***************************************************************************
+ * How far apart, in a transmit thread's own sequence of targets, a probe
+ * and its retry are. Each target costs a packet for the probe and for
+ * each retry, whether or not it's sent, and each thread gets its share
+ * of "--max-rate", so this is at least "--retry-delay" seconds.
+ ***************************************************************************/
+uint64_t
+masscan_retry_gap(const struct Masscan *masscan)
+{
+    unsigned nic_count = masscan->nic_count ? masscan->nic_count : 1;
 
-    masscan_echo(masscan, fp);
+    return (uint64_t)(masscan->retry_delay * (unsigned)masscan->max_rate)
+            / (masscan->retries + 1) / nic_count;
+}
 
-    fclose(fp);
+/***************************************************************************
+ * The transmit threads count through the targets in our --shard, where
+ * target 'i' is at index (i * shards + shard - 1) of the whole scan. This
+ * is how many there are, or fewer with --resume-count.
+ ***************************************************************************/
+uint64_t
+masscan_shard_limit(const struct Masscan *masscan, uint64_t range)
+{
+    uint64_t offset = masscan->shard.one - 1;
+    uint64_t limit;
+
+    if (range <= offset)
+        return 0;
+    limit = (range - offset + masscan->shard.of - 1) / masscan->shard.of;
+    if (masscan->resume.count && limit > masscan->resume.index + masscan->resume.count)
+        limit = masscan->resume.index + masscan->resume.count;
+    return limit;
 }
 
 
@@ -406,6 +556,45 @@ parseInt(const char *str)
     return result;
 }
 
+/***************************************************************************
+ * Parses a size in bytes, with an optional suffix, like "100k", "10MB",
+ * or "2g". These are powers of 1024.
+ ***************************************************************************/
+static uint64_t
+parseSize(const char *value)
+{
+    uint64_t num = 0;
+
+    while (isdigit(value[0]&0xFF)) {
+        num = num*10 + (value[0] - '0');
+        value++;
+    }
+    while (isspace(value[0]&0xFF))
+        value++;
+
+    switch (tolower(value[0]&0xFF)) {
+    case '\0':
+    case 'b':
+        break;
+    case 'k':
+        num *= 1024ULL;
+        break;
+    case 'm':
+        num *= 1024ULL*1024ULL;
+        break;
+    case 'g':
+        num *= 1024ULL*1024ULL*1024ULL;
+        break;
+    case 't':
+        num *= 1024ULL*1024ULL*1024ULL*1024ULL;
+        break;
+    default:
+        fprintf(stderr, "%s: unknown size suffix\n", value);
+        exit(1);
+    }
+    return num;
+}
+
 /***************************************************************************
  * Parses the number of seconds (for rotating files mostly). We do a little
  * more than just parse an integer. We support strings like:
@@ -471,6 +660,51 @@ parseTime(const char *value)
     return num;
 }
 
+/***************************************************************************
+ * Parses a fraction, either like "0.05" or as a percentage like "5%"
+ ***************************************************************************/
+static double
+parseFraction(const char *value)
+{
+    char *end;
+    double x = strtod(value, &end);
+
+    while (isspace(*end&0xFF))
+        end++;
+    if (*end == '%')
+        x /= 100.0;
+    if (x < 0.0 || x > 1.0) {
+        fprintf(stderr, "%s: expected a fraction between 0 and 1\n", value);
+        exit(1);
+    }
+    return x;
+}
+
+/***************************************************************************
+ * Parses a short duration into microseconds, like "250us", "20ms", or
+ * "1s". Without a suffix, the number is in milliseconds.
+ ***************************************************************************/
+static unsigned
+parseMicroseconds(const char *value)
+{
+    char *end;
+    double x = strtod(value, &end);
+
+    while (isspace(*end&0xFF))
+        end++;
+    if (tolower(end[0]&0xFF) == 'u')
+        ;
+    else if (tolower(end[0]&0xFF) == 's')
+        x *= 1000000.0;
+    else
+        x *= 1000.0;
+    if (x < 0.0 || x > 60000000.0) {
+        fprintf(stderr, "%s: expected a time up to 60 seconds\n", value);
+        exit(1);
+    }
+    return (unsigned)x;
+}
+
 
 
 /***************************************************************************
@@ -510,6 +744,27 @@ ARRAY(const char *rhs)
     return (unsigned)parseInt(p);
 }
 
+/***************************************************************************
+ * Add a file to the list for "--readscan" or "--merge"
+ ***************************************************************************/
+static void
+scanfiles_add(struct Masscan *masscan, const char *filename)
+{
+    size_t len = strlen(filename) + 1;
+    char **names;
+
+    names = (char**)realloc(masscan->scanfiles.names,
+                    (masscan->scanfiles.count + 1) * sizeof(names[0]));
+    if (names == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    names[masscan->scanfiles.count] = (char*)malloc(len);
+    memcpy(names[masscan->scanfiles.count], filename, len);
+    masscan->scanfiles.names = names;
+    masscan->scanfiles.count++;
+}
+
 /***************************************************************************
  * Called either from the "command-line" parser when it sees a --parm,
  * or from the "config-file" parser for normal options.
@@ -583,7 +838,8 @@ masscan_set_parameter(struct Masscan *masscan,
 
         memcpy(masscan->nic[index].router_mac, mac, 6);
     }
-    else if (EQUALS("rate", name) || EQUALS("max-rate", name) ) {
+    else if (EQUALS("rate", name) || EQUALS("max-rate", name)
+             || EQUALS("min-rate", name)) {
         double rate = 0.0;
         double point = 10.0;
         unsigned i;
@@ -612,7 +868,10 @@ masscan_set_parameter(struct Masscan *masscan,
             }
         }
 
-        masscan->max_rate = rate;
+        if (EQUALS("min-rate", name))
+            masscan->min_rate = rate;
+        else
+            masscan->max_rate = rate;
 
     }
     else if (EQUALS("ports", name) || EQUALS("port", name)) {
@@ -622,6 +881,38 @@ masscan_set_parameter(struct Masscan *masscan,
     }
     else if (EQUALS("exclude-ports", name) || EQUALS("exclude-port", name)) {
         rangelist_parse_ports(&masscan->exclude_port, value);
+    } else if (EQUALS("checkpoint", name)) {
+        masscan->checkpoint.interval = (unsigned)parseTime(value);
+    } else if (EQUALS("checkpoint-file", name)) {
+        strcpy_s(masscan->checkpoint.filename, sizeof(masscan->checkpoint.filename), value);
+    } else if (EQUALS("checkpoint-responders", name)) {
+        masscan->checkpoint.is_responders = 1;
+    } else if (EQUALS("coordinator", name) || EQUALS("worker", name)) {
+        if (lease_parse_address(value, &masscan->lease.ip, &masscan->lease.port) != 0
+            || (EQUALS("worker", name) && masscan->lease.ip == 0)) {
+            fprintf(stderr, "error: %s=<%s>: expected an address like "
+                            "\"%s\"\n", name,
+                    EQUALS("worker", name) ? "ip:port" : "[ip:]port",
+                    EQUALS("worker", name) ? "10.0.0.1:7000" : "0.0.0.0:7000");
+            exit(1);
+        }
+        if (EQUALS("worker", name))
+            masscan->lease.is_worker = 1;
+        else
+            masscan->op = Operation_Coordinator;
+    } else if (EQUALS("lease-key", name)) {
+        strcpy_s(masscan->lease.key, sizeof(masscan->lease.key), value);
+    } else if (EQUALS("lease-timeout", name)) {
+        masscan->lease.timeout = (unsigned)parseTime(value);
+        if (masscan->lease.timeout == 0) {
+            fprintf(stderr, "error: lease-timeout=<secs>: expected at least 1 second\n");
+            masscan->lease.timeout = 30;
+        }
+    } else if (EQUALS("discover", name)) {
+        masscan->is_discover = 1;
+    } else if (EQUALS("discover-ports", name) || EQUALS("discover-port", name)) {
+        rangelist_parse_ports(&masscan->discover_ports, value);
+        masscan->is_discover = 1;
     } else if (EQUALS("ping", name) || EQUALS("ping-sweep", name)) {
         /* Add ICMP ping request */
         struct Range range;
@@ -750,9 +1041,6 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("min-rtt-timeout", name) || EQUALS("max-rtt-timeout", name) || EQUALS("initial-rtt-timeout", name)) {
         fprintf(stderr, "nmap(%s): unsupported: we are asychronous, so no timeouts, no RTT tracking!\n", name);
         exit(1);
-    } else if (EQUALS("min-rate", name)) {
-        fprintf(stderr, "nmap(%s): unsupported, we go as fast as --max-rate allows\n", name);
-        /* no exit here, since it's just info */
     } else if (EQUALS("mtu", name)) {
         fprintf(stderr, "nmap(%s): fragmentation not yet supported\n", name);
         exit(1);
@@ -796,6 +1084,7 @@ masscan_set_parameter(struct Masscan *masscan,
         else if (EQUALS("interactive", value))  masscan->nmap.format = Output_Interactive;
         else if (EQUALS("xml", value))          masscan->nmap.format = Output_XML;
         else if (EQUALS("binary", value))       masscan->nmap.format = Output_Binary;
+        else if (EQUALS("binary2", value))      masscan->nmap.format = Output_Binary2;
         else if (EQUALS("json", value))       masscan->nmap.format = Output_JSON;
         else {
             fprintf(stderr, "error: %s=%s\n", name, value);
@@ -804,6 +1093,10 @@ masscan_set_parameter(struct Masscan *masscan,
         strcpy_s(masscan->nmap.filename, sizeof(masscan->nmap.filename), value);
     } else if (EQUALS("pcap", name)) {
         strcpy_s(masscan->pcap_filename, sizeof(masscan->pcap_filename), value);
+    } else if (EQUALS("pcap-snaplen", name)) {
+        masscan->pcap_snaplen = (unsigned)parseInt(value);
+    } else if (EQUALS("pcap-max-size", name)) {
+        masscan->pcap_max_size = parseSize(value);
     } else if (EQUALS("packet-trace", name) || EQUALS("trace-packet", name)) {
         masscan->nmap.packet_trace = 1;
     } else if (EQUALS("privileged", name) || EQUALS("unprivileged", name)) {
@@ -826,10 +1119,31 @@ masscan_set_parameter(struct Masscan *masscan,
         masscan_set_parameter(masscan, "output-append", "true");
     } else if (EQUALS("resume-seed", name)) {
         masscan->resume.seed = parseInt(value);
+    } else if (EQUALS("resume-responders", name)) {
+        strcpy_s(masscan->resume.responders, sizeof(masscan->resume.responders), value);
     } else if (EQUALS("resume-index", name)) {
         masscan->resume.index = parseInt(value);
     } else if (EQUALS("resume-count", name)) {
         masscan->resume.count = parseInt(value);
+    } else if (EQUALS("resume-chunk-size", name)) {
+        masscan->resume.chunk_size = parseInt(value);
+    } else if (EQUALS("resume-chunks", name)) {
+        char *p = (char*)value;
+
+        while (isdigit(*p & 0xFF)) {
+            unsigned begin = strtoul(p, &p, 10);
+            unsigned end = begin;
+
+            if (*p == '-') {
+                p++;
+                end = strtoul(p, &p, 10);
+            }
+            if (end >= begin)
+                rangelist_add_range(&masscan->resume.chunks, begin, end);
+            if (*p != ',')
+                break;
+            p++;
+        }
     } else if (EQUALS("retries", name) || EQUALS("retry", name)) {
         unsigned x = strtoul(value, 0, 0);
         if (x >= 1000) {
@@ -837,8 +1151,23 @@ masscan_set_parameter(struct Masscan *masscan,
         } else {
             masscan->retries = x;
         }
+    } else if (EQUALS("retry-delay", name)) {
+        double x = strtod(value, 0);
+        if (x < 0 || x > 3600) {
+            fprintf(stderr, "error: retry-delay=<secs>: expected 0 to 3600 seconds\n");
+        } else {
+            masscan->retry_delay = x;
+        }
     } else if (EQUALS("rotate-output", name) || EQUALS("rotate", name) || EQUALS("ouput-rotate", name)) {
         masscan->rotate_output = (unsigned)parseTime(value);
+    } else if (EQUALS("rotate-size", name)) {
+        masscan->rotate_size = parseSize(value);
+    } else if (EQUALS("rotate-count", name)) {
+        masscan->rotate_count = parseInt(value);
+    } else if (EQUALS("rotate-compress", name)) {
+        masscan->is_rotate_compress = 1;
+    } else if (EQUALS("rotate-fsync", name)) {
+        masscan->is_rotate_fsync = 1;
     } else if (EQUALS("rotate-offset", name) || EQUALS("ouput-rotate-offset", name)) {
         masscan->rotate_offset = (unsigned)parseTime(value);
     } else if (EQUALS("rotate-dir", name) || EQUALS("rotate-directory", name) || EQUALS("ouput-rotate-dir", name)) {
@@ -862,6 +1191,20 @@ masscan_set_parameter(struct Masscan *masscan,
         exit(1);
     } else if (EQUALS("seed", name)) {
         masscan->seed = parseInt(value);
+    } else if (EQUALS("sim-open", name)) {
+        masscan->sim.open = parseFraction(value);
+    } else if (EQUALS("sim-closed", name)) {
+        masscan->sim.closed = parseFraction(value);
+    } else if (EQUALS("sim-loss", name)) {
+        masscan->sim.loss = parseFraction(value);
+    } else if (EQUALS("sim-rtt", name)) {
+        masscan->sim.rtt = parseMicroseconds(value);
+    } else if (EQUALS("stats-file", name)) {
+        strcpy_s(masscan->stats_filename, sizeof(masscan->stats_filename), value);
+    } else if (EQUALS("stats-listen", name)) {
+        strcpy_s(masscan->stats_listen, sizeof(masscan->stats_listen), value);
+    } else if (EQUALS("stats-interval", name)) {
+        masscan->stats_interval = (unsigned)parseTime(value);
     } else if (EQUALS("sendq", name)) {
         masscan->is_sendq = 1;
     } else if (EQUALS("send-eth", name)) {
@@ -869,6 +1212,31 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("send-ip", name)) {
         fprintf(stderr, "nmap(%s): unsupported, we only do --send-eth\n", name);
         exit(1);
+    } else if (EQUALS("readscan", name)) {
+        scanfiles_add(masscan, value);
+        masscan->op = Operation_ReadScan;
+        return;
+    } else if (EQUALS("merge", name)) {
+        scanfiles_add(masscan, value);
+        masscan->op = Operation_Merge;
+        return;
+    } else if (EQUALS("diff", name)) {
+        scanfiles_add(masscan, value);
+        masscan->op = Operation_Diff;
+        return;
+    } else if (EQUALS("replay", name)) {
+        strcpy_s(masscan->replay_filename, sizeof(masscan->replay_filename), value);
+        masscan->op = Operation_Replay;
+        return;
+    } else if (EQUALS("replay-realtime", name)) {
+        masscan->is_replay_realtime = 1;
+    } else if (EQUALS("profile", name)) {
+        masscan->is_profile = 1;
+    } else if (EQUALS("adaptive-rate", name)) {
+        masscan->is_adaptive_rate = 1;
+    } else if (EQUALS("benchmark", name)) {
+        masscan->op = Operation_Benchmark;
+        return;
     } else if (EQUALS("selftest", name) || EQUALS("self-test", name) || EQUALS("regress", name)) {
         masscan->op = Operation_Selftest;
         return;
@@ -951,7 +1319,7 @@ static int
 is_singleton(const char *name)
 {
     static const char *singletons[] = {
-        "echo", "selftest", "self-test", "regress",
+        "echo", "selftest", "self-test", "regress", "benchmark",
         "system-dns", "traceroute", "version-light",
         "version-all", "version-trace",
         "osscan-limit", "osscan-guess",
@@ -962,6 +1330,8 @@ is_singleton(const char *name)
         "send-eth", "send-ip", "iflist", "randomize-hosts",
         "nmap", "trace-packet", "pfring", "sendq",
         "banners", "banner", "offline", "ping", "ping-sweep",
+        "rotate-compress", "rotate-fsync", "replay-realtime",
+        "profile", "adaptive-rate", "discover", "checkpoint-responders",
         0};
     size_t i;
 
@@ -1319,6 +1689,15 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
             continue;
         }
 
+        /* With "--readscan", "--merge", or "--diff", the remaining
+         * parameters are more files, and with "--benchmark", a capture
+         * file to read */
+        if (masscan->op == Operation_ReadScan || masscan->op == Operation_Merge
+            || masscan->op == Operation_Diff || masscan->op == Operation_Benchmark) {
+            scanfiles_add(masscan, argv[i]);
+            continue;
+        }
+
         if (!isdigit(argv[i][0])) {
             fprintf(stderr, "FAIL: unknown command-line parameter \"%s\"\n", argv[i]);
             fprintf(stderr, " [hint] did you want \"--%s\"?\n", argv[i]);
@@ -0,0 +1,536 @@
+/*
+    "--coordinator": leasing chunks of a scan to workers
+
+    Instead of sending any packets, the coordinator cuts the scan into
+    chunks the same way the transmit threads would (see main-scheduler.c),
+    and hands them out to the workers that connect to it, a few at a time.
+    The workers send back their results, which we write to the output
+    file, like a normal scan would.
+
+    A worker that disconnects, or that we haven't heard from for
+    "--lease-timeout" seconds, loses the chunks it hasn't reported done,
+    and they're given to the next worker that asks. Workers can come and
+    go during the scan. Once every chunk is done, we tell the workers,
+    and exit once they've all disconnected, which they do after waiting
+    for the last responses.
+
+    Everything is done in this one thread, with select(), since the
+    workers are the ones doing the real work.
+*/
+#include "masscan.h"
+#include "main-lease.h"
+#include "main-scheduler.h"
+#include "main-status.h"
+#include "main-checkpoint.h"
+#include "output.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(WIN32)
+#include <sys/time.h>
+#include <arpa/inet.h>
+#endif
+
+extern unsigned control_c_pressed;
+
+/* Small enough for select() */
+#define CLIENTS_MAX 64
+
+struct Client {
+    SOCKET fd;
+    char name[32];
+    unsigned kind;
+    unsigned is_hello:1;
+    time_t last_heard;
+
+    /* What the worker's hello has to answer, see main-lease.h */
+    uint64_t nonce;
+
+    /* Chunks the worker asked for that we haven't given it yet */
+    unsigned wanted;
+
+    /* Chunks the worker has, and hasn't reported done, which includes
+     * the ones it's waiting on the last responses for */
+    unsigned *leases;
+    unsigned lease_count;
+    unsigned lease_max;
+
+    struct LeaseBuffer in;
+};
+
+struct Coordinator {
+    struct Masscan *masscan;
+    struct Scheduler *scheduler;
+    struct Output *out;
+    uint64_t fingerprint;
+    uint64_t limit;
+    unsigned is_finished:1;
+
+    /* Chunks taken back from workers that went away, to give out again
+     * before any new ones */
+    unsigned *returned;
+    unsigned returned_count;
+    unsigned returned_max;
+
+    struct Client *clients[CLIENTS_MAX];
+    unsigned client_count;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+return_chunk(struct Coordinator *co, unsigned chunk)
+{
+    if (co->returned_count >= co->returned_max) {
+        co->returned_max = co->returned_max * 2 + 64;
+        co->returned = (unsigned *)realloc(co->returned,
+                            co->returned_max * sizeof(co->returned[0]));
+        if (co->returned == NULL)
+            exit(1);
+    }
+    co->returned[co->returned_count++] = chunk;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+client_drop(struct Coordinator *co, unsigned index, const char *why)
+{
+    struct Client *client = co->clients[index];
+    unsigned i;
+
+    if (client->kind != Lease_KindControl || !client->is_hello)
+        LOG(1, "coordinator: %s: %s\n", client->name, why);
+    else if (client->lease_count)
+        LOG(0, "coordinator: %s: worker %s, giving its %u chunk%s to others\n",
+            client->name, why, client->lease_count,
+            client->lease_count==1 ? "" : "s");
+    else
+        LOG(0, "coordinator: %s: worker %s\n", client->name, why);
+
+    for (i=0; i<client->lease_count; i++)
+        return_chunk(co, client->leases[i]);
+
+    closesocket(client->fd);
+    free(client->leases);
+    free(client);
+    co->clients[index] = co->clients[--co->client_count];
+}
+
+/***************************************************************************
+ * A worker finished a chunk. It may have been given to another worker as
+ * well, if we thought this one had died, so it's removed from everywhere.
+ ***************************************************************************/
+static void
+chunk_done(struct Coordinator *co, unsigned chunk)
+{
+    struct Scheduler *scheduler = co->scheduler;
+    unsigned i;
+    unsigned j;
+
+    if (chunk < scheduler->first || chunk - scheduler->first >= scheduler->count)
+        return;
+    scheduler_done(scheduler, chunk - scheduler->first);
+
+    for (i=0; i<co->client_count; i++) {
+        struct Client *client = co->clients[i];
+
+        for (j=0; j<client->lease_count; j++) {
+            if (client->leases[j] == chunk) {
+                client->leases[j] = client->leases[--client->lease_count];
+                break;
+            }
+        }
+    }
+    for (j=0; j<co->returned_count; j++) {
+        if (co->returned[j] == chunk) {
+            co->returned[j] = co->returned[--co->returned_count];
+            break;
+        }
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+client_hello(struct Coordinator *co, struct Client *client,
+             const unsigned char *payload, unsigned length)
+{
+    unsigned char x[24];
+
+    if (length < 17)
+        return -1;
+    if (lease_get64(payload) != co->fingerprint) {
+        static const char reason[] = "different targets, ports, seed, "
+                                     "retries, shard, or --discover";
+
+        lease_send(client->fd, Lease_Reject, (const unsigned char *)reason,
+                   sizeof(reason) - 1);
+        return -1;
+    }
+    if (lease_get64(payload + 9) != lease_mac(co->masscan->lease.key,
+                                              client->nonce, co->fingerprint,
+                                              payload[8])) {
+        static const char reason[] = "wrong --lease-key";
+
+        LOG(0, "coordinator: %s: wrong --lease-key\n", client->name);
+        lease_send(client->fd, Lease_Reject, (const unsigned char *)reason,
+                   sizeof(reason) - 1);
+        return -1;
+    }
+    client->kind = payload[8];
+    client->is_hello = 1;
+    if (client->kind != Lease_KindControl)
+        return 0;
+
+    LOG(0, "coordinator: %s: worker connected\n", client->name);
+    lease_put64(x +  0, co->scheduler->chunk_size);
+    lease_put64(x +  8, co->scheduler->begin);
+    lease_put64(x + 16, co->scheduler->end);
+    if (lease_send(client->fd, Lease_Welcome, x, sizeof(x)) != 0)
+        return -1;
+    if (co->is_finished)
+        return lease_send(client->fd, Lease_Finished, 0, 0);
+    return 0;
+}
+
+/***************************************************************************
+ * Handle the messages from a worker
+ * @return
+ *      0 on success, or -1 to drop the worker
+ ***************************************************************************/
+static int
+client_read(struct Coordinator *co, struct Client *client)
+{
+    unsigned char payload[LEASE_PAYLOAD_MAX];
+    unsigned type;
+    unsigned length;
+
+    if (lease_recv(client->fd, &client->in) < 0)
+        return -1;
+    client->last_heard = time(0);
+
+    while (lease_next(&client->in, &type, payload, &length)) {
+        if (!client->is_hello) {
+            if (type != Lease_Hello || client_hello(co, client, payload, length) != 0)
+                return -1;
+            continue;
+        }
+
+        switch (type) {
+        case Lease_Request:
+            if (length >= 4)
+                client->wanted += lease_get32(payload);
+            break;
+        case Lease_Done:
+            if (length >= 4)
+                chunk_done(co, lease_get32(payload));
+            break;
+        case Lease_Heartbeat:
+            break;
+        case Lease_Status:
+            if (length >= 15)
+                output_report_status_at(co->out,
+                        (time_t)lease_get32(payload + 0),
+                        payload[4],
+                        lease_get32(payload + 5),
+                        lease_get32(payload + 9),
+                        payload[13],
+                        payload[14]);
+            break;
+        case Lease_Banner:
+            if (length >= 15)
+                output_report_banner_at(co->out,
+                        (time_t)lease_get32(payload + 0),
+                        lease_get32(payload + 4),
+                        payload[8],
+                        lease_get32(payload + 9),
+                        payload[13]<<8 | payload[14],
+                        payload + 15,
+                        length - 15);
+            break;
+        default:
+            LOG(1, "coordinator: %s: unexpected message 0x%02x\n",
+                client->name, type);
+            break;
+        }
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Give the workers the chunks they've asked for, as long as there are
+ * some left
+ ***************************************************************************/
+static void
+hand_out(struct Coordinator *co, unsigned index)
+{
+    struct Client *client = co->clients[index];
+
+    while (client->wanted) {
+        unsigned char x[4];
+        unsigned chunk;
+
+        if (co->returned_count)
+            chunk = co->returned[--co->returned_count];
+        else {
+            uint64_t begin, end;
+
+            if (!scheduler_next(co->scheduler, &chunk, &begin, &end))
+                break;
+            chunk += co->scheduler->first;
+        }
+
+        if (client->lease_count >= client->lease_max) {
+            client->lease_max = client->lease_max * 2 + 16;
+            client->leases = (unsigned *)realloc(client->leases,
+                                client->lease_max * sizeof(client->leases[0]));
+            if (client->leases == NULL)
+                exit(1);
+        }
+        client->leases[client->lease_count++] = chunk;
+        client->wanted--;
+        lease_put32(x, chunk);
+        if (lease_send(client->fd, Lease_Chunk, x, 4) != 0) {
+            client_drop(co, index, "disconnected");
+            return;
+        }
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static SOCKET
+coordinator_listen(const struct Masscan *masscan)
+{
+    struct sockaddr_in sin;
+    SOCKET fd;
+    int yes = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET)
+        goto fail;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(masscan->lease.ip);
+    sin.sin_port = htons((unsigned short)masscan->lease.port);
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0
+        || listen(fd, 16) != 0) {
+        closesocket(fd);
+        goto fail;
+    }
+    if ((masscan->lease.ip >> 24) != 127 && masscan->lease.key[0] == '\0')
+        LOG(0, "coordinator: without --lease-key, anybody who can reach "
+               "port %u can join the scan\n", masscan->lease.port);
+    return fd;
+
+fail:
+    LOG(0, "coordinator: port %u: %s\n", masscan->lease.port, strerror_x(errno));
+    return INVALID_SOCKET;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+client_accept(struct Coordinator *co, SOCKET listener)
+{
+    struct sockaddr_in sin;
+    socklen_t sizeof_sin = sizeof(sin);
+    struct Client *client;
+    unsigned char x[8];
+    unsigned ip;
+    SOCKET fd;
+
+    fd = accept(listener, (struct sockaddr *)&sin, &sizeof_sin);
+    if (fd == INVALID_SOCKET)
+        return;
+    if (co->client_count >= CLIENTS_MAX) {
+        LOG(0, "coordinator: too many connections\n");
+        closesocket(fd);
+        return;
+    }
+
+    client = (struct Client *)malloc(sizeof(*client));
+    if (client == NULL)
+        exit(1);
+    memset(client, 0, sizeof(*client));
+    client->fd = fd;
+    client->last_heard = time(0);
+    ip = ntohl(sin.sin_addr.s_addr);
+    sprintf_s(client->name, sizeof(client->name), "%u.%u.%u.%u:%u",
+              (ip>>24)&0xFF, (ip>>16)&0xFF, (ip>>8)&0xFF, (ip>>0)&0xFF,
+              ntohs(sin.sin_port));
+
+    /* A fresh nonce on every connection, so that an old hello is no good */
+    client->nonce = lease_nonce();
+    lease_put64(x, client->nonce);
+    if (lease_send(fd, Lease_Challenge, x, sizeof(x)) != 0) {
+        closesocket(fd);
+        free(client);
+        return;
+    }
+    co->clients[co->client_count++] = client;
+}
+
+/***************************************************************************
+ * Called from main() for "--coordinator"
+ ***************************************************************************/
+int
+main_coordinator(struct Masscan *masscan)
+{
+    struct Coordinator co[1];
+    struct Status status;
+    uint64_t count_ips;
+    uint64_t count_ports;
+    uint64_t low_water;
+    time_t next_checkpoint;
+    SOCKET listener;
+    unsigned i;
+
+    memset(co, 0, sizeof(co[0]));
+    co->masscan = masscan;
+
+    count_ips = rangelist_count(&masscan->targets);
+    count_ports = rangelist_count(&masscan->ports);
+    if (count_ips == 0 || count_ports == 0) {
+        LOG(0, "FAIL: coordinator needs targets and ports, like a scan\n");
+        return 1;
+    }
+
+    /* Cut the scan up the same way main_scan() would, which the workers
+     * will use instead of their own */
+    if (masscan->is_discover) {
+        if (rangelist_count(&masscan->discover_ports) == 0)
+            rangelist_parse_ports(&masscan->discover_ports, "I:0,80,443");
+        count_ports = rangelist_count(&masscan->discover_ports);
+    }
+    co->fingerprint = lease_fingerprint(masscan);
+    co->limit = masscan_shard_limit(masscan, count_ips * count_ports);
+    co->scheduler = scheduler_create(masscan->resume.index, co->limit,
+                                     masscan->resume.chunk_size,
+                                     &masscan->resume.chunks);
+
+    listener = coordinator_listen(masscan);
+    if (listener == INVALID_SOCKET) {
+        scheduler_destroy(co->scheduler);
+        return 1;
+    }
+    co->out = output_create(masscan);
+
+    LOG(0, "coordinator: %u chunks of %llu, waiting for workers on port %u\n",
+        co->scheduler->count, co->scheduler->chunk_size, masscan->lease.port);
+
+    /*
+     * Until the scan is done, and the workers have gone, or <ctrl-c>
+     */
+    status_start(&status);
+    next_checkpoint = time(0) + masscan->checkpoint.interval;
+    while (!control_c_pressed) {
+        struct timeval tv;
+        fd_set readset;
+        int nfds = (int)listener;
+        time_t now;
+        int x;
+
+        FD_ZERO(&readset);
+        FD_SET(listener, &readset);
+        for (i=0; i<co->client_count; i++) {
+            FD_SET(co->clients[i]->fd, &readset);
+            if ((int)co->clients[i]->fd > nfds)
+                nfds = (int)co->clients[i]->fd;
+        }
+        tv.tv_sec = 0;
+        tv.tv_usec = 250000;
+        x = select(nfds+1, &readset, 0, 0, &tv);
+        if (x < 0 && errno != EINTR) {
+            LOG(0, "coordinator: select: %s\n", strerror_x(errno));
+            break;
+        }
+
+        /* Read before accepting, since that changes the list */
+        for (i=0; x > 0 && i<co->client_count; ) {
+            if (FD_ISSET(co->clients[i]->fd, &readset)
+                && client_read(co, co->clients[i]) != 0)
+                client_drop(co, i, "disconnected");
+            else
+                i++;
+        }
+        if (x > 0 && FD_ISSET(listener, &readset))
+            client_accept(co, listener);
+
+        /* Workers that have stopped sending heartbeats lose their chunks.
+         * The results connections only go quiet when there's nothing to
+         * report, so they're left alone. */
+        now = time(0);
+        for (i=0; i<co->client_count; ) {
+            struct Client *client = co->clients[i];
+
+            if (client->kind == Lease_KindControl
+                && now - client->last_heard > (time_t)masscan->lease.timeout)
+                client_drop(co, i, "timed out");
+            else
+                i++;
+        }
+
+        for (i=0; i<co->client_count; ) {
+            unsigned count = co->client_count;
+
+            if (co->clients[i]->kind == Lease_KindControl && co->clients[i]->is_hello)
+                hand_out(co, i);
+            if (count == co->client_count)
+                i++;
+        }
+
+        /* When every chunk is done, tell the workers, who will disconnect
+         * once they've waited for the last responses */
+        if (!co->is_finished && co->scheduler->completed == co->scheduler->count) {
+            co->is_finished = 1;
+            LOG(0, "coordinator: every chunk is done\n");
+            for (i=0; i<co->client_count; ) {
+                struct Client *client = co->clients[i];
+
+                if (client->kind == Lease_KindControl && client->is_hello
+                    && lease_send(client->fd, Lease_Finished, 0, 0) != 0)
+                    client_drop(co, i, "disconnected");
+                else
+                    i++;
+            }
+        }
+        if (co->is_finished && co->client_count == 0)
+            break;
+
+        /* With --checkpoint, save the chunks reported so far */
+        if (masscan->checkpoint.interval && now >= next_checkpoint) {
+            checkpoint_save(masscan, co->scheduler, NULL, 1, 1);
+            next_checkpoint = now + masscan->checkpoint.interval;
+        }
+
+        status_print(&status, scheduler_progress(co->scheduler),
+                     co->scheduler->end, 0, 0);
+    }
+    status_finish(&status);
+
+    /*
+     * If we were stopped early, save the chunks that the workers reported
+     * done, so that "--resume" with "--coordinator" carries on from there
+     */
+    low_water = scheduler_low_water(co->scheduler);
+    if (low_water < co->limit)
+        checkpoint_save(masscan, co->scheduler, NULL, 0, 0);
+    else if (masscan->checkpoint.interval)
+        checkpoint_save(masscan, co->scheduler, NULL, 1, 0);
+
+    while (co->client_count)
+        client_drop(co, co->client_count - 1, "closed");
+    closesocket(listener);
+    output_destroy(co->out);
+    scheduler_destroy(co->scheduler);
+    free(co->returned);
+    return 0;
+}
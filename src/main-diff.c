@@ -0,0 +1,722 @@
+/*
+    --diff <old> <new>
+
+    Compare two scans of the same targets, and output only what changed:
+
+        masscan --diff monday.scan tuesday.scan -oJ changes.json
+
+    The inputs must be sorted by IP address and port, such as the output
+    of "--merge". Both files are then read in step with each other, like
+    the classic 'comm' or 'diff' of two sorted lists, so memory use is
+    only that of the readers (a block of each), no matter the size of
+    the scans.
+
+    Each record is one of:
+    - added: in the new scan, but not the old, such as a newly opened port.
+      This is output as it appears in the new scan.
+    - removed: in the old scan, but not the new. An open port that went
+      away is output as a "closed" port, with the old timestamp. Other
+      removed records (banners, closed ports) are only counted.
+    - changed: in both, but the port went from open to closed (or back),
+      or the banner is different. This is output as in the new scan.
+    - unchanged: in both, and the same, so not output.
+
+    When both files are "masscan/2.0" format, the block index is used to
+    split the IP address space into partitions, which are diffed in
+    parallel, one thread per CPU. The results of each partition are
+    handed to this thread through a ring buffer, and output in partition
+    order, so the output is still sorted.
+*/
+#include "masscan.h"
+#include "in-binary.h"
+#include "out-binary2.h"
+#include "output.h"
+#include "logger.h"
+#include "rte-ring.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_RECORDS 1024
+#define BATCH_BANNERS (64*1024)
+
+/* How many partitions to make per thread, so that threads finishing
+ * early aren't left idle */
+#define PARTITIONS_PER_THREAD 4
+
+struct DiffBatch {
+    unsigned count;
+    unsigned banner_length;
+    struct ScanRecord records[BATCH_RECORDS];
+    unsigned char banners[BATCH_BANNERS];
+};
+
+struct DiffCounts {
+    uint64_t added;
+    uint64_t removed;
+    uint64_t changed;
+    uint64_t unchanged;
+};
+
+/* Called for every record that should be output */
+typedef void (*DIFF_EMIT)(void *data, const struct ScanRecord *rec);
+
+struct DiffPartition {
+    /* the range of IP addresses [lo, hi) */
+    uint64_t lo;
+    uint64_t hi;
+
+    /* where in each file to start reading, or -1 for nothing */
+    int64_t old_offset;
+    int64_t new_offset;
+
+    /* results being sent to the output thread */
+    struct rte_ring *ring;
+    struct DiffBatch *batch;
+    volatile unsigned is_done;
+
+    struct DiffCounts counts;
+    int is_error;
+};
+
+struct DiffWorker {
+    const struct Masscan *masscan;
+    struct DiffPartition *partitions;
+    unsigned partition_count;
+    unsigned index;
+    unsigned thread_count;
+};
+
+
+/***************************************************************************
+ * Get the next record within the partition, making sure the file is
+ * sorted.
+ * @return
+ *      1 if a record was returned, 0 at the end of the partition, or -1
+ *      if the file is corrupt or not sorted
+ ***************************************************************************/
+static int
+diff_next(struct ScanFile *f, struct ScanRecord *rec, int *is_first,
+          uint64_t lo, uint64_t hi)
+{
+    struct ScanRecord prev = *rec;
+
+    for (;;) {
+        int x = scanfile_next(f, rec);
+        if (x <= 0)
+            return x;
+        if (!*is_first && scanrecord_compare_key(&prev, rec) > 0)
+            return -1;
+        *is_first = 0;
+        prev = *rec;
+        if (rec->ip < lo)
+            continue;
+        if (rec->ip >= hi)
+            return 0;
+        return 1;
+    }
+}
+
+/***************************************************************************
+ * Whether a record found in both scans is different in the new one
+ ***************************************************************************/
+static int
+diff_is_changed(const struct ScanRecord *a, const struct ScanRecord *b)
+{
+    if (a->kind != b->kind)
+        return 1;
+    if (a->kind == SCAN_KIND_BANNER) {
+        if (a->banner_length != b->banner_length)
+            return 1;
+        if (memcmp(a->banner, b->banner, a->banner_length) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * A record in the old scan is missing from the new one. If it was an
+ * open port, then report it as closed.
+ ***************************************************************************/
+static void
+diff_removed(const struct ScanRecord *rec, DIFF_EMIT emit, void *data)
+{
+    struct ScanRecord closed = *rec;
+
+    switch (rec->kind) {
+    case Port_Open:
+        closed.kind = Port_Closed;
+        break;
+    case Port_UdpOpen:
+        closed.kind = Port_UdpClosed;
+        break;
+    case Port_SctpOpen:
+        closed.kind = Port_SctpClosed;
+        break;
+    default:
+        return;
+    }
+    closed.reason = 0;
+    closed.ttl = 0;
+    emit(data, &closed);
+}
+
+/***************************************************************************
+ * Diff the records from both files within the range [lo, hi). The files
+ * must already be positioned at or before the first record of the range.
+ * @return
+ *      0 on success, -1 if a file is corrupt or not sorted
+ ***************************************************************************/
+static int
+diff_range(struct ScanFile *old_f, struct ScanFile *new_f,
+           uint64_t lo, uint64_t hi,
+           DIFF_EMIT emit, void *data, struct DiffCounts *counts)
+{
+    struct ScanRecord a, b;
+    int is_first_a = 1, is_first_b = 1;
+    int xa = 0, xb = 0;
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    if (old_f)
+        xa = diff_next(old_f, &a, &is_first_a, lo, hi);
+    if (new_f)
+        xb = diff_next(new_f, &b, &is_first_b, lo, hi);
+
+    while (xa > 0 || xb > 0) {
+        int cmp;
+
+        if (xa > 0 && xb > 0)
+            cmp = scanrecord_compare_key(&a, &b);
+        else if (xa > 0)
+            cmp = -1;
+        else
+            cmp = 1;
+
+        if (cmp < 0) {
+            counts->removed++;
+            diff_removed(&a, emit, data);
+            xa = diff_next(old_f, &a, &is_first_a, lo, hi);
+        } else if (cmp > 0) {
+            counts->added++;
+            emit(data, &b);
+            xb = diff_next(new_f, &b, &is_first_b, lo, hi);
+        } else {
+            if (diff_is_changed(&a, &b)) {
+                counts->changed++;
+                emit(data, &b);
+            } else
+                counts->unchanged++;
+            xa = diff_next(old_f, &a, &is_first_a, lo, hi);
+            xb = diff_next(new_f, &b, &is_first_b, lo, hi);
+        }
+    }
+
+    if (xa < 0 || xb < 0)
+        return -1;
+    return 0;
+}
+
+/***************************************************************************
+ * Hand the current batch to the output thread, waiting if it's behind
+ ***************************************************************************/
+static void
+batch_send(struct DiffPartition *p)
+{
+    if (p->batch == NULL)
+        return;
+    while (rte_ring_sp_enqueue(p->ring, p->batch) != 0)
+        pixie_usleep(100);
+    p->batch = NULL;
+}
+
+/***************************************************************************
+ * Add a result to the current batch, copying the banner, because it's
+ * only valid until we read the next record.
+ ***************************************************************************/
+static void
+batch_emit(void *data, const struct ScanRecord *rec)
+{
+    struct DiffPartition *p = (struct DiffPartition *)data;
+    struct DiffBatch *batch = p->batch;
+    unsigned length = 0;
+    struct ScanRecord *r;
+
+    if (rec->kind == SCAN_KIND_BANNER) {
+        length = rec->banner_length;
+        if (length > BATCH_BANNERS)
+            length = BATCH_BANNERS;
+    }
+
+    if (batch && (batch->count >= BATCH_RECORDS
+                  || batch->banner_length + length > BATCH_BANNERS)) {
+        batch_send(p);
+        batch = NULL;
+    }
+    if (batch == NULL) {
+        batch = (struct DiffBatch *)malloc(sizeof(*batch));
+        if (batch == NULL) {
+            fprintf(stderr, "diff: out of memory\n");
+            exit(1);
+        }
+        batch->count = 0;
+        batch->banner_length = 0;
+        p->batch = batch;
+    }
+
+    r = &batch->records[batch->count++];
+    *r = *rec;
+    if (rec->kind == SCAN_KIND_BANNER) {
+        memcpy(batch->banners + batch->banner_length, rec->banner, length);
+        r->banner = batch->banners + batch->banner_length;
+        r->banner_length = length;
+        batch->banner_length += length;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+diff_thread(void *v)
+{
+    struct DiffWorker *w = (struct DiffWorker *)v;
+    const struct Masscan *masscan = w->masscan;
+    struct ScanFile *old_f;
+    struct ScanFile *new_f;
+    unsigned i;
+
+    old_f = scanfile_open(masscan->scanfiles.names[0]);
+    new_f = scanfile_open(masscan->scanfiles.names[1]);
+
+    for (i=w->index; i<w->partition_count; i += w->thread_count) {
+        struct DiffPartition *p = &w->partitions[i];
+        struct ScanFile *a = old_f;
+        struct ScanFile *b = new_f;
+
+        if (old_f == NULL || new_f == NULL)
+            p->is_error = 1;
+        else {
+            if (p->old_offset < 0 || scanfile_seek(old_f, p->old_offset) != 0)
+                a = NULL;
+            if (p->new_offset < 0 || scanfile_seek(new_f, p->new_offset) != 0)
+                b = NULL;
+            if (diff_range(a, b, p->lo, p->hi, batch_emit, p, &p->counts) != 0)
+                p->is_error = 1;
+        }
+        batch_send(p);
+        p->is_done = 1;
+    }
+
+    scanfile_close(old_f);
+    scanfile_close(new_f);
+}
+
+/***************************************************************************
+ * Find the first block that might contain addresses at or above 'lo'.
+ * The blocks of a sorted file are in order of IP address.
+ ***************************************************************************/
+static int64_t
+index_find(const struct Binary2Index *index, unsigned count, uint64_t lo)
+{
+    unsigned i;
+
+    for (i=0; i<count; i++) {
+        if (index[i].max_ip >= lo)
+            return (int64_t)index[i].offset;
+    }
+    return -1;
+}
+
+/***************************************************************************
+ * Whether the blocks are in order, which they are if the whole file is
+ ***************************************************************************/
+static int
+index_is_sorted(const struct Binary2Index *index, unsigned count)
+{
+    unsigned i;
+
+    for (i=1; i<count; i++) {
+        if (index[i].min_ip < index[i-1].max_ip)
+            return 0;
+    }
+    return 1;
+}
+
+/***************************************************************************
+ * Split the address space into partitions, using the block index of the
+ * files. If either file doesn't have an index, we can't seek in it, so
+ * there's only one partition covering everything.
+ ***************************************************************************/
+static struct DiffPartition *
+diff_partitions(const struct Masscan *masscan, unsigned max_count,
+                unsigned *r_count)
+{
+    struct DiffPartition *partitions;
+    struct Binary2Index *old_index = NULL;
+    struct Binary2Index *new_index = NULL;
+    unsigned old_count = 0;
+    unsigned new_count = 0;
+    struct ScanFile *f;
+    unsigned count = 0;
+    unsigned i;
+
+    partitions = (struct DiffPartition *)malloc((max_count + 1) * sizeof(partitions[0]));
+    if (partitions == NULL)
+        return NULL;
+    memset(partitions, 0, (max_count + 1) * sizeof(partitions[0]));
+
+    f = scanfile_open(masscan->scanfiles.names[0]);
+    if (f && scanfile_index(f, &old_index, &old_count) != 0)
+        old_index = NULL;
+    scanfile_close(f);
+    f = scanfile_open(masscan->scanfiles.names[1]);
+    if (f && scanfile_index(f, &new_index, &new_count) != 0)
+        new_index = NULL;
+    scanfile_close(f);
+
+    if (old_index && !index_is_sorted(old_index, old_count)) {
+        fprintf(stderr, "%s: not sorted\n", masscan->scanfiles.names[0]);
+        goto fail;
+    }
+    if (new_index && !index_is_sorted(new_index, new_count)) {
+        fprintf(stderr, "%s: not sorted\n", masscan->scanfiles.names[1]);
+        goto fail;
+    }
+
+    if (old_index == NULL || new_index == NULL || new_count < 2 || max_count < 2) {
+        partitions[0].lo = 0;
+        partitions[0].hi = 0x100000000ULL;
+        partitions[0].old_offset = 0;
+        partitions[0].new_offset = 0;
+        count = 1;
+    } else {
+        /* Split on block boundaries of the new file, which should be
+         * about the same as the old file */
+        if (max_count > new_count)
+            max_count = new_count;
+        for (i=0; i<max_count; i++) {
+            uint64_t lo = new_index[(uint64_t)i * new_count / max_count].min_ip;
+            if (i == 0)
+                lo = 0;
+            if (count && lo <= partitions[count-1].lo)
+                continue;
+            if (count)
+                partitions[count-1].hi = lo;
+            partitions[count].lo = lo;
+            partitions[count].old_offset = index_find(old_index, old_count, lo);
+            partitions[count].new_offset = index_find(new_index, new_count, lo);
+            count++;
+        }
+        partitions[count-1].hi = 0x100000000ULL;
+    }
+
+    free(old_index);
+    free(new_index);
+    *r_count = count;
+    return partitions;
+fail:
+    free(old_index);
+    free(new_index);
+    free(partitions);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+diff_output(struct Output *out, const struct DiffBatch *batch)
+{
+    unsigned i;
+
+    for (i=0; i<batch->count; i++) {
+        const struct ScanRecord *rec = &batch->records[i];
+
+        if (rec->kind == SCAN_KIND_BANNER)
+            output_report_banner_at(out, rec->timestamp, rec->ip,
+                                    rec->ip_proto, rec->port, rec->proto,
+                                    rec->banner, rec->banner_length);
+        else
+            output_report_status_at(out, rec->timestamp, rec->kind, rec->ip,
+                                    rec->port, rec->reason, rec->ttl);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+main_diff(struct Masscan *masscan)
+{
+    struct DiffPartition *partitions;
+    struct DiffWorker *workers;
+    struct DiffCounts counts;
+    unsigned partition_count = 0;
+    unsigned thread_count;
+    unsigned is_error = 0;
+    struct Output *out;
+    uint64_t start;
+    unsigned i;
+
+    if (masscan->scanfiles.count != 2) {
+        LOG(0, "FAIL: need two scan files to compare\n");
+        LOG(0, " [hint] try something like \"--diff old.scan new.scan\"\n");
+        return 1;
+    }
+
+    start = pixie_gettime();
+    thread_count = pixie_cpu_get_count();
+    if (thread_count == 0)
+        thread_count = 1;
+
+    partitions = diff_partitions(masscan,
+                        thread_count * PARTITIONS_PER_THREAD,
+                        &partition_count);
+    if (partitions == NULL) {
+        LOG(0, " [hint] sort the files first with \"--merge\"\n");
+        return 1;
+    }
+    if (thread_count > partition_count)
+        thread_count = partition_count;
+    for (i=0; i<partition_count; i++)
+        partitions[i].ring = rte_ring_create(16, RING_F_SP_ENQ|RING_F_SC_DEQ);
+
+    /*
+     * Start the threads. Each thread works on its partitions in order, so
+     * that the partition we are outputting is always being worked on.
+     */
+    workers = (struct DiffWorker *)malloc(thread_count * sizeof(workers[0]));
+    if (workers == NULL)
+        return 1;
+    for (i=0; i<thread_count; i++) {
+        workers[i].masscan = masscan;
+        workers[i].partitions = partitions;
+        workers[i].partition_count = partition_count;
+        workers[i].index = i;
+        workers[i].thread_count = thread_count;
+        pixie_begin_thread(diff_thread, 0, &workers[i]);
+    }
+
+    /*
+     * Output the results of each partition in turn
+     */
+    out = output_create(masscan);
+    memset(&counts, 0, sizeof(counts));
+    for (i=0; i<partition_count; i++) {
+        struct DiffPartition *p = &partitions[i];
+
+        for (;;) {
+            struct DiffBatch *batch;
+            unsigned is_done = p->is_done;
+
+            if (rte_ring_sc_dequeue(p->ring, (void**)&batch) == 0) {
+                diff_output(out, batch);
+                free(batch);
+                continue;
+            }
+            if (is_done && rte_ring_empty(p->ring))
+                break;
+            pixie_usleep(100);
+        }
+
+        counts.added += p->counts.added;
+        counts.removed += p->counts.removed;
+        counts.changed += p->counts.changed;
+        counts.unchanged += p->counts.unchanged;
+        is_error |= p->is_error;
+        free(p->ring);
+    }
+    output_destroy(out);
+
+    if (is_error) {
+        fprintf(stderr, "diff: files are corrupt or not sorted\n");
+        fprintf(stderr, " [hint] sort the files first with \"--merge\"\n");
+    }
+
+    LOG(0, "diff: %llu added, %llu removed, %llu changed, %llu unchanged\n",
+        (unsigned long long)counts.added,
+        (unsigned long long)counts.removed,
+        (unsigned long long)counts.changed,
+        (unsigned long long)counts.unchanged);
+    LOG(0, "diff: %u partitions on %u threads in %.2f sec\n",
+        partition_count, thread_count,
+        (pixie_gettime() - start) / 1000000.0);
+
+    free(workers);
+    free(partitions);
+    return is_error ? 1 : 0;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct DiffTest {
+    unsigned count;
+    struct ScanRecord records[16];
+};
+
+static void
+diff_test_emit(void *data, const struct ScanRecord *rec)
+{
+    struct DiffTest *t = (struct DiffTest *)data;
+
+    if (t->count < sizeof(t->records)/sizeof(t->records[0]))
+        t->records[t->count] = *rec;
+    t->count++;
+}
+
+/***************************************************************************
+ * Write a sorted test file, then read it back into memory
+ ***************************************************************************/
+static unsigned char *
+diff_test_file(const struct ScanRecord *records, unsigned count,
+               size_t *r_length)
+{
+    struct Binary2Writer *w;
+    unsigned char *buf = NULL;
+    FILE *fp;
+    long length;
+    unsigned i;
+
+    fp = tmpfile();
+    if (fp == NULL)
+        return NULL;
+    w = binary2_writer_create();
+    binary2_writer_open(w, fp);
+    for (i=0; i<count; i++)
+        binary2_writer_write(w, fp, &records[i]);
+    binary2_writer_close(w, fp);
+    binary2_writer_destroy(w);
+
+    length = ftell(fp);
+    rewind(fp);
+    buf = (unsigned char *)malloc(length);
+    if (buf && fread(buf, 1, length, fp) != (size_t)length) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    *r_length = length;
+    return buf;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+diff_selftest(void)
+{
+    static const unsigned char hello[] = "hello";
+    static const unsigned char howdy[] = "howdy";
+    struct ScanRecord old_records[5];
+    struct ScanRecord new_records[5];
+    struct DiffCounts counts;
+    struct DiffTest t[1];
+    unsigned char *old_buf = NULL;
+    unsigned char *new_buf = NULL;
+    size_t old_length, new_length;
+    struct ScanFile *a = NULL;
+    struct ScanFile *b = NULL;
+    unsigned pass;
+    int result = 1;
+
+    memset(old_records, 0, sizeof(old_records));
+    memset(new_records, 0, sizeof(new_records));
+
+    /* 10.0.0.1:22 banner: changed */
+    old_records[0].kind = SCAN_KIND_BANNER;
+    old_records[0].ip = 0x0a000001;
+    old_records[0].port = 22;
+    old_records[0].banner = hello;
+    old_records[0].banner_length = 5;
+    new_records[0] = old_records[0];
+    new_records[0].banner = howdy;
+
+    /* 10.0.0.1:80 open: removed, output as closed */
+    old_records[1].kind = Port_Open;
+    old_records[1].ip = 0x0a000001;
+    old_records[1].port = 80;
+
+    /* 10.0.0.2:80 open: unchanged */
+    old_records[2].kind = Port_Open;
+    old_records[2].ip = 0x0a000002;
+    old_records[2].port = 80;
+    new_records[1] = old_records[2];
+
+    /* 10.0.0.3:443 open: added */
+    new_records[2].kind = Port_Open;
+    new_records[2].ip = 0x0a000003;
+    new_records[2].port = 443;
+
+    old_buf = diff_test_file(old_records, 3, &old_length);
+    new_buf = diff_test_file(new_records, 3, &new_length);
+    if (old_buf == NULL || new_buf == NULL) {
+        result = 0; /* can't test without temporary files */
+        goto end;
+    }
+
+    /* Do it all as one partition, then split into two partitions, to
+     * test the boundary */
+    for (pass=0; pass<2; pass++) {
+        memset(t, 0, sizeof(t));
+        memset(&counts, 0, sizeof(counts));
+        a = scanfile_open_mem(old_buf, old_length);
+        b = scanfile_open_mem(new_buf, new_length);
+        if (a == NULL || b == NULL)
+            goto end;
+        if (pass == 0) {
+            if (diff_range(a, b, 0, 0x100000000ULL, diff_test_emit, t, &counts) != 0)
+                goto end;
+        } else {
+            if (diff_range(a, b, 0, 0x0a000002, diff_test_emit, t, &counts) != 0)
+                goto end;
+            scanfile_seek(a, 0);
+            scanfile_seek(b, 0);
+            if (diff_range(a, b, 0x0a000002, 0x100000000ULL, diff_test_emit, t, &counts) != 0)
+                goto end;
+        }
+        scanfile_close(a);
+        scanfile_close(b);
+        a = b = NULL;
+
+        if (counts.added != 1 || counts.removed != 1 || counts.changed != 1
+            || counts.unchanged != 1 || t->count != 3)
+            goto end;
+        if (t->records[0].port != 22 || t->records[0].banner_length != 5
+            || memcmp(t->records[0].banner, howdy, 5) != 0)
+            goto end;
+        if (t->records[1].port != 80 || t->records[1].kind != Port_Closed)
+            goto end;
+        if (t->records[2].ip != 0x0a000003 || t->records[2].kind != Port_Open)
+            goto end;
+    }
+
+    /* An unsorted file must be detected. The "masscan/2.0" writer sorts
+     * each block, so this uses the original format */
+    {
+        static const unsigned char unsorted[] = {
+            1, 12,  0,0,0,0,  10,0,0,2,  0,80,  0x12, 64,
+            1, 12,  0,0,0,0,  10,0,0,1,  0,80,  0x12, 64,
+        };
+        free(old_buf);
+        old_length = 2 + 'a' + sizeof(unsorted);
+        old_buf = (unsigned char *)malloc(old_length);
+        if (old_buf == NULL)
+            goto end;
+        memset(old_buf, 0, 2 + 'a');
+        memcpy(old_buf, "masscan/1.1", 11);
+        memcpy(old_buf + 2 + 'a', unsorted, sizeof(unsorted));
+    }
+    memset(&counts, 0, sizeof(counts));
+    a = scanfile_open_mem(old_buf, old_length);
+    if (a == NULL || diff_range(a, NULL, 0, 0x100000000ULL, diff_test_emit, t, &counts) != -1)
+        goto end;
+
+    result = 0;
+end:
+    scanfile_close(a);
+    scanfile_close(b);
+    free(old_buf);
+    free(new_buf);
+    if (result)
+        fprintf(stderr, "diff: selftest failed\n");
+    return result;
+}
@@ -0,0 +1,280 @@
+/*
+    host discovery, then port scanning, for "--discover"
+
+    The receive thread puts live hosts on a ring, the same single-producer,
+    single-consumer ring used for the transmit queue. The transmit thread
+    takes up to DISCOVER_WINDOW_MAX hosts off it at a time, and scans all
+    the ports on that "window" of hosts in a random order, using BlackRock
+    over (hosts * ports), the same as for the main scan. So the memory
+    used doesn't depend on the number of live hosts, and the probes are
+    still spread out over many hosts rather than hitting one host's ports
+    one after another.
+
+    Retries go through the whole window again, once per retry, and only
+    then is the next window taken. Each retry pass waits until
+    "--retry-delay" after the end of the pass before it, so that every
+    host's retry is at least that long after its last probe. While it
+    waits, the transmit thread goes on with the discovery probes.
+
+    A host may answer several discovery probes (a ping, and a SYN-ACK
+    from two ports), so a table remembers the hosts already queued. On
+    a collision, the older host is forgotten, so a host is rarely scanned
+    twice, but never missed.
+*/
+#include "main-discover.h"
+#include "rand-blackrock.h"
+#include "ranges.h"
+#include "rte-ring.h"
+#include "logger.h"
+#include "pixie-timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DISCOVER_QUEUE_SIZE (1024*256)  /* live hosts waiting, power of 2 */
+#define DISCOVER_SEEN_SIZE  (1024*1024) /* hosts already queued */
+#define DISCOVER_WINDOW_MAX 4096        /* hosts scanned together */
+
+struct Discovery {
+    const struct RangeList *discover_ports;
+    const struct RangeList *scan_ports;
+    uint64_t port_count;
+    unsigned retries;
+    uint64_t retry_usecs;
+    uint64_t seed;
+
+    /* Receive thread: stored inverted, so that the empty entries, zero,
+     * match nothing */
+    unsigned *seen;
+    uint64_t overflows;
+    volatile uint64_t last_found;
+
+    /* Between the threads */
+    struct rte_ring *queue;
+
+    /* Transmit thread: the window of hosts being scanned */
+    unsigned *hosts;
+    unsigned host_count;
+    unsigned window_count;
+    struct BlackRock blackrock;
+    uint64_t range;
+    uint64_t index;
+    uint64_t pass_end; /* when the last pass over the window finished */
+    uint64_t idle_since;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct Discovery *
+discover_create(const struct RangeList *discover_ports,
+                const struct RangeList *scan_ports,
+                unsigned retries, uint64_t retry_usecs, uint64_t seed)
+{
+    struct Discovery *d;
+
+    d = (struct Discovery *)malloc(sizeof(*d));
+    if (d == NULL)
+        exit(1);
+    memset(d, 0, sizeof(*d));
+    d->discover_ports = discover_ports;
+    d->scan_ports = scan_ports;
+    d->port_count = rangelist_count(scan_ports);
+    d->retries = retries;
+    d->retry_usecs = retry_usecs;
+    d->seed = seed;
+
+    d->seen = (unsigned *)calloc(DISCOVER_SEEN_SIZE, sizeof(d->seen[0]));
+    d->hosts = (unsigned *)malloc(DISCOVER_WINDOW_MAX * sizeof(d->hosts[0]));
+    d->queue = rte_ring_create(DISCOVER_QUEUE_SIZE, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    if (d->seen == NULL || d->hosts == NULL || d->queue == NULL)
+        exit(1);
+
+    return d;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+discover_destroy(struct Discovery *d)
+{
+    if (d == NULL)
+        return;
+    free(d->seen);
+    free(d->hosts);
+    free(d->queue);
+    free(d);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_found(struct Discovery *d, unsigned ip, unsigned port)
+{
+    unsigned x;
+
+    if (!rangelist_is_contains(d->discover_ports, port))
+        return 0; /* a response from the port scan, not discovery */
+
+    x = ip * 2654435761U;
+    x = (x ^ (x >> 16)) & (DISCOVER_SEEN_SIZE - 1);
+    if (d->seen[x] == ~ip)
+        return 0;
+
+    if (rte_ring_sp_enqueue(d->queue, (void*)(size_t)ip) != 0) {
+        d->overflows++;
+        return 0;
+    }
+    d->seen[x] = ~ip;
+    d->last_found = pixie_gettime();
+    LOGip(2, ip, port & 0xFFFF, "discovered live host\n");
+    return 1;
+}
+
+/***************************************************************************
+ * Take the next window of hosts off the queue
+ ***************************************************************************/
+static int
+discover_refill(struct Discovery *d)
+{
+    unsigned n = 0;
+
+    while (n < DISCOVER_WINDOW_MAX) {
+        void *p;
+
+        if (rte_ring_sc_dequeue(d->queue, &p) != 0)
+            break;
+        d->hosts[n++] = (unsigned)(size_t)p;
+    }
+    if (n == 0 || d->port_count == 0)
+        return 0;
+
+    d->host_count = n;
+    d->range = n * d->port_count;
+    d->index = 0;
+    blackrock_init(&d->blackrock, d->range, d->seed + d->window_count++);
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_next(struct Discovery *d, unsigned *ip, unsigned *port,
+              uint64_t now)
+{
+    uint64_t x;
+
+    if (d->index >= d->range * (d->retries + 1) && !discover_refill(d))
+        return 0;
+
+    /* A retry pass waits for --retry-delay after the last one */
+    if (d->index && d->index % d->range == 0
+        && now < d->pass_end + d->retry_usecs)
+        return 0;
+
+    x = blackrock_shuffle(&d->blackrock, d->index % d->range);
+    *ip = d->hosts[x % d->host_count];
+    *port = rangelist_pick(d->scan_ports, x / d->host_count);
+    d->index++;
+    if (d->index % d->range == 0)
+        d->pass_end = now;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_is_done(struct Discovery *d, unsigned wait, uint64_t now)
+{
+    uint64_t last;
+
+    if (d->index < d->range * (d->retries + 1) || rte_ring_count(d->queue)) {
+        d->idle_since = 0;
+        return 0;
+    }
+    if (d->idle_since == 0)
+        d->idle_since = now;
+
+    last = d->last_found;
+    if (last < d->idle_since)
+        last = d->idle_since;
+    return now >= last && now - last >= wait * 1000000ULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+discover_overflows(const struct Discovery *d)
+{
+    return d->overflows;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_selftest(void)
+{
+    struct RangeList discover_ports;
+    struct RangeList scan_ports;
+    struct Discovery *d;
+    unsigned char counts[4][8];
+    uint64_t now;
+    unsigned ip, port;
+    unsigned found = 0;
+    unsigned i;
+
+    memset(&discover_ports, 0, sizeof(discover_ports));
+    memset(&scan_ports, 0, sizeof(scan_ports));
+    rangelist_add_range(&discover_ports, 80, 80);
+    rangelist_add_range(&discover_ports, 65536*3, 65536*3);
+    rangelist_add_range(&scan_ports, 20, 27);
+
+    now = pixie_gettime();
+    d = discover_create(&discover_ports, &scan_ports, 1, 1000000, 1234);
+    if (discover_next(d, &ip, &port, now))
+        goto fail;
+
+    /* Only responses to discovery probes count, and only once each */
+    found += discover_found(d, 0x0A000001, 80);
+    found += discover_found(d, 0x0A000001, 65536*3);
+    found += discover_found(d, 0x0A000002, 22);
+    found += discover_found(d, 0x0A000003, 65536*3);
+    if (found != 2)
+        goto fail;
+
+    /* Every port on both hosts, twice (1 retry), in two passes, with
+     * the retry delay between them */
+    memset(counts, 0, sizeof(counts));
+    for (i=0; i<32; i++) {
+        if (i == 16) {
+            if (discover_next(d, &ip, &port, now + 999999))
+                goto fail;
+            now += 1000000;
+        }
+        if (!discover_next(d, &ip, &port, now))
+            goto fail;
+        if ((ip != 0x0A000001 && ip != 0x0A000003) || port < 20 || port > 27)
+            goto fail;
+        counts[ip & 3][port - 20]++;
+    }
+    for (i=0; i<8; i++) {
+        if (counts[1][i] != 2 || counts[3][i] != 2)
+            goto fail;
+    }
+    if (discover_next(d, &ip, &port, now))
+        goto fail;
+
+    /* Done only once nothing new has turned up for a while */
+    now = pixie_gettime();
+    if (discover_is_done(d, 10, now))
+        goto fail;
+    if (!discover_is_done(d, 10, now + 10000000ULL))
+        goto fail;
+
+    discover_destroy(d);
+    rangelist_free(&discover_ports);
+    rangelist_free(&scan_ports);
+    return 0;
+fail:
+    fprintf(stderr, "discover: selftest failed\n");
+    return 1;
+}
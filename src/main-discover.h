@@ -0,0 +1,69 @@
+/*
+    host discovery, then port scanning, for "--discover"
+
+    Instead of sending every port to every address, the transmit thread
+    first sends a few discovery probes to each address (by default, a
+    ping and a SYN to ports 80 and 443, see "--discover-ports"). Every
+    host that answers one of those is handed to the transmit thread,
+    which then scans all the "--ports" on it, ahead of the remaining
+    discovery probes. See main-discover.c.
+*/
+#ifndef MAIN_DISCOVER_H
+#define MAIN_DISCOVER_H
+#include <stdint.h>
+struct RangeList;
+struct Discovery;
+
+/**
+ * @param discover_ports
+ *      the probes that find live hosts, in the same form as the ports
+ *      in the transmit thread, such as 65536*3 for a ping
+ * @param scan_ports
+ *      the ports to scan on each live host
+ * @param retry_usecs
+ *      "--retry-delay", the least time between the end of one pass over
+ *      a window of hosts and the retry pass that follows it
+ */
+struct Discovery *
+discover_create(const struct RangeList *discover_ports,
+                const struct RangeList *scan_ports,
+                unsigned retries, uint64_t retry_usecs, uint64_t seed);
+
+void discover_destroy(struct Discovery *d);
+
+/**
+ * Called by the receive thread for each response that has our cookie,
+ * with the 'port' in the same form. Hosts that answer one of the
+ * discovery probes are queued for the transmit thread, once each.
+ * @return
+ *      1 if this is a new live host
+ */
+int discover_found(struct Discovery *d, unsigned ip, unsigned port);
+
+/**
+ * Called by the transmit thread to get the next port on a live host
+ * @param now
+ *      the time, from pixie_gettime()
+ * @return
+ *      1 if there is one, 0 if we are waiting for more hosts, or for
+ *      the retry delay to pass
+ */
+int
+discover_next(struct Discovery *d, unsigned *ip, unsigned *port,
+              uint64_t now);
+
+/**
+ * Called by the transmit thread once it has sent all the discovery
+ * probes. We are done once every live host has been scanned, and no
+ * new ones have turned up for 'wait' seconds.
+ */
+int discover_is_done(struct Discovery *d, unsigned wait, uint64_t now);
+
+/**
+ * How many live hosts weren't scanned, because the queue was full
+ */
+uint64_t discover_overflows(const struct Discovery *d);
+
+int discover_selftest(void);
+
+#endif
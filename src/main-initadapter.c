@@ -24,6 +24,7 @@ masscan_initialize_adapter(
 {
     char *ifname;
     char ifname2[256];
+    struct SimConfig sim;
 
     LOG(1, "initializing adapter\n");
 
@@ -59,6 +60,12 @@ masscan_initialize_adapter(
      * adapter doesn't have one, then the user must configure one.
      */
     *r_adapter_ip = masscan->nic[index].adapter_ip;
+    if (*r_adapter_ip == 0 && simnet_is_name(ifname)) {
+        /* The simulated Internet has no addresses of its own, so make one
+         * up from the documentation range (RFC 5737) */
+        *r_adapter_ip = 0xC0000201; /* 192.0.2.1 */
+        LOG(2, "sim: adapter-ip=192.0.2.1\n");
+    }
     if (*r_adapter_ip == 0) {
         *r_adapter_ip = rawsock_get_adapter_ip(ifname);
         LOG(2, "auto-detected: adapter-ip=%u.%u.%u.%u\n",
@@ -83,6 +90,8 @@ masscan_initialize_adapter(
      * try to use the hardware address in the network card.
      */
     memcpy(adapter_mac, masscan->nic[index].adapter_mac, 6);
+    if (memcmp(adapter_mac, "\0\0\0\0\0\0", 6) == 0 && simnet_is_name(ifname))
+        memcpy(adapter_mac, "\x02\x00\x00\x00\x00\x01", 6);
     if (memcmp(adapter_mac, "\0\0\0\0\0\0", 6) == 0) {
         rawsock_get_adapter_mac(ifname, adapter_mac);
         LOG(2, "auto-detected: adapter-mac=%02x-%02x-%02x-%02x-%02x-%02x\n",
@@ -106,12 +115,15 @@ masscan_initialize_adapter(
      * Once we've figured out which adapter to use, we now need to
      * turn it on.
      */
+    sim = masscan->sim;
+    sim.seed = masscan->seed;
     masscan->nic[index].adapter = rawsock_init_adapter(   
                                             ifname, 
                                             masscan->is_pfring, 
                                             masscan->is_sendq,
                                             masscan->nmap.packet_trace,
-                                            masscan->is_offline);
+                                            masscan->is_offline,
+                                            &sim);
     if (masscan->nic[index].adapter == 0) {
         fprintf(stderr, "adapter[%s].init: failed\n", ifname);
         return -1;
@@ -132,7 +144,7 @@ masscan_initialize_adapter(
      * code above.
      */
     memcpy(router_mac, masscan->nic[index].router_mac, 6);
-    if (masscan->is_offline) {
+    if (masscan->is_offline || simnet_is_name(ifname)) {
         memcpy(router_mac, "\x66\x55\x44\x33\x22\x11", 6);
     } else if (memcmp(router_mac, "\0\0\0\0\0\0", 6) == 0) {
         unsigned router_ipv4;
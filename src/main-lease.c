@@ -0,0 +1,505 @@
+/*
+    the protocol between "--coordinator" and "--worker"
+
+    See main-lease.h for the messages. The coordinator is in
+    main-coordinator.c, and the worker in main-worker.c.
+*/
+#include "main-lease.h"
+#include "masscan.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include "string_s.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(WIN32)
+#include <sys/time.h>
+#endif
+
+/* A worker shouldn't be killed by SIGPIPE when the coordinator goes away,
+ * it should finish the chunks it has. On the Mac, it's SO_NOSIGPIPE. */
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+void
+lease_put32(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x >> 24);
+    px[1] = (unsigned char)(x >> 16);
+    px[2] = (unsigned char)(x >>  8);
+    px[3] = (unsigned char)(x >>  0);
+}
+void
+lease_put64(unsigned char *px, uint64_t x)
+{
+    lease_put32(px + 0, (unsigned)(x >> 32));
+    lease_put32(px + 4, (unsigned)(x >>  0));
+}
+unsigned
+lease_get32(const unsigned char *px)
+{
+    return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3]<<0;
+}
+uint64_t
+lease_get64(const unsigned char *px)
+{
+    return (uint64_t)lease_get32(px) << 32 | lease_get32(px + 4);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_format(unsigned char *buf, size_t sizeof_buf, size_t *length,
+             unsigned type, const unsigned char *payload, unsigned payload_length)
+{
+    if (payload_length > LEASE_PAYLOAD_MAX
+        || *length + LEASE_HEADER + payload_length > sizeof_buf)
+        return -1;
+
+    buf[*length + 0] = (unsigned char)type;
+    buf[*length + 1] = (unsigned char)(payload_length >> 8);
+    buf[*length + 2] = (unsigned char)(payload_length >> 0);
+    if (payload_length)
+        memcpy(buf + *length + LEASE_HEADER, payload, payload_length);
+    *length += LEASE_HEADER + payload_length;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_send_all(SOCKET fd, const unsigned char *buf, size_t length)
+{
+    while (length) {
+        int n = send(fd, (const char *)buf, (int)length, MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_send(SOCKET fd, unsigned type, const unsigned char *payload,
+           unsigned payload_length)
+{
+    unsigned char buf[LEASE_HEADER + LEASE_PAYLOAD_MAX];
+    size_t length = 0;
+
+    if (lease_format(buf, sizeof(buf), &length, type, payload, payload_length) != 0)
+        return -1;
+    return lease_send_all(fd, buf, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_recv(SOCKET fd, struct LeaseBuffer *in)
+{
+    int n;
+
+    if (in->length == sizeof(in->buf))
+        return -1; /* can't happen, since messages are less than half */
+
+    n = recv(fd, (char *)in->buf + in->length,
+             (int)(sizeof(in->buf) - in->length), 0);
+    if (n <= 0)
+        return -1;
+    in->length += n;
+    return n;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_wait(SOCKET fd, unsigned msecs)
+{
+    struct timeval tv;
+    fd_set readset;
+    int x;
+
+    FD_ZERO(&readset);
+    FD_SET(fd, &readset);
+    tv.tv_sec = msecs / 1000;
+    tv.tv_usec = (msecs % 1000) * 1000;
+    x = select((int)fd+1, &readset, 0, 0, &tv);
+    if (x < 0 && errno == EINTR)
+        return 0;
+    return x;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_next(struct LeaseBuffer *in, unsigned *type,
+           unsigned char *payload, unsigned *payload_length)
+{
+    unsigned length;
+
+    if (in->length < LEASE_HEADER)
+        return 0;
+    length = in->buf[1]<<8 | in->buf[2];
+    if (length > LEASE_PAYLOAD_MAX) {
+        /* garbage, so throw it all away, and let the caller time out */
+        in->length = 0;
+        return 0;
+    }
+    if (in->length < LEASE_HEADER + length)
+        return 0;
+
+    *type = in->buf[0];
+    memcpy(payload, in->buf + LEASE_HEADER, length);
+    *payload_length = length;
+    memmove(in->buf, in->buf + LEASE_HEADER + length,
+            in->length - LEASE_HEADER - length);
+    in->length -= LEASE_HEADER + length;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_parse_address(const char *addr, unsigned *r_ip, unsigned *r_port)
+{
+    const char *colon = strrchr(addr, ':');
+    unsigned ip = 0x7F000001;
+    unsigned port = 0;
+
+    if (colon) {
+        unsigned i;
+
+        ip = 0;
+        for (i=0; i<4; i++) {
+            unsigned octet = 0;
+
+            if (!isdigit(*addr&0xFF))
+                return -1;
+            while (isdigit(*addr&0xFF)) {
+                octet = octet*10 + (*addr++ - '0');
+                if (octet > 255)
+                    return -1;
+            }
+            if (*addr != (i<3 ? '.' : ':'))
+                return -1;
+            addr++;
+            ip = ip<<8 | octet;
+        }
+    }
+
+    if (!isdigit(addr[0]&0xFF))
+        return -1;
+    while (isdigit(addr[0]&0xFF)) {
+        port = port*10 + (*addr++ - '0');
+        if (port > 65535)
+            return -1;
+    }
+    if (addr[0] != '\0' || port == 0)
+        return -1;
+
+    *r_ip = ip;
+    *r_port = port;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+SOCKET
+lease_connect(const struct Masscan *masscan, unsigned kind)
+{
+    struct sockaddr_in sin;
+    struct LeaseBuffer in;
+    unsigned char payload[LEASE_PAYLOAD_MAX];
+    unsigned char hello[17];
+    uint64_t fingerprint;
+    unsigned type;
+    unsigned length;
+    SOCKET fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == INVALID_SOCKET)
+        goto fail;
+#if defined(SO_NOSIGPIPE)
+    {
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+    }
+#endif
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(masscan->lease.ip);
+    sin.sin_port = htons((unsigned short)masscan->lease.port);
+    if (connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) {
+        closesocket(fd);
+        goto fail;
+    }
+
+    /* The coordinator starts with a nonce, which we prove we know the
+     * key with, so that a hello that's been seen can't be used again */
+    memset(&in, 0, sizeof(in));
+    while (!lease_next(&in, &type, payload, &length)) {
+        if (lease_wait(fd, 10000) <= 0 || lease_recv(fd, &in) < 0) {
+            LOG(0, "worker: no challenge from the coordinator\n");
+            closesocket(fd);
+            return INVALID_SOCKET;
+        }
+    }
+    if (type != Lease_Challenge || length < 8) {
+        LOG(0, "worker: unexpected message from the coordinator\n");
+        closesocket(fd);
+        return INVALID_SOCKET;
+    }
+
+    fingerprint = lease_fingerprint(masscan);
+    lease_put64(hello, fingerprint);
+    hello[8] = (unsigned char)kind;
+    lease_put64(hello + 9, lease_mac(masscan->lease.key,
+                                     lease_get64(payload), fingerprint, kind));
+    if (lease_send(fd, Lease_Hello, hello, sizeof(hello)) != 0) {
+        closesocket(fd);
+        goto fail;
+    }
+    return fd;
+
+fail:
+    LOG(0, "worker: %u.%u.%u.%u:%u: %s\n",
+        (masscan->lease.ip>>24)&0xFF, (masscan->lease.ip>>16)&0xFF,
+        (masscan->lease.ip>> 8)&0xFF, (masscan->lease.ip>> 0)&0xFF,
+        masscan->lease.port, strerror_x(errno));
+    return INVALID_SOCKET;
+}
+
+/***************************************************************************
+ * FNV-1a over everything that decides which target is at which index
+ ***************************************************************************/
+static uint64_t
+fnv(uint64_t hash, uint64_t x)
+{
+    unsigned i;
+
+    for (i=0; i<8; i++) {
+        hash ^= (x >> (i*8)) & 0xFF;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+uint64_t
+lease_fingerprint(const struct Masscan *masscan)
+{
+    const struct RangeList *lists[3];
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    unsigned i;
+    unsigned j;
+
+    lists[0] = &masscan->targets;
+    lists[1] = &masscan->ports;
+    lists[2] = &masscan->discover_ports;
+    for (i=0; i<3; i++) {
+        hash = fnv(hash, lists[i]->count);
+        for (j=0; j<lists[i]->count; j++) {
+            hash = fnv(hash, lists[i]->list[j].begin);
+            hash = fnv(hash, lists[i]->list[j].end);
+        }
+    }
+    hash = fnv(hash, masscan->seed);
+    hash = fnv(hash, masscan->retries);
+    hash = fnv(hash, masscan->shard.one);
+    hash = fnv(hash, masscan->shard.of);
+    hash = fnv(hash, masscan->is_discover);
+    return hash;
+}
+
+/***************************************************************************
+ * SipHash-2-4, as in the paper by Aumasson and Bernstein
+ ***************************************************************************/
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIPROUND                                                    \
+    do {                                                            \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                    \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                    \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while (0)
+
+uint64_t
+lease_siphash(uint64_t k0, uint64_t k1, const unsigned char *px, size_t length)
+{
+    uint64_t v0 = k0 ^ 0x736F6D6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646F72616E646F6DULL;
+    uint64_t v2 = k0 ^ 0x6C7967656E657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t m;
+    size_t i;
+    unsigned j;
+
+    /* The message in little-endian words, the last one padded with zeroes
+     * and the length in its top byte */
+    for (i=0; i<=length; i+=8) {
+        m = 0;
+        for (j=0; j<8 && i+j<length; j++)
+            m |= (uint64_t)px[i+j] << (j*8);
+        if (i+8 > length)
+            m |= (uint64_t)(length & 0xFF) << 56;
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+        if (i+8 > length)
+            break;
+    }
+
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+lease_mac(const char *key, uint64_t nonce, uint64_t fingerprint, unsigned kind)
+{
+    unsigned char x[17];
+    size_t key_length = strlen(key);
+    uint64_t k0;
+    uint64_t k1;
+
+    /* The key can be any length, so it's hashed down to the 128 bits that
+     * SipHash takes */
+    k0 = lease_siphash(0, 0, (const unsigned char *)key, key_length);
+    k1 = lease_siphash(0, 1, (const unsigned char *)key, key_length);
+
+    lease_put64(x + 0, nonce);
+    lease_put64(x + 8, fingerprint);
+    x[16] = (unsigned char)kind;
+    return lease_siphash(k0, k1, x, sizeof(x));
+}
+
+/***************************************************************************
+ * Nonces only need to be unpredictable and never repeat, so they're a
+ * counter hashed with a random key picked the first time
+ ***************************************************************************/
+uint64_t
+lease_nonce(void)
+{
+    static uint64_t k0;
+    static uint64_t k1;
+    static uint64_t counter;
+    unsigned char x[8];
+
+    if (counter == 0) {
+        FILE *fp;
+
+        k0 = pixie_nanotime();
+        k1 = (uint64_t)time(0);
+        if (fopen_s(&fp, "/dev/urandom", "rb") == 0 && fp) {
+            uint64_t r[2] = {0, 0};
+
+            if (fread(r, 1, sizeof(r), fp) == sizeof(r)) {
+                k0 ^= r[0];
+                k1 ^= r[1];
+            }
+            fclose(fp);
+        }
+    }
+    lease_put64(x, ++counter);
+    return lease_siphash(k0, k1, x, sizeof(x));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+lease_selftest(void)
+{
+    struct LeaseBuffer in;
+    unsigned char out[64];
+    unsigned char payload[LEASE_PAYLOAD_MAX];
+    unsigned char chunk[4];
+    size_t length = 0;
+    unsigned type;
+    unsigned payload_length;
+    unsigned ip;
+    unsigned port;
+
+    /* Two messages, arriving a byte at a time */
+    lease_put32(chunk, 0x12345678);
+    if (lease_format(out, sizeof(out), &length, Lease_Chunk, chunk, 4) != 0
+        || lease_format(out, sizeof(out), &length, Lease_Finished, 0, 0) != 0
+        || length != 10)
+        goto fail;
+    memset(&in, 0, sizeof(in));
+    in.buf[in.length++] = out[0];
+    if (lease_next(&in, &type, payload, &payload_length))
+        goto fail;
+    memcpy(in.buf + in.length, out + 1, 6);
+    in.length += 6;
+    if (!lease_next(&in, &type, payload, &payload_length)
+        || type != Lease_Chunk || payload_length != 4
+        || lease_get32(payload) != 0x12345678)
+        goto fail;
+    if (lease_next(&in, &type, payload, &payload_length))
+        goto fail;
+    memcpy(in.buf + in.length, out + 7, 3);
+    in.length += 3;
+    if (!lease_next(&in, &type, payload, &payload_length)
+        || type != Lease_Finished || payload_length != 0 || in.length != 0)
+        goto fail;
+
+    /* Too long to be a message */
+    length = 0;
+    if (lease_format(out, sizeof(out), &length, Lease_Banner, payload, 62) == 0)
+        goto fail;
+
+    /* SipHash, from the paper's test vectors */
+    for (ip=0; ip<15; ip++)
+        payload[ip] = (unsigned char)ip;
+    if (lease_siphash(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                      payload, 15) != 0xA129CA6149BE45E5ULL
+        || lease_siphash(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+                         payload, 0) != 0x726FDB47DD0E0E31ULL)
+        goto fail;
+
+    /* A hello only answers its own nonce, with the right key */
+    if (lease_mac("s3cret", 1, 2, 0) != lease_mac("s3cret", 1, 2, 0)
+        || lease_mac("s3cret", 1, 2, 0) == lease_mac("s3cret", 3, 2, 0)
+        || lease_mac("s3cret", 1, 2, 0) == lease_mac("s3cre", 1, 2, 0)
+        || lease_mac("s3cret", 1, 2, 0) == lease_mac("s3cret", 1, 2, 1)
+        || lease_nonce() == lease_nonce())
+        goto fail;
+
+    /* Addresses */
+    if (lease_parse_address("7000", &ip, &port) != 0
+        || ip != 0x7F000001 || port != 7000)
+        goto fail;
+    if (lease_parse_address("0.0.0.0:7000", &ip, &port) != 0 || ip != 0)
+        goto fail;
+    if (lease_parse_address("10.1.2.3:80", &ip, &port) != 0
+        || ip != 0x0A010203 || port != 80)
+        goto fail;
+    if (lease_parse_address("10.1.2:80", &ip, &port) == 0
+        || lease_parse_address("localhost:80", &ip, &port) == 0
+        || lease_parse_address("1.2.3.4:70000", &ip, &port) == 0
+        || lease_parse_address("1.2.3.4:4294967376", &ip, &port) == 0
+        || lease_parse_address("4294967297.2.3.4:80", &ip, &port) == 0)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "lease: selftest failed\n");
+    return 1;
+}
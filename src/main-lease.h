@@ -0,0 +1,171 @@
+/*
+    the protocol between "--coordinator" and "--worker"
+
+    The coordinator hands out chunks of the scan index to workers over
+    TCP, the same chunks that the transmit threads take from the
+    scheduler (main-scheduler.h), and workers send back what they found.
+    Every message is a type byte, a 2-byte big-endian length, and then
+    that many bytes of payload, with the numbers in the payload also in
+    big-endian order:
+
+    worker -> coordinator
+        Hello       fingerprint(8) kind(1) mac(8)
+                                            the answer to the Challenge, the
+                                            kind is 0 for leases, 1 for
+                                            results
+        Request     count(4)                wants this many more chunks
+        Done        chunk(4)                finished a chunk, and sent its
+                                            results
+        Heartbeat                           still alive, once a second
+        Status      time(4) status(1) ip(4) port(4) reason(1) ttl(1)
+        Banner      time(4) ip(4) ip_proto(1) port(4) proto(2) banner(...)
+
+    coordinator -> worker
+        Challenge   nonce(8)                first on every connection
+        Welcome     chunk_size(8) begin(8) end(8)
+        Reject      reason(...)             the worker's scan isn't ours
+        Chunk       chunk(4)
+        Finished                            every chunk is done
+
+    The mac in the Hello is SipHash, keyed with "--lease-key", of the nonce,
+    the fingerprint, and the kind, so that only a worker that knows the key
+    can answer, and only for that connection. Nothing after that is
+    signed or encrypted.
+*/
+#ifndef MAIN_LEASE_H
+#define MAIN_LEASE_H
+#include <stdint.h>
+#include <stddef.h>
+struct Masscan;
+
+#if defined(WIN32)
+#include <WinSock.h>
+typedef int socklen_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket(fd) close(fd)
+#endif
+
+enum LeaseMessage {
+    Lease_Challenge = 'K',
+    Lease_Hello     = 'H',
+    Lease_Request   = 'L',
+    Lease_Done      = 'D',
+    Lease_Heartbeat = 'B',
+    Lease_Status    = 'S',
+    Lease_Banner    = 'N',
+    Lease_Welcome   = 'W',
+    Lease_Reject    = 'X',
+    Lease_Chunk     = 'C',
+    Lease_Finished  = 'F',
+};
+
+enum {
+    Lease_KindControl = 0,
+    Lease_KindResults = 1,
+};
+
+#define LEASE_PAYLOAD_MAX 4096
+#define LEASE_HEADER 3
+
+/**
+ * Bytes received but not yet parsed into messages
+ */
+struct LeaseBuffer {
+    unsigned char buf[2 * (LEASE_HEADER + LEASE_PAYLOAD_MAX)];
+    unsigned length;
+};
+
+/**
+ * Add a message to the end of a buffer, to be sent later
+ * @return
+ *      0 on success, -1 if the buffer is full
+ */
+int
+lease_format(unsigned char *buf, size_t sizeof_buf, size_t *length,
+             unsigned type, const unsigned char *payload, unsigned payload_length);
+
+/**
+ * Send one message, waiting until it's sent
+ * @return
+ *      0 on success, -1 if the connection failed
+ */
+int
+lease_send(SOCKET fd, unsigned type, const unsigned char *payload,
+           unsigned payload_length);
+
+/**
+ * Send everything in the buffer, waiting until it's sent
+ */
+int lease_send_all(SOCKET fd, const unsigned char *buf, size_t length);
+
+/**
+ * Read whatever bytes are waiting on the socket into the buffer
+ * @return
+ *      the number of bytes, or -1 if the connection was closed, or a
+ *      message was too long
+ */
+int lease_recv(SOCKET fd, struct LeaseBuffer *in);
+
+/**
+ * Wait up to 'msecs' for bytes to arrive on the socket
+ * @return
+ *      1 if there are some, 0 if not, or -1 on error
+ */
+int lease_wait(SOCKET fd, unsigned msecs);
+
+/**
+ * Take the next whole message off the front of the buffer
+ * @return
+ *      1 if there was one, 0 if we need more bytes
+ */
+int
+lease_next(struct LeaseBuffer *in, unsigned *type,
+           unsigned char *payload, unsigned *payload_length);
+
+/**
+ * Parse "1.2.3.4:7000", or just "7000", which is 127.0.0.1:7000, so that
+ * a coordinator only listens on the loopback address unless told to
+ * @return
+ *      0 on success, -1 on a bad address
+ */
+int lease_parse_address(const char *addr, unsigned *r_ip, unsigned *r_port);
+
+/**
+ * Connect to the coordinator, and answer its challenge with a hello
+ */
+SOCKET lease_connect(const struct Masscan *masscan, unsigned kind);
+
+/**
+ * A hash of what we are scanning, so that a worker that was started with
+ * a different scan than the coordinator isn't used
+ */
+uint64_t lease_fingerprint(const struct Masscan *masscan);
+
+/**
+ * The keyed hash of a Hello, proving that the worker knows "--lease-key"
+ */
+uint64_t
+lease_mac(const char *key, uint64_t nonce, uint64_t fingerprint, unsigned kind);
+
+/**
+ * A new nonce for a Challenge, which nobody can guess ahead of time
+ */
+uint64_t lease_nonce(void);
+
+uint64_t
+lease_siphash(uint64_t k0, uint64_t k1, const unsigned char *px, size_t length);
+
+void     lease_put32(unsigned char *px, unsigned x);
+void     lease_put64(unsigned char *px, uint64_t x);
+unsigned lease_get32(const unsigned char *px);
+uint64_t lease_get64(const unsigned char *px);
+
+int lease_selftest(void);
+
+#endif
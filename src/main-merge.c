@@ -0,0 +1,560 @@
+/*
+    --merge <files...>
+
+    Merge many binary scan files (such as from "--shard 1/16" through
+    "--shard 16/16" run on different machines) into a single result,
+    sorted by IP address and port, with duplicates removed:
+
+        masscan --merge shard*.scan --output-format binary2 -oB all.scan
+
+    This is an external sort specialized for our records. In the first
+    phase, worker threads (one per CPU) read the input files, collecting
+    records into a fixed-size buffer. When the buffer fills, it's sorted,
+    duplicates are removed, and it's written as a "run" to a temporary
+    file in the "masscan/2.0" format. Thus, memory is bounded no matter
+    how big the inputs are, and the sorting and compression is spread
+    across all the cores.
+
+    In the second phase, all the runs are merged together through a
+    heap, dropping duplicates that appeared in different runs, and the
+    results written through the normal output system.
+
+    A "duplicate" is the same IP address, port, and type of record, as
+    defined by scanrecord_compare_key(). When duplicates are found, the
+    one with the newest timestamp is kept.
+*/
+#include "masscan.h"
+#include "in-binary.h"
+#include "out-binary2.h"
+#include "output.h"
+#include "logger.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* The size of each run buffer, per thread */
+#define RUN_RECORDS (256*1024)
+#define RUN_BANNERS (16*1024*1024)
+
+struct MergeWorker {
+    const struct Masscan *masscan;
+    unsigned index;
+    unsigned thread_count;
+    volatile unsigned *done_count;
+
+    /* the current run being collected */
+    struct ScanRecord *records;
+    unsigned count;
+    unsigned char *banners;
+    unsigned banner_length;
+    struct Binary2Writer *writer;
+
+    /* the temporary files holding sorted runs */
+    FILE **runs;
+    unsigned run_count;
+
+    uint64_t bytes;
+    uint64_t records_in;
+    unsigned error_count;
+};
+
+/* The merge calls this for each unique record, in sorted order */
+typedef void (*MERGE_EMIT)(void *data, const struct ScanRecord *rec);
+
+
+/***************************************************************************
+ * The full sort order: by key, then newest first, so that the first of
+ * a group of duplicates is the one we keep.
+ ***************************************************************************/
+static int
+record_compare(const void *lhs, const void *rhs)
+{
+    const struct ScanRecord *a = (const struct ScanRecord *)lhs;
+    const struct ScanRecord *b = (const struct ScanRecord *)rhs;
+    int x;
+
+    x = scanrecord_compare_key(a, b);
+    if (x != 0)
+        return x;
+    if (a->timestamp != b->timestamp)
+        return (a->timestamp > b->timestamp) ? -1 : 1;
+    return 0;
+}
+
+/***************************************************************************
+ * Sort the current buffer, and write it without duplicates to a new
+ * temporary file.
+ ***************************************************************************/
+static void
+run_flush(struct MergeWorker *w)
+{
+    FILE *fp;
+    FILE **runs;
+    unsigned i;
+
+    if (w->count == 0)
+        return;
+
+    qsort(w->records, w->count, sizeof(w->records[0]), record_compare);
+
+    fp = tmpfile();
+    if (fp == NULL) {
+        perror("merge: tmpfile");
+        exit(1);
+    }
+    binary2_writer_open(w->writer, fp);
+    for (i=0; i<w->count; i++) {
+        if (i > 0 && scanrecord_compare_key(&w->records[i-1], &w->records[i]) == 0)
+            continue;
+        binary2_writer_write(w->writer, fp, &w->records[i]);
+    }
+    binary2_writer_close(w->writer, fp);
+    fflush(fp);
+
+    runs = (FILE **)realloc(w->runs, (w->run_count + 1) * sizeof(runs[0]));
+    if (runs == NULL) {
+        fprintf(stderr, "merge: out of memory\n");
+        exit(1);
+    }
+    w->runs = runs;
+    w->runs[w->run_count++] = fp;
+
+    w->count = 0;
+    w->banner_length = 0;
+}
+
+/***************************************************************************
+ * Add a record to the current run, copying the banner, because it's only
+ * valid until we read the next record.
+ ***************************************************************************/
+static void
+run_add(struct MergeWorker *w, const struct ScanRecord *rec)
+{
+    struct ScanRecord *r;
+    unsigned length = 0;
+
+    if (rec->kind == SCAN_KIND_BANNER) {
+        length = rec->banner_length;
+        if (length > RUN_BANNERS)
+            length = RUN_BANNERS;
+        if (w->banner_length + length > RUN_BANNERS)
+            run_flush(w);
+    }
+    if (w->count >= RUN_RECORDS)
+        run_flush(w);
+
+    r = &w->records[w->count++];
+    *r = *rec;
+    if (rec->kind == SCAN_KIND_BANNER) {
+        memcpy(w->banners + w->banner_length, rec->banner, length);
+        r->banner = w->banners + w->banner_length;
+        r->banner_length = length;
+        w->banner_length += length;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+worker_init(struct MergeWorker *w)
+{
+    w->records = (struct ScanRecord *)malloc(RUN_RECORDS * sizeof(w->records[0]));
+    w->banners = (unsigned char *)malloc(RUN_BANNERS);
+    w->writer = binary2_writer_create();
+    if (w->records == NULL || w->banners == NULL || w->writer == NULL) {
+        fprintf(stderr, "merge: out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Free the run buffers, but not the run files, which still need to be
+ * merged.
+ ***************************************************************************/
+static void
+worker_cleanup(struct MergeWorker *w)
+{
+    free(w->records);
+    free(w->banners);
+    binary2_writer_destroy(w->writer);
+    w->records = NULL;
+    w->banners = NULL;
+    w->writer = NULL;
+}
+
+/***************************************************************************
+ * PHASE 1: read input files and produce sorted runs
+ ***************************************************************************/
+static void
+merge_thread(void *v)
+{
+    struct MergeWorker *w = (struct MergeWorker *)v;
+    const struct Masscan *masscan = w->masscan;
+    unsigned i;
+
+    for (i=w->index; i<masscan->scanfiles.count; i += w->thread_count) {
+        struct ScanFile *f;
+        struct ScanRecord rec;
+        int x;
+
+        f = scanfile_open(masscan->scanfiles.names[i]);
+        if (f == NULL) {
+            w->error_count++;
+            continue;
+        }
+        w->bytes += scanfile_size(f);
+
+        while ((x = scanfile_next(f, &rec)) > 0) {
+            run_add(w, &rec);
+            w->records_in++;
+        }
+        if (x < 0) {
+            fprintf(stderr, "%s: file corrupt\n", masscan->scanfiles.names[i]);
+            w->error_count++;
+        }
+        scanfile_close(f);
+    }
+    run_flush(w);
+    worker_cleanup(w);
+
+    pixie_locked_add_u32(w->done_count, 1);
+}
+
+
+/***************************************************************************
+ * PHASE 2: k-way merge of the runs
+ ***************************************************************************/
+struct MergeCursor {
+    struct ScanFile *f;
+    struct ScanRecord rec;
+};
+
+/***************************************************************************
+ * Restore the heap property, moving the cursor at 'i' down the heap
+ ***************************************************************************/
+static void
+heap_down(struct MergeCursor **heap, unsigned count, unsigned i)
+{
+    for (;;) {
+        unsigned smallest = i;
+        unsigned left = 2*i + 1;
+        unsigned right = 2*i + 2;
+        struct MergeCursor *tmp;
+
+        if (left < count && record_compare(&heap[left]->rec, &heap[smallest]->rec) < 0)
+            smallest = left;
+        if (right < count && record_compare(&heap[right]->rec, &heap[smallest]->rec) < 0)
+            smallest = right;
+        if (smallest == i)
+            break;
+        tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/***************************************************************************
+ * Merge the sorted runs, calling 'emit' for each unique record.
+ * @return
+ *      the number of unique records, or -1 if a run couldn't be read
+ ***************************************************************************/
+static int64_t
+merge_runs(FILE **runs, unsigned run_count, MERGE_EMIT emit, void *data)
+{
+    struct MergeCursor *cursors;
+    struct MergeCursor **heap;
+    struct ScanRecord last;
+    unsigned count = 0;
+    unsigned i;
+    int64_t total = 0;
+    int is_first = 1;
+
+    cursors = (struct MergeCursor *)malloc((run_count + 1) * sizeof(cursors[0]));
+    heap = (struct MergeCursor **)malloc((run_count + 1) * sizeof(heap[0]));
+    if (cursors == NULL || heap == NULL) {
+        free(cursors);
+        free(heap);
+        return -1;
+    }
+    memset(&last, 0, sizeof(last));
+
+    for (i=0; i<run_count; i++) {
+        struct MergeCursor *c = &cursors[i];
+
+        rewind(runs[i]);
+        c->f = scanfile_open_fp(runs[i]);
+        if (c->f == NULL) {
+            total = -1;
+            continue;
+        }
+        if (scanfile_next(c->f, &c->rec) > 0)
+            heap[count++] = c;
+    }
+    for (i=count/2; i>0; i--)
+        heap_down(heap, count, i-1);
+
+    while (count) {
+        struct MergeCursor *c = heap[0];
+        int x;
+
+        if (is_first || scanrecord_compare_key(&last, &c->rec) != 0) {
+            emit(data, &c->rec);
+            if (total >= 0)
+                total++;
+            last = c->rec;
+            is_first = 0;
+        }
+
+        x = scanfile_next(c->f, &c->rec);
+        if (x <= 0) {
+            if (x < 0)
+                total = -1;
+            heap[0] = heap[--count];
+        }
+        heap_down(heap, count, 0);
+    }
+
+    for (i=0; i<run_count; i++)
+        scanfile_close(cursors[i].f);
+    free(cursors);
+    free(heap);
+    return total;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+merge_output(void *data, const struct ScanRecord *rec)
+{
+    struct Output *out = (struct Output *)data;
+
+    if (rec->kind == SCAN_KIND_BANNER)
+        output_report_banner_at(out, rec->timestamp, rec->ip, rec->ip_proto,
+                                rec->port, rec->proto, rec->banner,
+                                rec->banner_length);
+    else
+        output_report_status_at(out, rec->timestamp, rec->kind, rec->ip,
+                                rec->port, rec->reason, rec->ttl);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+main_merge(struct Masscan *masscan)
+{
+    struct MergeWorker *workers;
+    volatile unsigned done_count = 0;
+    unsigned thread_count;
+    FILE **runs = NULL;
+    unsigned run_count = 0;
+    uint64_t bytes = 0;
+    uint64_t records_in = 0;
+    unsigned error_count = 0;
+    int64_t records_out;
+    struct Output *out;
+    uint64_t start, middle;
+    double elapsed;
+    unsigned i;
+
+    if (masscan->scanfiles.count == 0) {
+        LOG(0, "FAIL: no scan files specified\n");
+        LOG(0, " [hint] try something like \"--merge a.scan b.scan\"\n");
+        return 1;
+    }
+
+    thread_count = pixie_cpu_get_count();
+    if (thread_count > masscan->scanfiles.count)
+        thread_count = masscan->scanfiles.count;
+    if (thread_count == 0)
+        thread_count = 1;
+
+    start = pixie_gettime();
+
+    /*
+     * Phase 1: sort the inputs into runs, in parallel
+     */
+    workers = (struct MergeWorker *)malloc(thread_count * sizeof(workers[0]));
+    if (workers == NULL)
+        return 1;
+    memset(workers, 0, thread_count * sizeof(workers[0]));
+    for (i=0; i<thread_count; i++) {
+        struct MergeWorker *w = &workers[i];
+        w->masscan = masscan;
+        w->index = i;
+        w->thread_count = thread_count;
+        w->done_count = &done_count;
+        if (worker_init(w) != 0)
+            exit(1);
+        pixie_begin_thread(merge_thread, 0, w);
+    }
+    while (done_count < thread_count)
+        pixie_usleep(1000);
+
+    for (i=0; i<thread_count; i++) {
+        struct MergeWorker *w = &workers[i];
+        FILE **tmp;
+
+        bytes += w->bytes;
+        records_in += w->records_in;
+        error_count += w->error_count;
+
+        tmp = (FILE **)realloc(runs, (run_count + w->run_count + 1) * sizeof(runs[0]));
+        if (tmp == NULL) {
+            fprintf(stderr, "merge: out of memory\n");
+            exit(1);
+        }
+        runs = tmp;
+        if (w->run_count)
+            memcpy(runs + run_count, w->runs, w->run_count * sizeof(runs[0]));
+        run_count += w->run_count;
+        free(w->runs);
+    }
+    free(workers);
+    middle = pixie_gettime();
+
+    /*
+     * Phase 2: merge the runs into the output
+     */
+    out = output_create(masscan);
+    records_out = merge_runs(runs, run_count, merge_output, out);
+    output_destroy(out);
+
+    for (i=0; i<run_count; i++)
+        fclose(runs[i]);
+    free(runs);
+
+    if (records_out < 0) {
+        fprintf(stderr, "merge: error reading temporary files\n");
+        return 1;
+    }
+
+    elapsed = (pixie_gettime() - start) / 1000000.0;
+    if (elapsed <= 0)
+        elapsed = 0.000001;
+    LOG(0, "merge: %llu records from %u files, %llu unique, %llu duplicates\n",
+        (unsigned long long)records_in, masscan->scanfiles.count,
+        (unsigned long long)records_out,
+        (unsigned long long)(records_in - records_out));
+    LOG(0, "merge: %u runs on %u threads in %.2f sec, merged in %.2f sec, %.1f MB/s\n",
+        run_count, thread_count,
+        (middle - start) / 1000000.0,
+        (pixie_gettime() - middle) / 1000000.0,
+        bytes / elapsed / 1000000.0);
+
+    return error_count ? 1 : 0;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct MergeTest {
+    unsigned count;
+    struct ScanRecord records[16];
+};
+
+static void
+merge_test_emit(void *data, const struct ScanRecord *rec)
+{
+    struct MergeTest *t = (struct MergeTest *)data;
+
+    if (t->count < sizeof(t->records)/sizeof(t->records[0]))
+        t->records[t->count] = *rec;
+    t->count++;
+}
+
+/***************************************************************************
+ * Sort two small runs, with duplicates both within and across runs, then
+ * merge them and make sure only the newest of each is left.
+ ***************************************************************************/
+int
+merge_selftest(void)
+{
+    static const struct {
+        unsigned run;
+        unsigned kind;
+        unsigned timestamp;
+        unsigned ip;
+        unsigned port;
+        unsigned proto;
+    } tests[] = {
+        {0, Port_Open,          100, 0x0a000002, 80,  0},
+        {0, Port_Closed,        200, 0x0a000002, 80,  0},   /* newer */
+        {0, Port_UdpOpen,       100, 0x0a000002, 80,  0},   /* not a dup */
+        {0, SCAN_KIND_BANNER,   100, 0x0a000001, 22,  2},
+        {1, SCAN_KIND_BANNER,   300, 0x0a000001, 22,  2},   /* newer */
+        {1, SCAN_KIND_BANNER,   100, 0x0a000001, 22,  3},   /* not a dup */
+        {1, Port_Open,          150, 0x0a000002, 80,  0},
+        {1, Port_Open,          100, 0x0a000001, 443, 0},
+        {0, 0, 0, 0, 0, 0}
+    };
+    static const unsigned expected[][3] = {
+        /* ip, port, timestamp, in sorted order */
+        {0x0a000001, 22,  300},
+        {0x0a000001, 22,  100},
+        {0x0a000001, 443, 100},
+        {0x0a000002, 80,  200},
+        {0x0a000002, 80,  100},
+    };
+    struct MergeWorker w[2];
+    struct MergeTest t[1];
+    FILE *runs[2];
+    unsigned run_count = 0;
+    unsigned i;
+    int64_t x;
+    int result = 0;
+
+    memset(w, 0, sizeof(w));
+    memset(t, 0, sizeof(t));
+    for (i=0; i<2; i++) {
+        if (worker_init(&w[i]) != 0)
+            return 1;
+    }
+
+    for (i=0; tests[i].timestamp; i++) {
+        struct ScanRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = tests[i].kind;
+        rec.timestamp = tests[i].timestamp;
+        rec.ip = tests[i].ip;
+        rec.port = tests[i].port;
+        rec.proto = tests[i].proto;
+        if (rec.kind == SCAN_KIND_BANNER) {
+            rec.banner = (const unsigned char *)"hello";
+            rec.banner_length = 5;
+        }
+        run_add(&w[tests[i].run], &rec);
+    }
+    for (i=0; i<2; i++) {
+        run_flush(&w[i]);
+        if (w[i].run_count == 1)
+            runs[run_count++] = w[i].runs[0];
+        worker_cleanup(&w[i]);
+        free(w[i].runs);
+    }
+    if (run_count != 2) {
+        fprintf(stderr, "merge: selftest: can't create temporary files\n");
+        for (i=0; i<run_count; i++)
+            fclose(runs[i]);
+        return 0;
+    }
+
+    x = merge_runs(runs, run_count, merge_test_emit, t);
+    if (x != sizeof(expected)/sizeof(expected[0]) || t->count != x)
+        result = 1;
+    for (i=0; result == 0 && i<t->count; i++) {
+        if (t->records[i].ip != expected[i][0]
+            || t->records[i].port != expected[i][1]
+            || t->records[i].timestamp != expected[i][2])
+            result = 1;
+    }
+
+    for (i=0; i<run_count; i++)
+        fclose(runs[i]);
+
+    if (result)
+        fprintf(stderr, "merge: selftest failed\n");
+    return result;
+}
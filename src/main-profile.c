@@ -0,0 +1,258 @@
+/*
+    profiling the transmit and receive loops, for "--profile"
+
+    The timing itself is inline in the header. This file adds up the
+    profiles from all the threads, and prints the report at the end of
+    the scan, like:
+
+        profile: 2.90 GHz counter, 4.50 seconds
+        stage      calls       cycles/call cycles/pkt  share  p50    p99
+        throttle   ...
+
+    "cycles/call" is the average for each time the stage ran, whereas
+    "cycles/pkt" spreads the cost of the stage over every probe sent (for
+    transmit stages) or every frame received (for receive stages), so
+    that the transmit stages add up to what it costs to send one probe.
+    The percentiles come from log2 histograms, so they are only accurate
+    to the next power of two.
+*/
+#include "main-profile.h"
+#include "main-stats.h"
+#include "string_s.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(WIN32)
+#include <malloc.h>
+#endif
+
+static const char *stage_names[PROFILE_STAGE_COUNT] = {
+    "throttle",
+    "shuffle",
+    "pick",
+    "template",
+    "send",
+    "flush",
+    "receive",
+    "timeouts",
+    "parse",
+    "protocol",
+    "report",
+};
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+profile_stage_name(unsigned stage)
+{
+    if (stage >= PROFILE_STAGE_COUNT)
+        return "unknown";
+    return stage_names[stage];
+}
+
+/***************************************************************************
+ * The counters are cache aligned so that the transmit and receive threads
+ * don't share lines, which plain malloc() doesn't guarantee.
+ ***************************************************************************/
+struct Profile *
+profile_create(void)
+{
+    struct Profile *prof;
+
+#if defined(WIN32)
+    prof = (struct Profile *)_aligned_malloc(sizeof(*prof), 64);
+#else
+    if (posix_memalign((void **)&prof, 64, sizeof(*prof)) != 0)
+        prof = NULL;
+#endif
+    if (prof == NULL) {
+        fprintf(stderr, "profile: out of memory\n");
+        exit(1);
+    }
+    memset(prof, 0, sizeof(*prof));
+    return prof;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profile_destroy(struct Profile *prof)
+{
+#if defined(WIN32)
+    _aligned_free(prof);
+#else
+    free(prof);
+#endif
+}
+
+/***************************************************************************
+ * The threads are still writing while we read, so this may be a lap or
+ * two behind, which doesn't matter for averages.
+ ***************************************************************************/
+void
+profile_add(struct Profile *total, const struct Profile *prof)
+{
+    unsigned i, j;
+
+    if (prof == NULL)
+        return;
+    for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+        total->stage[i].calls += prof->stage[i].calls;
+        total->stage[i].cycles += prof->stage[i].cycles;
+        for (j=0; j<PROFILE_BUCKETS; j++)
+            total->stage[i].histogram[j] += prof->stage[i].histogram[j];
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profile_sample(const struct Profile *total, struct StatsSample *sample)
+{
+    unsigned i;
+
+    sample->has_profile = 1;
+    for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+        sample->profile_calls[i] = total->stage[i].calls;
+        sample->profile_cycles[i] = total->stage[i].cycles;
+    }
+}
+
+/***************************************************************************
+ * Find the histogram bucket the percentile falls in, returning the top
+ * of that bucket
+ ***************************************************************************/
+static uint64_t
+profile_percentile(const struct Profile *total, unsigned stage,
+                   unsigned percent)
+{
+    uint64_t target;
+    uint64_t sum = 0;
+    unsigned i;
+
+    if (total->stage[stage].calls == 0)
+        return 0;
+    target = (total->stage[stage].calls * percent + 99) / 100;
+    for (i=0; i<PROFILE_BUCKETS; i++) {
+        sum += total->stage[stage].histogram[i];
+        if (sum >= target)
+            break;
+    }
+    if (i >= PROFILE_BUCKETS - 1)
+        i = PROFILE_BUCKETS - 2;
+    return 2ULL << i;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profile_report(FILE *fp, const struct Profile *total,
+               uint64_t probes, uint64_t frames,
+               uint64_t elapsed_cycles, uint64_t elapsed_usecs)
+{
+    uint64_t group_cycles[2] = {0, 0};
+    unsigned i;
+
+    for (i=0; i<PROFILE_STAGE_COUNT; i++)
+        group_cycles[i >= PROFILE_FIRST_RECEIVE] += total->stage[i].cycles;
+
+    fprintf(fp, "profile: %.2f GHz counter, %.2f seconds\n",
+        elapsed_usecs ? elapsed_cycles / (elapsed_usecs * 1000.0) : 0.0,
+        elapsed_usecs / 1000000.0);
+    fprintf(fp, "%-10s %12s %11s %10s %6s %7s %7s\n",
+        "stage", "calls", "cycles/call", "cycles/pkt", "share", "p50", "p99");
+
+    for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+        unsigned is_receive = (i >= PROFILE_FIRST_RECEIVE);
+        uint64_t calls = total->stage[i].calls;
+        uint64_t cycles = total->stage[i].cycles;
+        uint64_t packets = is_receive ? frames : probes;
+        uint64_t group = group_cycles[is_receive];
+
+        /* Skip stages that never ran, like the transmit stages when
+         * doing "--replay" */
+        if (calls == 0)
+            continue;
+        if (i == PROFILE_FIRST_RECEIVE && group_cycles[0])
+            fprintf(fp, "\n");
+        fprintf(fp, "%-10s %12llu %11.1f %10.1f %5.1f%% %7llu %7llu\n",
+            stage_names[i],
+            (unsigned long long)calls,
+            calls ? (double)cycles / calls : 0.0,
+            packets ? (double)cycles / packets : 0.0,
+            group ? 100.0 * cycles / group : 0.0,
+            (unsigned long long)profile_percentile(total, i, 50),
+            (unsigned long long)profile_percentile(total, i, 99));
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+profile_selftest(void)
+{
+    struct Profile *prof;
+    struct Profile *total;
+    struct StatsSample sample;
+    unsigned i;
+
+    if (sizeof(*prof) % 64 != 0)
+        goto fail;
+
+    /* Buckets are floor(log2) */
+    if (profile_bucket(0) != 0 || profile_bucket(1) != 0
+        || profile_bucket(2) != 1 || profile_bucket(3) != 1
+        || profile_bucket(1024) != 10 || profile_bucket(~0ULL) != PROFILE_BUCKETS - 1)
+        goto fail;
+
+    /* The counter must move forward */
+    {
+        uint64_t a = profile_cycles();
+        uint64_t b;
+        pixie_usleep(1000);
+        b = profile_cycles();
+        if (b <= a)
+            goto fail;
+    }
+
+    /* Laps charge time to each stage */
+    prof = profile_create();
+    total = profile_create();
+    profile_start(prof);
+    for (i=0; i<100; i++) {
+        profile_lap(prof, Profile_Shuffle);
+        profile_lap(prof, Profile_Send);
+    }
+    if (prof->stage[Profile_Shuffle].calls != 100
+        || prof->stage[Profile_Send].calls != 100
+        || prof->stage[Profile_Pick].calls != 0)
+        goto fail;
+
+    profile_add(total, prof);
+    profile_add(total, prof);
+    profile_add(total, NULL);
+    if (total->stage[Profile_Send].calls != 200
+        || total->stage[Profile_Send].cycles != 2 * prof->stage[Profile_Send].cycles)
+        goto fail;
+
+    /* Percentiles come from the histogram */
+    memset(total, 0, sizeof(*total));
+    total->stage[Profile_Pick].calls = 100;
+    total->stage[Profile_Pick].histogram[4] = 90;   /* 16..31 cycles */
+    total->stage[Profile_Pick].histogram[10] = 10;  /* 1024..2047 cycles */
+    if (profile_percentile(total, Profile_Pick, 50) != 32
+        || profile_percentile(total, Profile_Pick, 90) != 32
+        || profile_percentile(total, Profile_Pick, 99) != 2048)
+        goto fail;
+
+    memset(&sample, 0, sizeof(sample));
+    profile_sample(total, &sample);
+    if (!sample.has_profile || sample.profile_calls[Profile_Pick] != 100)
+        goto fail;
+
+    profile_destroy(prof);
+    profile_destroy(total);
+    return 0;
+fail:
+    fprintf(stderr, "profile: selftest failed\n");
+    return 1;
+}
@@ -0,0 +1,158 @@
+/*
+    profiling the transmit and receive loops, for "--profile"
+
+    Each stage of the hot loops is timed with the CPU's timestamp counter,
+    which costs a few dozen cycles, rather than a system call. Timing is
+    done with "laps": each PROFILE_LAP() charges the cycles since the
+    previous lap to the named stage, so each stage costs only one read of
+    the counter.
+
+    Every thread has its own Profile, so there is no locking. When
+    "--profile" isn't given, the pointer is NULL, and the cost is a
+    single predictable branch per stage. Build with -DNOPROFILE to remove
+    even that.
+*/
+#ifndef MAIN_PROFILE_H
+#define MAIN_PROFILE_H
+#include <stdio.h>
+#include <stdint.h>
+#include "pixie-threads.h"  /* CACHE_ALIGNED */
+#include "pixie-timer.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#undef inline
+#define inline _inline
+#endif
+
+/**
+ * The stages we time. Transmit stages come first, then receive stages.
+ */
+enum ProfileStage {
+    Profile_Throttle,       /* throttler_next_batch() */
+    Profile_Shuffle,        /* blackrock_shuffle() */
+    Profile_Pick,           /* rangelist_pick2(), rangelist_pick() */
+    Profile_Template,       /* template_set_target() */
+    Profile_Send,           /* rawsock_send_packet() */
+    Profile_Flush,          /* flush_packets(), for --banners */
+
+    Profile_Receive,        /* rawsock_recv_packet(), including waiting */
+    Profile_Timeouts,       /* tcpcon_timeouts() */
+    Profile_Parse,          /* preprocess_frame(), and checking addresses */
+    Profile_Protocol,       /* ARP, UDP, ICMP, and the TCP state machine */
+    Profile_Report,         /* checking cookies, dedup, output */
+
+    PROFILE_STAGE_COUNT
+};
+#define PROFILE_FIRST_RECEIVE Profile_Receive
+
+struct StatsSample;
+
+/* Log2 buckets, enough for 2^40 cycles, or a few minutes */
+#define PROFILE_BUCKETS 40
+
+struct CACHE_ALIGNED Profile {
+    uint64_t last;
+    struct {
+        uint64_t calls;
+        uint64_t cycles;
+        uint64_t histogram[PROFILE_BUCKETS];
+    } stage[PROFILE_STAGE_COUNT];
+};
+
+/**
+ * Read the timestamp counter. Where there isn't one, this falls back to
+ * nanoseconds, in which case the report is in nanoseconds, too.
+ */
+static inline uint64_t
+profile_cycles(void)
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    return __rdtsc();
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    unsigned lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return pixie_nanotime();
+#endif
+}
+
+/**
+ * Which histogram bucket: floor(log2(cycles))
+ */
+static inline unsigned
+profile_bucket(uint64_t cycles)
+{
+    unsigned bucket = 0;
+
+#if defined(__GNUC__)
+    if (cycles > 1)
+        bucket = 63 - __builtin_clzll(cycles);
+#else
+    while (cycles > 1) {
+        cycles >>= 1;
+        bucket++;
+    }
+#endif
+    if (bucket > PROFILE_BUCKETS - 1)
+        bucket = PROFILE_BUCKETS - 1;
+    return bucket;
+}
+
+static inline void
+profile_start(struct Profile *prof)
+{
+    prof->last = profile_cycles();
+}
+
+static inline void
+profile_lap(struct Profile *prof, unsigned stage)
+{
+    uint64_t now = profile_cycles();
+    uint64_t elapsed = now - prof->last;
+
+    prof->last = now;
+    prof->stage[stage].calls++;
+    prof->stage[stage].cycles += elapsed;
+    prof->stage[stage].histogram[profile_bucket(elapsed)]++;
+}
+
+#if defined(NOPROFILE)
+#define PROFILE_START(prof)
+#define PROFILE_LAP(prof, stage)
+#else
+#define PROFILE_START(prof) do {if (prof) profile_start(prof);} while (0)
+#define PROFILE_LAP(prof, stage) do {if (prof) profile_lap(prof, stage);} while (0)
+#endif
+
+/**
+ * Allocate a zeroed profile for one thread
+ */
+struct Profile *profile_create(void);
+
+void profile_destroy(struct Profile *prof);
+
+/**
+ * Add one thread's profile into the totals
+ */
+void profile_add(struct Profile *total, const struct Profile *prof);
+
+/**
+ * Copy the calls and cycles for each stage into the stats stream
+ */
+void profile_sample(const struct Profile *total, struct StatsSample *sample);
+
+/**
+ * Print the "--profile" report at the end of the scan. The probes and
+ * frames are the denominators for "cycles/packet".
+ */
+void profile_report(FILE *fp, const struct Profile *total,
+                    uint64_t probes, uint64_t frames,
+                    uint64_t elapsed_cycles, uint64_t elapsed_usecs);
+
+const char *profile_stage_name(unsigned stage);
+
+int profile_selftest(void);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+    adaptive rate control, for "--adaptive-rate"
+
+    Once a second, we look at what happened since the last time, and
+    decide whether to speed up or slow down. Any one of these is taken
+    as a sign that we are going too fast:
+
+    - send errors: the adapter, or the kernel, refused some of our
+      packets (more than 0.1% of them)
+    - kernel drops: the kernel dropped frames it received before we could
+      read them, according to libpcap's statistics
+    - responses: the number of responses per probe fell well below the
+      best we've seen recently. Only responses that matched our cookies
+      count, since the adapter also sees other traffic that would hide a
+      drop. Upstream rate limiters drop probes, or
+      responses, without telling anybody, and this is the only way to
+      notice.
+    - latency: the round-trip time, from a sample of probes, more than
+      doubled compared to the lowest we've seen, which means packets are
+      sitting in queues somewhere
+
+    When we see any of those, we multiply the rate by 0.7, never going
+    below "--min-rate". Otherwise, we add 5% of "--max-rate", never going
+    above it. Each decision is logged at -v, and is also sent to the
+    "--stats-file" and "--stats-listen" output.
+
+    The response ratio naturally goes up and down as we move through
+    different parts of the address space, so the "best" ratio decays by
+    5% each second, and we only react to drops of more than 30%.
+*/
+#include "main-ratectl.h"
+#include "main-stats.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_DECREASE 0.7           /* multiply by this on a bad sign */
+#define RATE_INCREASE 0.05          /* add this fraction of --max-rate */
+#define RATE_INTERVAL 1000000       /* microseconds between decisions */
+#define RATE_MIN_PROBES 100         /* probes needed to judge an interval */
+#define RATIO_DECAY 0.95
+#define RATIO_THRESHOLD 0.7
+#define RTT_THRESHOLD 2.0
+#define RTT_SLACK 5000.0            /* microseconds, to ignore jitter */
+
+static const char *reason_names[RATE_REASON_COUNT] = {
+    "start",
+    "increase",
+    "hold",
+    "send_errors",
+    "kernel_drops",
+    "responses",
+    "latency",
+};
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+ratectl_reason_name(unsigned reason)
+{
+    if (reason >= RATE_REASON_COUNT)
+        return "unknown";
+    return reason_names[reason];
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+ratectl_init(struct RateController *ctl, double min_rate, double max_rate)
+{
+    memset(ctl, 0, sizeof(*ctl));
+    if (min_rate <= 0 || min_rate > max_rate)
+        min_rate = max_rate / 100;
+    if (min_rate < 1)
+        min_rate = 1;
+    if (min_rate > max_rate)
+        min_rate = max_rate;
+    ctl->min_rate = min_rate;
+    ctl->max_rate = max_rate;
+    ctl->rate = min_rate;
+    ctl->reason = Rate_Start;
+}
+
+/***************************************************************************
+ * Look at the last interval, and decide which way to go
+ ***************************************************************************/
+static unsigned
+ratectl_decide(struct RateController *ctl, const struct StatsSample *sample)
+{
+    uint64_t probes = sample->probes_sent - ctl->last_probes;
+    uint64_t responses = sample->reported - ctl->last_reported;
+    uint64_t send_errors = sample->send_errors - ctl->last_send_errors;
+    uint64_t kernel_drops = sample->kernel_drops - ctl->last_kernel_drops;
+    uint64_t rtt_samples = sample->rtt_samples - ctl->last_rtt_samples;
+    uint64_t rtt_usecs = sample->rtt_usecs - ctl->last_rtt_usecs;
+    unsigned reason = Rate_Increase;
+
+    if (probes < RATE_MIN_PROBES)
+        return Rate_Hold;
+
+    if (send_errors * 1000 > probes)
+        return Rate_SendErrors;
+    if (kernel_drops)
+        return Rate_KernelDrops;
+
+    /*
+     * Responses per probe. We need enough responses for this to mean
+     * anything, which rules it out for scans where almost nothing
+     * responds.
+     */
+    {
+        double ratio = (double)responses / probes;
+
+        if (ctl->best_ratio * probes >= 20.0
+            && ratio < ctl->best_ratio * RATIO_THRESHOLD)
+            reason = Rate_Responses;
+        ctl->best_ratio *= RATIO_DECAY;
+        if (ctl->best_ratio < ratio)
+            ctl->best_ratio = ratio;
+    }
+    if (reason != Rate_Increase)
+        return reason;
+
+    /*
+     * Round-trip time
+     */
+    if (rtt_samples >= 5) {
+        double rtt = (double)rtt_usecs / rtt_samples;
+
+        if (ctl->best_rtt == 0 || rtt < ctl->best_rtt)
+            ctl->best_rtt = rtt;
+        else if (rtt > ctl->best_rtt * RTT_THRESHOLD + RTT_SLACK)
+            return Rate_Latency;
+    }
+
+    return Rate_Increase;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+double
+ratectl_update(struct RateController *ctl, struct StatsSample *sample,
+               uint64_t now)
+{
+    if (ctl->last_time == 0)
+        ctl->last_time = now;
+    else if (now - ctl->last_time >= RATE_INTERVAL) {
+        double old_rate = ctl->rate;
+
+        ctl->reason = ratectl_decide(ctl, sample);
+        switch (ctl->reason) {
+        case Rate_Increase:
+            ctl->rate += ctl->max_rate * RATE_INCREASE;
+            if (ctl->rate > ctl->max_rate)
+                ctl->rate = ctl->max_rate;
+            break;
+        case Rate_Hold:
+            break;
+        default:
+            ctl->decreases[ctl->reason]++;
+            ctl->rate *= RATE_DECREASE;
+            if (ctl->rate < ctl->min_rate)
+                ctl->rate = ctl->min_rate;
+            break;
+        }
+        if (ctl->rate != old_rate)
+            LOG(1, "rate: %.0f -> %.0f packets/second (%s)\n",
+                old_rate, ctl->rate, ratectl_reason_name(ctl->reason));
+
+        ctl->last_time = now;
+        ctl->last_probes = sample->probes_sent;
+        ctl->last_reported = sample->reported;
+        ctl->last_send_errors = sample->send_errors;
+        ctl->last_kernel_drops = sample->kernel_drops;
+        ctl->last_rtt_samples = sample->rtt_samples;
+        ctl->last_rtt_usecs = sample->rtt_usecs;
+    }
+
+    sample->has_rate_control = 1;
+    sample->rate_limit = (uint64_t)ctl->rate;
+    sample->rate_reason = ctl->reason;
+    memcpy(sample->rate_decreases, ctl->decreases, sizeof(ctl->decreases));
+    return ctl->rate;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+rtt_received(struct RttTable *rtt, unsigned ip, unsigned port)
+{
+    unsigned i = rtt_index(ip, port);
+    uint64_t when;
+    uint64_t now;
+
+    if (rtt->entries[i].ip != ip || rtt->entries[i].port != port)
+        return 0;
+    when = rtt->entries[i].when;
+    now = pixie_gettime();
+    if (now <= when || now - when > 10000000)
+        return 0;
+    return now - when;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+ratectl_selftest(void)
+{
+    struct RateController ctl[1];
+    struct StatsSample sample;
+    struct RttTable *rtt;
+    uint64_t now = 1000000;
+    unsigned i;
+
+    /* Start at --min-rate, or 1% of --max-rate */
+    ratectl_init(ctl, 0, 100000);
+    if (ctl->rate != 1000)
+        goto fail;
+    ratectl_init(ctl, 10000, 100000);
+    if (ctl->rate != 10000)
+        goto fail;
+
+    /* Healthy: 10% respond, add 5% of max each second, up to the max */
+    memset(&sample, 0, sizeof(sample));
+    ratectl_update(ctl, &sample, now);
+    for (i=0; i<30; i++) {
+        now += RATE_INTERVAL;
+        sample.probes_sent += (uint64_t)ctl->rate;
+        sample.reported += (uint64_t)ctl->rate / 10;
+        ratectl_update(ctl, &sample, now);
+    }
+    if (ctl->rate != 100000 || sample.rate_limit != 100000
+        || ctl->reason != Rate_Increase || !sample.has_rate_control)
+        goto fail;
+
+    /* Responses drop to 5%: back off, but not below --min-rate */
+    for (i=0; i<10; i++) {
+        now += RATE_INTERVAL;
+        sample.probes_sent += (uint64_t)ctl->rate;
+        sample.reported += (uint64_t)ctl->rate / 20;
+        /* other traffic on the wire must not hide the drop */
+        sample.frames_received += (uint64_t)ctl->rate;
+        ratectl_update(ctl, &sample, now);
+        if (i == 0 && (ctl->rate != 70000 || ctl->reason != Rate_Responses))
+            goto fail;
+    }
+    if (ctl->rate < 10000 || sample.rate_decreases[Rate_Responses] == 0)
+        goto fail;
+
+    /* Send errors */
+    now += RATE_INTERVAL;
+    sample.probes_sent += 10000;
+    sample.reported += 1000;
+    sample.send_errors += 100;
+    ratectl_update(ctl, &sample, now);
+    if (ctl->reason != Rate_SendErrors)
+        goto fail;
+
+    /* Nothing sent, such as while waiting at the end: hold */
+    now += RATE_INTERVAL;
+    ratectl_update(ctl, &sample, now);
+    if (ctl->reason != Rate_Hold)
+        goto fail;
+
+    /* Round-trip times come back only for the probes we recorded */
+    rtt = (struct RttTable *)malloc(sizeof(*rtt));
+    if (rtt == NULL)
+        goto fail;
+    memset(rtt, 0, sizeof(*rtt));
+    rtt_sent(rtt, 0x0A000001, 80, pixie_gettime() - 1000);
+    if (rtt_received(rtt, 0x0A000001, 80) < 1000
+        || rtt_received(rtt, 0x0A000001, 81) != 0
+        || rtt_received(rtt, 0x0A000002, 80) != 0) {
+        free(rtt);
+        goto fail;
+    }
+    free(rtt);
+
+    return 0;
+fail:
+    fprintf(stderr, "ratectl: selftest failed\n");
+    return 1;
+}
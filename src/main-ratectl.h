@@ -0,0 +1,117 @@
+/*
+    adaptive rate control, for "--adaptive-rate"
+
+    Instead of always sending at "--max-rate", start at "--min-rate" and
+    speed up for as long as the network keeps up, slowing down when it
+    shows signs of dropping our packets. This is "AIMD" (additive
+    increase, multiplicative decrease), the same idea as TCP congestion
+    control. See main-ratectl.c for the signals that are used.
+*/
+#ifndef MAIN_RATECTL_H
+#define MAIN_RATECTL_H
+#include <stdint.h>
+
+struct StatsSample;
+
+/**
+ * Why the rate was last changed
+ */
+enum RateReason {
+    Rate_Start,
+    Rate_Increase,
+    Rate_Hold,              /* not enough probes sent to tell */
+    Rate_SendErrors,        /* the adapter couldn't send */
+    Rate_KernelDrops,       /* the kernel dropped received frames */
+    Rate_Responses,         /* fewer responses per probe than before */
+    Rate_Latency,           /* responses are taking longer than before */
+    RATE_REASON_COUNT
+};
+
+struct RateController {
+    double min_rate;
+    double max_rate;
+    double rate;
+    unsigned reason;
+
+    /* Counters from the previous interval */
+    uint64_t last_time;
+    uint64_t last_probes;
+    uint64_t last_reported;
+    uint64_t last_send_errors;
+    uint64_t last_kernel_drops;
+    uint64_t last_rtt_samples;
+    uint64_t last_rtt_usecs;
+
+    /* What a healthy network looks like */
+    double best_ratio;
+    double best_rtt;
+
+    uint64_t decreases[RATE_REASON_COUNT];
+};
+
+/**
+ * Start at the "--min-rate", or if not given, 1% of the "--max-rate"
+ */
+void ratectl_init(struct RateController *ctl, double min_rate, double max_rate);
+
+/**
+ * Called by the main thread about once a second with the latest totals.
+ * Adds the decision to the sample for the stats stream.
+ * @return
+ *      the new rate, in packets/second, for all threads together
+ */
+double ratectl_update(struct RateController *ctl, struct StatsSample *sample,
+                      uint64_t now);
+
+const char *ratectl_reason_name(unsigned reason);
+
+
+/*
+ * Round-trip times, measured from a sample of probes. The transmit
+ * thread records when it sent every 256th probe, and the receive thread
+ * looks up each response. The table is written by one thread and read
+ * by another without locking, so a lookup may rarely return garbage
+ * when an entry is overwritten during the lookup, which is why times
+ * over 10 seconds are thrown away.
+ */
+#define RTT_TABLE_SIZE 1024
+#define RTT_SAMPLE_MASK 0xFF
+
+struct RttTable {
+    struct {
+        volatile unsigned ip;
+        volatile unsigned port;
+        volatile uint64_t when;
+    } entries[RTT_TABLE_SIZE];
+};
+
+static __inline unsigned
+rtt_index(unsigned ip, unsigned port)
+{
+    unsigned x = ip * 2654435761U ^ port;
+    return (x ^ (x >> 16)) & (RTT_TABLE_SIZE - 1);
+}
+
+/**
+ * Called by the transmit thread
+ */
+static __inline void
+rtt_sent(struct RttTable *rtt, unsigned ip, unsigned port, uint64_t now)
+{
+    unsigned i = rtt_index(ip, port);
+    rtt->entries[i].when = now;
+    rtt->entries[i].port = port;
+    rtt->entries[i].ip = ip;
+}
+
+/**
+ * Called by the receive thread for each new response
+ * @return
+ *      the round-trip time in microseconds, or 0 if this wasn't one of
+ *      the probes we recorded
+ */
+uint64_t rtt_received(struct RttTable *rtt, unsigned ip, unsigned port);
+
+int ratectl_selftest(void);
+
+#endif
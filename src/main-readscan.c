@@ -0,0 +1,252 @@
+/*
+    --readscan <files...>
+
+    Read binary scan files (either "masscan/1.1" or "masscan/2.0" format)
+    and write the results again through the normal output system. This
+    converts old scans into any other output format, such as:
+
+        masscan --readscan *.scan -oJ results.json
+
+    Parsing is done by worker threads, one file at a time per thread,
+    which hand batches of records to this thread through a ring buffer.
+    Only this thread touches the output, since the output writers aren't
+    thread-safe. Since the files are memory-mapped, and banners are
+    copied into the batch, the parsing threads never block on I/O for
+    long, so conversion runs at close to disk speed.
+*/
+#include "masscan.h"
+#include "in-binary.h"
+#include "output.h"
+#include "logger.h"
+#include "rte-ring.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH_RECORDS 1024
+#define BATCH_BANNERS (64*1024)
+
+struct ReadScanBatch {
+    unsigned count;
+    unsigned banner_length;
+    struct ScanRecord records[BATCH_RECORDS];
+    unsigned char banners[BATCH_BANNERS];
+};
+
+struct ReadScan {
+    const struct Masscan *masscan;
+    struct rte_ring *ring;
+    unsigned thread_count;
+    volatile unsigned done_count;
+    volatile unsigned error_count;
+};
+
+struct ReadScanWorker {
+    struct ReadScan *rs;
+    unsigned index;
+    uint64_t bytes;
+};
+
+
+/***************************************************************************
+ * Hand a batch to the output thread, waiting if the ring is full
+ ***************************************************************************/
+static void
+batch_send(struct ReadScan *rs, struct ReadScanBatch *batch)
+{
+    if (batch->count == 0) {
+        free(batch);
+        return;
+    }
+    while (rte_ring_mp_enqueue(rs->ring, batch) != 0)
+        pixie_usleep(100);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static struct ReadScanBatch *
+batch_create(void)
+{
+    struct ReadScanBatch *batch;
+
+    batch = (struct ReadScanBatch *)malloc(sizeof(*batch));
+    if (batch == NULL) {
+        fprintf(stderr, "readscan: out of memory\n");
+        exit(1);
+    }
+    batch->count = 0;
+    batch->banner_length = 0;
+    return batch;
+}
+
+/***************************************************************************
+ * Parse one file, sending batches of records to the output thread
+ ***************************************************************************/
+static void
+readscan_file(struct ReadScanWorker *worker, const char *filename)
+{
+    struct ReadScan *rs = worker->rs;
+    struct ScanFile *f;
+    struct ReadScanBatch *batch;
+    int x;
+
+    f = scanfile_open(filename);
+    if (f == NULL) {
+        pixie_locked_add_u32(&rs->error_count, 1);
+        return;
+    }
+    worker->bytes += scanfile_size(f);
+
+    batch = batch_create();
+    for (;;) {
+        struct ScanRecord rec;
+
+        x = scanfile_next(f, &rec);
+        if (x <= 0)
+            break;
+
+        if (rec.kind == SCAN_KIND_BANNER) {
+            /* copy the banner, because the file will be unmapped before
+             * the output thread gets to it */
+            if (rec.banner_length > BATCH_BANNERS)
+                rec.banner_length = BATCH_BANNERS;
+            if (batch->banner_length + rec.banner_length > BATCH_BANNERS) {
+                batch_send(rs, batch);
+                batch = batch_create();
+            }
+            memcpy(batch->banners + batch->banner_length,
+                   rec.banner, rec.banner_length);
+            rec.banner = batch->banners + batch->banner_length;
+            batch->banner_length += rec.banner_length;
+        }
+
+        batch->records[batch->count++] = rec;
+        if (batch->count >= BATCH_RECORDS) {
+            batch_send(rs, batch);
+            batch = batch_create();
+        }
+    }
+    batch_send(rs, batch);
+
+    if (x < 0) {
+        fprintf(stderr, "%s: file corrupt\n", filename);
+        pixie_locked_add_u32(&rs->error_count, 1);
+    }
+
+    scanfile_close(f);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+readscan_thread(void *v)
+{
+    struct ReadScanWorker *worker = (struct ReadScanWorker *)v;
+    struct ReadScan *rs = worker->rs;
+    const struct Masscan *masscan = rs->masscan;
+    unsigned i;
+
+    for (i=worker->index; i<masscan->scanfiles.count; i += rs->thread_count)
+        readscan_file(worker, masscan->scanfiles.names[i]);
+
+    pixie_locked_add_u32(&rs->done_count, 1);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static uint64_t
+readscan_output(struct Output *out, struct ReadScanBatch *batch)
+{
+    unsigned i;
+
+    for (i=0; i<batch->count; i++) {
+        const struct ScanRecord *rec = &batch->records[i];
+
+        if (rec->kind == SCAN_KIND_BANNER)
+            output_report_banner_at(out, rec->timestamp, rec->ip,
+                                    rec->ip_proto, rec->port, rec->proto,
+                                    rec->banner, rec->banner_length);
+        else
+            output_report_status_at(out, rec->timestamp, rec->kind, rec->ip,
+                                    rec->port, rec->reason, rec->ttl);
+    }
+    return batch->count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+main_readscan(struct Masscan *masscan)
+{
+    struct ReadScan rs[1];
+    struct ReadScanWorker *workers;
+    struct Output *out;
+    uint64_t start;
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    double elapsed;
+    unsigned i;
+
+    if (masscan->scanfiles.count == 0) {
+        LOG(0, "FAIL: no scan files specified\n");
+        LOG(0, " [hint] try something like \"--readscan foo.scan\"\n");
+        return 1;
+    }
+
+    memset(rs, 0, sizeof(rs[0]));
+    rs->masscan = masscan;
+    rs->ring = rte_ring_create(256, RING_F_SC_DEQ);
+    rs->thread_count = pixie_cpu_get_count();
+    if (rs->thread_count > masscan->scanfiles.count)
+        rs->thread_count = masscan->scanfiles.count;
+    if (rs->thread_count == 0)
+        rs->thread_count = 1;
+
+    out = output_create(masscan);
+    start = pixie_gettime();
+
+    /*
+     * Start the parsing threads
+     */
+    workers = (struct ReadScanWorker *)malloc(rs->thread_count * sizeof(workers[0]));
+    memset(workers, 0, rs->thread_count * sizeof(workers[0]));
+    for (i=0; i<rs->thread_count; i++) {
+        workers[i].rs = rs;
+        workers[i].index = i;
+        pixie_begin_thread(readscan_thread, 0, &workers[i]);
+    }
+
+    /*
+     * Output the results, until all the threads are done and the ring
+     * is empty
+     */
+    for (;;) {
+        struct ReadScanBatch *batch;
+        unsigned done = rs->done_count;
+
+        if (rte_ring_sc_dequeue(rs->ring, (void**)&batch) == 0) {
+            records += readscan_output(out, batch);
+            free(batch);
+            continue;
+        }
+        if (done >= rs->thread_count && rte_ring_empty(rs->ring))
+            break;
+        pixie_usleep(100);
+    }
+
+    output_destroy(out);
+
+    for (i=0; i<rs->thread_count; i++)
+        bytes += workers[i].bytes;
+    elapsed = (pixie_gettime() - start) / 1000000.0;
+    if (elapsed <= 0)
+        elapsed = 0.000001;
+    LOG(0, "readscan: %llu records from %u files, %.1f MB/s, %.0f records/s\n",
+        (unsigned long long)records, masscan->scanfiles.count,
+        bytes / elapsed / 1000000.0, records / elapsed);
+
+    free(workers);
+    free(rs->ring);
+    return rs->error_count ? 1 : 0;
+}
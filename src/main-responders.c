@@ -0,0 +1,235 @@
+/*
+    the targets that have answered, for "--retries"
+
+    The transmit thread picks a target from an index 'x' in the range
+    [0..ips*ports), the IP address from (x % ips), and the port from
+    (x / ips). To mark a response, we go the other way: find the index
+    of the IP address and port in their lists, with a binary search like
+    the one the transmit thread uses, and set that bit.
+
+    With "--checkpoint-responders", the bitmap is saved with the resume
+    information, as a 16-byte header, "MASRESP1" and the number of bits,
+    followed by the bits.
+*/
+#include "main-responders.h"
+#include "main-checkpoint.h"
+#include "ranges.h"
+#include "pixie-tmp.h"
+#include "string_s.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/***************************************************************************
+ ***************************************************************************/
+struct Responders *
+responders_create(const struct RangeList *targets,
+                  const unsigned *target_picker,
+                  const struct RangeList *ports)
+{
+    struct Responders *responders;
+    uint64_t count_ips = rangelist_count(targets);
+    uint64_t range = count_ips * rangelist_count(ports);
+
+    if (range == 0 || range > RESPONDERS_MAX)
+        return NULL;
+
+    responders = (struct Responders *)malloc(sizeof(*responders));
+    if (responders == NULL)
+        exit(1);
+    memset(responders, 0, sizeof(*responders));
+    responders->targets = targets;
+    responders->target_picker = target_picker;
+    responders->ports = ports;
+    responders->port_picker = rangelist_pick2_create((struct RangeList *)ports);
+    responders->count_ips = count_ips;
+    responders->range = range;
+    responders->bits = (volatile unsigned char *)calloc((size_t)((range + 7) / 8), 1);
+    if (responders->bits == NULL || responders->port_picker == NULL) {
+        fprintf(stderr, "responders: out of memory\n");
+        exit(1);
+    }
+
+    return responders;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+responders_destroy(struct Responders *responders)
+{
+    if (responders == NULL)
+        return;
+    rangelist_pick2_destroy(responders->port_picker);
+    free((void*)responders->bits);
+    free(responders);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+responders_add(struct Responders *responders, unsigned ip, unsigned port)
+{
+    uint64_t ip_index;
+    uint64_t port_index;
+    uint64_t index;
+
+    ip_index = rangelist_index_of(responders->targets, ip,
+                                  responders->target_picker);
+    if (ip_index >= responders->count_ips)
+        return;
+    port_index = rangelist_index_of(responders->ports, port,
+                                    responders->port_picker);
+    if (port_index == ~(uint64_t)0)
+        return;
+
+    index = ip_index + port_index * responders->count_ips;
+    responders->bits[index >> 3] |= (unsigned char)(1 << (index & 7));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+header_format(unsigned char *header, uint64_t range)
+{
+    unsigned i;
+
+    memcpy(header, "MASRESP1", 8);
+    for (i=0; i<8; i++)
+        header[8 + i] = (unsigned char)(range >> (i*8));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+responders_save(const struct Responders *responders, const char *filename)
+{
+    unsigned char header[16];
+    size_t length = (size_t)((responders->range + 7) / 8);
+    FILE *fp;
+
+    fp = checkpoint_create(filename);
+    if (fp == NULL)
+        return -1;
+
+    /* The receive threads keep adding bits while we write, which is fine,
+     * since any of them we miss are only retried */
+    header_format(header, responders->range);
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite((const void *)responders->bits, 1, length, fp);
+    return checkpoint_commit(fp, filename);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+responders_load(struct Responders *responders, const char *filename)
+{
+    unsigned char header[16];
+    unsigned char expected[16];
+    size_t length = (size_t)((responders->range + 7) / 8);
+    FILE *fp;
+    int err;
+
+    err = fopen_s(&fp, filename, "rb");
+    if (err || fp == NULL)
+        return -1;
+
+    header_format(expected, responders->range);
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header)
+        || memcmp(header, expected, sizeof(header)) != 0
+        || fread((void *)responders->bits, 1, length, fp) != length) {
+        memset((void *)responders->bits, 0, length);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+responders_selftest(void)
+{
+    struct RangeList targets;
+    struct RangeList ports;
+    struct Responders *responders;
+    unsigned *picker;
+    uint64_t count_ips;
+    uint64_t range;
+    uint64_t x;
+
+    memset(&targets, 0, sizeof(targets));
+    memset(&ports, 0, sizeof(ports));
+    rangelist_add_range(&targets, 0x0A000000, 0x0A0000FF);
+    rangelist_add_range(&targets, 0xC0A80010, 0xC0A80013);
+    rangelist_parse_ports(&ports, "22,80,U:53");
+    picker = rangelist_pick2_create(&targets);
+    count_ips = rangelist_count(&targets);
+    range = count_ips * rangelist_count(&ports);
+
+    responders = responders_create(&targets, picker, &ports);
+    if (responders == NULL)
+        goto fail;
+
+    /* Every target we mark is found at the index the transmit thread
+     * would pick it from, and nothing else */
+    for (x=0; x<range; x += 7) {
+        unsigned ip = rangelist_pick2(&targets, x % count_ips, picker);
+        unsigned port = rangelist_pick(&ports, x / count_ips);
+
+        responders_add(responders, ip, port);
+    }
+    for (x=0; x<range; x++) {
+        if (responders_contains(responders, x) != (x % 7 == 0))
+            goto fail;
+    }
+
+    /* Responses from outside the scan are ignored */
+    responders_add(responders, 0x0B000000, 80);
+    responders_add(responders, 0x0A000001, 443);
+    responders_add(responders, 0x0A000001, 53);
+    for (x=0; x<range; x++) {
+        if (responders_contains(responders, x) != (x % 7 == 0))
+            goto fail;
+    }
+
+    /* Saved and loaded back, for a scan of the same size only */
+    {
+        struct Responders *loaded;
+        struct RangeList other;
+        char filename[256];
+
+        pixie_tmp_filename(filename, sizeof(filename), "masscan-responders");
+        if (responders_save(responders, filename) != 0)
+            goto fail;
+        loaded = responders_create(&targets, picker, &ports);
+        if (responders_load(loaded, filename) != 0)
+            goto fail;
+        for (x=0; x<range; x++) {
+            if (responders_contains(loaded, x) != (x % 7 == 0))
+                goto fail;
+        }
+        responders_destroy(loaded);
+
+        memset(&other, 0, sizeof(other));
+        rangelist_parse_ports(&other, "22,80");
+        loaded = responders_create(&targets, picker, &other);
+        if (responders_load(loaded, filename) == 0
+            || responders_contains(loaded, 0))
+            goto fail;
+        responders_destroy(loaded);
+        rangelist_free(&other);
+        remove(filename);
+    }
+
+    responders_destroy(responders);
+    rangelist_pick2_destroy(picker);
+    rangelist_free(&targets);
+    rangelist_free(&ports);
+    return 0;
+fail:
+    fprintf(stderr, "responders: selftest failed\n");
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+    the targets that have answered, for "--retries"
+
+    Instead of sending every retry blindly, the transmit thread skips the
+    retries to targets that have already answered. The receive threads
+    mark them in a bitmap with one bit per target, using the same index
+    that the transmit thread "picks" the IP address and port from. See
+    main-responders.c.
+*/
+#ifndef MAIN_RESPONDERS_H
+#define MAIN_RESPONDERS_H
+#include <stdint.h>
+struct RangeList;
+
+/**
+ * The most targets we'll keep a bitmap for, which is 512-megabytes.
+ * That's the entire Internet on one port.
+ */
+#define RESPONDERS_MAX (1ULL<<32)
+
+struct Responders {
+    const struct RangeList *targets;
+    const unsigned *target_picker;
+    const struct RangeList *ports;
+    unsigned *port_picker;
+    uint64_t count_ips;
+    uint64_t range;
+
+    /* Written by the receive threads, and read by the transmit threads,
+     * without locking. If two receive threads write the same byte at
+     * once, one bit may be lost, and that target gets a retry anyway. */
+    volatile unsigned char *bits;
+};
+
+/**
+ * @param target_picker
+ *      from rangelist_pick2_create(), for the targets
+ * @param ports
+ *      the ports as the transmit thread numbers them, such as 65536+53
+ *      for UDP port 53
+ * @return
+ *      NULL if there are more than RESPONDERS_MAX targets
+ */
+struct Responders *
+responders_create(const struct RangeList *targets,
+                  const unsigned *target_picker,
+                  const struct RangeList *ports);
+
+void responders_destroy(struct Responders *responders);
+
+/**
+ * Called by the receive thread for each response that has our cookie
+ */
+void responders_add(struct Responders *responders, unsigned ip, unsigned port);
+
+/**
+ * Called by the transmit thread, with the shuffled index it picked the
+ * target from
+ */
+static __inline int
+responders_contains(const struct Responders *responders, uint64_t index)
+{
+    return (responders->bits[index >> 3] >> (index & 7)) & 1;
+}
+
+/**
+ * For "--checkpoint-responders", save the targets that have answered so
+ * far, or load them back when resuming
+ * @return
+ *      0 on success, or -1 if the file couldn't be written or read, or was
+ *      for a different scan
+ */
+int responders_save(const struct Responders *responders, const char *filename);
+int responders_load(struct Responders *responders, const char *filename);
+
+int responders_selftest(void);
+
+#endif
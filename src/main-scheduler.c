@@ -0,0 +1,681 @@
+/*
+    handing out the scan index to the transmit threads
+
+    Chunks are numbered from index 0, not from the start of the scan, so
+    that a resumed scan that starts in the middle cuts the index into the
+    same chunks as before, as long as it uses the same chunk size.
+
+    There's no lock. Threads take chunks by incrementing a shared counter
+    with compare-and-swap, and mark them done the same way, so a thread
+    that gets stuck only ever holds up its own chunk. Since every thread
+    takes from the same counter, there's nothing to steal: a thread that
+    runs out of work simply finds no chunks left.
+
+    With "--worker", the counter isn't used. The worker's lease thread puts
+    the chunks the coordinator gives us in a ring, that the transmit
+    threads take from, and they put the chunks that are done in another
+    ring, for the lease thread to report back.
+
+    The retries for a chunk are sent by the thread that took it, through
+    its SchedulerCursor, after the chunks it takes next. If they were
+    sent by whichever thread was at the index 'gap' further on, as they
+    used to be, then the thread with the next chunk would often send them
+    right away, before the first probes, since every thread is at a
+    different place in the index.
+*/
+#include "main-scheduler.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "rte-ring.h"
+#include "ranges.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+is_done(const struct Scheduler *scheduler, unsigned n)
+{
+    return (scheduler->done[n/32] >> (n%32)) & 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+locked_increment(volatile unsigned *counter)
+{
+    for (;;) {
+        unsigned old = *counter;
+        if (rte_atomic32_cmpset(counter, old, old + 1))
+            break;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+mark_done(struct Scheduler *scheduler, unsigned n)
+{
+    volatile unsigned *word = &scheduler->done[n/32];
+    unsigned bit = 1U << (n%32);
+
+    for (;;) {
+        unsigned old = *word;
+        if (old & bit)
+            return;
+        if (rte_atomic32_cmpset(word, old, old | bit))
+            break;
+    }
+    locked_increment(&scheduler->completed);
+}
+
+/***************************************************************************
+ * The part of the index that chunk 'n' covers, cut short at the start and
+ * end of the scan
+ ***************************************************************************/
+static void
+chunk_range(const struct Scheduler *scheduler, unsigned n,
+            uint64_t *begin, uint64_t *end)
+{
+    uint64_t x;
+
+    x = (scheduler->first + (uint64_t)n) * scheduler->chunk_size;
+    *begin = (x > scheduler->begin) ? x : scheduler->begin;
+    x += scheduler->chunk_size;
+    *end = (x < scheduler->end) ? x : scheduler->end;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Scheduler *
+scheduler_create(uint64_t begin, uint64_t end, uint64_t chunk_size,
+                 const struct RangeList *done)
+{
+    struct Scheduler *scheduler;
+
+    scheduler = (struct Scheduler *)malloc(sizeof(*scheduler));
+    if (scheduler == NULL)
+        exit(1);
+    memset(scheduler, 0, sizeof(*scheduler));
+
+    /* Big enough that the chunk numbers fit in the bitmap */
+    if (chunk_size == 0) {
+        chunk_size = (end + SCHEDULER_CHUNKS_MAX - 1) / SCHEDULER_CHUNKS_MAX;
+        if (chunk_size < SCHEDULER_CHUNK_MIN)
+            chunk_size = SCHEDULER_CHUNK_MIN;
+    }
+    scheduler->begin = begin;
+    scheduler->end = end;
+    scheduler->chunk_size = chunk_size;
+    scheduler->first = (unsigned)(begin / chunk_size);
+    if (end > begin)
+        scheduler->count = (unsigned)((end - 1) / chunk_size) - scheduler->first + 1;
+
+    scheduler->done = (volatile unsigned *)calloc(scheduler->count/32 + 1,
+                                                  sizeof(scheduler->done[0]));
+    if (scheduler->done == NULL)
+        exit(1);
+
+    /* The chunks a resumed scan already did */
+    if (done) {
+        unsigned i;
+
+        for (i=0; i<done->count; i++) {
+            uint64_t c;
+
+            for (c=done->list[i].begin; c<=done->list[i].end; c++) {
+                if (c >= scheduler->first
+                    && c < (uint64_t)scheduler->first + scheduler->count)
+                    mark_done(scheduler, (unsigned)(c - scheduler->first));
+            }
+        }
+    }
+
+    return scheduler;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scheduler_destroy(struct Scheduler *scheduler)
+{
+    if (scheduler == NULL)
+        return;
+    free(scheduler->leased);
+    free(scheduler->finished);
+    free((void*)scheduler->done);
+    free(scheduler);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_next(struct Scheduler *scheduler, unsigned *chunk,
+               uint64_t *begin, uint64_t *end)
+{
+    if (scheduler->leased) {
+        void *p;
+
+        if (rte_ring_mc_dequeue(scheduler->leased, &p) != 0)
+            return 0;
+        *chunk = (unsigned)(size_t)p;
+        chunk_range(scheduler, *chunk, begin, end);
+        return 1;
+    }
+
+    for (;;) {
+        unsigned n = scheduler->next;
+
+        if (n >= scheduler->count)
+            return 0;
+        if (!rte_atomic32_cmpset(&scheduler->next, n, n + 1))
+            continue;
+        if (is_done(scheduler, n))
+            continue; /* from before we were resumed */
+
+        chunk_range(scheduler, n, begin, end);
+        *chunk = n;
+        return 1;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scheduler_done(struct Scheduler *scheduler, unsigned chunk)
+{
+    mark_done(scheduler, chunk);
+
+    /* The lease thread empties this at least every 100 milliseconds, so
+     * it's rarely full for long */
+    if (scheduler->finished) {
+        while (rte_ring_mp_enqueue(scheduler->finished,
+                                   (void*)(size_t)chunk) != 0)
+            pixie_usleep(1000);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_is_finished(const struct Scheduler *scheduler)
+{
+    if (scheduler->leased)
+        return scheduler->is_final && rte_ring_count(scheduler->leased) == 0;
+    return scheduler->next >= scheduler->count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scheduler_use_leases(struct Scheduler *scheduler)
+{
+    scheduler->leased = rte_ring_create(SCHEDULER_LEASES_MAX,
+                                        RING_F_SP_ENQ);
+    scheduler->finished = rte_ring_create(2 * SCHEDULER_LEASES_MAX,
+                                          RING_F_SC_DEQ);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_lease(struct Scheduler *scheduler, unsigned chunk)
+{
+    if (chunk < scheduler->first || chunk - scheduler->first >= scheduler->count)
+        return -1;
+    chunk -= scheduler->first;
+
+    /* We did it before, but the coordinator didn't hear about it */
+    if (is_done(scheduler, chunk)) {
+        if (rte_ring_mp_enqueue(scheduler->finished, (void*)(size_t)chunk) != 0)
+            return -1;
+        return 0;
+    }
+
+    if (rte_ring_sp_enqueue(scheduler->leased, (void*)(size_t)chunk) != 0)
+        return -1;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_reap(struct Scheduler *scheduler, unsigned *chunk)
+{
+    void *p;
+
+    if (rte_ring_sc_dequeue(scheduler->finished, &p) != 0)
+        return 0;
+    *chunk = scheduler->first + (unsigned)(size_t)p;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+scheduler_queued(const struct Scheduler *scheduler)
+{
+    return rte_ring_count(scheduler->leased);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+scheduler_low_water(struct Scheduler *scheduler)
+{
+    uint64_t x;
+
+    while (scheduler->low_water < scheduler->count
+        && is_done(scheduler, scheduler->low_water))
+        scheduler->low_water++;
+
+    if (scheduler->low_water == scheduler->count)
+        return scheduler->end;
+    x = (scheduler->first + (uint64_t)scheduler->low_water) * scheduler->chunk_size;
+    return (x > scheduler->begin) ? x : scheduler->begin;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+scheduler_progress(const struct Scheduler *scheduler)
+{
+    uint64_t x;
+
+    if (scheduler->completed == scheduler->count)
+        return scheduler->end;
+    x = scheduler->begin + scheduler->completed * scheduler->chunk_size;
+    return (x < scheduler->end) ? x : scheduler->end;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scheduler_get_done(struct Scheduler *scheduler, struct RangeList *done)
+{
+    unsigned n;
+
+    scheduler_low_water(scheduler);
+    for (n=scheduler->low_water; n<scheduler->count; ) {
+        unsigned run;
+
+        if (!is_done(scheduler, n)) {
+            n++;
+            continue;
+        }
+        for (run=n; run+1<scheduler->count && is_done(scheduler, run+1); run++)
+            ;
+        rangelist_add_range(done, scheduler->first + n, scheduler->first + run);
+        n = run + 1;
+    }
+}
+
+/* A chunk in a transmit thread's sequence, from position 'start' */
+struct CursorChunk {
+    uint64_t start;
+    uint64_t begin;
+    uint64_t end;
+    unsigned chunk;
+};
+
+struct SchedulerCursor {
+    struct Scheduler *scheduler;
+    unsigned retries;
+    uint64_t gap;
+
+    /* Where we are: the slots at each position go from the last retry
+     * down to the first probe */
+    uint64_t position;
+    unsigned slot;
+
+    /* The chunks that still have retries to send, the first of which is
+     * chunk number 'base' of those we took, and the end of the last one */
+    struct CursorChunk *chunks;
+    unsigned count;
+    unsigned max;
+    uint64_t base;
+    uint64_t filled;
+
+    /* For each retry, the number of the chunk its target was in last time,
+     * since that only moves forward */
+    uint64_t *at;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct SchedulerCursor *
+scheduler_cursor_create(struct Scheduler *scheduler, unsigned retries,
+                        uint64_t gap)
+{
+    struct SchedulerCursor *cursor;
+
+    cursor = (struct SchedulerCursor *)malloc(sizeof(*cursor));
+    if (cursor == NULL)
+        exit(1);
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->scheduler = scheduler;
+    cursor->retries = retries;
+    cursor->gap = gap;
+    cursor->slot = retries;
+    cursor->at = (uint64_t *)calloc(retries + 1, sizeof(cursor->at[0]));
+    if (cursor->at == NULL)
+        exit(1);
+    return cursor;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scheduler_cursor_destroy(struct SchedulerCursor *cursor)
+{
+    if (cursor == NULL)
+        return;
+    free(cursor->chunks);
+    free(cursor->at);
+    free(cursor);
+}
+
+/***************************************************************************
+ * Take the next chunk, which starts at the position we are at
+ ***************************************************************************/
+static int
+cursor_take(struct SchedulerCursor *cursor)
+{
+    struct CursorChunk *x;
+    uint64_t begin;
+    uint64_t end;
+    unsigned chunk;
+
+    if (!scheduler_next(cursor->scheduler, &chunk, &begin, &end))
+        return 0;
+
+    if (cursor->count >= cursor->max) {
+        cursor->max = cursor->max * 2 + 16;
+        cursor->chunks = (struct CursorChunk *)realloc(cursor->chunks,
+                                cursor->max * sizeof(cursor->chunks[0]));
+        if (cursor->chunks == NULL)
+            exit(1);
+    }
+    x = &cursor->chunks[cursor->count++];
+    x->start = cursor->position;
+    x->begin = begin;
+    x->end = end;
+    x->chunk = chunk;
+    cursor->filled = cursor->position + (end - begin);
+    return 1;
+}
+
+/***************************************************************************
+ * Chunks are done once we are past the last retry of their last target
+ ***************************************************************************/
+static void
+cursor_retire(struct SchedulerCursor *cursor)
+{
+    unsigned n;
+
+    for (n=0; n<cursor->count; n++) {
+        const struct CursorChunk *x = &cursor->chunks[n];
+
+        if (x->start + (x->end - x->begin) + cursor->retries * cursor->gap
+                > cursor->position)
+            break;
+        scheduler_done(cursor->scheduler, x->chunk);
+    }
+    if (n) {
+        cursor->count -= n;
+        memmove(cursor->chunks, cursor->chunks + n,
+                cursor->count * sizeof(cursor->chunks[0]));
+        cursor->base += n;
+    }
+}
+
+/***************************************************************************
+ * The target for retry 'r' at the position we are at, which is the one
+ * 'r * gap' positions before, if that was in one of our chunks
+ ***************************************************************************/
+static int
+cursor_lookup(struct SchedulerCursor *cursor, unsigned r, uint64_t *index)
+{
+    uint64_t distance = r * cursor->gap;
+    uint64_t t;
+    uint64_t n;
+
+    if (cursor->position < distance)
+        return 0;
+    t = cursor->position - distance;
+
+    n = cursor->at[r];
+    if (n < cursor->base)
+        n = cursor->base;
+    for (; n < cursor->base + cursor->count; n++) {
+        const struct CursorChunk *x = &cursor->chunks[n - cursor->base];
+
+        if (t < x->start)
+            break; /* between chunks, when we had to wait for one */
+        if (t < x->start + (x->end - x->begin)) {
+            cursor->at[r] = n;
+            *index = x->begin + (t - x->start);
+            return 1;
+        }
+    }
+    cursor->at[r] = n;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_cursor_next(struct SchedulerCursor *cursor, uint64_t *index,
+                      unsigned *retry)
+{
+    unsigned r = cursor->slot;
+    int is_found;
+
+    /* At the start of each position, get the next chunk if we are past
+     * the last one. If there isn't one, we keep going with empty slots
+     * for as long as there are retries to send. */
+    if (r == cursor->retries && cursor->position >= cursor->filled) {
+        if (!cursor_take(cursor) && cursor->count == 0)
+            return -1;
+    }
+
+    is_found = cursor_lookup(cursor, r, index);
+    *retry = r;
+
+    if (r)
+        cursor->slot--;
+    else {
+        cursor->slot = cursor->retries;
+        cursor->position++;
+        cursor_retire(cursor);
+    }
+    return is_found;
+}
+
+/***************************************************************************
+ * For the selftest, a transmit thread that records the position each
+ * probe was sent at, plus one
+ ***************************************************************************/
+#define TEST_TARGETS 1000
+#define TEST_RETRIES 2
+#define TEST_GAP 7
+
+struct TestThread {
+    struct Scheduler *scheduler;
+    uint64_t sent[TEST_TARGETS][TEST_RETRIES + 1];
+    unsigned is_bad;
+    volatile unsigned is_done;
+};
+
+static void
+test_thread(void *v)
+{
+    struct TestThread *t = (struct TestThread *)v;
+    struct SchedulerCursor *cursor;
+    uint64_t slot;
+    uint64_t index;
+    unsigned retry;
+    int x;
+
+    cursor = scheduler_cursor_create(t->scheduler, TEST_RETRIES, TEST_GAP);
+    for (slot=0; (x = scheduler_cursor_next(cursor, &index, &retry)) >= 0; slot++) {
+        if (x == 0)
+            continue;
+        if (index >= TEST_TARGETS || retry > TEST_RETRIES
+            || t->sent[index][retry])
+            t->is_bad = 1;
+        else
+            t->sent[index][retry] = slot / (TEST_RETRIES + 1) + 1;
+
+        /* so that the other thread gets some of the chunks */
+        if (slot % 64 == 0)
+            pixie_usleep(100);
+    }
+    scheduler_cursor_destroy(cursor);
+    t->is_done = 1;
+}
+
+/***************************************************************************
+ * Two threads scan the same scheduler. Every target must get its first
+ * probe and its retries from the same thread, each retry TEST_GAP
+ * positions after the one before, and every chunk must end up done.
+ ***************************************************************************/
+static int
+test_cursors(void)
+{
+    struct Scheduler *scheduler;
+    struct TestThread *t;
+    unsigned i;
+    unsigned r;
+    int result = 1;
+
+    scheduler = scheduler_create(0, TEST_TARGETS, 10, NULL);
+    t = (struct TestThread *)calloc(2, sizeof(*t));
+    if (t == NULL)
+        exit(1);
+    t[0].scheduler = scheduler;
+    t[1].scheduler = scheduler;
+    pixie_begin_thread(test_thread, 0, &t[0]);
+    pixie_begin_thread(test_thread, 0, &t[1]);
+    while (!t[0].is_done || !t[1].is_done)
+        pixie_usleep(1000);
+
+    if (t[0].is_bad || t[1].is_bad)
+        goto end;
+    for (i=0; i<TEST_TARGETS; i++) {
+        const struct TestThread *mine = t[0].sent[i][0] ? &t[0] : &t[1];
+        const struct TestThread *other = (mine == &t[0]) ? &t[1] : &t[0];
+
+        for (r=0; r<=TEST_RETRIES; r++) {
+            if (mine->sent[i][r] != mine->sent[i][0] + r * TEST_GAP
+                || other->sent[i][r] != 0)
+                goto end;
+        }
+        if (mine->sent[i][0] == 0)
+            goto end;
+    }
+    if (scheduler->completed != scheduler->count
+        || scheduler_low_water(scheduler) != TEST_TARGETS)
+        goto end;
+    result = 0;
+end:
+    free(t);
+    scheduler_destroy(scheduler);
+    return result;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scheduler_selftest(void)
+{
+    struct Scheduler *scheduler;
+    struct RangeList done;
+    unsigned char seen[40];
+    unsigned chunk;
+    uint64_t begin, end;
+    uint64_t x;
+
+    /* Chunks are aligned to the chunk size, not the start of the scan,
+     * and the first and last are cut short */
+    scheduler = scheduler_create(15, 45, 10, NULL);
+    if (scheduler->count != 4)
+        goto fail;
+    memset(seen, 0, sizeof(seen));
+    while (scheduler_next(scheduler, &chunk, &begin, &end)) {
+        for (x=begin; x<end; x++)
+            seen[x - 10]++;
+    }
+    for (x=10; x<50; x++) {
+        if (seen[x - 10] != (x >= 15 && x < 45))
+            goto fail;
+    }
+
+    /* Out of order, the low water mark only moves past the chunks that
+     * are done, and the rest are saved */
+    if (scheduler_low_water(scheduler) != 15)
+        goto fail;
+    scheduler_done(scheduler, 1);
+    scheduler_done(scheduler, 3);
+    if (scheduler_low_water(scheduler) != 15)
+        goto fail;
+    scheduler_done(scheduler, 0);
+    if (scheduler_low_water(scheduler) != 30)
+        goto fail;
+    memset(&done, 0, sizeof(done));
+    scheduler_get_done(scheduler, &done);
+    if (done.count != 1 || done.list[0].begin != 4 || done.list[0].end != 4)
+        goto fail;
+    scheduler_destroy(scheduler);
+
+    /* Resuming from there, only chunk 3 is handed out */
+    scheduler = scheduler_create(30, 45, 10, &done);
+    if (!scheduler_next(scheduler, &chunk, &begin, &end)
+        || begin != 30 || end != 40)
+        goto fail;
+    if (scheduler_next(scheduler, &chunk, &begin, &end))
+        goto fail;
+    scheduler_done(scheduler, chunk);
+    if (scheduler_low_water(scheduler) != 45 || scheduler_progress(scheduler) != 45)
+        goto fail;
+    scheduler_destroy(scheduler);
+    rangelist_free(&done);
+
+    /* With leases, only the chunks we are given are handed out, numbered
+     * from index 0 */
+    scheduler = scheduler_create(15, 45, 10, NULL);
+    scheduler_use_leases(scheduler);
+    if (scheduler_next(scheduler, &chunk, &begin, &end)
+        || scheduler_is_finished(scheduler))
+        goto fail;
+    if (scheduler_lease(scheduler, 0) == 0 || scheduler_lease(scheduler, 5) == 0)
+        goto fail;
+    if (scheduler_lease(scheduler, 3) != 0 || scheduler_queued(scheduler) != 1)
+        goto fail;
+    if (!scheduler_next(scheduler, &chunk, &begin, &end)
+        || begin != 30 || end != 40)
+        goto fail;
+    scheduler_done(scheduler, chunk);
+    if (!scheduler_reap(scheduler, &chunk) || chunk != 3)
+        goto fail;
+    if (scheduler_reap(scheduler, &chunk))
+        goto fail;
+
+    /* Leased again, it's reported done again, without being scanned */
+    if (scheduler_lease(scheduler, 3) != 0 || scheduler_queued(scheduler) != 0
+        || !scheduler_reap(scheduler, &chunk) || chunk != 3)
+        goto fail;
+    scheduler->is_final = 1;
+    if (!scheduler_is_finished(scheduler))
+        goto fail;
+    scheduler_destroy(scheduler);
+
+    if (test_cursors() != 0)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "scheduler: selftest failed\n");
+    return 1;
+}
@@ -0,0 +1,178 @@
+/*
+    handing out the scan index to the transmit threads
+
+    Instead of each transmit thread taking every Nth index, the index is
+    cut into chunks, and each thread takes the next chunk when it's done
+    with the last one. A thread on a slow adapter, or one that's busy
+    sending for its receive thread, just does fewer chunks, rather than
+    holding everyone else back.
+
+    Since chunks finish out of order, there is no longer a single index
+    below which everything is done. Instead, a bitmap records which chunks
+    are done, and that's what "--resume" saves. See main-scheduler.c.
+
+    With "--worker", the chunks come from the coordinator instead (see
+    main-worker.c), which queues them with scheduler_lease(), and takes
+    back the ones that are done with scheduler_reap().
+
+    Each transmit thread sends the "--retries" for the targets in the
+    chunks it took, through a SchedulerCursor, so a chunk is only done
+    once its retries have been sent too.
+*/
+#ifndef MAIN_SCHEDULER_H
+#define MAIN_SCHEDULER_H
+#include <stdint.h>
+struct RangeList;
+struct rte_ring;
+
+/**
+ * The most chunks we'll cut the index into, so that the bitmap is at
+ * most 2-megabytes
+ */
+#define SCHEDULER_CHUNKS_MAX (1<<24)
+#define SCHEDULER_CHUNK_MIN 4096
+
+/**
+ * With "--worker", the most chunks that can be waiting for the transmit
+ * threads, or waiting for the lease thread to take them back
+ */
+#define SCHEDULER_LEASES_MAX 256
+
+struct Scheduler {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t chunk_size;
+    unsigned first;     /* chunk number of 'begin' */
+    unsigned count;     /* chunks in [begin..end) */
+
+    /* Shared by all the transmit threads, changed with compare-and-swap */
+    volatile unsigned next;
+    volatile unsigned completed;
+    volatile unsigned *done;
+
+    /* With "--worker", the transmit threads take chunks from 'leased'
+     * instead of the counter, and put them in 'finished' when done. The
+     * coordinator says when there are no more with 'is_final'. */
+    struct rte_ring *leased;
+    struct rte_ring *finished;
+    volatile unsigned is_final;
+
+    /* Main thread only */
+    unsigned low_water;
+};
+
+/**
+ * @param chunk_size
+ *      from a resumed scan, so that the chunks are the same as they were
+ *      before, or 0 to choose one
+ * @param done
+ *      from a resumed scan, the chunks that were already done, or NULL
+ */
+struct Scheduler *
+scheduler_create(uint64_t begin, uint64_t end, uint64_t chunk_size,
+                 const struct RangeList *done);
+
+void scheduler_destroy(struct Scheduler *scheduler);
+
+/**
+ * Called by a transmit thread to get the next chunk of the index
+ * @return
+ *      1 if there was one, or 0 when they are all taken
+ */
+int
+scheduler_next(struct Scheduler *scheduler, unsigned *chunk,
+               uint64_t *begin, uint64_t *end);
+
+/**
+ * Called by a transmit thread once it has sent all of a chunk
+ */
+void scheduler_done(struct Scheduler *scheduler, unsigned chunk);
+
+/**
+ * Called by a transmit thread when scheduler_next() has nothing for it:
+ * true if there never will be, false if it should wait for more chunks
+ * from the coordinator
+ */
+int scheduler_is_finished(const struct Scheduler *scheduler);
+
+/**
+ * With "--worker", hand out chunks only as they are leased from the
+ * coordinator, rather than all of them
+ */
+void scheduler_use_leases(struct Scheduler *scheduler);
+
+/**
+ * Called by the worker when the coordinator leases us a chunk, by its
+ * number counting from index 0, like in "resume-chunks"
+ * @return
+ *      0 on success, or -1 if it's not one of our chunks, or the queue
+ *      is full
+ */
+int scheduler_lease(struct Scheduler *scheduler, unsigned chunk);
+
+/**
+ * Called by the worker to get the chunks that are done, to report them
+ * to the coordinator
+ * @return
+ *      1 if there was one, 0 otherwise
+ */
+int scheduler_reap(struct Scheduler *scheduler, unsigned *chunk);
+
+/**
+ * The number of leased chunks the transmit threads haven't started yet
+ */
+unsigned scheduler_queued(const struct Scheduler *scheduler);
+
+/**
+ * Called by the main thread: everything below this index is done
+ */
+uint64_t scheduler_low_water(struct Scheduler *scheduler);
+
+/**
+ * Called by the main thread: roughly how much of the index is done,
+ * for the status line
+ */
+uint64_t scheduler_progress(const struct Scheduler *scheduler);
+
+/**
+ * Called by the main thread when saving "--resume" information: the
+ * chunks done above the low water mark
+ */
+void scheduler_get_done(struct Scheduler *scheduler, struct RangeList *done);
+
+/**
+ * A transmit thread's own sequence of targets: the chunks it has taken,
+ * one after the other. Every position in it is one slot for the first
+ * probe to its target, and one for each retry to the target 'gap'
+ * positions before, for every retry, so a retry is always sent by the
+ * thread that sent the first probe, 'gap' positions of its own later.
+ */
+struct SchedulerCursor;
+
+struct SchedulerCursor *
+scheduler_cursor_create(struct Scheduler *scheduler, unsigned retries,
+                        uint64_t gap);
+
+void scheduler_cursor_destroy(struct SchedulerCursor *cursor);
+
+/**
+ * Called by a transmit thread for each packet of the rate, taking the
+ * next chunk from the scheduler when it needs one, and marking chunks
+ * done once their last retry has been sent
+ * @param index
+ *      the target, counting from the start of the scan
+ * @param retry
+ *      0 for the first probe, or which retry this is
+ * @return
+ *      1 if there's a probe to send, 0 if this slot is empty but still
+ *      costs a packet of the rate, so that retries stay "--retry-delay"
+ *      apart, or -1 if there are no chunks left for now, and no retries
+ *      to send
+ */
+int
+scheduler_cursor_next(struct SchedulerCursor *cursor, uint64_t *index,
+                      unsigned *retry);
+
+int scheduler_selftest(void);
+
+#endif
@@ -0,0 +1,740 @@
+/*
+    counters, and exporting them
+
+    The counters themselves are updated by the transmit and receive
+    threads without any locking: each counter has exactly one writer, and
+    each thread's counters are on their own cache line. The main thread
+    reads them without locking either, so a total may be a packet or two
+    behind, which doesn't matter for statistics.
+
+    The main thread then does two things with the totals:
+    - "--stats-file" appends a JSON object per line, once per
+      "--stats-interval" seconds, which is easy to graph later
+    - "--stats-listen" serves the latest totals over HTTP on the local
+      machine, either on a loopback TCP port, or a Unix domain socket.
+      "GET /metrics" returns the Prometheus text format, anything else
+      returns the same JSON object as the file.
+
+    The HTTP server runs on its own thread, which only ever reads a copy
+    of the totals, protected by a sequence number (a "seqlock"), so that
+    a slow client can never hold up the main thread.
+*/
+#include "main-stats.h"
+#include "masscan.h"
+#include "packet-queue.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "string-fmt.h"
+#include "logger.h"
+#include "string_s.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(WIN32)
+#include <WinSock.h>
+typedef int socklen_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket(fd) close(fd)
+#endif
+
+struct StatsExporter {
+    FILE *fp;
+    unsigned interval;
+    uint64_t start;         /* from pixie_gettime() */
+    uint64_t last_write;
+
+    /* The latest totals, for the HTTP thread. The sequence number is odd
+     * while the main thread is updating them. */
+    struct StatsSample snapshot;
+    volatile unsigned sequence;
+
+    SOCKET fd;
+    char unix_path[256];
+    volatile unsigned is_closing;
+    volatile unsigned is_done;
+};
+
+/***************************************************************************
+ * Everything we export, in the order we export it
+ ***************************************************************************/
+static const struct StatsField {
+    const char *name;
+    const char *help;
+    unsigned is_gauge;
+    size_t offset;
+} fields[] = {
+    {"probes_sent",     "Scan probes transmitted", 0,
+        offsetof(struct StatsSample, probes_sent)},
+    {"packets_sent",    "Other packets transmitted, such as ACKs", 0,
+        offsetof(struct StatsSample, packets_sent)},
+    {"send_errors",     "Packets the adapter failed to transmit", 0,
+        offsetof(struct StatsSample, send_errors)},
+    {"probes_suppressed", "Retries not sent, because the target was unreachable", 0,
+        offsetof(struct StatsSample, probes_suppressed)},
+    {"probes_answered", "Retries not sent, because the target already answered", 0,
+        offsetof(struct StatsSample, probes_answered)},
+    {"frames_received", "Frames received from the adapter", 0,
+        offsetof(struct StatsSample, frames_received)},
+    {"frames_filtered", "Frames that were corrupt, or not to our address or port", 0,
+        offsetof(struct StatsSample, frames_filtered)},
+    {"bad_cookies",     "Responses with the wrong SYN-cookie", 0,
+        offsetof(struct StatsSample, bad_cookies)},
+    {"duplicates",      "Responses ignored as duplicates", 0,
+        offsetof(struct StatsSample, duplicates)},
+    {"reported",        "Port states sent to the output", 0,
+        offsetof(struct StatsSample, reported)},
+    {"tcb_created",     "TCP connections created for banners", 0,
+        offsetof(struct StatsSample, tcb_created)},
+    {"tcb_destroyed",   "TCP connections closed", 0,
+        offsetof(struct StatsSample, tcb_destroyed)},
+    {"tcb_timeouts",    "TCP connections closed because they timed out", 0,
+        offsetof(struct StatsSample, tcb_timeouts)},
+    {"tcb_active",      "TCP connections currently open", 1,
+        offsetof(struct StatsSample, tcb_active)},
+    {"banners",         "Banners sent to the output", 0,
+        offsetof(struct StatsSample, banners)},
+    {"transmit_queue",  "Packets queued by the receive threads, waiting to be sent", 1,
+        offsetof(struct StatsSample, transmit_queue)},
+    {"kernel_drops",    "Received frames the kernel dropped before we could read them", 0,
+        offsetof(struct StatsSample, kernel_drops)},
+    {"rtt_samples",     "Round-trip times measured, from a sample of probes", 0,
+        offsetof(struct StatsSample, rtt_samples)},
+    {"rtt_usecs",       "The sum of the round-trip times measured, in microseconds", 0,
+        offsetof(struct StatsSample, rtt_usecs)},
+    {"hosts_discovered", "Live hosts found by \"--discover\", to be port scanned", 0,
+        offsetof(struct StatsSample, hosts_discovered)},
+    {"rate_limit",      "Packets/second we are trying to send, for all threads", 1,
+        offsetof(struct StatsSample, rate_limit)},
+    {0, 0, 0, 0}
+};
+
+static uint64_t
+field_value(const struct StatsSample *sample, const struct StatsField *f)
+{
+    return *(const uint64_t *)((const char *)sample + f->offset);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stats_sample_add(struct StatsSample *sample,
+                 const struct TransmitStats *tx,
+                 const struct ReceiveStats *rx,
+                 uint64_t transmit_queue)
+{
+    sample->probes_sent += tx->probes;
+    sample->packets_sent += tx->packets;
+    sample->send_errors += tx->send_errors;
+    sample->probes_suppressed += tx->suppressed;
+    sample->probes_answered += tx->answered;
+    sample->frames_received += rx->frames;
+    sample->frames_filtered += rx->corrupt + rx->not_mine + rx->not_my_port;
+    sample->bad_cookies += rx->bad_cookie;
+    sample->duplicates += rx->duplicate;
+    sample->reported += rx->reported;
+    sample->tcb_created += rx->tcp_stats.created;
+    sample->tcb_destroyed += rx->tcp_stats.destroyed;
+    sample->tcb_timeouts += rx->tcp_stats.timeouts;
+    sample->tcb_active += rx->tcp_stats.created - rx->tcp_stats.destroyed;
+    sample->banners += rx->tcp_stats.banners;
+    sample->transmit_queue += transmit_queue;
+    sample->kernel_drops += rx->kernel_drops;
+    sample->rtt_samples += rx->rtt_samples;
+    sample->rtt_usecs += rx->rtt_usecs;
+    sample->hosts_discovered += rx->discovered;
+}
+
+/***************************************************************************
+ * Format the totals as a single-line JSON object
+ ***************************************************************************/
+static void
+format_json(struct FmtBuf *fb, const struct StatsSample *sample,
+            time_t now, uint64_t elapsed)
+{
+    const struct StatsField *f;
+    char tmp[64];
+
+    fmt_string(fb, "{\"time\":");
+    fmt_u64(fb, (uint64_t)now);
+    sprintf_s(tmp, sizeof(tmp), ",\"elapsed\":%.3f", elapsed/1000000.0);
+    fmt_string(fb, tmp);
+    for (f=fields; f->name; f++) {
+        fmt_string(fb, ",\"");
+        fmt_string(fb, f->name);
+        fmt_string(fb, "\":");
+        fmt_u64(fb, field_value(sample, f));
+    }
+
+    /* For "--profile", the cycles per probe sent, or per frame received,
+     * spent in each stage */
+    if (sample->has_profile) {
+        unsigned i;
+
+        fmt_string(fb, ",\"profile\":{");
+        for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+            uint64_t packets = (i >= PROFILE_FIRST_RECEIVE)
+                                ? sample->frames_received
+                                : sample->probes_sent;
+            sprintf_s(tmp, sizeof(tmp), "%s\"%s\":%.1f",
+                i ? "," : "",
+                profile_stage_name(i),
+                packets ? (double)sample->profile_cycles[i] / packets : 0.0);
+            fmt_string(fb, tmp);
+        }
+        fmt_char(fb, '}');
+    }
+
+    /* For "--adaptive-rate", why the rate was last changed */
+    if (sample->has_rate_control) {
+        fmt_string(fb, ",\"rate_decision\":\"");
+        fmt_string(fb, ratectl_reason_name(sample->rate_reason));
+        fmt_char(fb, '"');
+    }
+    fmt_string(fb, "}\n");
+}
+
+/***************************************************************************
+ * Format the totals in the Prometheus text exposition format
+ ***************************************************************************/
+static void
+format_prometheus(struct FmtBuf *fb, const struct StatsSample *sample)
+{
+    const struct StatsField *f;
+
+    for (f=fields; f->name; f++) {
+        const char *suffix = f->is_gauge ? "" : "_total";
+
+        fmt_string(fb, "# HELP masscan_");
+        fmt_string(fb, f->name);
+        fmt_string(fb, suffix);
+        fmt_char(fb, ' ');
+        fmt_string(fb, f->help);
+        fmt_string(fb, "\n# TYPE masscan_");
+        fmt_string(fb, f->name);
+        fmt_string(fb, suffix);
+        fmt_string(fb, f->is_gauge ? " gauge\n" : " counter\n");
+        fmt_string(fb, "masscan_");
+        fmt_string(fb, f->name);
+        fmt_string(fb, suffix);
+        fmt_char(fb, ' ');
+        fmt_u64(fb, field_value(sample, f));
+        fmt_char(fb, '\n');
+    }
+
+    if (sample->has_profile) {
+        unsigned i;
+
+        fmt_string(fb, "# HELP masscan_profile_cycles_total CPU cycles spent in each stage\n");
+        fmt_string(fb, "# TYPE masscan_profile_cycles_total counter\n");
+        for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+            fmt_string(fb, "masscan_profile_cycles_total{stage=\"");
+            fmt_string(fb, profile_stage_name(i));
+            fmt_string(fb, "\"} ");
+            fmt_u64(fb, sample->profile_cycles[i]);
+            fmt_char(fb, '\n');
+        }
+        fmt_string(fb, "# HELP masscan_profile_calls_total Times each stage ran\n");
+        fmt_string(fb, "# TYPE masscan_profile_calls_total counter\n");
+        for (i=0; i<PROFILE_STAGE_COUNT; i++) {
+            fmt_string(fb, "masscan_profile_calls_total{stage=\"");
+            fmt_string(fb, profile_stage_name(i));
+            fmt_string(fb, "\"} ");
+            fmt_u64(fb, sample->profile_calls[i]);
+            fmt_char(fb, '\n');
+        }
+    }
+
+    if (sample->has_rate_control) {
+        unsigned i;
+
+        fmt_string(fb, "# HELP masscan_rate_decreases_total Times --adaptive-rate slowed down, by reason\n");
+        fmt_string(fb, "# TYPE masscan_rate_decreases_total counter\n");
+        for (i=Rate_SendErrors; i<RATE_REASON_COUNT; i++) {
+            fmt_string(fb, "masscan_rate_decreases_total{reason=\"");
+            fmt_string(fb, ratectl_reason_name(i));
+            fmt_string(fb, "\"} ");
+            fmt_u64(fb, sample->rate_decreases[i]);
+            fmt_char(fb, '\n');
+        }
+    }
+}
+
+/***************************************************************************
+ * Get a consistent copy of the latest totals, retrying if the main
+ * thread was updating them at the same time
+ ***************************************************************************/
+static void
+snapshot_read(const struct StatsExporter *st, struct StatsSample *sample)
+{
+    for (;;) {
+        unsigned sequence = st->sequence;
+
+        rte_rmb();
+        if ((sequence & 1) == 0) {
+            memcpy(sample, &st->snapshot, sizeof(*sample));
+            rte_rmb();
+            if (sequence == st->sequence)
+                return;
+        }
+        pixie_usleep(10);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+snapshot_write(struct StatsExporter *st, const struct StatsSample *sample)
+{
+    st->sequence++;
+    rte_wmb();
+    memcpy(&st->snapshot, sample, sizeof(*sample));
+    rte_wmb();
+    st->sequence++;
+}
+
+/***************************************************************************
+ * Answer one HTTP request. We only look at the path in the first line.
+ ***************************************************************************/
+static void
+serve_request(struct StatsExporter *st, SOCKET fd)
+{
+    char request[1024];
+    char body[8192];
+    char header[256];
+    struct FmtBuf fb[1];
+    struct StatsSample sample;
+    const char *content_type;
+    size_t length = 0;
+    const char *p;
+
+    /* Read until the end of the request line. Clients may send more,
+     * but we don't care about the headers. */
+    while (length < sizeof(request) - 1) {
+        int n = recv(fd, request + length, (int)(sizeof(request) - 1 - length), 0);
+        if (n <= 0)
+            break;
+        length += n;
+        request[length] = '\0';
+        if (strchr(request, '\n'))
+            break;
+    }
+    request[length] = '\0';
+    if (length < 4 || memcmp(request, "GET ", 4) != 0) {
+        const char *bad = "HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n";
+        send(fd, bad, (int)strlen(bad), 0);
+        return;
+    }
+    p = request + 4;
+
+    snapshot_read(st, &sample);
+    fmt_init(fb, body, sizeof(body));
+    if (strncmp(p, "/metrics", 8) == 0 && (isspace(p[8]&0xFF) || p[8] == '?')) {
+        format_prometheus(fb, &sample);
+        content_type = "text/plain; version=0.0.4";
+    } else {
+        format_json(fb, &sample, time(0), pixie_gettime() - st->start);
+        content_type = "application/json";
+    }
+
+    sprintf_s(header, sizeof(header),
+              "HTTP/1.0 200 OK\r\n"
+              "Content-Type: %s\r\n"
+              "Content-Length: %u\r\n"
+              "Connection: close\r\n"
+              "\r\n",
+              content_type, (unsigned)fb->length);
+    send(fd, header, (int)strlen(header), 0);
+    send(fd, body, (int)fb->length, 0);
+}
+
+/***************************************************************************
+ * The HTTP server thread. It handles one client at a time, which is
+ * plenty for something polled every few seconds.
+ ***************************************************************************/
+static void
+stats_server_thread(void *v)
+{
+    struct StatsExporter *st = (struct StatsExporter *)v;
+
+    while (!st->is_closing) {
+        fd_set readset;
+        struct timeval tv;
+        SOCKET fd;
+
+        /* Wake up every 100 milliseconds to check whether we are done */
+        FD_ZERO(&readset);
+        FD_SET(st->fd, &readset);
+        tv.tv_sec = 0;
+        tv.tv_usec = 100000;
+        if (select((int)st->fd + 1, &readset, 0, 0, &tv) <= 0)
+            continue;
+
+        fd = accept(st->fd, 0, 0);
+        if (fd == INVALID_SOCKET)
+            continue;
+
+        /* Don't let a client that never sends anything hang us */
+        {
+#if defined(WIN32)
+            DWORD timeout = 1000;
+#else
+            struct timeval timeout;
+            timeout.tv_sec = 1;
+            timeout.tv_usec = 0;
+#endif
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO,
+                       (const char *)&timeout, sizeof(timeout));
+        }
+        serve_request(st, fd);
+        closesocket(fd);
+    }
+
+    closesocket(st->fd);
+#if !defined(WIN32)
+    if (st->unix_path[0])
+        unlink(st->unix_path);
+#endif
+    st->is_done = 1;
+}
+
+/***************************************************************************
+ * Parse "--stats-listen", which is one of:
+ *      9100
+ *      127.0.0.1:9100
+ *      localhost:9100
+ *      unix:/var/run/masscan.sock
+ *      /var/run/masscan.sock
+ * Only the loopback address is allowed, since there's no authentication.
+ * @return
+ *      0 on success, -1 on a bad address
+ ***************************************************************************/
+static int
+parse_listen(const char *addr, unsigned *r_ip, unsigned *r_port,
+             char *unix_path, size_t sizeof_unix_path)
+{
+    const char *colon;
+    unsigned ip = 0x7F000001;
+    unsigned port = 0;
+
+    unix_path[0] = '\0';
+    if (strncmp(addr, "unix:", 5) == 0)
+        addr += 5;
+    if (addr[0] == '/' || addr[0] == '.') {
+        if (strlen(addr) + 1 > sizeof_unix_path)
+            return -1;
+        strcpy_s(unix_path, sizeof_unix_path, addr);
+        return 0;
+    }
+
+    colon = strrchr(addr, ':');
+    if (colon) {
+        size_t host_length = colon - addr;
+
+        if (host_length == 9 && memcmp(addr, "localhost", 9) == 0)
+            ;
+        else {
+            unsigned octets[4] = {0,0,0,0};
+            unsigned i;
+            const char *p = addr;
+
+            for (i=0; i<4; i++) {
+                if (!isdigit(*p&0xFF))
+                    return -1;
+                while (isdigit(*p&0xFF)) {
+                    octets[i] = octets[i]*10 + (*p++ - '0');
+                    if (octets[i] > 255)
+                        return -1;
+                }
+                if (*p != (i<3 ? '.' : ':'))
+                    return -1;
+                p++;
+            }
+            if (octets[0] != 127)
+                return -1;
+            ip = octets[0]<<24 | octets[1]<<16 | octets[2]<<8 | octets[3];
+        }
+        addr = colon + 1;
+    }
+
+    if (!isdigit(addr[0]&0xFF))
+        return -1;
+    while (isdigit(addr[0]&0xFF)) {
+        port = port*10 + (*addr++ - '0');
+        if (port > 65535)
+            return -1;
+    }
+    if (addr[0] != '\0' || port == 0)
+        return -1;
+
+    *r_ip = ip;
+    *r_port = port;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static SOCKET
+stats_listen(struct StatsExporter *st, const char *addr)
+{
+    SOCKET fd;
+    unsigned ip = 0;
+    unsigned port = 0;
+
+    if (parse_listen(addr, &ip, &port, st->unix_path, sizeof(st->unix_path)) != 0) {
+        LOG(0, "stats: %s: expected a loopback port like \"127.0.0.1:9100\", "
+               "or a Unix socket like \"unix:/tmp/masscan.sock\"\n", addr);
+        return INVALID_SOCKET;
+    }
+
+    if (st->unix_path[0]) {
+#if defined(WIN32)
+        LOG(0, "stats: %s: Unix sockets aren't supported here\n", addr);
+        return INVALID_SOCKET;
+#else
+        struct sockaddr_un sun;
+        struct stat s;
+
+        if (strlen(st->unix_path) >= sizeof(sun.sun_path)) {
+            LOG(0, "stats: %s: path too long\n", st->unix_path);
+            return INVALID_SOCKET;
+        }
+
+        /* Remove a socket left over from a previous run, but never
+         * anything else */
+        if (stat(st->unix_path, &s) == 0 && S_ISSOCK(s.st_mode))
+            unlink(st->unix_path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET)
+            goto fail;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        memcpy(sun.sun_path, st->unix_path, strlen(st->unix_path) + 1);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            closesocket(fd);
+            goto fail;
+        }
+#endif
+    } else {
+        struct sockaddr_in sin;
+        int yes = 1;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == INVALID_SOCKET)
+            goto fail;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(ip);
+        sin.sin_port = htons((unsigned short)port);
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) {
+            closesocket(fd);
+            goto fail;
+        }
+    }
+
+    if (listen(fd, 8) != 0) {
+        closesocket(fd);
+        goto fail;
+    }
+    LOG(1, "stats: listening on %s\n", addr);
+    return fd;
+
+fail:
+    LOG(0, "stats: %s: %s\n", addr, strerror_x(errno));
+    st->unix_path[0] = '\0';
+    return INVALID_SOCKET;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct StatsExporter *
+stats_create(const struct Masscan *masscan)
+{
+    struct StatsExporter *st;
+
+    if (masscan->stats_filename[0] == '\0' && masscan->stats_listen[0] == '\0')
+        return NULL;
+
+    st = (struct StatsExporter *)malloc(sizeof(*st));
+    if (st == NULL)
+        exit(1);
+    memset(st, 0, sizeof(*st));
+    st->fd = INVALID_SOCKET;
+    st->interval = masscan->stats_interval ? masscan->stats_interval : 1;
+    st->start = pixie_gettime();
+
+    if (masscan->stats_filename[0]) {
+        int err = fopen_s(&st->fp, masscan->stats_filename, "a");
+        if (err || st->fp == NULL) {
+            LOG(0, "stats: %s: %s\n", masscan->stats_filename, strerror_x(err));
+            exit(1);
+        }
+    }
+
+    if (masscan->stats_listen[0]) {
+        st->fd = stats_listen(st, masscan->stats_listen);
+        if (st->fd == INVALID_SOCKET)
+            exit(1);
+        pixie_begin_thread(stats_server_thread, 0, st);
+    }
+
+    return st;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+stats_write(struct StatsExporter *st, const struct StatsSample *sample,
+            uint64_t now)
+{
+    char buf[4096];
+    struct FmtBuf fb[1];
+
+    fmt_init(fb, buf, sizeof(buf));
+    format_json(fb, sample, time(0), now - st->start);
+    fwrite(buf, 1, fb->length, st->fp);
+    fflush(st->fp);
+    st->last_write = now;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stats_update(struct StatsExporter *st, const struct StatsSample *sample)
+{
+    uint64_t now;
+
+    if (st == NULL)
+        return;
+    now = pixie_gettime();
+
+    if (st->fd != INVALID_SOCKET)
+        snapshot_write(st, sample);
+
+    if (st->fp && now - st->last_write >= st->interval * 1000000ULL)
+        stats_write(st, sample, now);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stats_destroy(struct StatsExporter *st, const struct StatsSample *sample)
+{
+    if (st == NULL)
+        return;
+
+    if (st->fp) {
+        stats_write(st, sample, pixie_gettime());
+        fclose(st->fp);
+    }
+
+    if (st->fd != INVALID_SOCKET) {
+        st->is_closing = 1;
+        while (!st->is_done)
+            pixie_usleep(10000);
+    }
+
+    free(st);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+stats_selftest(void)
+{
+    struct StatsSample sample;
+    struct TransmitStats tx;
+    struct ReceiveStats rx;
+    struct FmtBuf fb[1];
+    char buf[8192];
+    char path[256];
+    unsigned ip, port;
+
+    /* Threads must not share cache lines */
+    if (sizeof(tx) % 64 != 0 || sizeof(rx) % 64 != 0)
+        goto fail;
+
+    memset(&sample, 0, sizeof(sample));
+    memset(&tx, 0, sizeof(tx));
+    memset(&rx, 0, sizeof(rx));
+    tx.probes = 1000;
+    rx.frames = 100;
+    rx.corrupt = 1;
+    rx.not_mine = 2;
+    rx.not_my_port = 3;
+    rx.tcp_stats.created = 10;
+    rx.tcp_stats.destroyed = 4;
+    stats_sample_add(&sample, &tx, &rx, 7);
+    stats_sample_add(&sample, &tx, &rx, 0);
+    if (sample.probes_sent != 2000 || sample.frames_filtered != 12
+        || sample.tcb_active != 12 || sample.transmit_queue != 7)
+        goto fail;
+
+    fmt_init(fb, buf, sizeof(buf));
+    format_json(fb, &sample, 1234567890, 1500000);
+    fmt_cstr(fb);
+    if (strncmp(buf, "{\"time\":1234567890,\"elapsed\":1.500,\"probes_sent\":2000,", 54) != 0
+        || strstr(buf, ",\"transmit_queue\":7,") == NULL
+        || strstr(buf, ",\"rate_limit\":0}\n") == NULL)
+        goto fail;
+
+    fmt_init(fb, buf, sizeof(buf));
+    format_prometheus(fb, &sample);
+    fmt_cstr(fb);
+    if (strstr(buf, "# TYPE masscan_probes_sent_total counter\n"
+                    "masscan_probes_sent_total 2000\n") == NULL
+        || strstr(buf, "# TYPE masscan_tcb_active gauge\n"
+                       "masscan_tcb_active 12\n") == NULL)
+        goto fail;
+
+    /* "--profile" adds cycles per packet for each stage */
+    sample.has_profile = 1;
+    sample.profile_cycles[Profile_Shuffle] = 5000;
+    sample.profile_calls[Profile_Shuffle] = 2000;
+    fmt_init(fb, buf, sizeof(buf));
+    format_json(fb, &sample, 1234567890, 1500000);
+    fmt_cstr(fb);
+    if (strstr(buf, ",\"profile\":{\"throttle\":0.0,\"shuffle\":2.5,") == NULL)
+        goto fail;
+    fmt_init(fb, buf, sizeof(buf));
+    format_prometheus(fb, &sample);
+    fmt_cstr(fb);
+    if (strstr(buf, "masscan_profile_cycles_total{stage=\"shuffle\"} 5000\n") == NULL)
+        goto fail;
+
+    if (parse_listen("9100", &ip, &port, path, sizeof(path)) != 0
+        || ip != 0x7F000001 || port != 9100 || path[0])
+        goto fail;
+    if (parse_listen("127.0.0.2:80", &ip, &port, path, sizeof(path)) != 0
+        || ip != 0x7F000002 || port != 80)
+        goto fail;
+    if (parse_listen("unix:/tmp/x.sock", &ip, &port, path, sizeof(path)) != 0
+        || strcmp(path, "/tmp/x.sock") != 0)
+        goto fail;
+    if (parse_listen("0.0.0.0:9100", &ip, &port, path, sizeof(path)) == 0
+        || parse_listen("10.1.2.3:9100", &ip, &port, path, sizeof(path)) == 0
+        || parse_listen("127.0.0.1:99999", &ip, &port, path, sizeof(path)) == 0
+        || parse_listen("127.0.0.1:4294976396", &ip, &port, path, sizeof(path)) == 0
+        || parse_listen("4294967423.0.0.1:80", &ip, &port, path, sizeof(path)) == 0)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "stats: selftest failed\n");
+    return 1;
+}
@@ -0,0 +1,126 @@
+/*
+    counters, and exporting them
+
+    Each thread counts what it does in its own block of counters, which
+    is aligned to a cache line so that threads don't slow each other
+    down by writing to the same line. Once per interval, the main thread
+    adds up the blocks from all the threads, then writes the totals as a
+    JSON line to "--stats-file", and serves them over HTTP, both as JSON
+    and in Prometheus text format, at "--stats-listen".
+*/
+#ifndef MAIN_STATS_H
+#define MAIN_STATS_H
+#include <stdint.h>
+#include "proto-tcp.h"
+#include "pixie-threads.h"  /* CACHE_ALIGNED */
+#include "main-profile.h"   /* PROFILE_STAGE_COUNT */
+#include "main-ratectl.h"   /* RATE_REASON_COUNT */
+
+struct Masscan;
+struct StatsExporter;
+
+/**
+ * Written only by the transmit thread
+ */
+struct CACHE_ALIGNED TransmitStats {
+    uint64_t probes;        /* scan probes sent */
+    uint64_t packets;       /* sent for the receive thread, like ACKs */
+    uint64_t send_errors;
+    uint64_t suppressed;    /* retries skipped, the target was unreachable */
+    uint64_t answered;      /* retries skipped, the target already answered */
+};
+
+/**
+ * Written only by the receive thread: what it did with the frames it
+ * received, stage by stage
+ */
+struct CACHE_ALIGNED ReceiveStats {
+    uint64_t frames;
+    uint64_t corrupt;       /* too long, or couldn't be parsed */
+    uint64_t not_mine;      /* not to our IP address */
+    uint64_t arp;
+    uint64_t udp;
+    uint64_t icmp;
+    uint64_t sctp;
+    uint64_t tcp;
+    uint64_t not_my_port;
+    uint64_t bad_cookie;
+    uint64_t duplicate;
+    uint64_t reported;      /* port status sent to output */
+    uint64_t tcp_payload;   /* data given to the banner parsers */
+    uint64_t kernel_drops;  /* frames the kernel dropped, from libpcap */
+    uint64_t rtt_samples;   /* round-trip times measured */
+    uint64_t rtt_usecs;     /* the sum of them */
+    uint64_t discovered;    /* live hosts queued for "--discover" */
+    struct TCP_Stats tcp_stats;
+};
+
+/**
+ * The totals for all threads at one point in time
+ */
+struct StatsSample {
+    uint64_t probes_sent;
+    uint64_t packets_sent;
+    uint64_t send_errors;
+    uint64_t probes_suppressed;
+    uint64_t probes_answered;
+    uint64_t frames_received;
+    uint64_t frames_filtered;
+    uint64_t bad_cookies;
+    uint64_t duplicates;
+    uint64_t reported;
+    uint64_t tcb_created;
+    uint64_t tcb_destroyed;
+    uint64_t tcb_timeouts;
+    uint64_t tcb_active;
+    uint64_t banners;
+    uint64_t transmit_queue;
+    uint64_t kernel_drops;
+    uint64_t rtt_samples;
+    uint64_t rtt_usecs;
+    uint64_t hosts_discovered;
+    uint64_t rate_limit;
+
+    /* For "--adaptive-rate", the last decision, and how many times the
+     * rate was lowered for each reason */
+    unsigned has_rate_control;
+    unsigned rate_reason;
+    uint64_t rate_decreases[RATE_REASON_COUNT];
+
+    /* For "--profile", the cycles spent in each stage, otherwise zero */
+    unsigned has_profile;
+    uint64_t profile_calls[PROFILE_STAGE_COUNT];
+    uint64_t profile_cycles[PROFILE_STAGE_COUNT];
+};
+
+/**
+ * Add one thread-pair's counters into the totals
+ * @param transmit_queue
+ *      the number of packets waiting for the transmit thread to send
+ */
+void stats_sample_add(struct StatsSample *sample,
+                      const struct TransmitStats *tx,
+                      const struct ReceiveStats *rx,
+                      uint64_t transmit_queue);
+
+/**
+ * Open the "--stats-file" and start listening on "--stats-listen"
+ * @return
+ *      NULL if neither was asked for. Errors are fatal.
+ */
+struct StatsExporter *stats_create(const struct Masscan *masscan);
+
+/**
+ * Called by the main thread about once a second with the latest totals.
+ * The line is only written to the file once per "--stats-interval".
+ */
+void stats_update(struct StatsExporter *st, const struct StatsSample *sample);
+
+/**
+ * Write the final totals, stop the server, and close the file
+ */
+void stats_destroy(struct StatsExporter *st, const struct StatsSample *sample);
+
+int stats_selftest(void);
+
+#endif
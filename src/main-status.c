@@ -16,7 +16,6 @@
 
 
 extern time_t global_now;
-extern uint64_t global_tcb_count;
 
 /***************************************************************************
  * Print a status message about once-per-second to the command-line. This
@@ -28,7 +27,8 @@ status_print(
     struct Status *status, 
     uint64_t count, 
     uint64_t max_count, 
-    double x)
+    double x,
+    uint64_t tcb_count)
 {
     double elapsed_time;
     double rate;
@@ -106,7 +106,7 @@ status_print(
                     (unsigned)(time_remaining/60/60),
                     (unsigned)(time_remaining/60)%60,
                     (unsigned)(time_remaining)%60,
-                    global_tcb_count
+                    (unsigned long long)tcb_count
                     //(unsigned)rate
                     );
     fflush(stderr);
@@ -18,7 +18,8 @@ struct Status
 };
 
 
-void status_print(struct Status *status, uint64_t count, uint64_t max_count, double x);
+void status_print(struct Status *status, uint64_t count, uint64_t max_count,
+                  double x, uint64_t tcb_count);
 void status_finish(struct Status *status);
 void status_start(struct Status *status);
 
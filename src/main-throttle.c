@@ -44,6 +44,18 @@ throttler_start(struct Throttler *throttler, double max_rate)
     LOG(1, "maxrate = %0.2f\n", throttler->max_rate);
 }
 
+/***************************************************************************
+ * The transmit thread reads the rate once per batch, so it picks up the
+ * new rate on the next one. Since the rate is averaged over the last 256
+ * batches, slowing down takes effect right away, with a pause, whereas
+ * speeding up happens gradually.
+ ***************************************************************************/
+void
+throttler_set_rate(struct Throttler *throttler, double max_rate)
+{
+    throttler->max_rate = max_rate;
+}
+
 
 /***************************************************************************
  * We return the number of packets that can be sent in a batch. Thus,
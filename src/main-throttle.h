@@ -24,4 +24,10 @@ struct Throttler
 uint64_t throttler_next_batch(struct Throttler *throttler, uint64_t count);
 void throttler_start(struct Throttler *status, double max_rate);
 
+/**
+ * Change the rate while the transmit thread is running, such as for
+ * "--adaptive-rate". Called from the main thread.
+ */
+void throttler_set_rate(struct Throttler *throttler, double max_rate);
+
 #endif
@@ -0,0 +1,425 @@
+/*
+    "--worker": scanning chunks leased from a "--coordinator"
+
+    The lease thread keeps a few chunks queued in the scheduler for the
+    transmit threads, asking the coordinator for more as they are taken.
+    Once a second it sends a heartbeat, so that the coordinator knows we
+    are still working on the chunks we have. When the coordinator says
+    every chunk is done, the transmit threads finish, and the scan ends
+    the same way any other does.
+
+    A chunk is only reported done once "--wait" has passed since its last
+    probe, and every receive thread has sent the coordinator the results
+    from up to then, so that if we die after reporting it, nothing from
+    it is lost. Until then, the coordinator gives it to another worker if
+    we die.
+
+    If we lose the coordinator, we scan the chunks we already have, and
+    stop. The coordinator gives the ones we didn't report to another
+    worker.
+*/
+#include "main-worker.h"
+#include "main-scheduler.h"
+#include "masscan.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Results are buffered, and sent whenever the buffer fills, or once a
+ * second, either when the next one comes along, or from the receive
+ * thread when nothing does (worker_output_idle())
+ */
+struct WorkerOutput {
+    SOCKET fd;
+    unsigned slot;
+    time_t last_send;
+    size_t length;
+    unsigned char buf[16384];
+};
+
+/* For each receive thread's WorkerOutput, every result from before this
+ * second has been sent to the coordinator. They're here rather than in
+ * the WorkerOutput, since the lease thread looks at them until it ends,
+ * after the receive threads have gone. */
+#define WORKER_OUTPUTS_MAX 8
+static volatile time_t flushed[WORKER_OUTPUTS_MAX];
+static volatile unsigned flushed_count;
+static volatile unsigned is_results_lost;
+
+/***************************************************************************
+ * Whether all the results up to and including second 'due' have been
+ * sent to the coordinator
+ ***************************************************************************/
+static int
+is_flushed(time_t due)
+{
+    unsigned i;
+
+    if (flushed_count == 0)
+        return 0;
+    for (i=0; i<flushed_count; i++) {
+        if (flushed[i] <= due)
+            return 0;
+    }
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Worker *
+worker_create(const struct Masscan *masscan)
+{
+    struct Worker *worker;
+    struct LeaseBuffer in;
+    unsigned char payload[LEASE_PAYLOAD_MAX];
+    unsigned type;
+    unsigned length;
+    SOCKET fd;
+
+    fd = lease_connect(masscan, Lease_KindControl);
+    if (fd == INVALID_SOCKET)
+        return NULL;
+
+    /* The first thing the coordinator sends is whether it wants us */
+    memset(&in, 0, sizeof(in));
+    while (!lease_next(&in, &type, payload, &length)) {
+        if (lease_wait(fd, 10000) <= 0 || lease_recv(fd, &in) < 0) {
+            LOG(0, "worker: no welcome from the coordinator\n");
+            closesocket(fd);
+            return NULL;
+        }
+    }
+    if (type == Lease_Reject) {
+        LOG(0, "worker: coordinator rejected us: %.*s\n", (int)length, payload);
+        closesocket(fd);
+        return NULL;
+    }
+    if (type != Lease_Welcome || length < 24) {
+        LOG(0, "worker: unexpected message from the coordinator\n");
+        closesocket(fd);
+        return NULL;
+    }
+
+    worker = (struct Worker *)malloc(sizeof(*worker));
+    if (worker == NULL)
+        exit(1);
+    memset(worker, 0, sizeof(*worker));
+    worker->masscan = masscan;
+    worker->fd = fd;
+    worker->chunk_size = lease_get64(payload + 0);
+    worker->begin = lease_get64(payload + 8);
+    worker->end = lease_get64(payload + 16);
+
+    /* Enough that every transmit thread has the next chunk waiting */
+    worker->depth = 2 * (masscan->nic_count ? masscan->nic_count : 1) + 2;
+
+    LOG(1, "worker: [%llu..%llu) in chunks of %llu\n",
+        worker->begin, worker->end, worker->chunk_size);
+    return worker;
+}
+
+/***************************************************************************
+ * Keep a chunk that's done until it can be reported, at the end of the
+ * queue, since they're all held for the same time
+ ***************************************************************************/
+static void
+hold_chunk(struct Worker *worker, unsigned chunk, time_t due)
+{
+    struct HeldChunk *x;
+
+    if (worker->held_first + worker->held_count >= worker->held_max) {
+        if (worker->held_first) {
+            memmove(worker->held, worker->held + worker->held_first,
+                    worker->held_count * sizeof(worker->held[0]));
+            worker->held_first = 0;
+        }
+        if (worker->held_count >= worker->held_max) {
+            worker->held_max = worker->held_max * 2 + 64;
+            worker->held = (struct HeldChunk *)realloc(worker->held,
+                                worker->held_max * sizeof(worker->held[0]));
+            if (worker->held == NULL)
+                exit(1);
+        }
+    }
+    x = &worker->held[worker->held_first + worker->held_count++];
+    x->chunk = chunk;
+    x->due = due;
+}
+
+/***************************************************************************
+ * Exchange messages with the coordinator, until we are told to stop
+ ***************************************************************************/
+static void
+worker_thread(void *v)
+{
+    struct Worker *worker = (struct Worker *)v;
+    struct Scheduler *scheduler = worker->scheduler;
+    struct LeaseBuffer in;
+    uint64_t last_heartbeat = 0;
+
+    memset(&in, 0, sizeof(in));
+
+    for (;;) {
+        unsigned char out[4096];
+        size_t length = 0;
+        unsigned char payload[LEASE_PAYLOAD_MAX];
+        unsigned type;
+        unsigned payload_length;
+        unsigned chunk;
+        unsigned queued;
+        int is_closing = worker->is_closing;
+        uint64_t now = pixie_gettime();
+
+        /* The chunks that are done wait for their last responses, and
+         * for those to be sent */
+        while (scheduler_reap(scheduler, &chunk))
+            hold_chunk(worker, chunk, time(0) + worker->masscan->wait);
+        if (is_results_lost && worker->fd != INVALID_SOCKET) {
+            LOG(0, "worker: lost the coordinator, finishing the chunks we have\n");
+            closesocket(worker->fd);
+            worker->fd = INVALID_SOCKET;
+            scheduler->is_final = 1;
+        }
+
+        /* Report the ones that have, as many as there's room for */
+        while (worker->held_count
+            && is_flushed(worker->held[worker->held_first].due)) {
+            unsigned char x[4];
+
+            lease_put32(x, worker->held[worker->held_first].chunk);
+            if (lease_format(out, sizeof(out) - 64, &length, Lease_Done, x, 4) != 0)
+                break;
+            worker->held_first++;
+            worker->held_count--;
+        }
+
+        /* Ask for more to replace the ones that were taken */
+        queued = scheduler_queued(scheduler) + worker->requested;
+        if (!scheduler->is_final && !is_closing && queued < worker->depth) {
+            unsigned char x[4];
+
+            lease_put32(x, worker->depth - queued);
+            lease_format(out, sizeof(out), &length, Lease_Request, x, 4);
+            worker->requested += worker->depth - queued;
+        }
+
+        if (now - last_heartbeat >= 1000000) {
+            lease_format(out, sizeof(out), &length, Lease_Heartbeat, 0, 0);
+            last_heartbeat = now;
+        }
+
+        if (worker->fd != INVALID_SOCKET && length
+            && lease_send_all(worker->fd, out, length) != 0) {
+            LOG(0, "worker: lost the coordinator, finishing the chunks we have\n");
+            closesocket(worker->fd);
+            worker->fd = INVALID_SOCKET;
+            scheduler->is_final = 1;
+        }
+
+        if (is_closing)
+            break;
+
+        /* Wait a bit, for chunks, or for the scan to be over */
+        if (worker->fd == INVALID_SOCKET) {
+            pixie_usleep(100000);
+            continue;
+        }
+        if (lease_wait(worker->fd, 100) <= 0)
+            continue;
+        if (lease_recv(worker->fd, &in) < 0) {
+            LOG(0, "worker: lost the coordinator, finishing the chunks we have\n");
+            closesocket(worker->fd);
+            worker->fd = INVALID_SOCKET;
+            scheduler->is_final = 1;
+            continue;
+        }
+        while (lease_next(&in, &type, payload, &payload_length)) {
+            switch (type) {
+            case Lease_Chunk:
+                if (payload_length < 4)
+                    break;
+                if (worker->requested)
+                    worker->requested--;
+                chunk = lease_get32(payload);
+                if (scheduler_lease(scheduler, chunk) != 0)
+                    LOG(0, "worker: can't scan chunk %u\n", chunk);
+                break;
+            case Lease_Finished:
+                LOG(1, "worker: coordinator says the scan is done\n");
+                scheduler->is_final = 1;
+                break;
+            default:
+                LOG(1, "worker: unexpected message 0x%02x\n", type);
+                break;
+            }
+        }
+    }
+
+    if (worker->fd != INVALID_SOCKET)
+        closesocket(worker->fd);
+    worker->fd = INVALID_SOCKET;
+    worker->is_done = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_start(struct Worker *worker, struct Scheduler *scheduler)
+{
+    worker->scheduler = scheduler;
+    pixie_begin_thread(worker_thread, 0, worker);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_destroy(struct Worker *worker)
+{
+    if (worker == NULL)
+        return;
+
+    worker->is_closing = 1;
+    while (!worker->is_done)
+        pixie_usleep(1000);
+    free(worker->held);
+    free(worker);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+remote_flush(struct WorkerOutput *remote, time_t now)
+{
+    if (remote->fd != INVALID_SOCKET && remote->length
+        && lease_send_all(remote->fd, remote->buf, remote->length) != 0) {
+        LOG(0, "worker: lost the coordinator, results are being dropped\n");
+        closesocket(remote->fd);
+        remote->fd = INVALID_SOCKET;
+        is_results_lost = 1;
+    }
+    remote->length = 0;
+    if (remote->fd != INVALID_SOCKET)
+        flushed[remote->slot] = now;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+remote_add(struct WorkerOutput *remote, time_t now, unsigned type,
+           const unsigned char *payload, unsigned payload_length)
+{
+    if (lease_format(remote->buf, sizeof(remote->buf), &remote->length,
+                     type, payload, payload_length) != 0) {
+        remote_flush(remote, now);
+        lease_format(remote->buf, sizeof(remote->buf), &remote->length,
+                     type, payload, payload_length);
+    }
+    if (now != remote->last_send) {
+        remote_flush(remote, now);
+        remote->last_send = now;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_output_idle(struct WorkerOutput *remote, time_t now)
+{
+    if (now != remote->last_send) {
+        remote_flush(remote, now);
+        remote->last_send = now;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct WorkerOutput *
+worker_output_create(const struct Masscan *masscan)
+{
+    struct WorkerOutput *remote;
+
+    remote = (struct WorkerOutput *)malloc(sizeof(*remote));
+    if (remote == NULL)
+        exit(1);
+    memset(remote, 0, sizeof(*remote));
+
+    remote->fd = lease_connect(masscan, Lease_KindResults);
+    if (remote->fd == INVALID_SOCKET)
+        exit(1);
+    remote->last_send = time(0);
+
+    /* One for each receive thread, of which there's one for each adapter */
+    for (;;) {
+        unsigned n = flushed_count;
+
+        if (n >= WORKER_OUTPUTS_MAX) {
+            LOG(0, "worker: too many receive threads\n");
+            exit(1);
+        }
+        flushed[n] = remote->last_send;
+        if (rte_atomic32_cmpset(&flushed_count, n, n + 1)) {
+            remote->slot = n;
+            break;
+        }
+    }
+    return remote;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_output_status(struct WorkerOutput *remote, time_t timestamp,
+                     int status, unsigned ip, unsigned port,
+                     unsigned reason, unsigned ttl)
+{
+    unsigned char x[15];
+
+    lease_put32(x + 0, (unsigned)timestamp);
+    x[4] = (unsigned char)status;
+    lease_put32(x + 5, ip);
+    lease_put32(x + 9, port);
+    x[13] = (unsigned char)reason;
+    x[14] = (unsigned char)ttl;
+    remote_add(remote, timestamp, Lease_Status, x, sizeof(x));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_output_banner(struct WorkerOutput *remote, time_t timestamp,
+                     unsigned ip, unsigned ip_proto, unsigned port,
+                     unsigned proto, const unsigned char *px, unsigned length)
+{
+    unsigned char x[LEASE_PAYLOAD_MAX];
+
+    if (length > sizeof(x) - 15)
+        length = sizeof(x) - 15;
+    lease_put32(x + 0, (unsigned)timestamp);
+    lease_put32(x + 4, ip);
+    x[8] = (unsigned char)ip_proto;
+    lease_put32(x + 9, port);
+    x[13] = (unsigned char)(proto >> 8);
+    x[14] = (unsigned char)(proto >> 0);
+    memcpy(x + 15, px, length);
+    remote_add(remote, timestamp, Lease_Banner, x, 15 + length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+worker_output_destroy(struct WorkerOutput *remote)
+{
+    if (remote == NULL)
+        return;
+
+    /* Everything has been sent, once this is */
+    remote_flush(remote, (time_t)LONG_MAX);
+    if (remote->fd != INVALID_SOCKET)
+        closesocket(remote->fd);
+    free(remote);
+}
@@ -0,0 +1,88 @@
+/*
+    "--worker": scanning chunks leased from a "--coordinator"
+
+    Instead of a fixed "--shard", a worker asks the coordinator for chunks
+    of the scan, a few at a time, and scans them like any other scan. If
+    the worker dies, the coordinator gives its chunks to the other
+    workers. The results are sent back to the coordinator, which writes
+    the output file. See main-lease.h for the protocol.
+*/
+#ifndef MAIN_WORKER_H
+#define MAIN_WORKER_H
+#include "main-lease.h"
+#include <stdint.h>
+#include <time.h>
+struct Masscan;
+struct Scheduler;
+struct WorkerOutput;
+
+/* A chunk that's done, and reported to the coordinator at 'due' */
+struct HeldChunk {
+    unsigned chunk;
+    time_t due;
+};
+
+struct Worker {
+    const struct Masscan *masscan;
+    struct Scheduler *scheduler;
+    SOCKET fd;
+
+    /* From the coordinator, for creating our scheduler */
+    uint64_t chunk_size;
+    uint64_t begin;
+    uint64_t end;
+
+    /* How many chunks we keep queued for the transmit threads, and how
+     * many we have asked for and not gotten yet */
+    unsigned depth;
+    unsigned requested;
+
+    /* The chunks that are done, waiting for "--wait" and their results to
+     * be sent before they are reported, oldest first */
+    struct HeldChunk *held;
+    unsigned held_first;
+    unsigned held_count;
+    unsigned held_max;
+
+    volatile unsigned is_closing;
+    volatile unsigned is_done;
+};
+
+/**
+ * Connect to the coordinator, and find out how it has cut up the scan
+ * @return
+ *      NULL if we couldn't connect, or the coordinator is scanning
+ *      something else
+ */
+struct Worker *worker_create(const struct Masscan *masscan);
+
+/**
+ * Start the thread that leases chunks into the scheduler, and reports
+ * back the ones that are done
+ */
+void worker_start(struct Worker *worker, struct Scheduler *scheduler);
+
+/**
+ * Called once the transmit and receive threads are done: disconnects
+ */
+void worker_destroy(struct Worker *worker);
+
+/**
+ * Each receive thread sends its results to the coordinator on its own
+ * connection, called from output.c instead of writing the file
+ */
+struct WorkerOutput *worker_output_create(const struct Masscan *masscan);
+void worker_output_status(struct WorkerOutput *remote, time_t timestamp,
+                          int status, unsigned ip, unsigned port,
+                          unsigned reason, unsigned ttl);
+void worker_output_banner(struct WorkerOutput *remote, time_t timestamp,
+                          unsigned ip, unsigned ip_proto, unsigned port,
+                          unsigned proto, const unsigned char *px,
+                          unsigned length);
+/**
+ * Send the results that have been waiting since an earlier second
+ */
+void worker_output_idle(struct WorkerOutput *remote, time_t now);
+void worker_output_destroy(struct WorkerOutput *remote);
+
+#endif
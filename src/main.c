@@ -32,14 +32,30 @@
 #include "proto-preprocess.h"   /* quick parse of packets */
 #include "proto-icmp.h"         /* handle ICMP responses */
 #include "proto-udp.h"          /* handle UDP responses */
+#include "proto-sctp.h"         /* handle SCTP responses */
+#include "proto-udp-banner.h"   /* banners from UDP responses */
 #include "syn-cookie.h"         /* for SYN-cookies on send */
 #include "output.h"             /* for outputing results */
 #include "rte-ring.h"           /* producer/consumer ring buffer */
-#include "rawsock-pcapfile.h"   /* for saving pcap files w/ raw packets */
+#include "out-pcap.h"            /* for saving pcap files w/ raw packets */
 #include "smack.h"              /* Aho-corasick state-machine pattern-matcher */
 #include "pixie-timer.h"        /* portable time functions */
 #include "pixie-threads.h"      /* portable threads */
 #include "templ-payloads.h"     /* UDP packet payloads */
+#include "string-fmt.h"         /* fast number/address formatting */
+#include "out-binary2.h"        /* compressed, indexed scan files */
+#include "in-binary.h"          /* reading binary scan files */
+#include "in-pcap.h"            /* reading packet captures */
+#include "rawsock-sim.h"         /* simulated Internet, for --adapter sim */
+#include "main-stats.h"          /* counters, --stats-file, --stats-listen */
+#include "main-profile.h"        /* --profile */
+#include "main-ratectl.h"        /* --adaptive-rate */
+#include "main-discover.h"       /* --discover */
+#include "main-responders.h"     /* --retries, only to non-responders */
+#include "main-scheduler.h"      /* chunks of the index for each thread */
+#include "main-worker.h"         /* --worker, leasing chunks to scan */
+#include "main-lease.h"          /* protocol between coordinator/worker */
+#include "main-checkpoint.h"     /* --checkpoint, saving --resume as we go */
 
 #include <limits.h>
 #include <string.h>
@@ -103,8 +119,20 @@ struct ThreadPair {
      */
     unsigned *picker;
 
-    /* the master 'i' variable */
-    uint64_t my_index;
+    /**
+     * Hands out chunks of the index to the transmit threads, shared by
+     * all of them, and records which are done for --resume
+     */
+    struct Scheduler *scheduler;
+
+    /**
+     * How far apart in this thread's own sequence of targets a probe and
+     * its retry are, see masscan_retry_gap()
+     */
+    uint64_t retry_gap;
+
+    /* the transmit thread has no more probes to send */
+    unsigned done_scanning;
 
 
     /* This is used both by the transmit and receive thread for
@@ -119,6 +147,47 @@ struct ThreadPair {
     unsigned done_transmitting;
     unsigned done_receiving;
 
+    /**
+     * What each thread has done, for "--stats-file" and "--replay".
+     * These are on separate cache lines, since the two threads are
+     * constantly writing them.
+     */
+    struct TransmitStats tx;
+    struct ReceiveStats rx;
+
+    /**
+     * For "--profile", the cycles each thread spent in each stage of its
+     * loop, or NULL when not profiling
+     */
+    struct Profile *tx_profile;
+    struct Profile *rx_profile;
+
+    /**
+     * For "--adaptive-rate", when a sample of probes were sent, so that
+     * the receive thread can measure round-trip times, or NULL
+     */
+    struct RttTable *rtt;
+
+    /**
+     * For "--retries", the hosts and networks that routers told the
+     * receive thread are unreachable, so that the transmit thread can
+     * skip the retries to them, or NULL
+     */
+    struct UnreachableTable *dead;
+
+    /**
+     * For "--discover", the live hosts the receive thread found, for the
+     * transmit thread to port scan, or NULL
+     */
+    struct Discovery *discovery;
+
+    /**
+     * For "--retries", the targets that have answered, so that the
+     * transmit thread doesn't retry them. This is shared by all the
+     * threads, or NULL if the scan is too big.
+     */
+    struct Responders *responders;
+
     struct Throttler throttler[1];
 };
 
@@ -136,7 +205,8 @@ void
 flush_packets(struct Adapter *adapter,
     PACKET_QUEUE *packet_buffers,
     PACKET_QUEUE *transmit_queue,
-    struct Throttler *throttler, uint64_t *packets_sent)
+    struct Throttler *throttler, uint64_t *packets_sent,
+    struct TransmitStats *stats)
 {
     uint64_t batch_size;
     unsigned is_queue_empty = 0;
@@ -169,7 +239,9 @@ flush_packets(struct Adapter *adapter,
             /*
              * Actually send the packet
              */
-            rawsock_send_packet(adapter, p->px, (unsigned)p->length, 1);
+            if (rawsock_send_packet(adapter, p->px, (unsigned)p->length, 1) < 0)
+                stats->send_errors++;
+            stats->packets++;
 
             /*
              * Now that we are done with the packet, put it on the free list
@@ -206,12 +278,10 @@ transmit_thread(void *v) /*aka. scanning_thread() */
 {
     struct ThreadPair *parms = (struct ThreadPair *)v;
     uint64_t i;
-    uint64_t start;
-    uint64_t end;
+    unsigned r;
+    int is_chunk = 1;
     const struct Masscan *masscan = parms->masscan;
-    unsigned retries = masscan->retries;
-    unsigned rate = (unsigned)masscan->max_rate;
-    unsigned r = retries + 1;
+    struct SchedulerCursor *cursor;
     uint64_t range;
     struct BlackRock blackrock;
     uint64_t count_ips = rangelist_count(&masscan->targets);
@@ -220,41 +290,50 @@ transmit_thread(void *v) /*aka. scanning_thread() */
     unsigned *picker = parms->picker;
     struct Adapter *adapter = parms->adapter;
     uint64_t packets_sent = 0;
-    unsigned increment = masscan->shard.of + masscan->nic_count;
+    struct Profile *prof = parms->tx_profile;
+    struct RttTable *rtt = parms->rtt;
+    struct UnreachableTable *dead = parms->dead;
+    struct Responders *responders = parms->responders;
+    struct Discovery *discovery = parms->discovery;
+    struct Scheduler *scheduler = parms->scheduler;
+    const struct RangeList *ports = &masscan->ports;
 
     LOG(1, "xmit: starting transmit thread #%u\n", parms->nic_index);
 
+    /* With --discover, the main loop only sends the discovery probes, and
+     * the ports are scanned on the hosts that answer */
+    if (discovery)
+        ports = &masscan->discover_ports;
+
     /* Create the shuffler/randomizer. This creates the 'range' variable,
      * which is simply the number of IP addresses times the number of
      * ports */
     range = rangelist_count(&masscan->targets) 
-            * rangelist_count(&masscan->ports);
+            * rangelist_count(ports);
     blackrock_init(&blackrock, range, masscan->seed);
 
-    /* Calculate the 'start' and 'end' of a scan. One reason to do this is
-     * to support --shard, so that multiple machines can co-operate on
-     * the same scan. Another reason to do this is so that we can bleed
-     * a little bit past the end when we have --retries. Yet another
-     * thing to do here is deal with multiple network adapters, which
-     * is essentially the same logic as shards. */
-    start = masscan->resume.index + (masscan->shard.one-1) + parms->nic_index;
-    end = range;
-    if (masscan->resume.count && end > start + masscan->resume.count)
-        end = start + masscan->resume.count;
-    end += retries * rate;
-
-    
+    /* The chunks we are given count through the targets in our --shard,
+     * so that multiple machines can co-operate on the same scan. We send
+     * the --retries for the targets in them ourselves, --retry-delay
+     * after the first probes, see main-scheduler.c */
+    cursor = scheduler_cursor_create(scheduler, masscan->retries,
+                                     parms->retry_gap);
 
     /* "THROTTLER" rate-limits how fast we transmit, set with the
-     * --max-rate parameter */
-    throttler_start(throttler, masscan->max_rate/masscan->nic_count);
+     * --max-rate parameter. It's started by main_scan(), since with
+     * --adaptive-rate the main thread changes the rate as we go */
 
     /* -----------------
      * the main loop
      * -----------------*/
-    LOG(3, "xmit: starting main loop: [%llu..%llu]\n", start, end);
-    for (i=start; i<end; ) {
+    LOG(3, "xmit: starting main loop: [%llu..%llu]\n",
+        scheduler->begin, scheduler->end);
+    for (;;) {
         uint64_t batch_size;
+        unsigned ip;
+        unsigned port;
+        uint64_t now = 0;
+        int sent;
 
         /*
          * Do a batch of many packets at a time. That because per-packet
@@ -262,13 +341,48 @@ transmit_thread(void *v) /*aka. scanning_thread() */
          * per-packet cost by doing batches. At slower rates, the batch
          * size will always be one. (--max-rate)
          */
+        PROFILE_START(prof);
         batch_size = throttler_next_batch(throttler, packets_sent);
         packets_sent += batch_size;
-        while (batch_size && i < end) {
+        PROFILE_LAP(prof, Profile_Throttle);
+
+        /* With --discover, the hosts that have answered so far are
+         * scanned first, so that they aren't waiting on the sweep */
+        if (discovery)
+            now = pixie_gettime();
+        while (discovery && batch_size
+            && discover_next(discovery, &ip, &port, now)) {
+            batch_size--;
+            sent = rawsock_send_probe(
+                    adapter,
+                    ip,
+                    port,
+                    syn_hash(ip, port),
+                    !batch_size, /* flush queue on last packet in batch */
+                    pkt_template,
+                    prof
+                    );
+            if (sent < 0)
+                parms->tx.send_errors++;
+            else
+                packets_sent += sent - 1; /* several UDP payloads */
+            parms->tx.probes++;
+        }
+
+        while (batch_size) {
             uint64_t xXx;
-            unsigned ip;
-            unsigned port;
+            int x;
 
+            /*
+             * GET THE NEXT TARGET:
+             *  Every transmit thread takes the next chunk of the index
+             *  from the same scheduler, so that a slow adapter just does
+             *  fewer of them.
+             */
+            x = scheduler_cursor_next(cursor, &i, &r);
+            is_chunk = (x >= 0);
+            if (!is_chunk)
+                break;
 
             /*
              * RANDOMIZE THE TARGET:
@@ -279,13 +393,20 @@ transmit_thread(void *v) /*aka. scanning_thread() */
              *  same range. That way we visit all targets, but in a random 
              *  order. Then, once we've shuffled the index, we "pick" the
              *  the IP address and port that the index refers to.
+             *  The cursor gives us either the first probe to a target, or
+             *  retry 'r' to one we sent to before. Every slot costs one
+             *  packet of the rate, even when there's nothing to send, so
+             *  that the retries are --retry-delay apart.
              */
-            xXx = (i + (r--) * rate);
-            while (xXx >= range)
-                xXx -= range;
+            batch_size--;
+            if (x == 0)
+                continue;
+            xXx = i * masscan->shard.of + (masscan->shard.one - 1);
             xXx = blackrock_shuffle(&blackrock,  xXx);
+            PROFILE_LAP(prof, Profile_Shuffle);
             ip = rangelist_pick2(&masscan->targets, xXx % count_ips, picker);
-            port = rangelist_pick(&masscan->ports, xXx / count_ips);
+            port = rangelist_pick(ports, xXx / count_ips);
+            PROFILE_LAP(prof, Profile_Pick);
             
             /*
              * SEND THE PROBE
@@ -293,49 +414,63 @@ transmit_thread(void *v) /*aka. scanning_thread() */
              *  exciting happens here. The thing to note that this may
              *  be a "raw" transmit that bypasses the kernel, meaning
              *  we can call this function millions of times a second.
+             *  Retries are skipped when the target has already answered,
+             *  or when a router has told us the target is unreachable.
              */
-            rawsock_send_probe(
-                    adapter,
-                    ip,
-                    port,
-                    syn_hash(ip, port),
-                    !batch_size, /* flush queue on last packet in batch */
-                    pkt_template
-                    );
-            batch_size--;
-            foo_count++;
-
-            /*
-             * SEQUENTIALLY INCREMENT THROUGH THE RANGE
-             *  Yea, I know this is a puny 'i++' here, but it's a core feature
-             *  of the system that is linearly increments through the range,
-             *  but produces from that a shuffled sequence of targets (as
-             *  described above). Because we are linearly incrementing this
-             *  number, we can do lots of creative stuff, like doing clever
-             *  retransmits and sharding.
-             */
-            if (r == 0) {
-                i += increment; /* <------ increment by 1 normally, more with shards/nics */
-                r = retries + 1;
+            if (r && responders && responders_contains(responders, xXx)) {
+                parms->tx.answered++;
+            } else if (r && dead && unreachable_lookup(dead, ip)) {
+                parms->tx.suppressed++;
+            } else {
+                sent = rawsock_send_probe(
+                        adapter,
+                        ip,
+                        port,
+                        syn_hash(ip, port),
+                        !batch_size, /* flush queue on last packet in batch */
+                        pkt_template,
+                        prof
+                        );
+                if (sent < 0)
+                    parms->tx.send_errors++;
+                else
+                    packets_sent += sent - 1; /* several UDP payloads */
+                if (rtt && (parms->tx.probes & RTT_SAMPLE_MASK) == 0)
+                    rtt_sent(rtt, ip, port, pixie_gettime());
+                parms->tx.probes++;
             }
+            foo_count++;
 
         } /* end of batch */
 
         /* Transmit packets from other thread, when doing --banners */
         flush_packets(adapter, parms->packet_buffers, parms->transmit_queue, 
-                        throttler, &packets_sent);
+                        throttler, &packets_sent, &parms->tx);
+        PROFILE_LAP(prof, Profile_Flush);
 
         /* If the user pressed <ctrl-c>, then we need to exit. but, in case
-         * the user wants to --resume the scan later, we save the current
-         * state in a file */
+         * the user wants to --resume the scan later, the main thread saves
+         * the chunks that are done */
         if (control_c_pressed) {
             break;
         }
 
-        /* save our current location for resuming, if the user pressed
-         * <ctrl-c> to exit early */
-        parms->my_index = i;
+        /* Once there are no chunks left, we are done, except that with
+         * --discover, we keep going for as long as hosts are still
+         * answering the sweep, and with --worker, for as long as the
+         * coordinator may lease us more */
+        if (!is_chunk) {
+            packets_sent -= batch_size;
+            if (scheduler_is_finished(scheduler)
+                && (!discovery
+                || discover_is_done(discovery, masscan->wait, pixie_gettime())))
+                break;
+            if (batch_size)
+                pixie_usleep(1000);
+        }
     }
+    scheduler_cursor_destroy(cursor);
+    parms->done_scanning = 1;
 
 
     /*
@@ -353,7 +488,8 @@ transmit_thread(void *v) /*aka. scanning_thread() */
                             parms->packet_buffers, 
                             parms->transmit_queue, 
                             throttler, 
-                            &packets_sent);
+                            &packets_sent,
+                            &parms->tx);
 
             pixie_usleep(1000);
         }
@@ -384,6 +520,21 @@ is_my_port(const struct Masscan *masscan, unsigned ip)
     return 0;
 }
 
+/***************************************************************************
+ * Called for every response that had our cookie, with the port the way
+ * the transmit thread numbers them, so that it isn't sent any more
+ * retries (--retries), and so that we scan the rest of its ports if it
+ * was a discovery probe (--discover)
+ ***************************************************************************/
+static void
+target_answered(struct ThreadPair *parms, unsigned ip, unsigned port)
+{
+    if (parms->responders)
+        responders_add(parms->responders, ip, port);
+    if (parms->discovery && discover_found(parms->discovery, ip, port))
+        parms->rx.discovered++;
+}
+
 /***************************************************************************
  * 
  * Asynchronous receive thread
@@ -401,8 +552,10 @@ receive_thread(void *v)
 
     struct Output *out;
     struct DedupTable *dedup;
-    struct PcapFile *pcapfile = NULL;
+    struct PcapWriter *pcapfile = NULL;
     struct TCP_ConnectionTable *tcpcon = 0;
+    struct Profile *prof = parms->rx_profile;
+    unsigned last_drop_check = 0;
 
 
     LOG(1, "recv: start receive thread #%u\n", parms->nic_index);
@@ -411,10 +564,22 @@ receive_thread(void *v)
      * If configured, open a --pcap file for saving raw packets. This is
      * so that we can debug scans, but also so that we can look at the
      * strange things people send us. Note that we don't record transmitted
-     * packets, just the packets we've received.
+     * packets, just the packets we've received. The file is written by a
+     * background thread, so frames are dropped rather than slowing us down
+     * if the disk can't keep up.
      */
-    /*if (masscan->pcap_filename[0])
-        pcapfile = pcapfile_openwrite(masscan->pcap_filename, 1);*/
+    if (masscan->pcap_filename[0]) {
+        char filename[300];
+        if (masscan->nic_count > 1)
+            sprintf_s(filename, sizeof(filename), "%s.%u",
+                      masscan->pcap_filename, parms->nic_index);
+        else
+            sprintf_s(filename, sizeof(filename), "%s", masscan->pcap_filename);
+        pcapfile = pcapwriter_create(filename,
+                                     rawsock_datalink(parms->adapter),
+                                     masscan->pcap_snaplen,
+                                     masscan->pcap_max_size);
+    }
 
     /*
      * Open output. This is where results are reported when saving
@@ -440,7 +605,8 @@ receive_thread(void *v)
             &parms->tmplset->pkts[Proto_TCP],
             output_report_banner,
             out,
-            masscan->tcb.timeout
+            masscan->tcb.timeout,
+            &parms->rx.tcp_stats
             );
     }
 
@@ -476,6 +642,7 @@ receive_thread(void *v)
          *
          * This is the boring part of actually receiving a packet
          */
+        PROFILE_START(prof);
         err = rawsock_recv_packet(
                     parms->adapter,
                     &length,
@@ -483,8 +650,21 @@ receive_thread(void *v)
                     &usecs,
                     &px);
 
-        if (err != 0)
+        if (err != 0) {
+            /* Nothing arrived, so send any results that are waiting for
+             * the coordinator (--worker) */
+            output_idle(out, time(0));
             continue;
+        }
+        parms->rx.frames++;
+        PROFILE_LAP(prof, Profile_Receive);
+
+        /* Once a second, see if the kernel is dropping frames because
+         * we can't keep up, for --adaptive-rate and --stats-file */
+        if (secs != last_drop_check) {
+            last_drop_check = secs;
+            parms->rx.kernel_drops = rawsock_get_drops(parms->adapter);
+        }
         
 
         /*
@@ -495,9 +675,12 @@ receive_thread(void *v)
         if (tcpcon) {
             tcpcon_timeouts(tcpcon, secs, usecs);
         }
+        PROFILE_LAP(prof, Profile_Timeouts);
 
-        if (length > 1514)
+        if (length > 1514) {
+            parms->rx.corrupt++;
             continue;
+        }
 
         /*
          * "Preprocess" the response packet. This means to go through and
@@ -505,8 +688,10 @@ receive_thread(void *v)
          * some fields, like IP address and port numbers.
          */
         x = preprocess_frame(px, length, 1, &parsed);
-        if (!x)
+        if (!x) {
+            parms->rx.corrupt++;
             continue; /* corrupt packet */
+        }
         ip_me = parsed.ip_dst[0]<<24 | parsed.ip_dst[1]<<16
             | parsed.ip_dst[2]<< 8 | parsed.ip_dst[3]<<0;
         ip_them = parsed.ip_src[0]<<24 | parsed.ip_src[1]<<16
@@ -516,9 +701,15 @@ receive_thread(void *v)
 
 
         /* verify: my IP address */
-        if (parms->adapter_ip != ip_me)
+        if (parms->adapter_ip != ip_me) {
+            parms->rx.not_mine++;
             continue;
+        }
 
+        /* Save raw packet in --pcap file */
+        if (pcapfile)
+            pcapwriter_frame(pcapfile, px, length, secs, usecs);
+        PROFILE_LAP(prof, Profile_Parse);
 
         /*
          * Handle non-TCP protocols
@@ -529,20 +720,58 @@ receive_thread(void *v)
                  * stack, we may have to handle ARPs ourself, or the router will 
                  * lose track of us. */
                 LOGip(2, ip_them, 0, "-> ARP [%u] \n", px[parsed.found_offset]);
+                parms->rx.arp++;
                 arp_response(   parms->adapter_ip,
                                 parms->adapter_mac,
                                 px, length,
                                 parms->packet_buffers,
                                 parms->transmit_queue);
+
+                /* A reply to an "A:0" probe (--discover-ports A:0). There's
+                 * no cookie, so it only counts if it's one of our targets */
+                if (parsed.ip_protocol == 2
+                    && rangelist_is_contains(&masscan->targets, ip_them))
+                    target_answered(parms, ip_them, 65536*3+2);
+                PROFILE_LAP(prof, Profile_Protocol);
                 continue;
             case FOUND_UDP:
             case FOUND_DNS:
-                if (!is_my_port(masscan, parsed.port_dst))
+                if (!is_my_port(masscan, parsed.port_dst)) {
+                    parms->rx.not_my_port++;
                     continue;
-                handle_udp(out, px, length, &parsed);
+                }
+                parms->rx.udp++;
+                if (!handle_udp(out, px, length, &parsed))
+                    parms->rx.bad_cookie++;
+                else
+                    target_answered(parms, ip_them, 65536 + parsed.port_src);
+                PROFILE_LAP(prof, Profile_Protocol);
                 continue;
             case FOUND_ICMP:
-                handle_icmp(out, px, length, &parsed);
+                {
+                    unsigned ip_answered = 0;
+                    unsigned port_answered = ICMP_NOT_ANSWERED;
+
+                    parms->rx.icmp++;
+                    if (!handle_icmp(out, px, length, &parsed, parms->dead,
+                                     &ip_answered, &port_answered))
+                        parms->rx.bad_cookie++;
+                    else if (port_answered != ICMP_NOT_ANSWERED)
+                        target_answered(parms, ip_answered, port_answered);
+                }
+                PROFILE_LAP(prof, Profile_Protocol);
+                continue;
+            case FOUND_SCTP:
+                if (parms->adapter_port != parsed.port_dst) {
+                    parms->rx.not_my_port++;
+                    continue;
+                }
+                parms->rx.sctp++;
+                if (!handle_sctp(out, px, length, &parsed))
+                    parms->rx.bad_cookie++;
+                else
+                    target_answered(parms, ip_them, 65536*2 + parsed.port_src);
+                PROFILE_LAP(prof, Profile_Protocol);
                 continue;
             case FOUND_TCP:
                 /* fall down to below */
@@ -553,19 +782,11 @@ receive_thread(void *v)
 
 
         /* verify: my port number */
-        if (parms->adapter_port != parsed.port_dst)
+        if (parms->adapter_port != parsed.port_dst) {
+            parms->rx.not_my_port++;
             continue;
-
-        /* Save raw packet in --pcap file */
-        if (pcapfile) {
-            pcapfile_writeframe(
-                pcapfile,
-                px,
-                length,
-                length,
-                secs,
-                usecs);
         }
+        parms->rx.tcp++;
 
         {
             char buf[64];
@@ -589,6 +810,7 @@ receive_thread(void *v)
                     LOG(2, "%u.%u.%u.%u - bad cookie: ackno=0x%08x expected=0x%08x\n", 
                         (ip_them>>24)&0xff, (ip_them>>16)&0xff, (ip_them>>8)&0xff, (ip_them>>0)&0xff, 
                         seqno_me-1, syn_hash(ip_them, parsed.port_src));
+                    parms->rx.bad_cookie++;
                     continue;
                 }
 
@@ -612,6 +834,7 @@ receive_thread(void *v)
 
                 /* If this contains payload, handle that */
                 if (parsed.app_length) {
+                    parms->rx.tcp_payload++;
                     tcpcon_handle(tcpcon, tcb, TCP_WHAT_DATA, 
                         px + parsed.app_offset, parsed.app_length,
                         secs, usecs, seqno_them);
@@ -645,6 +868,7 @@ receive_thread(void *v)
             }
 
         }
+        PROFILE_LAP(prof, Profile_Protocol);
 
         if (TCP_IS_SYNACK(px, parsed.transport_offset)) {
             /* figure out the status */
@@ -660,16 +884,32 @@ receive_thread(void *v)
                     (ip_them>>24)&0xff, (ip_them>>16)&0xff, 
                     (ip_them>>8)&0xff, (ip_them>>0)&0xff, 
                     seqno_me-1, syn_hash(ip_them, parsed.port_src));
+                parms->rx.bad_cookie++;
                 continue;
             }
 
+            target_answered(parms, ip_them, parsed.port_src);
+
             /* verify: ignore duplicates */
-            if (dedup_is_duplicate(dedup, ip_them, parsed.port_src))
+            if (dedup_is_duplicate(dedup, ip_them, parsed.port_src)) {
+                parms->rx.duplicate++;
                 continue;
+            }
+
+            /* If this was one of the probes we timed, then record the
+             * round-trip time (--adaptive-rate) */
+            if (parms->rtt) {
+                uint64_t rtt = rtt_received(parms->rtt, ip_them, parsed.port_src);
+                if (rtt) {
+                    parms->rx.rtt_samples++;
+                    parms->rx.rtt_usecs += rtt;
+                }
+            }
 
             /*
              * This is where we do the output
              */
+            parms->rx.reported++;
             output_report_status(
                         out,
                         status,
@@ -678,6 +918,12 @@ receive_thread(void *v)
                         px[parsed.transport_offset + 13], /* tcp flags */
                         px[parsed.ip_offset + 8] /* ttl */
                         );
+            PROFILE_LAP(prof, Profile_Report);
+        } else if (TCP_IS_RST(px, parsed.transport_offset)
+                   && syn_hash(ip_them, parsed.port_src) == seqno_me - 1) {
+            /* A closed port isn't reported, but it's an answer, so it
+             * isn't retried */
+            target_answered(parms, ip_them, parsed.port_src);
         }
     }
 
@@ -689,8 +935,7 @@ receive_thread(void *v)
      */
     dedup_destroy(dedup);
     output_destroy(out);
-    if (pcapfile)
-        pcapfile_close(pcapfile);
+    pcapwriter_destroy(pcapfile);
 
     /* Thread is about to exit */
     parms->done_receiving = 1;
@@ -718,6 +963,58 @@ static void control_c_handler(int x)
 
 
 
+/***************************************************************************
+ * For "--profile", add up the cycles from all the threads
+ ***************************************************************************/
+static void
+main_profile_total(const struct Masscan *masscan,
+                   const struct ThreadPair *parms_array,
+                   struct Profile *total)
+{
+    unsigned i;
+
+    memset(total, 0, sizeof(*total));
+    for (i=0; i<masscan->nic_count; i++) {
+        profile_add(total, parms_array[i].tx_profile);
+        profile_add(total, parms_array[i].rx_profile);
+    }
+}
+
+/***************************************************************************
+ * Add up the counters from all the threads, for the status line and for
+ * "--stats-file". The threads keep counting while we read, so the totals
+ * may lag by a packet or two, which is fine. With "--adaptive-rate", this
+ * is also where we decide the new rate.
+ ***************************************************************************/
+static void
+main_stats_sample(const struct Masscan *masscan,
+                  struct ThreadPair *parms_array,
+                  struct RateController *rate_control,
+                  struct StatsSample *sample)
+{
+    unsigned i;
+
+    memset(sample, 0, sizeof(*sample));
+    for (i=0; i<masscan->nic_count; i++) {
+        struct ThreadPair *parms = &parms_array[i];
+        stats_sample_add(sample, &parms->tx, &parms->rx,
+                         rte_ring_count(parms->transmit_queue));
+    }
+
+    if (masscan->is_profile) {
+        struct Profile total;
+        main_profile_total(masscan, parms_array, &total);
+        profile_sample(&total, sample);
+    }
+
+    /* With --adaptive-rate, decide whether to change the rate */
+    if (rate_control)
+        ratectl_update(rate_control, sample, pixie_gettime());
+    else
+        sample->rate_limit = (uint64_t)masscan->max_rate;
+}
+
+
 /***************************************************************************
  * Called from main() to initiate the scan.
  * Launches the 'transmit_thread()' and 'receive_thread()' and waits for
@@ -734,7 +1031,20 @@ main_scan(struct Masscan *masscan)
     unsigned *picker;
     time_t now = time(0);
     struct Status status;
-    uint64_t min_index = UINT64_MAX;
+    struct StatsExporter *stats;
+    struct StatsSample sample;
+    uint64_t profile_start_cycles = profile_cycles();
+    uint64_t profile_start_usecs = pixie_gettime();
+    struct RateController ratectl[1];
+    struct RateController *rate_control = NULL;
+    double rate_limit = masscan->max_rate;
+    uint64_t limit;
+    uint64_t gap = masscan_retry_gap(masscan);
+    uint64_t low_water;
+    struct Scheduler *scheduler;
+    struct Responders *responders = NULL;
+    struct Worker *worker = NULL;
+    time_t next_checkpoint;
 
     /*
      * Initialize the task size
@@ -753,7 +1063,34 @@ main_scan(struct Masscan *masscan)
         LOG(0, " [hint] try something like \"--ports 0-65535\"\n");
         return 1;
     }
-    range = count_ips * count_ports + (uint64_t)(masscan->retries * masscan->max_rate);
+
+    /* With --discover, the sweep is what we count, the ports are only
+     * scanned on the hosts that answer it */
+    if (masscan->is_discover) {
+        if (rangelist_count(&masscan->discover_ports) == 0)
+            rangelist_parse_ports(&masscan->discover_ports, "I:0,80,443");
+        count_ports = rangelist_count(&masscan->discover_ports);
+    }
+
+    /* Cut the targets in our shard into chunks for the transmit threads.
+     * With --worker, the coordinator has already done that, and leases
+     * the chunks to us. */
+    limit = masscan_shard_limit(masscan, count_ips * count_ports);
+    if (masscan->lease.is_worker) {
+        worker = worker_create(masscan);
+        if (worker == NULL)
+            return 1;
+        limit = worker->end;
+        scheduler = scheduler_create(worker->begin, worker->end,
+                                     worker->chunk_size, NULL);
+        scheduler_use_leases(scheduler);
+        worker_start(worker, scheduler);
+    } else
+        scheduler = scheduler_create(masscan->resume.index,
+                                     limit,
+                                     masscan->resume.chunk_size,
+                                     &masscan->resume.chunks);
+    range = scheduler->end;
 
 
     /* 
@@ -771,7 +1108,21 @@ main_scan(struct Masscan *masscan)
      * trim the nmap UDP payloads down to only those ports we are using. This 
      * makes lookups faster at high packet rates.
      */
-    payloads_trim(masscan->payloads, &masscan->ports);
+    if (masscan->is_discover) {
+        struct RangeList both;
+        unsigned i;
+
+        memset(&both, 0, sizeof(both));
+        for (i=0; i<masscan->ports.count; i++)
+            rangelist_add_range(&both, masscan->ports.list[i].begin,
+                                masscan->ports.list[i].end);
+        for (i=0; i<masscan->discover_ports.count; i++)
+            rangelist_add_range(&both, masscan->discover_ports.list[i].begin,
+                                masscan->discover_ports.list[i].end);
+        payloads_trim(masscan->payloads, &both);
+        rangelist_free(&both);
+    } else
+        payloads_trim(masscan->payloads, &masscan->ports);
 
     /* Optimize target selection so it's a quick binary search instead
      * of walking large memory tables. When we scan the entire Internet
@@ -779,6 +1130,33 @@ main_scan(struct Masscan *masscan)
      * hundreds of subranges. This scans through them faster. */
     picker = rangelist_pick2_create(&masscan->targets);
 
+    /* With --retries, remember which targets have answered, so that we
+     * only retry the ones that haven't */
+    if (masscan->retries) {
+        responders = responders_create(&masscan->targets, picker,
+                            masscan->is_discover ? &masscan->discover_ports
+                                                 : &masscan->ports);
+        if (responders == NULL)
+            LOG(0, "retries: too many targets to track, retrying all of them\n");
+        else if (masscan->resume.responders[0]
+            && responders_load(responders, masscan->resume.responders) != 0)
+            LOG(0, "retries: %s: can't use it, retrying all of them\n",
+                masscan->resume.responders);
+    }
+
+    /* With --adaptive-rate, start slow, and the main loop below will
+     * speed up for as long as the network keeps up */
+    if (masscan->is_adaptive_rate) {
+        ratectl_init(ratectl, masscan->min_rate, masscan->max_rate);
+        rate_control = ratectl;
+        rate_limit = ratectl->rate;
+    }
+
+    /* When debugging, the threads may log for every packet, so send
+     * the messages through a buffer instead of waiting on the console */
+    if (verbosity >= LOG_DEBUG)
+        logger_buffered_start();
+
     /* needed for --packet-trace option so that we know when we started
      * the scan */
     global_timestamp_start = 1.0 * pixie_gettime() / 1000000.0;
@@ -795,9 +1173,42 @@ main_scan(struct Masscan *masscan)
         parms->masscan = masscan;
         parms->nic_index = index;
         parms->picker = picker;
-        parms->my_index = masscan->resume.index;
+        parms->scheduler = scheduler;
+        parms->retry_gap = gap;
+        parms->done_scanning = 0;
         parms->done_transmitting = 0;
         parms->done_receiving = 0;
+        memset(&parms->tx, 0, sizeof(parms->tx));
+        memset(&parms->rx, 0, sizeof(parms->rx));
+        parms->tx_profile = NULL;
+        parms->rx_profile = NULL;
+        if (masscan->is_profile) {
+            parms->tx_profile = profile_create();
+            parms->rx_profile = profile_create();
+        }
+        parms->rtt = NULL;
+        if (masscan->is_adaptive_rate) {
+            parms->rtt = (struct RttTable *)malloc(sizeof(*parms->rtt));
+            if (parms->rtt == NULL)
+                exit(1);
+            memset(parms->rtt, 0, sizeof(*parms->rtt));
+        }
+        parms->dead = NULL;
+        if (masscan->retries) {
+            parms->dead = (struct UnreachableTable *)malloc(sizeof(*parms->dead));
+            if (parms->dead == NULL)
+                exit(1);
+            memset(parms->dead, 0, sizeof(*parms->dead));
+        }
+        parms->responders = responders;
+        parms->discovery = NULL;
+        if (masscan->is_discover)
+            parms->discovery = discover_create(&masscan->discover_ports,
+                                               &masscan->ports,
+                                               masscan->retries,
+                                               (uint64_t)(masscan->retry_delay
+                                                          * 1000000.0),
+                                               masscan->seed + 1 + index);
         
 
     
@@ -877,6 +1288,7 @@ main_scan(struct Masscan *masscan)
          * THIS IS WHERE THE PROGRAM STARTS SPEWING OUT PACKETS AT A HIGH
          * RATE OF SPEED.
          */
+        throttler_start(parms->throttler, rate_limit/masscan->nic_count);
         pixie_begin_thread(transmit_thread, 0, parms);
 
 
@@ -901,31 +1313,41 @@ main_scan(struct Masscan *masscan)
         LOG(0, "\nStarting masscan 1.0 (http://bit.ly/14GZzcT) at %s\n", buffer);
         LOG(0, " -- forced options: -sS -Pn -n --randomize-hosts -v --send-eth\n");
         LOG(0, "Initiating SYN Stealth Scan\n");
-        LOG(0, "Scanning %u hosts [%u port%s/host]\n",
-            (unsigned)count_ips, (unsigned)count_ports, (count_ports==1)?"":"s");
+        if (masscan->is_discover)
+            LOG(0, "Discovering %u hosts [%u probe%s/host], then scanning %u port%s/host\n",
+                (unsigned)count_ips, (unsigned)count_ports, (count_ports==1)?"":"s",
+                (unsigned)rangelist_count(&masscan->ports),
+                (rangelist_count(&masscan->ports)==1)?"":"s");
+        else
+            LOG(0, "Scanning %u hosts [%u port%s/host]\n",
+                (unsigned)count_ips, (unsigned)count_ports, (count_ports==1)?"":"s");
     }
 
+    /*
+     * Start writing "--stats-file" and serving "--stats-listen"
+     */
+    stats = stats_create(masscan);
+
     /*
      * Now wait for <ctrl-c> to be pressed OR for threads to exit
      */
     status_start(&status);
+    next_checkpoint = time(0) + masscan->checkpoint.interval;
     while (!control_c_pressed) {
         unsigned i;
+        unsigned done_count = 0;
         double rate = 0;
         
         
-        /* Find the minimum index of all the threads */
-        min_index = UINT64_MAX;
+        /* See if all the threads are done */
         for (i=0; i<masscan->nic_count; i++) {
             struct ThreadPair *parms = &parms_array[i];
 
-            if (min_index > parms->my_index)
-                min_index = parms->my_index;
-
+            done_count += parms->done_scanning;
             rate += parms->throttler->current_rate;
         }
 
-        if (min_index >= range) {
+        if (done_count == masscan->nic_count) {
             control_c_pressed = 1;
         }
 
@@ -933,19 +1355,43 @@ main_scan(struct Masscan *masscan)
          * update screen about once per second with statistics,
          * namely packets/second.
          */
-        status_print(&status, min_index, range, rate);
+        main_stats_sample(masscan, parms_array, rate_control, &sample);
+
+        /* With --adaptive-rate, speed up or slow down */
+        if (rate_control) {
+            for (i=0; i<masscan->nic_count; i++)
+                throttler_set_rate(parms_array[i].throttler,
+                                   rate_control->rate/masscan->nic_count);
+        }
+
+        stats_update(stats, &sample);
+        status_print(&status, scheduler_progress(scheduler), range, rate,
+                     sample.tcb_active);
         
+        /* With --checkpoint, save where we are, in case we crash */
+        if (masscan->checkpoint.interval && worker == NULL
+            && time(0) >= next_checkpoint) {
+            checkpoint_save(masscan, scheduler, responders, 1, 1);
+            next_checkpoint = time(0) + masscan->checkpoint.interval;
+        }
+
         /* Sleep for almost a second */
         pixie_mssleep(750);
     }
 
     /*
      * If we haven't completed the scan, then save the resume
-     * information.
+     * information. A worker doesn't, since the coordinator gives the
+     * chunks it didn't do to the other workers. With --checkpoint, the
+     * last one says we're done, so that resuming from it doesn't scan
+     * the chunks done since the one before.
      */
-    if (min_index < count_ips * count_ports) {
-        masscan->resume.index = min_index;
-        masscan_save_state(masscan);
+    low_water = scheduler_low_water(scheduler);
+    if (worker == NULL) {
+        if (low_water < limit)
+            checkpoint_save(masscan, scheduler, responders, 0, 0);
+        else if (masscan->checkpoint.interval)
+            checkpoint_save(masscan, scheduler, responders, 1, 0);
     }
 
 #if 0
@@ -973,7 +1419,10 @@ main_scan(struct Masscan *masscan)
         
         pixie_mssleep(750);
         
-        status_print(&status, masscan->resume.index, range, 0);
+        main_stats_sample(masscan, parms_array, rate_control, &sample);
+        stats_update(stats, &sample);
+        status_print(&status, scheduler_progress(scheduler), range, 0,
+                     sample.tcb_active);
 
         if (time(0) - now >= masscan->wait)
             control_c_pressed_again = 1;
@@ -996,7 +1445,246 @@ main_scan(struct Masscan *masscan)
     }    
 
 
+    main_stats_sample(masscan, parms_array, rate_control, &sample);
+    stats_destroy(stats, &sample);
     status_finish(&status);
+    responders_destroy(responders);
+    worker_destroy(worker);
+    scheduler_destroy(scheduler);
+
+    /*
+     * With --discover, say how many live hosts were found
+     */
+    if (masscan->is_discover) {
+        uint64_t overflows = 0;
+        unsigned i;
+
+        for (i=0; i<masscan->nic_count; i++) {
+            overflows += discover_overflows(parms_array[i].discovery);
+            discover_destroy(parms_array[i].discovery);
+            parms_array[i].discovery = NULL;
+        }
+        LOG(0, "discover: %llu live hosts found\n",
+            (unsigned long long)sample.hosts_discovered);
+        if (overflows)
+            LOG(0, "discover: %llu live hosts not scanned, the queue was full\n",
+                (unsigned long long)overflows);
+    }
+
+    /*
+     * Print the "--profile" report
+     */
+    if (masscan->is_profile) {
+        struct Profile total;
+
+        main_profile_total(masscan, parms_array, &total);
+        profile_report(stderr, &total,
+                       sample.probes_sent, sample.frames_received,
+                       profile_cycles() - profile_start_cycles,
+                       pixie_gettime() - profile_start_usecs);
+    }
+
+    /*
+     * Free the per-thread state, now that the threads are done with it
+     */
+    for (index=0; index<masscan->nic_count; index++) {
+        struct ThreadPair *parms = &parms_array[index];
+
+        free(parms->rtt);
+        parms->rtt = NULL;
+        free(parms->dead);
+        parms->dead = NULL;
+        profile_destroy(parms->tx_profile);
+        parms->tx_profile = NULL;
+        profile_destroy(parms->rx_profile);
+        parms->rx_profile = NULL;
+    }
+    return 0;
+}
+
+
+/***************************************************************************
+ * For "--replay", when not given on the command-line, figure out which
+ * IP address and port the capture was scanning from, using the first
+ * response in the capture: a SYN-ACK, or a RST-ACK from a closed port.
+ * Any other TCP packet could be one of our own outgoing probes, whose
+ * destination is the target rather than us.
+ ***************************************************************************/
+static void
+replay_learn(const char *filename, unsigned *r_ip, unsigned *r_port)
+{
+    struct PcapReader *cap;
+    struct PcapFrame frames[64];
+    unsigned count;
+    unsigned total = 0;
+
+    cap = pcapreader_open(filename);
+    if (cap == NULL)
+        return;
+
+    while (total < 100000 && (count = pcapreader_next(cap, frames, 64)) != 0) {
+        unsigned i;
+
+        for (i=0; i<count; i++) {
+            struct PreprocessedInfo parsed;
+            unsigned ip_me;
+
+            if (!preprocess_frame(frames[i].px, frames[i].length, 1, &parsed))
+                continue;
+            if (parsed.found != FOUND_TCP)
+                continue;
+            if (!TCP_IS_SYNACK(frames[i].px, parsed.transport_offset)
+                && !(TCP_IS_RST(frames[i].px, parsed.transport_offset)
+                     && TCP_IS_ACK(frames[i].px, parsed.transport_offset)))
+                continue;
+            ip_me = parsed.ip_dst[0]<<24 | parsed.ip_dst[1]<<16
+                | parsed.ip_dst[2]<< 8 | parsed.ip_dst[3]<<0;
+            if (*r_ip == 0)
+                *r_ip = ip_me;
+            if (*r_ip != ip_me)
+                continue;
+            if (*r_port == 0x10000)
+                *r_port = parsed.port_dst;
+            pcapreader_close(cap);
+            return;
+        }
+        total += count;
+    }
+    pcapreader_close(cap);
+}
+
+/***************************************************************************
+ * Feed the frames from a capture file through the receive thread, as if
+ * they'd just arrived from the network. This tests the entire receive
+ * side (cookies, dedup, the TCP stack, banners, and output) without a
+ * network. Use the same "--seed" as the scan that made the capture, so
+ * that the SYN-cookies match.
+ ***************************************************************************/
+static int
+main_replay(struct Masscan *masscan)
+{
+    struct ThreadPair parms[1];
+    unsigned adapter_ip = masscan->nic[0].adapter_ip;
+    unsigned adapter_port = masscan->nic[0].adapter_port;
+    uint64_t start;
+    uint64_t start_cycles;
+    uint64_t elapsed = 0;
+    uint64_t elapsed_cycles = 0;
+    uint64_t responses = 0;
+    unsigned i;
+
+    if (masscan->seed == 0)
+        LOG(0, "replay: no --seed given, so no SYN-ACKs will match our cookies\n");
+
+    if (adapter_ip == 0 || adapter_port == 0x10000)
+        replay_learn(masscan->replay_filename, &adapter_ip, &adapter_port);
+    if (adapter_ip == 0 || adapter_port == 0x10000) {
+        LOG(0, "FAIL: %s: can't find which address was scanning\n",
+            masscan->replay_filename);
+        LOG(0, " [hint] try something like \"--adapter-ip 192.168.100.5 --adapter-port 40000\"\n");
+        return 1;
+    }
+    LOG(1, "replay: adapter-ip=%u.%u.%u.%u adapter-port=%u\n",
+        (adapter_ip>>24)&0xFF, (adapter_ip>>16)&0xFF,
+        (adapter_ip>> 8)&0xFF, (adapter_ip>> 0)&0xFF,
+        adapter_port);
+    if (masscan->nic_count == 0)
+        masscan->nic_count = 1;
+
+    memset(parms, 0, sizeof(parms));
+    parms->masscan = masscan;
+    if (masscan->is_profile)
+        parms->rx_profile = profile_create();
+    parms->adapter = rawsock_init_replay(masscan->replay_filename,
+                                         masscan->is_replay_realtime,
+                                         masscan->nmap.packet_trace);
+    if (parms->adapter == NULL)
+        return 1;
+
+    /* Set up the templates for the TCP stack to respond with, which are
+     * just thrown away */
+    parms->adapter_ip = adapter_ip;
+    memcpy(parms->adapter_mac, masscan->nic[0].adapter_mac, 6);
+    memcpy(parms->router_mac, "\x66\x55\x44\x33\x22\x11", 6);
+    template_packet_init(
+                parms->tmplset,
+                parms->adapter_ip,
+                parms->adapter_mac,
+                parms->router_mac,
+                masscan->payloads);
+    template_set_source_port(parms->tmplset, adapter_port);
+    parms->adapter_port = template_get_source_port(parms->tmplset);
+
+    parms->packet_buffers = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    parms->transmit_queue = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    for (i=0; i<BUFFER_COUNT-1; i++) {
+        struct PacketBuffer *p = (struct PacketBuffer *)malloc(sizeof(*p));
+        rte_ring_sp_enqueue(parms->packet_buffers, p);
+    }
+
+    signal(SIGINT, control_c_handler);
+    if (verbosity >= LOG_DEBUG)
+        logger_buffered_start();
+
+    start = pixie_gettime();
+    start_cycles = profile_cycles();
+    pixie_begin_thread(receive_thread, 0, parms);
+
+    /*
+     * Do the job of the transmit thread, throwing away whatever the
+     * receive thread sends (such as ACKs with --banners), until the
+     * receive thread has seen every frame
+     */
+    while (!parms->done_receiving) {
+        struct PacketBuffer *p;
+
+        if (rte_ring_sc_dequeue(parms->transmit_queue, (void**)&p) == 0) {
+            rawsock_send_packet(parms->adapter, p->px, (unsigned)p->length, 1);
+            while (rte_ring_sp_enqueue(parms->packet_buffers, p) != 0)
+                pixie_usleep(100);
+            responses++;
+            continue;
+        }
+
+        if (!control_c_pressed_again
+            && (rawsock_is_replay_done(parms->adapter) || control_c_pressed)) {
+            elapsed = pixie_gettime() - start;
+            elapsed_cycles = profile_cycles() - start_cycles;
+            control_c_pressed_again = 1;
+        }
+        pixie_usleep(1000);
+    }
+
+    /*
+     * Print the counters for each stage
+     */
+    {
+        double seconds = elapsed ? elapsed/1000000.0 : 0.000001;
+
+        fprintf(stderr, "replay: %llu frames in %.3f seconds, %.0f frames/sec\n",
+                (unsigned long long)parms->rx.frames, seconds,
+                parms->rx.frames / seconds);
+        fprintf(stderr, "  %-12s %12llu\n", "corrupt",     (unsigned long long)parms->rx.corrupt);
+        fprintf(stderr, "  %-12s %12llu\n", "not-mine",    (unsigned long long)parms->rx.not_mine);
+        fprintf(stderr, "  %-12s %12llu\n", "not-my-port", (unsigned long long)parms->rx.not_my_port);
+        fprintf(stderr, "  %-12s %12llu\n", "arp",         (unsigned long long)parms->rx.arp);
+        fprintf(stderr, "  %-12s %12llu\n", "udp",         (unsigned long long)parms->rx.udp);
+        fprintf(stderr, "  %-12s %12llu\n", "icmp",        (unsigned long long)parms->rx.icmp);
+        fprintf(stderr, "  %-12s %12llu\n", "sctp",        (unsigned long long)parms->rx.sctp);
+        fprintf(stderr, "  %-12s %12llu\n", "tcp",         (unsigned long long)parms->rx.tcp);
+        fprintf(stderr, "  %-12s %12llu\n", "bad-cookie",  (unsigned long long)parms->rx.bad_cookie);
+        fprintf(stderr, "  %-12s %12llu\n", "duplicate",   (unsigned long long)parms->rx.duplicate);
+        fprintf(stderr, "  %-12s %12llu\n", "reported",    (unsigned long long)parms->rx.reported);
+        fprintf(stderr, "  %-12s %12llu\n", "tcp-payload", (unsigned long long)parms->rx.tcp_payload);
+        fprintf(stderr, "  %-12s %12llu\n", "sent",        (unsigned long long)responses);
+    }
+
+    if (parms->rx_profile) {
+        profile_report(stderr, parms->rx_profile, 0, parms->rx.frames,
+                       elapsed_cycles, elapsed);
+        profile_destroy(parms->rx_profile);
+    }
+
     return 0;
 }
 
@@ -1020,15 +1708,22 @@ int main(int argc, char *argv[])
     memset(masscan, 0, sizeof(*masscan));
     masscan->wait = 10; /* how long to wait for responses when done */
     masscan->max_rate = 100.0; /* max rate = hundred packets-per-second */
+    masscan->retry_delay = 1.0; /* a second between a probe and its retry */
     for (i=0; i<8; i++)
         masscan->nic[i].adapter_port = 0x10000; /* value not set */
     masscan->nic_count = 1;
     masscan->shard.one = 1;
     masscan->shard.of = 1;
+    masscan->lease.timeout = 30; /* seconds without a heartbeat */
+    masscan->sim.open = 0.01;
+    masscan->sim.closed = 0.10;
     masscan->payloads = payloads_create();
     strcpy_s(   masscan->rotate_directory,
                 sizeof(masscan->rotate_directory),
                 ".");
+    strcpy_s(   masscan->checkpoint.filename,
+                sizeof(masscan->checkpoint.filename),
+                "paused.conf");
 
     /*
      * On non-Windows systems, read the defaults from the file in
@@ -1102,6 +1797,40 @@ int main(int argc, char *argv[])
             rawsock_selftest_if(masscan->nic[i].ifname);
         return 0;
 
+    case Operation_ReadScan:
+        /* Convert binary scan files into other output formats */
+        return main_readscan(masscan);
+
+    case Operation_Merge:
+        /* Combine scan files, sorting and removing duplicates */
+        return main_merge(masscan);
+
+    case Operation_Diff:
+        /* Compare two scans, outputting only what changed */
+        return main_diff(masscan);
+
+    case Operation_Replay:
+        /* Feed a packet capture through the receive side */
+        return main_replay(masscan);
+
+    case Operation_Coordinator:
+        /* Lease chunks of the scan to workers, and collect the results */
+        signal(SIGINT, control_c_handler);
+        return main_coordinator(masscan);
+
+    case Operation_Benchmark:
+        /*
+         * Measure the speed of the significant units
+         */
+        fmt_benchmark();
+        output_benchmark();
+        binary2_benchmark();
+        pcapreader_benchmark(masscan->scanfiles.count
+                             ? masscan->scanfiles.names[0] : NULL);
+        udp_banner_benchmark(masscan->scanfiles.count
+                             ? masscan->scanfiles.names[0] : NULL);
+        return 0;
+
     case Operation_Selftest:
         /*
          * Do a regression test of all the significant units
@@ -1118,6 +1847,29 @@ int main(int argc, char *argv[])
             x += rte_ring_selftest();
             x += smack_selftest();
             x += banner1_selftest();
+            x += json_selftest();
+            x += output_selftest();
+            x += fmt_selftest();
+            x += binary2_selftest();
+            x += scanfile_selftest();
+            x += pcapreader_selftest();
+            x += pcapwriter_selftest();
+            x += merge_selftest();
+            x += diff_selftest();
+            x += simnet_selftest();
+            x += stats_selftest();
+            x += profile_selftest();
+            x += logger_selftest();
+            x += ratectl_selftest();
+            x += udp_selftest();
+            x += udp_banner_selftest();
+            x += icmp_selftest();
+            x += sctp_selftest();
+            x += discover_selftest();
+            x += responders_selftest();
+            x += scheduler_selftest();
+            x += lease_selftest();
+            x += checkpoint_selftest();
 
 
             if (x != 0) {
@@ -8,6 +8,7 @@
 
 #include "ranges.h"
 #include "packet-queue.h"
+#include "rawsock-sim.h"
 
 struct Adapter;
 struct TemplateSet;
@@ -22,6 +23,12 @@ enum {
     Operation_Scan = 3,         /* this is what you expect */
     Operation_DebugIF = 4,
     Operation_ListScan = 5,
+    Operation_Benchmark = 6,    /* --benchmark */
+    Operation_ReadScan = 7,     /* --readscan <files...> */
+    Operation_Merge = 8,        /* --merge <files...> */
+    Operation_Diff = 9,         /* --diff <old> <new> */
+    Operation_Replay = 10,      /* --replay <capture> */
+    Operation_Coordinator = 11, /* --coordinator <[ip:]port> */
 };
 
 enum OutpuFormat {
@@ -33,6 +40,7 @@ enum OutpuFormat {
     Output_Nmap         = 0x0020,
     Output_ScriptKiddie = 0x0040,
     Output_Grepable     = 0x0080,
+    Output_Binary2      = 0x0100,   /* block compressed "masscan/2.0" */
     Output_All          = 0xFFBF,
 };
 
@@ -44,6 +52,8 @@ enum PortStatus {
     Port_IcmpEchoResponse,
     Port_UdpOpen,
     Port_UdpClosed,
+    Port_SctpOpen,
+    Port_SctpClosed,
 };
 
 struct Masscan
@@ -80,6 +90,13 @@ struct Masscan
     struct RangeList exclude_ip;
     struct RangeList exclude_port;
 
+    /**
+     * For "--discover": first send these probes, then scan "ports" only
+     * on the hosts that answer one of them ("--discover-ports")
+     */
+    struct RangeList discover_ports;
+    unsigned is_discover:1;
+
 
 
     /**
@@ -87,11 +104,25 @@ struct Masscan
      */
     double max_rate;
 
+    /**
+     * For "--adaptive-rate": start at "--min-rate", and change the rate
+     * between that and "--max-rate" depending on how well the network
+     * keeps up
+     */
+    double min_rate;
+    unsigned is_adaptive_rate:1;
+
     /**
      * Number of retries (--retries or --max-retries parameter)
      */
     unsigned retries;
 
+    /**
+     * Seconds between a probe and its retry (--retry-delay), so that
+     * the retry is only sent if no answer has come back by then
+     */
+    double retry_delay;
+
     unsigned is_pfring:1;       /* --pfring */
     unsigned is_sendq:1;        /* --sendq */
     unsigned is_banners:1;      /* --banners */
@@ -104,17 +135,53 @@ struct Masscan
     unsigned wait;
 
 
+    /**
+     * For "--resume". The index counts the targets in this shard, and
+     * everything below it is done. Above it, the transmit threads work
+     * on chunks out of order, so the chunks that are done are listed
+     * too, by number, which depends on the chunk size.
+     */
     struct {
         uint64_t seed;
         uint64_t index;
         uint64_t count;
+        uint64_t chunk_size;
+        struct RangeList chunks;
+        char responders[256];   /* "resume-responders", the answered targets */
     } resume;
 
+    /**
+     * For "--checkpoint": save the "--resume" information this often, in
+     * seconds, and not just on <ctrl-c>. It goes to "--checkpoint-file",
+     * which is "paused.conf" unless set, and with
+     * "--checkpoint-responders", the targets that have answered go next
+     * to it, so that they aren't retried after resuming.
+     */
+    struct {
+        unsigned interval;
+        char filename[256];
+        unsigned is_responders:1;
+    } checkpoint;
+
     struct {
         unsigned one;
         unsigned of;
     } shard;
 
+    /**
+     * For "--coordinator", the address to listen on, and for "--worker",
+     * the coordinator to lease chunks of the scan from. A worker that
+     * isn't heard from for "--lease-timeout" seconds loses its chunks to
+     * the other workers. Workers must have the same "--lease-key".
+     */
+    struct {
+        unsigned ip;
+        unsigned port;
+        unsigned timeout;
+        unsigned is_worker:1;
+        char key[64];
+    } lease;
+
     /**
      * The packet template we are current using
      */
@@ -137,6 +204,15 @@ struct Masscan
      */
     unsigned rotate_offset;
 
+    /**
+     * Also rotate when the file reaches this many bytes ("--rotate-size")
+     * or records ("--rotate-count"), or zero to only rotate by time
+     */
+    uint64_t rotate_size;
+    uint64_t rotate_count;
+    unsigned is_rotate_compress:1;  /* --rotate-compress */
+    unsigned is_rotate_fsync:1;     /* --rotate-fsync */
+
     struct {
         unsigned data_length; /* number of bytes to randomly append */
         unsigned ttl; /* starting IP TTL field */
@@ -158,6 +234,43 @@ struct Masscan
     char rotate_directory[256];
     char pcap_filename[256];
 
+    /**
+     * For "--pcap": truncate captured frames to this many bytes
+     * ("--pcap-snaplen"), and start a new file when this one reaches
+     * this many bytes ("--pcap-max-size"), or zero for no limit
+     */
+    unsigned pcap_snaplen;
+    uint64_t pcap_max_size;
+
+    /**
+     * For "--replay": the capture file to feed through the receive
+     * thread, and whether to do so with the original timing
+     * ("--replay-realtime") rather than as fast as possible
+     */
+    char replay_filename[256];
+    unsigned is_replay_realtime:1;
+
+    /**
+     * For "--adapter sim": how the simulated Internet responds
+     * ("--sim-open", "--sim-closed", "--sim-loss", "--sim-rtt")
+     */
+    struct SimConfig sim;
+
+    /**
+     * For "--stats-file": append the counters as a JSON line this often
+     * ("--stats-interval", in seconds). For "--stats-listen": serve them
+     * over HTTP on this loopback port or Unix socket path.
+     */
+    char stats_filename[256];
+    char stats_listen[256];
+    unsigned stats_interval;
+
+    /**
+     * For "--profile": time each stage of the transmit and receive
+     * threads, and print a report at the end
+     */
+    unsigned is_profile:1;
+
     //PACKET_QUEUE *packet_buffers;
     //PACKET_QUEUE *transmit_queue;
 
@@ -166,6 +279,14 @@ struct Masscan
     } tcb;
 
     struct NmapPayloads *payloads;
+
+    /**
+     * The binary files read by "--readscan", "--merge", or "--diff"
+     */
+    struct {
+        char **names;
+        unsigned count;
+    } scanfiles;
 };
 
 
@@ -173,7 +294,31 @@ void masscan_read_config_file(struct Masscan *masscan, const char *filename);
 void masscan_command_line(struct Masscan *masscan, int argc, char *argv[]);
 void masscan_usage();
 void masscan_save_state(struct Masscan *masscan);
+
+/**
+ * Write the "--resume" information to a file, replacing it in one step
+ * @return
+ *      0 on success, -1 on failure
+ */
+int masscan_write_state(struct Masscan *masscan, const char *filename);
+
+/**
+ * How far apart, in the index, a probe and its retry are
+ */
+uint64_t masscan_retry_gap(const struct Masscan *masscan);
+
+/**
+ * The number of targets in our "--shard", out of 'range' in the scan
+ */
+uint64_t masscan_shard_limit(const struct Masscan *masscan, uint64_t range);
+
+int main_coordinator(struct Masscan *masscan);
 void main_listscan(struct Masscan *masscan);
+int main_readscan(struct Masscan *masscan);
+int main_merge(struct Masscan *masscan);
+int merge_selftest(void);
+int main_diff(struct Masscan *masscan);
+int diff_selftest(void);
 
 int
 masscan_initialize_adapter(
@@ -79,28 +79,33 @@ binary_out_status(struct Output *out, FILE *fp, int status, unsigned ip, unsigne
 
 
 /****************************************************************************
+ * TCP banners are type 3 records, as they always were. Banners over any
+ * other IP protocol, such as the UDP ones, are type 5 records, which are
+ * the same with a byte for the IP protocol after the IP address. Older
+ * readers skip those, rather than think they're TCP.
  ****************************************************************************/
 static void
-binary_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned port,
-        unsigned proto, const unsigned char *px, unsigned length)
+binary_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned ip_proto,
+        unsigned port, unsigned proto, const unsigned char *px, unsigned length)
 {
-    unsigned char foo[256];
+    unsigned char foo[32];
+    unsigned header_length = (ip_proto == 6) ? 12 : 13;
     unsigned i;
 
     UNUSEDPARM(out);
 
     /* [TYPE] field */
-    foo[0] = 3; /*banner*/
+    foo[0] = (ip_proto == 6) ? 3 : 5; /*banner*/
 
     /* [LENGTH] field*/
-    if (length >= 128 * 128 - 12)
+    if (length >= 128 * 128 - header_length)
         return;
-    if (length < 128 - 12) {
-        foo[1] = (unsigned char)(length + 12);
+    if (length < 128 - header_length) {
+        foo[1] = (unsigned char)(length + header_length);
         i = 2;
     } else {
-        foo[1] = (unsigned char)((length + 12)>>7) | 0x80;
-        foo[2] = (unsigned char)((length + 12) & 0x7F);
+        foo[1] = (unsigned char)((length + header_length)>>7) | 0x80;
+        foo[2] = (unsigned char)((length + header_length) & 0x7F);
         i = 3;
     }
 
@@ -114,18 +119,20 @@ binary_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned port,
     foo[i+5] = (unsigned char)(ip>>16);
     foo[i+6] = (unsigned char)(ip>> 8);
     foo[i+7] = (unsigned char)(ip>> 0);
+    i += 8;
 
-    foo[i+8] = (unsigned char)(port>>8);
-    foo[i+9] = (unsigned char)(port>>0);
-
-    foo[i+10] = (unsigned char)(proto>>8);
-    foo[i+11] = (unsigned char)(proto>>0);
+    if (ip_proto != 6)
+        foo[i++] = (unsigned char)ip_proto;
 
-    /* Banner */
-    memcpy(foo+i+12, px, length);
+    foo[i+0] = (unsigned char)(port>>8);
+    foo[i+1] = (unsigned char)(port>>0);
 
+    foo[i+2] = (unsigned char)(proto>>8);
+    foo[i+3] = (unsigned char)(proto>>0);
 
-    fwrite(&foo, 1, length+i+12, fp);
+    /* Banner */
+    fwrite(&foo, 1, i+4, fp);
+    fwrite(px, 1, length, fp);
 }
 
 
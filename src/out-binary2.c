@@ -0,0 +1,1408 @@
+/*
+    "masscan/2.0" binary output
+
+    The original binary format (out-binary.c) writes one small record at
+    a time. Files from full-Internet scans get huge, and are slow to
+    post-process. This format instead groups records into blocks, stores
+    each block column-by-column so that similar data sits together, and
+    compresses the block with zlib (when zlib can be loaded at runtime,
+    see pixie-zlib.c). An index at the end of the file lists the blocks,
+    so that readers can seek, or split a file among threads.
+
+    Everything is BIG-ENDIAN, except that variable-length integers use
+    the common LEB128 encoding (7 bits per byte, least significant group
+    first, high bit set on all but the last byte).
+
+    FILE LAYOUT
+
+    +------------------------+
+    | "masscan/2.0"          |  16 bytes, nul padded
+    +------------------------+
+    | block                  |
+    | block                  |
+    | ...                    |
+    +------------------------+
+    | index                  |  "IDX2", count, then 32 bytes per block
+    +------------------------+
+    | footer                 |  "END2", count, 8 byte offset of index
+    +------------------------+
+
+    If the writer runs out of memory for the index, it leaves out the
+    index and footer, rather than write one that misses blocks.
+
+    BLOCK LAYOUT
+
+    The 20 byte block header is "BLK2", then the number of records, the
+    decompressed length, the stored length, a 1 byte codec (0=stored,
+    1=zlib), a 1 byte flags field (0x01 = records are sorted by IP address
+    then port), then 2 reserved bytes. The (decompressed) contents are
+    the following columns, each 'count' entries long:
+
+    kind        1 byte per record: enum PortStatus, or 0xFF for a banner
+    timestamp   varint, zig-zag encoded difference from the previous one
+    ip          varint, zig-zag encoded difference from the previous one
+    ports       varint count of distinct ports in the block, followed by
+                the varint port numbers, then a varint per record that
+                is the index into this dictionary
+    reason      1 byte per record, for banners the IP protocol (17 for
+                UDP), where 0, as in older files, means TCP
+    ttl         1 byte per record (0 for banners)
+    banners     for each banner record, in order: varint protocol,
+                varint length, then the banner bytes
+
+    Because scans usually target a few ports, the port dictionary index
+    is almost always one byte, and since timestamps barely change, their
+    column compresses to almost nothing.
+
+    APPENDING
+
+    With --append-output, a whole new file (header, blocks, index, and
+    footer) is written after the old one. Index offsets are always from
+    the start of the file, so the footer at the end finds the index of
+    the last part, while streaming readers just skip the extra headers.
+*/
+#include "output.h"
+#include "masscan.h"
+#include "out-binary2.h"
+#include "pixie-zlib.h"
+#include "pixie-timer.h"
+#include "pixie-tmp.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define B2_FILE_MAGIC       "masscan/2.0"
+#define B2_FILE_HEADER      16
+#define B2_BLOCK_HEADER     20
+#define B2_INDEX_ENTRY      32
+#define B2_FOOTER           16
+
+/* When a block reaches this many records, or this many bytes of
+ * banners, then we compress it and write it out */
+#define B2_MAX_RECORDS      16384
+#define B2_MAX_BANNERS      (1024*1024)
+
+/* Sanity limits for the reader, so that a corrupt file can't make us
+ * allocate unbounded memory */
+#define B2_READ_MAX_RECORDS (1024*1024)
+#define B2_READ_MAX_RAW     (256*1024*1024)
+
+enum {
+    B2_CODEC_STORED = 0,
+    B2_CODEC_ZLIB = 1,
+};
+
+/* block header flags */
+#define B2_FLAG_SORTED      0x01
+
+
+struct Binary2Writer {
+    /* the columns of the current block */
+    unsigned count;
+    unsigned char kind[B2_MAX_RECORDS];
+    unsigned timestamp[B2_MAX_RECORDS];
+    unsigned ip[B2_MAX_RECORDS];
+    unsigned short port[B2_MAX_RECORDS];
+    unsigned char reason[B2_MAX_RECORDS];
+    unsigned char ttl[B2_MAX_RECORDS];
+    unsigned banner_offset[B2_MAX_RECORDS];
+    unsigned banner_size[B2_MAX_RECORDS];
+    unsigned banner_length;
+    unsigned char banners[B2_MAX_BANNERS];
+
+    /* the order in which records are written, sorted by IP then port,
+     * see b2_sort() */
+    uint64_t order[B2_MAX_RECORDS];
+
+    /* the port dictionary of the current block. The 'port_slot' table
+     * holds the dictionary index+1 for each port, or 0 if not yet used */
+    unsigned dict_count;
+    unsigned short dict[65536];
+    unsigned port_slot[65536];
+
+    /* per-file state, allocated in open() and freed in close() */
+    uint64_t offset;
+    struct Binary2Index *index;
+    unsigned index_count;
+    unsigned index_max;
+    int is_index_lost; /* out of memory, so don't write an index */
+    unsigned char *raw;
+    size_t raw_max;
+    unsigned char *zbuf;
+    size_t zbuf_max;
+    int is_zlib;
+};
+
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+put_u32(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x>>24);
+    px[1] = (unsigned char)(x>>16);
+    px[2] = (unsigned char)(x>> 8);
+    px[3] = (unsigned char)(x>> 0);
+}
+static void
+put_u64(unsigned char *px, uint64_t x)
+{
+    put_u32(px + 0, (unsigned)(x>>32));
+    put_u32(px + 4, (unsigned)(x>>0));
+}
+static unsigned
+get_u32(const unsigned char *px)
+{
+    return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+}
+static uint64_t
+get_u64(const unsigned char *px)
+{
+    return ((uint64_t)get_u32(px))<<32 | get_u32(px + 4);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+put_varint(unsigned char *px, unsigned x)
+{
+    unsigned i = 0;
+    while (x >= 0x80) {
+        px[i++] = (unsigned char)(x | 0x80);
+        x >>= 7;
+    }
+    px[i++] = (unsigned char)x;
+    return i;
+}
+
+/***************************************************************************
+ * @return
+ *      0 on success, -1 if we ran off the end of the buffer
+ ***************************************************************************/
+static int
+get_varint(const unsigned char *px, size_t length, size_t *offset, unsigned *r_x)
+{
+    unsigned x = 0;
+    unsigned shift = 0;
+
+    while (*offset < length && shift < 35) {
+        unsigned char c = px[(*offset)++];
+        x |= (c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            *r_x = x;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/***************************************************************************
+ * Zig-zag encoding maps small negative differences to small positive
+ * numbers, so that they fit in short varints.
+ ***************************************************************************/
+static unsigned
+zigzag(unsigned current, unsigned previous)
+{
+    int delta = (int)(current - previous);
+    return ((unsigned)delta << 1) ^ (unsigned)(delta >> 31);
+}
+static unsigned
+unzigzag(unsigned x, unsigned previous)
+{
+    unsigned delta = (x >> 1) ^ (unsigned)-(int)(x & 1);
+    return previous + delta;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+compare_u64(const void *lhs, const void *rhs)
+{
+    uint64_t a = *(const uint64_t *)lhs;
+    uint64_t b = *(const uint64_t *)rhs;
+    if (a < b)
+        return -1;
+    else if (a > b)
+        return 1;
+    else
+        return 0;
+}
+
+/***************************************************************************
+ * Sort the records in a block by IP address, then port. This makes the
+ * IP address differences much smaller (fewer varint bytes, and better
+ * compression), and lets tools like --merge and --diff work a block at
+ * a time. Each sort key packs the IP, port and record number into 64
+ * bits, so that a plain integer sort is all we need.
+ ***************************************************************************/
+static void
+b2_sort(struct Binary2Writer *w)
+{
+    unsigned i;
+
+    for (i=0; i<w->count; i++)
+        w->order[i] = ((uint64_t)w->ip[i])<<32 | w->port[i]<<14 | i;
+    qsort(w->order, w->count, sizeof(w->order[0]), compare_u64);
+    for (i=0; i<w->count; i++)
+        w->order[i] &= B2_MAX_RECORDS - 1;
+}
+
+/***************************************************************************
+ * Compress and write the current block, then start a new one.
+ ***************************************************************************/
+static void
+b2_flush(struct Binary2Writer *w, FILE *fp)
+{
+    unsigned char header[B2_BLOCK_HEADER];
+    unsigned char *raw = w->raw;
+    const unsigned char *stored;
+    size_t raw_length = 0;
+    size_t stored_length;
+    unsigned codec = B2_CODEC_STORED;
+    unsigned count = w->count;
+    unsigned prev;
+    unsigned i;
+    struct Binary2Index *entry;
+
+    if (count == 0 || raw == NULL)
+        return;
+
+    b2_sort(w);
+
+    /* [kind] */
+    for (i=0; i<count; i++)
+        raw[raw_length++] = w->kind[w->order[i]];
+
+    /* [timestamp] */
+    prev = 0;
+    for (i=0; i<count; i++) {
+        unsigned x = w->timestamp[w->order[i]];
+        raw_length += put_varint(raw + raw_length, zigzag(x, prev));
+        prev = x;
+    }
+
+    /* [ip] */
+    prev = 0;
+    for (i=0; i<count; i++) {
+        unsigned x = w->ip[w->order[i]];
+        raw_length += put_varint(raw + raw_length, zigzag(x, prev));
+        prev = x;
+    }
+
+    /* [ports] */
+    raw_length += put_varint(raw + raw_length, w->dict_count);
+    for (i=0; i<w->dict_count; i++)
+        raw_length += put_varint(raw + raw_length, w->dict[i]);
+    for (i=0; i<count; i++) {
+        unsigned port = w->port[w->order[i]];
+        raw_length += put_varint(raw + raw_length, w->port_slot[port] - 1);
+    }
+
+    /* [reason] [ttl] */
+    for (i=0; i<count; i++)
+        raw[raw_length++] = w->reason[w->order[i]];
+    for (i=0; i<count; i++)
+        raw[raw_length++] = w->ttl[w->order[i]];
+
+    /* [banners] */
+    for (i=0; i<count; i++) {
+        unsigned j = (unsigned)w->order[i];
+        if (w->kind[j] != SCAN_KIND_BANNER)
+            continue;
+        memcpy(raw + raw_length, w->banners + w->banner_offset[j], w->banner_size[j]);
+        raw_length += w->banner_size[j];
+    }
+
+    /*
+     * Compress, unless that doesn't help
+     */
+    stored = raw;
+    stored_length = raw_length;
+    if (w->is_zlib) {
+        size_t zlength = w->zbuf_max;
+        /* the fastest level gets almost all of the benefit */
+        if (pixie_zlib_compress(w->zbuf, &zlength, raw, raw_length, 1) == 0
+            && zlength < raw_length) {
+            stored = w->zbuf;
+            stored_length = zlength;
+            codec = B2_CODEC_ZLIB;
+        }
+    }
+
+    /*
+     * Write the block
+     */
+    memcpy(header, "BLK2", 4);
+    put_u32(header + 4, count);
+    put_u32(header + 8, (unsigned)raw_length);
+    put_u32(header + 12, (unsigned)stored_length);
+    header[16] = (unsigned char)codec;
+    header[17] = B2_FLAG_SORTED;
+    header[18] = 0;
+    header[19] = 0;
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(stored, 1, stored_length, fp);
+
+    /*
+     * Remember the block in the index
+     */
+    if (!w->is_index_lost && w->index_count >= w->index_max) {
+        unsigned new_max = w->index_max * 2 + 64;
+        struct Binary2Index *new_index;
+        new_index = (struct Binary2Index *)realloc(w->index,
+                                        new_max * sizeof(w->index[0]));
+        if (new_index) {
+            w->index = new_index;
+            w->index_max = new_max;
+        } else {
+            /* An index that misses blocks is worse than none, since
+             * readers would silently skip them */
+            LOG(0, "binary2: out of memory, the file won't have an index\n");
+            w->is_index_lost = 1;
+        }
+    }
+    if (!w->is_index_lost) {
+        entry = &w->index[w->index_count++];
+        entry->offset = w->offset;
+        entry->length = (unsigned)(B2_BLOCK_HEADER + stored_length);
+        entry->count = count;
+        entry->min_ip = w->ip[w->order[0]];
+        entry->max_ip = w->ip[w->order[count - 1]];
+        entry->min_timestamp = entry->max_timestamp = w->timestamp[0];
+        for (i=1; i<count; i++) {
+            if (entry->min_timestamp > w->timestamp[i])
+                entry->min_timestamp = w->timestamp[i];
+            if (entry->max_timestamp < w->timestamp[i])
+                entry->max_timestamp = w->timestamp[i];
+        }
+    }
+    w->offset += B2_BLOCK_HEADER + stored_length;
+
+    /*
+     * Reset for the next block. Only the dictionary slots we used need
+     * to be cleared.
+     */
+    for (i=0; i<w->dict_count; i++)
+        w->port_slot[w->dict[i]] = 0;
+    w->dict_count = 0;
+    w->count = 0;
+    w->banner_length = 0;
+}
+
+/***************************************************************************
+ * Add the fields common to status and banner records
+ ***************************************************************************/
+static unsigned
+b2_append(struct Binary2Writer *w, FILE *fp, unsigned kind, unsigned timestamp,
+          unsigned ip, unsigned port, unsigned banner_length)
+{
+    unsigned i;
+
+    if (w->count >= B2_MAX_RECORDS
+        || w->banner_length + banner_length > B2_MAX_BANNERS)
+        b2_flush(w, fp);
+
+    port &= 0xFFFF;
+    if (w->port_slot[port] == 0) {
+        w->dict[w->dict_count++] = (unsigned short)port;
+        w->port_slot[port] = w->dict_count;
+    }
+
+    i = w->count++;
+    w->kind[i] = (unsigned char)kind;
+    w->timestamp[i] = timestamp;
+    w->ip[i] = ip;
+    w->port[i] = (unsigned short)port;
+    w->reason[i] = 0;
+    w->ttl[i] = 0;
+
+    return i;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+b2_append_status(struct Binary2Writer *w, FILE *fp, unsigned status,
+        unsigned timestamp, unsigned ip, unsigned port,
+        unsigned reason, unsigned ttl)
+{
+    unsigned i;
+
+    i = b2_append(w, fp, status, timestamp, ip, port, 0);
+    w->reason[i] = (unsigned char)reason;
+    w->ttl[i] = (unsigned char)ttl;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+b2_append_banner(struct Binary2Writer *w, FILE *fp, unsigned timestamp,
+        unsigned ip, unsigned ip_proto, unsigned port, unsigned proto,
+        const unsigned char *px, unsigned length)
+{
+    unsigned i;
+
+    if (length > B2_MAX_BANNERS - 16)
+        length = B2_MAX_BANNERS - 16;
+
+    i = b2_append(w, fp, SCAN_KIND_BANNER, timestamp, ip, port, length + 10);
+    if (ip_proto != 6)
+        w->reason[i] = (unsigned char)ip_proto;
+    w->banner_offset[i] = w->banner_length;
+    w->banner_length += put_varint(w->banners + w->banner_length, proto);
+    w->banner_length += put_varint(w->banners + w->banner_length, length);
+    memcpy(w->banners + w->banner_length, px, length);
+    w->banner_length += length;
+    w->banner_size[i] = w->banner_length - w->banner_offset[i];
+}
+
+/****************************************************************************
+ ****************************************************************************/
+struct Binary2Writer *
+binary2_writer_create(void)
+{
+    struct Binary2Writer *w;
+
+    w = (struct Binary2Writer *)malloc(sizeof(*w));
+    if (w == NULL)
+        return NULL;
+    memset(w, 0, sizeof(*w));
+    return w;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+void
+binary2_writer_destroy(struct Binary2Writer *w)
+{
+    if (w == NULL)
+        return;
+    free(w->index);
+    free(w->raw);
+    free(w->zbuf);
+    free(w);
+}
+
+/****************************************************************************
+ * Write the file header, and allocate the per-file buffers
+ ****************************************************************************/
+void
+binary2_writer_open(struct Binary2Writer *w, FILE *fp)
+{
+    unsigned char header[B2_FILE_HEADER];
+    long end;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, B2_FILE_MAGIC, strlen(B2_FILE_MAGIC));
+    fwrite(header, 1, sizeof(header), fp);
+
+    if (w == NULL)
+        return;
+
+    /* With --append-output, the file doesn't start empty, and the index
+     * has to point past what's already there. A pipe can't tell us, but
+     * then nothing was there before. */
+    end = ftell(fp);
+    if (end < B2_FILE_HEADER)
+        end = B2_FILE_HEADER;
+
+    w->count = 0;
+    w->banner_length = 0;
+    w->offset = (uint64_t)end;
+    w->index_count = 0;
+    w->is_index_lost = 0;
+
+    /* worst case size of the uncompressed columns */
+    w->raw_max = B2_MAX_RECORDS * (1 + 5 + 5 + 3 + 1 + 1)
+                    + 5 + 65536 * 3
+                    + B2_MAX_BANNERS;
+    w->raw = (unsigned char *)malloc(w->raw_max);
+
+    w->is_zlib = pixie_zlib_init();
+    if (w->is_zlib) {
+        w->zbuf_max = pixie_zlib_bound(w->raw_max);
+        w->zbuf = (unsigned char *)malloc(w->zbuf_max);
+        if (w->zbuf == NULL)
+            w->is_zlib = 0;
+    }
+}
+
+/****************************************************************************
+ * Write out the final block, then the index and footer
+ ****************************************************************************/
+void
+binary2_writer_close(struct Binary2Writer *w, FILE *fp)
+{
+    unsigned char buf[B2_INDEX_ENTRY];
+    uint64_t index_offset;
+    unsigned i;
+
+    if (w == NULL)
+        return;
+
+    b2_flush(w, fp);
+
+    if (w->is_index_lost)
+        goto end;
+
+    index_offset = w->offset;
+    memcpy(buf, "IDX2", 4);
+    put_u32(buf + 4, w->index_count);
+    fwrite(buf, 1, 8, fp);
+    for (i=0; i<w->index_count; i++) {
+        const struct Binary2Index *entry = &w->index[i];
+        put_u64(buf + 0, entry->offset);
+        put_u32(buf + 8, entry->length);
+        put_u32(buf + 12, entry->count);
+        put_u32(buf + 16, entry->min_ip);
+        put_u32(buf + 20, entry->max_ip);
+        put_u32(buf + 24, entry->min_timestamp);
+        put_u32(buf + 28, entry->max_timestamp);
+        fwrite(buf, 1, B2_INDEX_ENTRY, fp);
+    }
+
+    memcpy(buf, "END2", 4);
+    put_u32(buf + 4, w->index_count);
+    put_u64(buf + 8, index_offset);
+    fwrite(buf, 1, B2_FOOTER, fp);
+
+end:
+    free(w->index);
+    free(w->raw);
+    free(w->zbuf);
+    w->index = NULL;
+    w->index_count = 0;
+    w->index_max = 0;
+    w->raw = NULL;
+    w->zbuf = NULL;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+void
+binary2_writer_write(struct Binary2Writer *w, FILE *fp,
+                     const struct ScanRecord *rec)
+{
+    if (rec->kind == SCAN_KIND_BANNER)
+        b2_append_banner(w, fp, rec->timestamp, rec->ip, rec->ip_proto,
+                         rec->port, rec->proto, rec->banner,
+                         rec->banner_length);
+    else
+        b2_append_status(w, fp, rec->kind, rec->timestamp, rec->ip,
+                         rec->port, rec->reason, rec->ttl);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void *
+binary2_out_create(struct Output *out)
+{
+    UNUSEDPARM(out);
+    return binary2_writer_create();
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary2_out_open(struct Output *out, FILE *fp)
+{
+    binary2_writer_open((struct Binary2Writer *)out->ctx, fp);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary2_out_close(struct Output *out, FILE *fp)
+{
+    binary2_writer_close((struct Binary2Writer *)out->ctx, fp);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary2_out_status(struct Output *out, FILE *fp, int status,
+        unsigned ip, unsigned port, unsigned reason, unsigned ttl)
+{
+    struct Binary2Writer *w = (struct Binary2Writer *)out->ctx;
+
+    if (w == NULL)
+        return;
+    b2_append_status(w, fp, status, (unsigned)global_now, ip, port,
+                     reason, ttl);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+binary2_out_banner(struct Output *out, FILE *fp, unsigned ip,
+        unsigned ip_proto, unsigned port, unsigned proto,
+        const unsigned char *px, unsigned length)
+{
+    struct Binary2Writer *w = (struct Binary2Writer *)out->ctx;
+
+    if (w == NULL)
+        return;
+    b2_append_banner(w, fp, (unsigned)global_now, ip, ip_proto, port, proto,
+                     px, length);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+const struct OutputType binary2_output = {
+    "scan",
+    binary2_out_create,
+    binary2_out_open,
+    binary2_out_close,
+    binary2_out_status,
+    binary2_out_banner,
+};
+
+
+/****************************************************************************
+ * READER
+ ****************************************************************************/
+struct Binary2Reader {
+    /* the source is either a FILE or a memory buffer */
+    FILE *fp;
+    const unsigned char *mem;
+    size_t mem_length;
+    size_t mem_offset;
+    unsigned char *iobuf;
+    size_t iobuf_max;
+
+    /* decompression buffer */
+    unsigned char *raw;
+    size_t raw_max;
+
+    /* the decoded columns of the current block */
+    unsigned count;
+    unsigned next;
+    unsigned max;
+    unsigned char *kind;
+    unsigned *timestamp;
+    unsigned *ip;
+    unsigned *port;
+    unsigned char *reason;
+    unsigned char *ttl;
+    const unsigned char *banners;
+    size_t banners_length;
+    size_t banners_offset;
+};
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_is_format(const unsigned char *px, size_t length)
+{
+    if (length < B2_FILE_HEADER)
+        return 0;
+    return memcmp(px, B2_FILE_MAGIC, strlen(B2_FILE_MAGIC) + 1) == 0;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+struct Binary2Reader *
+binary2_reader_create(FILE *fp)
+{
+    struct Binary2Reader *r;
+
+    r = (struct Binary2Reader *)malloc(sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->fp = fp;
+    return r;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+struct Binary2Reader *
+binary2_reader_create_mem(const unsigned char *px, size_t length)
+{
+    struct Binary2Reader *r;
+
+    r = binary2_reader_create(NULL);
+    if (r == NULL)
+        return NULL;
+    r->mem = px;
+    r->mem_length = length;
+    return r;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+void
+binary2_reader_destroy(struct Binary2Reader *r)
+{
+    if (r == NULL)
+        return;
+    free(r->iobuf);
+    free(r->raw);
+    free(r->kind);
+    free(r->timestamp);
+    free(r->ip);
+    free(r->port);
+    free(r->reason);
+    free(r->ttl);
+    free(r);
+}
+
+/****************************************************************************
+ * Get the next 'length' bytes from the source. For memory buffers, this
+ * is zero-copy. For files, the data is only valid until the next call.
+ ****************************************************************************/
+static const unsigned char *
+reader_get(struct Binary2Reader *r, size_t length)
+{
+    if (r->fp == NULL) {
+        const unsigned char *px;
+        if (length > r->mem_length - r->mem_offset)
+            return NULL;
+        px = r->mem + r->mem_offset;
+        r->mem_offset += length;
+        return px;
+    }
+
+    if (length > r->iobuf_max) {
+        unsigned char *new_buf = (unsigned char *)realloc(r->iobuf, length);
+        if (new_buf == NULL)
+            return NULL;
+        r->iobuf = new_buf;
+        r->iobuf_max = length;
+    }
+    if (fread(r->iobuf, 1, length, r->fp) != length)
+        return NULL;
+    return r->iobuf;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_reader_seek(struct Binary2Reader *r, uint64_t offset)
+{
+    r->count = 0;
+    r->next = 0;
+
+    if (r->fp == NULL) {
+        if (offset > r->mem_length)
+            return -1;
+        r->mem_offset = (size_t)offset;
+        return 0;
+    }
+    return fseek(r->fp, (long)offset, SEEK_SET);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static int
+reader_grow(struct Binary2Reader *r, unsigned count)
+{
+    if (count <= r->max)
+        return 0;
+
+    free(r->kind);
+    free(r->timestamp);
+    free(r->ip);
+    free(r->port);
+    free(r->reason);
+    free(r->ttl);
+    r->kind = (unsigned char *)malloc(count);
+    r->timestamp = (unsigned *)malloc(count * sizeof(unsigned));
+    r->ip = (unsigned *)malloc(count * sizeof(unsigned));
+    r->port = (unsigned *)malloc(count * sizeof(unsigned));
+    r->reason = (unsigned char *)malloc(count);
+    r->ttl = (unsigned char *)malloc(count);
+    if (r->kind == NULL || r->timestamp == NULL || r->ip == NULL
+        || r->port == NULL || r->reason == NULL || r->ttl == NULL) {
+        r->max = 0;
+        return -1;
+    }
+    r->max = count;
+    return 0;
+}
+
+/****************************************************************************
+ * Decode a block (after the "BLK2" magic) into the column arrays
+ ****************************************************************************/
+static int
+reader_block(struct Binary2Reader *r)
+{
+    const unsigned char *header;
+    const unsigned char *px;
+    unsigned count, raw_length, stored_length, codec;
+    size_t length;
+    size_t offset = 0;
+    unsigned dict_count;
+    unsigned *dict = NULL;
+    unsigned prev;
+    unsigned i;
+
+    header = reader_get(r, B2_BLOCK_HEADER - 4);
+    if (header == NULL)
+        return -1;
+    count = get_u32(header + 0);
+    raw_length = get_u32(header + 4);
+    stored_length = get_u32(header + 8);
+    codec = header[12];
+
+    if (count > B2_READ_MAX_RECORDS || raw_length > B2_READ_MAX_RAW)
+        return -1;
+    if (reader_grow(r, count) != 0)
+        return -1;
+
+    px = reader_get(r, stored_length);
+    if (px == NULL)
+        return -1;
+
+    switch (codec) {
+    case B2_CODEC_STORED:
+        length = stored_length;
+        break;
+    case B2_CODEC_ZLIB:
+        if (raw_length > r->raw_max) {
+            unsigned char *new_raw = (unsigned char *)realloc(r->raw, raw_length);
+            if (new_raw == NULL)
+                return -1;
+            r->raw = new_raw;
+            r->raw_max = raw_length;
+        }
+        length = raw_length;
+        if (pixie_zlib_uncompress(r->raw, &length, px, stored_length) != 0) {
+            LOG(0, "readscan: zlib: can't decompress block\n");
+            return -1;
+        }
+        px = r->raw;
+        break;
+    default:
+        return -1;
+    }
+
+    /* [kind] */
+    if (length < count)
+        return -1;
+    memcpy(r->kind, px, count);
+    offset += count;
+
+    /* [timestamp] */
+    prev = 0;
+    for (i=0; i<count; i++) {
+        unsigned x;
+        if (get_varint(px, length, &offset, &x) != 0)
+            return -1;
+        prev = r->timestamp[i] = unzigzag(x, prev);
+    }
+
+    /* [ip] */
+    prev = 0;
+    for (i=0; i<count; i++) {
+        unsigned x;
+        if (get_varint(px, length, &offset, &x) != 0)
+            return -1;
+        prev = r->ip[i] = unzigzag(x, prev);
+    }
+
+    /* [ports] */
+    if (get_varint(px, length, &offset, &dict_count) != 0 || dict_count > 65536)
+        return -1;
+    dict = (unsigned *)malloc((dict_count + 1) * sizeof(unsigned));
+    if (dict == NULL)
+        return -1;
+    for (i=0; i<dict_count; i++) {
+        if (get_varint(px, length, &offset, &dict[i]) != 0)
+            goto corrupt;
+    }
+    for (i=0; i<count; i++) {
+        unsigned x;
+        if (get_varint(px, length, &offset, &x) != 0 || x >= dict_count)
+            goto corrupt;
+        r->port[i] = dict[x];
+    }
+    free(dict);
+    dict = NULL;
+
+    /* [reason] [ttl] */
+    if (length - offset < 2 * (size_t)count)
+        return -1;
+    memcpy(r->reason, px + offset, count);
+    offset += count;
+    memcpy(r->ttl, px + offset, count);
+    offset += count;
+
+    /* [banners], which are parsed as we go in binary2_reader_next() */
+    r->banners = px + offset;
+    r->banners_length = length - offset;
+    r->banners_offset = 0;
+
+    r->count = count;
+    r->next = 0;
+    return 0;
+
+corrupt:
+    free(dict);
+    return -1;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_reader_next(struct Binary2Reader *r, struct ScanRecord *rec)
+{
+    unsigned i;
+
+    while (r->next >= r->count) {
+        const unsigned char *magic;
+
+        magic = reader_get(r, 4);
+        if (magic == NULL)
+            return 0; /* end-of-file */
+
+        if (memcmp(magic, "BLK2", 4) == 0) {
+            if (reader_block(r) != 0)
+                return -1;
+        } else if (memcmp(magic, "IDX2", 4) == 0) {
+            const unsigned char *px = reader_get(r, 4);
+            if (px == NULL || reader_get(r, get_u32(px) * (size_t)B2_INDEX_ENTRY) == NULL)
+                return -1;
+        } else if (memcmp(magic, "END2", 4) == 0) {
+            if (reader_get(r, B2_FOOTER - 4) == NULL)
+                return -1;
+        } else if (memcmp(magic, B2_FILE_MAGIC, 4) == 0) {
+            /* file header, which may also appear in the middle when
+             * output was appended to an existing file */
+            const unsigned char *px = reader_get(r, B2_FILE_HEADER - 4);
+            if (px == NULL || memcmp(px, B2_FILE_MAGIC + 4, strlen(B2_FILE_MAGIC) - 4) != 0)
+                return -1;
+        } else
+            return -1;
+    }
+
+    i = r->next++;
+    rec->kind = r->kind[i];
+    rec->timestamp = r->timestamp[i];
+    rec->ip = r->ip[i];
+    rec->port = r->port[i];
+    rec->reason = r->reason[i];
+    rec->ttl = r->ttl[i];
+    rec->ip_proto = 0;
+    rec->proto = 0;
+    rec->banner = NULL;
+    rec->banner_length = 0;
+
+    if (rec->kind == SCAN_KIND_BANNER) {
+        unsigned length;
+        rec->ip_proto = rec->reason ? rec->reason : 6;
+        rec->reason = 0;
+        if (get_varint(r->banners, r->banners_length, &r->banners_offset, &rec->proto) != 0)
+            return -1;
+        if (get_varint(r->banners, r->banners_length, &r->banners_offset, &length) != 0)
+            return -1;
+        if (length > r->banners_length - r->banners_offset)
+            return -1;
+        rec->banner = r->banners + r->banners_offset;
+        rec->banner_length = length;
+        r->banners_offset += length;
+    }
+
+    return 1;
+}
+
+/****************************************************************************
+ * Parse the index, given the footer and the index table.
+ ****************************************************************************/
+static int
+index_parse(const unsigned char *px, size_t length, unsigned count,
+            struct Binary2Index **r_index, unsigned *r_count)
+{
+    struct Binary2Index *index;
+    unsigned i;
+
+    if (length < 8 + (size_t)count * B2_INDEX_ENTRY)
+        return -1;
+    if (memcmp(px, "IDX2", 4) != 0 || get_u32(px + 4) != count)
+        return -1;
+    px += 8;
+
+    index = (struct Binary2Index *)malloc((count + 1) * sizeof(index[0]));
+    if (index == NULL)
+        return -1;
+    for (i=0; i<count; i++) {
+        const unsigned char *entry = px + i * B2_INDEX_ENTRY;
+        index[i].offset = get_u64(entry + 0);
+        index[i].length = get_u32(entry + 8);
+        index[i].count = get_u32(entry + 12);
+        index[i].min_ip = get_u32(entry + 16);
+        index[i].max_ip = get_u32(entry + 20);
+        index[i].min_timestamp = get_u32(entry + 24);
+        index[i].max_timestamp = get_u32(entry + 28);
+    }
+
+    *r_index = index;
+    *r_count = count;
+    return 0;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_index_load(const unsigned char *px, size_t length,
+                   struct Binary2Index **r_index, unsigned *r_count)
+{
+    const unsigned char *footer;
+    unsigned count;
+    uint64_t offset;
+
+    if (length < B2_FILE_HEADER + B2_FOOTER)
+        return -1;
+    footer = px + length - B2_FOOTER;
+    if (memcmp(footer, "END2", 4) != 0)
+        return -1;
+    count = get_u32(footer + 4);
+    offset = get_u64(footer + 8);
+    if (offset > length - B2_FOOTER)
+        return -1;
+
+    return index_parse(px + offset, (size_t)(length - B2_FOOTER - offset),
+                       count, r_index, r_count);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_index_load_file(FILE *fp,
+                        struct Binary2Index **r_index, unsigned *r_count)
+{
+    unsigned char footer[B2_FOOTER];
+    unsigned char *buf;
+    long end;
+    unsigned count;
+    uint64_t offset;
+    size_t length;
+    int err;
+
+    if (fseek(fp, 0, SEEK_END) != 0)
+        return -1;
+    end = ftell(fp);
+    if (end < B2_FILE_HEADER + B2_FOOTER)
+        return -1;
+    if (fseek(fp, end - B2_FOOTER, SEEK_SET) != 0)
+        return -1;
+    if (fread(footer, 1, B2_FOOTER, fp) != B2_FOOTER)
+        return -1;
+    if (memcmp(footer, "END2", 4) != 0)
+        return -1;
+    count = get_u32(footer + 4);
+    offset = get_u64(footer + 8);
+    if (offset > (uint64_t)(end - B2_FOOTER))
+        return -1;
+
+    length = (size_t)(end - B2_FOOTER - offset);
+    buf = (unsigned char *)malloc(length + 1);
+    if (buf == NULL)
+        return -1;
+    if (fseek(fp, (long)offset, SEEK_SET) != 0
+        || fread(buf, 1, length, fp) != length) {
+        free(buf);
+        return -1;
+    }
+
+    err = index_parse(buf, length, count, r_index, r_count);
+    free(buf);
+    return err;
+}
+
+
+/****************************************************************************
+ * Generate a test record. IP addresses are spread randomly, the way the
+ * scanner finds them, while timestamps and ports are what a typical
+ * scan produces.
+ ****************************************************************************/
+static void
+test_record(unsigned i, struct ScanRecord *rec)
+{
+    static const unsigned ports[] = {80, 443, 22, 8080, 53};
+
+    memset(rec, 0, sizeof(*rec));
+    rec->timestamp = 1381000000 + i / 5000;
+    rec->ip = i * 2654435761U;
+    rec->ip ^= rec->ip >> 15;
+    rec->ip *= 0x2c1b3c6d;
+    rec->ip ^= rec->ip >> 12;
+    rec->port = ports[i % 5];
+    if (i % 97 == 0) {
+        static const unsigned char banner[] =
+            "HTTP/1.0 200 OK\r\nServer: Apache/2.2.22 (Ubuntu)\r\n";
+        rec->kind = SCAN_KIND_BANNER;
+        rec->ip_proto = (i % 2) ? 17 : 6;
+        rec->proto = 3;
+        rec->banner = banner;
+        rec->banner_length = sizeof(banner) - 1 - (i % 10);
+    } else {
+        rec->kind = (i % 13) ? 1 : 2;
+        rec->reason = (i % 13) ? 0x12 : 0x14;
+        rec->ttl = 64 - (i % 3);
+    }
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+test_write(const struct OutputType *funcs, FILE *fp, unsigned count)
+{
+    struct Output out[1];
+    unsigned i;
+
+    memset(out, 0, sizeof(out[0]));
+    out->funcs = funcs;
+    if (funcs->create)
+        out->ctx = funcs->create(out);
+
+    funcs->open(out, fp);
+    for (i=0; i<count; i++) {
+        struct ScanRecord rec;
+        test_record(i, &rec);
+        global_now = rec.timestamp;
+        if (rec.kind == SCAN_KIND_BANNER)
+            funcs->banner(out, fp, rec.ip, rec.ip_proto, rec.port, rec.proto,
+                          rec.banner, rec.banner_length);
+        else
+            funcs->status(out, fp, rec.kind, rec.ip, rec.port,
+                          rec.reason, rec.ttl);
+    }
+    funcs->close(out, fp);
+    free(out->ctx);
+}
+
+/****************************************************************************
+ * A fingerprint of all the fields in a record, so that we can compare
+ * sets of records regardless of their order.
+ ****************************************************************************/
+static uint64_t
+test_fingerprint(const struct ScanRecord *rec)
+{
+    uint64_t hash = 0;
+    unsigned i;
+
+    hash = hash * 1000003 + rec->kind;
+    hash = hash * 1000003 + rec->timestamp;
+    hash = hash * 1000003 + rec->ip;
+    hash = hash * 1000003 + rec->ip_proto;
+    hash = hash * 1000003 + rec->port;
+    hash = hash * 1000003 + rec->reason;
+    hash = hash * 1000003 + rec->ttl;
+    hash = hash * 1000003 + rec->proto;
+    hash = hash * 1000003 + rec->banner_length;
+    for (i=0; i<rec->banner_length; i++)
+        hash = hash * 1000003 + rec->banner[i];
+    return hash;
+}
+
+/****************************************************************************
+ * Read 'count' records, and make sure they are the same as the test
+ * records [start..start+count), ignoring order, since blocks are sorted.
+ ****************************************************************************/
+static int
+test_compare(struct Binary2Reader *r, unsigned start, unsigned count)
+{
+    uint64_t *found;
+    uint64_t *expected;
+    unsigned i;
+    int result = 1;
+
+    found = (uint64_t *)malloc(count * sizeof(found[0]));
+    expected = (uint64_t *)malloc(count * sizeof(expected[0]));
+    if (found == NULL || expected == NULL)
+        goto end;
+
+    for (i=0; i<count; i++) {
+        struct ScanRecord rec;
+
+        if (binary2_reader_next(r, &rec) != 1)
+            goto end;
+        found[i] = test_fingerprint(&rec);
+        test_record(start + i, &rec);
+        expected[i] = test_fingerprint(&rec);
+    }
+
+    qsort(found, count, sizeof(found[0]), compare_u64);
+    qsort(expected, count, sizeof(expected[0]), compare_u64);
+    if (memcmp(found, expected, count * sizeof(found[0])) == 0)
+        result = 0;
+
+end:
+    free(found);
+    free(expected);
+    return result;
+}
+
+/****************************************************************************
+ * Append a second (smaller) file to the first, the way --append-output
+ * does, and make sure the index at the end points into the second one.
+ ****************************************************************************/
+static int
+test_append(unsigned count)
+{
+    char filename[256];
+    FILE *fp;
+    struct Binary2Reader *r = NULL;
+    struct Binary2Index *index = NULL;
+    unsigned index_count = 0;
+    long first_length = 0;
+    int result = 1;
+
+    pixie_tmp_filename(filename, sizeof(filename), "masscan-b2");
+    fp = output_fopen(filename, 0);
+    if (fp == NULL)
+        return 0; /* can't test without a file, so skip */
+    test_write(&binary2_output, fp, count);
+    first_length = ftell(fp);
+    fclose(fp);
+
+    fp = output_fopen(filename, 1);
+    if (fp == NULL)
+        goto end;
+    test_write(&binary2_output, fp, 100);
+    fclose(fp);
+
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
+        goto end;
+    if (binary2_index_load_file(fp, &index, &index_count) == 0
+        && index_count == 1) {
+        r = binary2_reader_create(fp);
+        if (r && index[0].offset == (uint64_t)first_length + B2_FILE_HEADER
+            && binary2_reader_seek(r, index[0].offset) == 0
+            && test_compare(r, 0, 100) == 0)
+            result = 0;
+    }
+    binary2_reader_destroy(r);
+    fclose(fp);
+
+end:
+    free(index);
+    remove(filename);
+    return result;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+binary2_selftest(void)
+{
+    static const unsigned count = 40000;
+    FILE *fp = NULL;
+    struct Binary2Reader *r = NULL;
+    struct Binary2Index *index = NULL;
+    unsigned index_count = 0;
+    unsigned char *buf = NULL;
+    long length;
+    time_t saved_now = global_now;
+    struct ScanRecord rec;
+
+    /* zig-zag deltas must round trip across wrap-around */
+    if (unzigzag(zigzag(5, 0xFFFFFFF0), 0xFFFFFFF0) != 5
+        || unzigzag(zigzag(0xFFFFFFF0, 5), 5) != 0xFFFFFFF0)
+        goto fail;
+
+    fp = tmpfile();
+    if (fp == NULL) {
+        /* can't test without a temporary file, so skip */
+        return 0;
+    }
+    test_write(&binary2_output, fp, count);
+    global_now = saved_now;
+
+    /* streaming through a FILE */
+    rewind(fp);
+    r = binary2_reader_create(fp);
+    if (r == NULL || test_compare(r, 0, count) != 0)
+        goto fail;
+    if (binary2_reader_next(r, &rec) != 0)
+        goto fail;
+    binary2_reader_destroy(r);
+    r = NULL;
+
+    /* the index, then seeking to the second block in memory */
+    if (binary2_index_load_file(fp, &index, &index_count) != 0)
+        goto fail;
+    if (index_count != (count + B2_MAX_RECORDS - 1) / B2_MAX_RECORDS)
+        goto fail;
+    length = ftell(fp);
+    buf = (unsigned char *)malloc(length);
+    rewind(fp);
+    if (buf == NULL || fread(buf, 1, length, fp) != (size_t)length)
+        goto fail;
+    if (!binary2_is_format(buf, length))
+        goto fail;
+    r = binary2_reader_create_mem(buf, length);
+    if (r == NULL || binary2_reader_seek(r, index[1].offset) != 0)
+        goto fail;
+    if (test_compare(r, index[0].count, index[1].count) != 0)
+        goto fail;
+    global_now = saved_now;
+
+    if (test_append(count) != 0)
+        goto fail;
+    global_now = saved_now;
+
+    binary2_reader_destroy(r);
+    free(index);
+    free(buf);
+    fclose(fp);
+    return 0;
+fail:
+    global_now = saved_now;
+    fprintf(stderr, "binary2: selftest failed\n");
+    binary2_reader_destroy(r);
+    free(index);
+    free(buf);
+    if (fp)
+        fclose(fp);
+    return 1;
+}
+
+/****************************************************************************
+ * Compare the size and speed of this format with the original
+ * binary format
+ ****************************************************************************/
+void
+binary2_benchmark(void)
+{
+    static const unsigned count = 2000000;
+    const struct OutputType *types[2];
+    unsigned i;
+    time_t saved_now = global_now;
+
+    types[0] = &binary_output;
+    types[1] = &binary2_output;
+
+    if (!pixie_zlib_init())
+        fprintf(stderr, "binary2: zlib not found, blocks not compressed\n");
+
+    for (i=0; i<2; i++) {
+        FILE *fp;
+        uint64_t start, elapsed;
+        long length;
+
+        fp = tmpfile();
+        if (fp == NULL) {
+            perror("tmpfile");
+            return;
+        }
+
+        start = pixie_gettime();
+        test_write(types[i], fp, count);
+        fflush(fp);
+        elapsed = pixie_gettime() - start;
+        length = ftell(fp);
+        fclose(fp);
+
+        fprintf(stderr, "%-8s write:  %10.0f records/sec, %5.2f bytes/record\n",
+                i ? "scan-v2" : "scan-v1",
+                count * 1000000.0 / (elapsed ? elapsed : 1),
+                (double)length / count);
+    }
+    global_now = saved_now;
+}
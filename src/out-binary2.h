@@ -0,0 +1,108 @@
+/*
+    "masscan/2.0" binary scan file format
+
+    See out-binary2.c for a description of the format.
+*/
+#ifndef OUT_BINARY2_H
+#define OUT_BINARY2_H
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The 'kind' of a banner record. Status records use the values from
+ * 'enum PortStatus' instead.
+ */
+#define SCAN_KIND_BANNER 0xFF
+
+/**
+ * One decoded record from a scan file, either a port status or a banner
+ */
+struct ScanRecord {
+    unsigned kind;          /* Port_Open, Port_Closed, ..., SCAN_KIND_BANNER */
+    unsigned timestamp;
+    unsigned ip;
+    unsigned ip_proto;      /* banner only: 6 for TCP, 17 for UDP */
+    unsigned port;
+    unsigned reason;        /* status only: TCP flags */
+    unsigned ttl;           /* status only */
+    unsigned proto;         /* banner only: PROTO_HTTP, etc. */
+    const unsigned char *banner;
+    unsigned banner_length;
+};
+
+/**
+ * An entry in the block index at the end of a file, so that readers can
+ * seek to blocks (and split work among threads) without decompressing
+ * the entire file.
+ */
+struct Binary2Index {
+    uint64_t offset;        /* file offset of the block header */
+    unsigned length;        /* size of the block, including header */
+    unsigned count;         /* number of records in the block */
+    unsigned min_ip;
+    unsigned max_ip;
+    unsigned min_timestamp;
+    unsigned max_timestamp;
+};
+
+struct Binary2Reader;
+struct Binary2Writer;
+
+/**
+ * A writer that can be used directly, rather than through the
+ * "--output-format binary2" output, such as for the temporary files
+ * of "--merge". Unlike the output, it takes the timestamp from the
+ * record, so it can be used by many threads at once (each with its
+ * own writer).
+ */
+struct Binary2Writer *binary2_writer_create(void);
+void binary2_writer_open(struct Binary2Writer *w, FILE *fp);
+void binary2_writer_write(struct Binary2Writer *w, FILE *fp,
+                          const struct ScanRecord *rec);
+void binary2_writer_close(struct Binary2Writer *w, FILE *fp);
+void binary2_writer_destroy(struct Binary2Writer *w);
+
+/**
+ * Test whether the start of a file looks like this format
+ */
+int binary2_is_format(const unsigned char *px, size_t length);
+
+/**
+ * Create a streaming reader, either from a file that we read()
+ * sequentially, or from a memory buffer (such as a memory-mapped file).
+ */
+struct Binary2Reader *binary2_reader_create(FILE *fp);
+struct Binary2Reader *binary2_reader_create_mem(const unsigned char *px, size_t length);
+void binary2_reader_destroy(struct Binary2Reader *r);
+
+/**
+ * Get the next record. Any banner pointed to by the record is only
+ * valid until the next call.
+ * @return
+ *      1 if a record was returned, 0 at end-of-file, -1 if the file is
+ *      corrupt
+ */
+int binary2_reader_next(struct Binary2Reader *r, struct ScanRecord *rec);
+
+/**
+ * Move the reader to the start of a block, as given by the index.
+ */
+int binary2_reader_seek(struct Binary2Reader *r, uint64_t offset);
+
+/**
+ * Read the block index at the end of the file. The caller must free()
+ * the returned array.
+ * @return
+ *      0 on success, -1 if there is no index (such as when the program
+ *      crashed before closing the file)
+ */
+int binary2_index_load(const unsigned char *px, size_t length,
+                       struct Binary2Index **r_index, unsigned *r_count);
+int binary2_index_load_file(FILE *fp,
+                       struct Binary2Index **r_index, unsigned *r_count);
+
+int binary2_selftest(void);
+void binary2_benchmark(void);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+    JSON output
+
+    This produces "newline delimited JSON" (NDJSON), where each record is
+    a complete JSON object on a line by itself. This is so that results
+    can be streamed into log pipelines (logstash, fluentd, etc.) without
+    having to parse an enclosing array, and so that a file can be
+    appended to (--append-output) or rotated without any header/trailer
+    fix-ups.
+
+    A record looks like:
+
+    {"ip":"10.0.0.1","timestamp":1381000000,"port":80,"proto":"tcp",
+     "status":"open","reason":"syn-ack","ttl":64}
+
+    PERFORMANCE
+
+    Unlike the other writers, we don't use fprintf() here. When a scan
+    finds millions of open ports, printf-style formatting becomes the
+    dominant CPU cost on the receive thread. Instead, each record is
+    built up in a buffer on the stack using the formatting functions in
+    string-fmt.c and a precomputed escape table, then written with a
+    single fwrite().
+*/
+#include "output.h"
+#include "masscan.h"
+#include "proto-banner1.h"
+#include "string-fmt.h"
+
+
+/****************************************************************************
+ * Maximum size of a single formatted record. A banner that won't fit is
+ * truncated, the same as the XML writer truncates banners.
+ ****************************************************************************/
+#define JSON_RECORD_MAX 8192
+
+/****************************************************************************
+ * Escape table for JSON strings. A zero means the byte is copied as-is.
+ * Otherwise, the byte is replaced by a backslash followed by the character
+ * in this table, where 'u' means a "\u00XX" hex escape. Bytes at 0x7F and
+ * above are escaped too, because banners are arbitrary binary data and
+ * JSON requires strings to be valid UTF-8.
+ ****************************************************************************/
+static const char json_escapes[256] = {
+    'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+     0,  0, '"', 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,'\\', 0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,'u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+    'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+};
+
+/****************************************************************************
+ * Append arbitrary bytes as the contents of a JSON string (without the
+ * surrounding quotes). We reserve room for the closing of the record, so
+ * that a truncated banner still produces valid JSON.
+ ****************************************************************************/
+static void
+json_append_escaped(struct FmtBuf *jb, const unsigned char *px, unsigned length)
+{
+    unsigned i;
+    unsigned max = jb->max - 8;
+    char *buf = jb->buf;
+    unsigned offset = jb->length;
+
+    for (i=0; i<length; i++) {
+        unsigned char c = px[i];
+        char e = json_escapes[c];
+
+        if (e == 0) {
+            if (offset + 1 > max)
+                break;
+            buf[offset++] = (char)c;
+        } else if (e != 'u') {
+            if (offset + 2 > max)
+                break;
+            buf[offset++] = '\\';
+            buf[offset++] = e;
+        } else {
+            if (offset + 6 > max)
+                break;
+            buf[offset++] = '\\';
+            buf[offset++] = 'u';
+            buf[offset++] = '0';
+            buf[offset++] = '0';
+            buf[offset++] = "0123456789abcdef"[c >> 4];
+            buf[offset++] = "0123456789abcdef"[c & 0xF];
+        }
+    }
+
+    jb->length = offset;
+}
+
+/****************************************************************************
+ * Format the fields common to all records. This leaves the object open
+ * so that the caller can add more fields.
+ ****************************************************************************/
+static void
+json_append_header(struct FmtBuf *jb, unsigned ip, unsigned port,
+        const char *proto)
+{
+    fmt_literal(jb, "{\"ip\":\"");
+    fmt_ipv4(jb, ip);
+    fmt_literal(jb, "\",\"timestamp\":");
+    fmt_unsigned(jb, (unsigned)global_now);
+    fmt_literal(jb, ",\"port\":");
+    fmt_unsigned(jb, port);
+    fmt_literal(jb, ",\"proto\":\"");
+    fmt_string(jb, proto);
+    fmt_literal(jb, "\"");
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static unsigned
+json_format_status(char *buf, unsigned max, int status,
+        unsigned ip, unsigned port, unsigned reason, unsigned ttl)
+{
+    struct FmtBuf jb;
+
+    fmt_init(&jb, buf, max);
+
+    json_append_header(&jb, ip, port, proto_from_status(status));
+    fmt_literal(&jb, ",\"status\":\"");
+    fmt_string(&jb, status_string(status));
+    fmt_literal(&jb, "\",\"reason\":\"");
+    fmt_tcpflags(&jb, reason);
+    fmt_literal(&jb, "\",\"ttl\":");
+    fmt_unsigned(&jb, ttl);
+    fmt_literal(&jb, "}\n");
+
+    return jb.length;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static unsigned
+json_format_banner(char *buf, unsigned max, unsigned ip, unsigned ip_proto,
+        unsigned port, unsigned proto, const unsigned char *px, unsigned length)
+{
+    struct FmtBuf jb;
+
+    fmt_init(&jb, buf, max);
+
+    json_append_header(&jb, ip, port, proto_from_ip_proto(ip_proto));
+    fmt_literal(&jb, ",\"service\":\"");
+    fmt_string(&jb, proto_string(proto));
+    fmt_literal(&jb, "\",\"banner\":\"");
+    json_append_escaped(&jb, px, length);
+    fmt_literal(&jb, "\"}\n");
+
+    return jb.length;
+}
+
+/****************************************************************************
+ * NDJSON has no file header
+ ****************************************************************************/
+static void
+json_out_open(struct Output *out, FILE *fp)
+{
+    UNUSEDPARM(out);
+    UNUSEDPARM(fp);
+}
+
+/****************************************************************************
+ * NDJSON has no file trailer
+ ****************************************************************************/
+static void
+json_out_close(struct Output *out, FILE *fp)
+{
+    UNUSEDPARM(out);
+    UNUSEDPARM(fp);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+json_out_status(struct Output *out, FILE *fp, int status,
+               unsigned ip, unsigned port, unsigned reason, unsigned ttl)
+{
+    char buf[256];
+    unsigned length;
+
+    UNUSEDPARM(out);
+
+    length = json_format_status(buf, sizeof(buf), status, ip, port, reason, ttl);
+    fwrite(buf, 1, length, fp);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+json_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned ip_proto,
+        unsigned port, unsigned proto, const unsigned char *px, unsigned length)
+{
+    char buf[JSON_RECORD_MAX];
+    unsigned count;
+
+    UNUSEDPARM(out);
+
+    count = json_format_banner(buf, sizeof(buf), ip, ip_proto, port, proto,
+                               px, length);
+    fwrite(buf, 1, count, fp);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+const struct OutputType json_output = {
+    "json",
+    0,
+    json_out_open,
+    json_out_close,
+    json_out_status,
+    json_out_banner
+};
+
+
+/****************************************************************************
+ ****************************************************************************/
+int
+json_selftest(void)
+{
+    char buf[JSON_RECORD_MAX];
+    unsigned length;
+    time_t saved_now = global_now;
+    static const char *expected;
+
+    global_now = 1381000000;
+
+    /* a status record */
+    expected = "{\"ip\":\"10.0.0.1\",\"timestamp\":1381000000,\"port\":80,"
+               "\"proto\":\"tcp\",\"status\":\"open\",\"reason\":\"syn-ack\","
+               "\"ttl\":64}\n";
+    length = json_format_status(buf, sizeof(buf), Port_Open,
+                                0x0a000001, 80, 0x12, 64);
+    if (length != strlen(expected) || memcmp(buf, expected, length) != 0)
+        goto fail;
+
+    /* a banner with characters that must be escaped */
+    expected = "{\"ip\":\"255.255.255.0\",\"timestamp\":1381000000,\"port\":22,"
+               "\"proto\":\"tcp\",\"service\":\"ssh\","
+               "\"banner\":\"SSH-2.0 \\\"x\\\\y\\\"\\r\\n\\u0001\\u00ff\"}\n";
+    {
+        static const char banner[] = "SSH-2.0 \"x\\y\"\r\n\x01\xff";
+        length = json_format_banner(buf, sizeof(buf), 0xFFFFFF00, 6, 22,
+                                    PROTO_SSH2,
+                                    (const unsigned char *)banner,
+                                    sizeof(banner)-1);
+    }
+    if (length != strlen(expected) || memcmp(buf, expected, length) != 0)
+        goto fail;
+
+    /* a UDP banner */
+    expected = "{\"ip\":\"10.0.0.2\",\"timestamp\":1381000000,\"port\":123,"
+               "\"proto\":\"udp\",\"service\":\"ntp\","
+               "\"banner\":\"stratum=2\"}\n";
+    length = json_format_banner(buf, sizeof(buf), 0x0a000002, 17, 123,
+                                PROTO_NTP,
+                                (const unsigned char *)"stratum=2", 9);
+    if (length != strlen(expected) || memcmp(buf, expected, length) != 0)
+        goto fail;
+
+    /* a banner too big for the buffer must still close the object */
+    {
+        unsigned char big[1024];
+        memset(big, 0x01, sizeof(big));
+        length = json_format_banner(buf, 256, 0, 6, 0, 0, big, sizeof(big));
+        if (length > 256 || memcmp(buf + length - 3, "\"}\n", 3) != 0)
+            goto fail;
+    }
+
+    global_now = saved_now;
+    return 0;
+fail:
+    global_now = saved_now;
+    fprintf(stderr, "json: selftest failed\n");
+    return 1;
+}
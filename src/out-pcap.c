@@ -0,0 +1,438 @@
+/*
+    --pcap capture of received packets
+
+    The original capture (pcapfile_writeframe() in rawsock-pcapfile.c)
+    does two small fwrite()s per frame on the receive thread. That's
+    fine for debugging, but at full rate, a disk hiccup stalls the
+    receive thread, and we lose responses.
+
+    Instead, the receive thread only copies each frame (with its 16 byte
+    pcap header already formatted) into one of two large buffers. When
+    the buffer fills up, or a second has passed, it's handed to the
+    writer thread, and the receive thread continues with the other
+    buffer. If the writer thread still hasn't finished writing that one,
+    then the disk can't keep up, and frames are dropped (and counted)
+    rather than waiting.
+*/
+#include "out-pcap.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "pixie-tmp.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The size of each of the two buffers */
+#define PCAP_BUFFER_SIZE (4*1024*1024)
+
+#define PCAP_HEADER_SIZE 24
+#define PCAP_FRAME_HEADER_SIZE 16
+
+struct PcapBuffer {
+    unsigned char *px;
+    size_t length;
+
+    /* Set by the receive thread when the buffer is handed off, cleared
+     * by the writer thread once it's been written */
+    volatile unsigned is_full;
+};
+
+struct PcapWriter {
+    char *filename;
+    unsigned linktype;
+    unsigned snaplen;
+    uint64_t max_size;
+
+    /* the receive thread's side */
+    struct PcapBuffer buffers[2];
+    unsigned current;
+    unsigned last_secs;
+    uint64_t frames;
+    uint64_t drops;
+
+    /* the writer thread's side */
+    FILE *fp;
+    uint64_t file_size;
+    unsigned file_number;
+    unsigned next_write;
+    unsigned is_error;
+
+    volatile unsigned is_closing;
+    volatile unsigned is_done;
+};
+
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+put_le32(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x >> 0);
+    px[1] = (unsigned char)(x >> 8);
+    px[2] = (unsigned char)(x >> 16);
+    px[3] = (unsigned char)(x >> 24);
+}
+
+/***************************************************************************
+ * Open the next file, writing the pcap header. The first file has the
+ * name given, the rest have a number appended.
+ ***************************************************************************/
+static FILE *
+pcap_open(struct PcapWriter *w)
+{
+    unsigned char header[PCAP_HEADER_SIZE];
+    char *filename;
+    size_t filename_size = strlen(w->filename) + 12;
+    FILE *fp;
+    int err;
+
+    filename = (char *)malloc(filename_size);
+    if (filename == NULL)
+        return NULL;
+    if (w->file_number == 0)
+        sprintf_s(filename, filename_size, "%s", w->filename);
+    else
+        sprintf_s(filename, filename_size, "%s%u", w->filename, w->file_number);
+
+    err = fopen_s(&fp, filename, "wb");
+    if (err || fp == NULL) {
+        LOG(0, "pcap: %s: %s\n", filename, strerror_x(err));
+        free(filename);
+        return NULL;
+    }
+
+    /* little-endian, version 2.4 */
+    put_le32(header + 0, 0xa1b2c3d4);
+    header[4] = 2;
+    header[5] = 0;
+    header[6] = 4;
+    header[7] = 0;
+    put_le32(header + 8, 0);
+    put_le32(header + 12, 0);
+    put_le32(header + 16, w->snaplen ? w->snaplen : 65535);
+    put_le32(header + 20, w->linktype);
+    fwrite(header, 1, sizeof(header), fp);
+
+    LOG(1, "pcap: capturing to %s\n", filename);
+    free(filename);
+    w->file_size = sizeof(header);
+    w->file_number++;
+    return fp;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static size_t
+get_le32(const unsigned char *px)
+{
+    return px[0] | px[1]<<8 | px[2]<<16 | (size_t)px[3]<<24;
+}
+
+/***************************************************************************
+ * Write the buffer, rolling over to the next file between frames
+ * whenever the current one would get too big
+ ***************************************************************************/
+static void
+pcap_write(struct PcapWriter *w, const struct PcapBuffer *buf)
+{
+    size_t offset = 0;
+
+    while (offset < buf->length && !w->is_error) {
+        size_t length = buf->length - offset;
+
+        if (w->max_size && w->file_size + length > w->max_size) {
+            /* Only write the frames that fit */
+            size_t room = 0;
+            if (w->max_size > w->file_size)
+                room = (size_t)(w->max_size - w->file_size);
+            length = 0;
+            while (offset + length < buf->length) {
+                size_t next = PCAP_FRAME_HEADER_SIZE
+                            + get_le32(buf->px + offset + length + 8);
+                if (length + next > room)
+                    break;
+                length += next;
+            }
+
+            /* The file is full, so start the next one, unless it's
+             * empty, in which case the frame is bigger than the limit
+             * and has to go in anyway */
+            if (length == 0) {
+                if (w->file_size > PCAP_HEADER_SIZE) {
+                    fclose(w->fp);
+                    w->fp = pcap_open(w);
+                    if (w->fp == NULL) {
+                        w->is_error = 1;
+                        return;
+                    }
+                    continue;
+                }
+                length = PCAP_FRAME_HEADER_SIZE
+                       + get_le32(buf->px + offset + 8);
+            }
+        }
+
+        if (fwrite(buf->px + offset, 1, length, w->fp) != length) {
+            LOG(0, "pcap: %s: write failed, capture stopped\n", w->filename);
+            w->is_error = 1;
+            return;
+        }
+        w->file_size += length;
+        offset += length;
+    }
+}
+
+/***************************************************************************
+ * The buffers are always handed off in turn, so we write them in turn
+ ***************************************************************************/
+static void
+pcap_thread(void *v)
+{
+    struct PcapWriter *w = (struct PcapWriter *)v;
+
+    for (;;) {
+        struct PcapBuffer *buf = &w->buffers[w->next_write];
+
+        if (buf->is_full) {
+            pcap_write(w, buf);
+            buf->length = 0;
+            buf->is_full = 0;
+            w->next_write ^= 1;
+            continue;
+        }
+
+        /* The last buffer may have been handed off after we checked,
+         * just before we were told to close, so check once more */
+        if (w->is_closing) {
+            if (w->buffers[0].is_full || w->buffers[1].is_full)
+                continue;
+            break;
+        }
+        pixie_usleep(1000);
+    }
+
+    if (w->fp) {
+        fflush(w->fp);
+        fclose(w->fp);
+        w->fp = NULL;
+    }
+    w->is_done = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PcapWriter *
+pcapwriter_create(const char *filename, unsigned linktype,
+                  unsigned snaplen, uint64_t max_size)
+{
+    struct PcapWriter *w;
+    size_t filename_size = strlen(filename) + 1;
+    unsigned i;
+
+    w = (struct PcapWriter *)malloc(sizeof(*w));
+    if (w == NULL)
+        return NULL;
+    memset(w, 0, sizeof(*w));
+    w->linktype = linktype;
+    w->snaplen = snaplen;
+    w->max_size = max_size;
+
+    w->filename = (char *)malloc(filename_size);
+    if (w->filename == NULL)
+        goto fail;
+    memcpy(w->filename, filename, filename_size);
+
+    for (i=0; i<2; i++) {
+        w->buffers[i].px = (unsigned char *)malloc(PCAP_BUFFER_SIZE);
+        if (w->buffers[i].px == NULL)
+            goto fail;
+    }
+
+    w->fp = pcap_open(w);
+    if (w->fp == NULL)
+        goto fail;
+
+    pixie_begin_thread(pcap_thread, 0, w);
+    return w;
+
+fail:
+    free(w->buffers[0].px);
+    free(w->buffers[1].px);
+    free(w->filename);
+    free(w);
+    return NULL;
+}
+
+/***************************************************************************
+ * Give the current buffer to the writer thread, and switch to the other
+ * one, if it's free.
+ * @return
+ *      0 on success, -1 if the writer thread is still busy with the
+ *      other buffer
+ ***************************************************************************/
+static int
+pcap_handoff(struct PcapWriter *w)
+{
+    struct PcapBuffer *next = &w->buffers[w->current ^ 1];
+
+    if (next->is_full)
+        return -1;
+    w->buffers[w->current].is_full = 1;
+    w->current ^= 1;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pcapwriter_frame(struct PcapWriter *w, const unsigned char *px,
+                 unsigned length, unsigned secs, unsigned usecs)
+{
+    struct PcapBuffer *buf;
+    unsigned caplen = length;
+    unsigned char *p;
+
+    if (w == NULL)
+        return;
+    if (w->snaplen && caplen > w->snaplen)
+        caplen = w->snaplen;
+
+    buf = &w->buffers[w->current];
+
+    /* Hand off the buffer when it's full, or at least once a second so
+     * that the file stays current when traffic is light */
+    if (buf->length + PCAP_FRAME_HEADER_SIZE + caplen > PCAP_BUFFER_SIZE
+        || (buf->length && secs != w->last_secs)) {
+        if (pcap_handoff(w) != 0) {
+            if (buf->length + PCAP_FRAME_HEADER_SIZE + caplen > PCAP_BUFFER_SIZE) {
+                w->drops++;
+                return;
+            }
+        } else
+            buf = &w->buffers[w->current];
+        w->last_secs = secs;
+    }
+
+    p = buf->px + buf->length;
+    put_le32(p + 0, secs);
+    put_le32(p + 4, usecs);
+    put_le32(p + 8, caplen);
+    put_le32(p + 12, length);
+    memcpy(p + PCAP_FRAME_HEADER_SIZE, px, caplen);
+    buf->length += PCAP_FRAME_HEADER_SIZE + caplen;
+    w->frames++;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pcapwriter_destroy(struct PcapWriter *w)
+{
+    if (w == NULL)
+        return;
+
+    /* Hand off the last partial buffer, waiting for the writer thread
+     * if need be, since we are no longer receiving */
+    if (w->buffers[w->current].length) {
+        while (pcap_handoff(w) != 0)
+            pixie_usleep(1000);
+    }
+
+    w->is_closing = 1;
+    while (!w->is_done)
+        pixie_usleep(1000);
+
+    LOG(0, "pcap: %llu frames captured, %llu dropped\n",
+        (unsigned long long)w->frames, (unsigned long long)w->drops);
+
+    free(w->buffers[0].px);
+    free(w->buffers[1].px);
+    free(w->filename);
+    free(w);
+}
+
+/***************************************************************************
+ * Read back one of the files written by the selftest, checking that it
+ * has the frames numbered [first..first+count)
+ ***************************************************************************/
+static int
+pcapwriter_selftest_file(const char *filename, unsigned first, unsigned count)
+{
+    unsigned char buf[PCAP_HEADER_SIZE + 8 * (PCAP_FRAME_HEADER_SIZE + 64)];
+    size_t length;
+    size_t offset;
+    FILE *fp;
+    unsigned i;
+
+    if (fopen_s(&fp, filename, "rb") != 0 || fp == NULL)
+        return 1;
+    length = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+
+    if (length != PCAP_HEADER_SIZE + count * (PCAP_FRAME_HEADER_SIZE + 64))
+        return 1;
+    if (get_le32(buf + 0) != 0xa1b2c3d4 || get_le32(buf + 16) != 64
+        || get_le32(buf + 20) != 1)
+        return 1;
+
+    offset = PCAP_HEADER_SIZE;
+    for (i=first; i<first+count; i++) {
+        const unsigned char *p = buf + offset;
+
+        if (get_le32(p + 0) != 1000 + i || get_le32(p + 4) != i
+            || get_le32(p + 8) != 64 || get_le32(p + 12) != 100
+            || p[PCAP_FRAME_HEADER_SIZE] != i
+            || p[PCAP_FRAME_HEADER_SIZE + 63] != 63)
+            return 1;
+        offset += PCAP_FRAME_HEADER_SIZE + 64;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Write some frames, truncated by the snaplen, and spread over several
+ * files by the maximum size, then read them back
+ ***************************************************************************/
+int
+pcapwriter_selftest(void)
+{
+    struct PcapWriter *w;
+    unsigned char frame[100];
+    char filename[256];
+    char filename2[272];
+    int failures = 0;
+    unsigned i;
+
+    pixie_tmp_filename(filename, sizeof(filename), "masscan-pcap");
+
+    /* Room for two frames in each file */
+    w = pcapwriter_create(filename, 1, 64,
+                          PCAP_HEADER_SIZE + 2 * (PCAP_FRAME_HEADER_SIZE + 64));
+    if (w == NULL)
+        goto fail;
+    for (i=0; i<5; i++) {
+        unsigned j;
+
+        for (j=0; j<sizeof(frame); j++)
+            frame[j] = (unsigned char)j;
+        frame[0] = (unsigned char)i;
+        pcapwriter_frame(w, frame, sizeof(frame), 1000 + i, i);
+    }
+    pcapwriter_destroy(w);
+
+    failures += pcapwriter_selftest_file(filename, 0, 2);
+    for (i=1; i<3; i++) {
+        sprintf_s(filename2, sizeof(filename2), "%s%u", filename, i);
+        failures += pcapwriter_selftest_file(filename2, i*2, i==1 ? 2 : 1);
+        remove(filename2);
+    }
+    remove(filename);
+    if (failures)
+        goto fail;
+    return 0;
+fail:
+    fprintf(stderr, "pcap: selftest failed\n");
+    return 1;
+}
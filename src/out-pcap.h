@@ -0,0 +1,45 @@
+/*
+    --pcap capture of received packets
+
+    Frames are copied into large buffers on the receive thread, then
+    written to disk by a background thread, so that capturing never
+    stalls reception. See out-pcap.c for details.
+*/
+#ifndef OUT_PCAP_H
+#define OUT_PCAP_H
+#include <stdint.h>
+
+struct PcapWriter;
+
+/**
+ * Open the capture file and start the writer thread.
+ * @param linktype
+ *      the adapter's link type, from rawsock_datalink(), 1 for Ethernet
+ * @param snaplen
+ *      frames are truncated to this many bytes, or zero to keep the
+ *      whole frame
+ * @param max_size
+ *      when a file reaches this many bytes, close it and continue
+ *      in "<filename>1", "<filename>2", and so on (like tcpdump's -C
+ *      option), or zero to keep writing one file
+ * @return
+ *      NULL if the file couldn't be opened
+ */
+struct PcapWriter *pcapwriter_create(const char *filename, unsigned linktype,
+                                     unsigned snaplen, uint64_t max_size);
+
+/**
+ * Save a frame. This never blocks: if the writer thread can't keep up,
+ * the frame is dropped and counted instead.
+ */
+void pcapwriter_frame(struct PcapWriter *w, const unsigned char *px,
+                      unsigned length, unsigned secs, unsigned usecs);
+
+/**
+ * Write what's left, stop the thread, and close the file.
+ */
+void pcapwriter_destroy(struct PcapWriter *w);
+
+int pcapwriter_selftest(void);
+
+#endif
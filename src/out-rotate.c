@@ -0,0 +1,337 @@
+/*
+    output rotation thread
+
+    When the output is rotated (by time with "--rotate", by size with
+    "--rotate-size", or by number of records with "--rotate-count"), the
+    finished file is moved into the "--rotate-dir" directory, and a new
+    file is started with the original name.
+
+    Doing this on the receive thread means that it blocks on the file
+    system for the close(), rename(), and open(), which on a busy disk
+    (or a network file system) can take a long time, during which the
+    receive queue overflows and we lose responses. Instead, this thread
+    does all the slow work:
+
+    1. It opens a "spare" file ahead of time, named "<filename>.next".
+    2. When it's time to rotate, the receive thread writes the trailer to
+       the current file, then simply switches to writing into the spare
+       file, and hands the old file to this thread.
+    3. This thread closes the old file, renames it into the rotation
+       directory, renames the spare (now the current file) back to the
+       original name, then opens the next spare.
+    4. Optionally ("--rotate-compress"), the rotated file is compressed
+       to "<name>.gz", and ("--rotate-fsync") synced to disk.
+
+    Like the original rotation, if renaming into the rotation directory
+    fails, the file is kept where it is, rather than lost. In that case,
+    rotation stops, and output continues into the last file.
+*/
+#include "out-rotate.h"
+#include "output.h"
+#include "masscan.h"
+#include "rte-ring.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "pixie-zlib.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#if defined(WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+struct RotateJob {
+    FILE *fp;
+    time_t last_rotate;
+    int is_last;
+};
+
+struct Rotator {
+    const struct Masscan *masscan;
+    char *spare_filename;
+
+    /* Set by this thread, cleared by the receive thread when it takes
+     * the spare file */
+    FILE * volatile spare;
+
+    /* finished files from the receive thread */
+    struct rte_ring *ring;
+
+    /* Only set once the last spare has been renamed back to the original
+     * filename, since opening a spare truncates that name */
+    unsigned is_spare_needed;
+
+    volatile unsigned is_broken;
+    volatile unsigned is_closing;
+    volatile unsigned is_done;
+};
+
+
+/***************************************************************************
+ * Make sure the file contents are on the disk
+ ***************************************************************************/
+static void
+file_sync(FILE *fp)
+{
+    fflush(fp);
+#if defined(WIN32)
+    _commit(_fileno(fp));
+#else
+    fsync(fileno(fp));
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+file_sync_name(const char *filename)
+{
+    FILE *fp;
+
+    /* Windows needs write access to sync, so open for appending */
+    fp = fopen(filename, "ab");
+    if (fp == NULL)
+        return;
+    file_sync(fp);
+    fclose(fp);
+}
+
+/***************************************************************************
+ * Move the finished file out of the way
+ * @return
+ *      the new name of the file, which the caller must free(), or NULL
+ *      if it couldn't be renamed
+ ***************************************************************************/
+static char *
+rotate_rename(const struct Masscan *masscan, time_t last_rotate)
+{
+    const char *filename = masscan->nmap.filename;
+    char *new_filename;
+
+    new_filename = output_rotate_filename(masscan->rotate_directory,
+                                          filename, last_rotate);
+    if (new_filename == NULL)
+        return NULL;
+
+    if (rename(filename, new_filename) != 0) {
+        LOG(0, "rename(\"%s\", \"%s\"): failed\n", filename, new_filename);
+        perror("rename()");
+        free(new_filename);
+        return NULL;
+    }
+    return new_filename;
+}
+
+/***************************************************************************
+ * Compress the rotated file, replacing it with the ".gz" version
+ ***************************************************************************/
+static void
+rotate_compress(const struct Masscan *masscan, const char *filename)
+{
+    size_t gz_size = strlen(filename) + 4;
+    char *gz_filename;
+
+    gz_filename = (char *)malloc(gz_size);
+    if (gz_filename == NULL)
+        return;
+    sprintf_s(gz_filename, gz_size, "%s.gz", filename);
+
+    if (pixie_zlib_gzip_file(filename, gz_filename, 6) != 0) {
+        LOG(0, "rotate: %s: compression failed\n", filename);
+        remove(gz_filename);
+    } else {
+        if (masscan->is_rotate_fsync)
+            file_sync_name(gz_filename);
+        remove(filename);
+        LOG(1, "rotate: compressed: %s\n", gz_filename);
+    }
+    free(gz_filename);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+rotate_job(struct Rotator *r, const struct RotateJob *job)
+{
+    const struct Masscan *masscan = r->masscan;
+    char *new_filename;
+
+    if (masscan->is_rotate_fsync)
+        file_sync(job->fp);
+    fclose(job->fp);
+
+    if (r->is_broken)
+        return;
+
+    new_filename = rotate_rename(masscan, job->last_rotate);
+    if (new_filename == NULL) {
+        /* Leave everything where it is, and stop rotating, so that no
+         * data is lost */
+        if (!job->is_last) {
+            LOG(0, "rotate: output continues in: %s\n", r->spare_filename);
+            r->is_broken = 1;
+        }
+        return;
+    }
+    LOG(1, "rotated: %s\n", new_filename);
+
+    /* The file we switched to goes back to the original name */
+    if (!job->is_last) {
+        if (rename(r->spare_filename, masscan->nmap.filename) != 0) {
+            LOG(0, "rename(\"%s\", \"%s\"): failed\n",
+                r->spare_filename, masscan->nmap.filename);
+            LOG(0, "rotate: output continues in: %s\n", r->spare_filename);
+            r->is_broken = 1;
+        }
+    }
+
+    if (masscan->is_rotate_compress)
+        rotate_compress(masscan, new_filename);
+    else if (masscan->is_rotate_fsync)
+        file_sync_name(new_filename);
+
+    free(new_filename);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+rotator_thread(void *v)
+{
+    struct Rotator *r = (struct Rotator *)v;
+
+    for (;;) {
+        struct RotateJob *job;
+
+        if (rte_ring_sc_dequeue(r->ring, (void**)&job) == 0) {
+            rotate_job(r, job);
+            free(job);
+            r->is_spare_needed = 1;
+            continue;
+        }
+
+        if (r->is_spare_needed && !r->is_broken && !r->is_closing) {
+            FILE *fp = output_fopen(r->spare_filename, 0);
+            if (fp == NULL) {
+                LOG(0, "rotate: %s: %s\n", r->spare_filename, strerror_x(errno));
+                r->is_broken = 1;
+            } else
+                r->spare = fp;
+            r->is_spare_needed = 0;
+            continue;
+        }
+
+        if (r->is_closing && rte_ring_empty(r->ring))
+            break;
+        pixie_usleep(10000);
+    }
+
+    r->is_done = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Rotator *
+rotator_create(const struct Masscan *masscan)
+{
+    struct Rotator *r;
+    size_t spare_size = strlen(masscan->nmap.filename) + 6;
+
+    r = (struct Rotator *)malloc(sizeof(*r));
+    if (r == NULL)
+        return NULL;
+    memset(r, 0, sizeof(*r));
+    r->masscan = masscan;
+
+    r->spare_filename = (char *)malloc(spare_size);
+    if (r->spare_filename == NULL) {
+        free(r);
+        return NULL;
+    }
+    sprintf_s(r->spare_filename, spare_size, "%s.next", masscan->nmap.filename);
+
+    /* Only one job is ever outstanding, because the next spare file isn't
+     * ready until the last job is done, so the ring can be small */
+    r->ring = rte_ring_create(16, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    r->is_spare_needed = 1;
+
+    pixie_begin_thread(rotator_thread, 0, r);
+    return r;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+rotator_get_spare(struct Rotator *r)
+{
+    FILE *fp;
+
+    if (r == NULL || r->is_broken)
+        return NULL;
+    fp = r->spare;
+    if (fp)
+        r->spare = NULL;
+    return fp;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+rotator_enqueue(struct Rotator *r, FILE *fp, time_t last_rotate, int is_last)
+{
+    struct RotateJob *job;
+
+    job = (struct RotateJob *)malloc(sizeof(*job));
+    if (job == NULL) {
+        fclose(fp);
+        return;
+    }
+    job->fp = fp;
+    job->last_rotate = last_rotate;
+    job->is_last = is_last;
+
+    while (rte_ring_sp_enqueue(r->ring, job) != 0)
+        pixie_usleep(1000);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+rotator_submit(struct Rotator *r, FILE *fp, time_t last_rotate)
+{
+    rotator_enqueue(r, fp, last_rotate, 0);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+rotator_destroy(struct Rotator *r, FILE *fp, time_t last_rotate)
+{
+    FILE *spare;
+
+    if (r == NULL)
+        return;
+
+    if (fp)
+        rotator_enqueue(r, fp, last_rotate, 1);
+
+    r->is_closing = 1;
+    while (!r->is_done)
+        pixie_usleep(1000);
+
+    /* Remove the unused spare file */
+    spare = r->spare;
+    if (spare) {
+        fclose(spare);
+        remove(r->spare_filename);
+    }
+
+    free(r->ring);
+    free(r->spare_filename);
+    free(r);
+}
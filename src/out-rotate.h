@@ -0,0 +1,47 @@
+/*
+    output rotation thread
+
+    Renaming, compressing, and syncing rotated files is slow, and can
+    block for a long time on a busy file system. This moves that work
+    off the receive thread, onto a background thread. See out-rotate.c
+    for details.
+*/
+#ifndef OUT_ROTATE_H
+#define OUT_ROTATE_H
+#include <stdio.h>
+#include <time.h>
+
+struct Masscan;
+struct Rotator;
+
+/**
+ * Start the background thread, which immediately opens the first
+ * spare file for the next rotation.
+ */
+struct Rotator *rotator_create(const struct Masscan *masscan);
+
+/**
+ * Get the file to rotate into. This never blocks.
+ * @return
+ *      an open (empty) file, or NULL if the background thread hasn't
+ *      got one ready yet, in which case the caller should keep writing
+ *      to the current file and try again later
+ */
+FILE *rotator_get_spare(struct Rotator *r);
+
+/**
+ * Hand off a finished file, whose trailer has already been written, to
+ * the background thread to be closed, renamed into the rotation
+ * directory, and optionally compressed and synced. This never blocks.
+ * @param last_rotate
+ *      when the file was started, used to name the rotated file
+ */
+void rotator_submit(struct Rotator *r, FILE *fp, time_t last_rotate);
+
+/**
+ * Same as rotator_submit(), for the last file, then wait for the
+ * background thread to finish and clean up.
+ */
+void rotator_destroy(struct Rotator *r, FILE *fp, time_t last_rotate);
+
+#endif
@@ -1,5 +1,7 @@
 #include "output.h"
 #include "masscan.h"
+#include "string-fmt.h"
+#include <string.h>
 
 /****************************************************************************
  ****************************************************************************/
@@ -25,42 +27,61 @@ static void
 text_out_status(struct Output *out, FILE *fp, 
     int status, unsigned ip, unsigned port, unsigned reason, unsigned ttl)
 {
+    char buf[128];
+    struct FmtBuf fb[1];
+
     UNUSEDPARM(ttl);
     UNUSEDPARM(reason);
     UNUSEDPARM(out);
-    
-
-    fprintf(fp, "%s tcp %u %u.%u.%u.%u %u\n",
-        status_string(status),
-        port,
-        (ip>>24)&0xFF,
-        (ip>>16)&0xFF,
-        (ip>> 8)&0xFF,
-        (ip>> 0)&0xFF,
-        (unsigned)global_now
-        );
+
+    fmt_init(fb, buf, sizeof(buf));
+    fmt_string(fb, status_string(status));
+    fmt_char(fb, ' ');
+    fmt_string(fb, proto_from_status(status));
+    fmt_char(fb, ' ');
+    fmt_unsigned(fb, port);
+    fmt_char(fb, ' ');
+    fmt_ipv4(fb, ip);
+    fmt_char(fb, ' ');
+    fmt_unsigned(fb, (unsigned)global_now);
+    fmt_char(fb, '\n');
+
+    fwrite(buf, 1, fb->length, fp);
 }
 
 /*************************************** *************************************
  ****************************************************************************/
 static void
-text_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned port, 
-        unsigned proto, const unsigned char *px, unsigned length)
+text_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned ip_proto,
+        unsigned port, unsigned proto, const unsigned char *px, unsigned length)
 {
+    char buf[128];
+    struct FmtBuf fb[1];
+    const unsigned char *nul;
 
     UNUSEDPARM(out);
 
-    fprintf(fp, "%s tcp %u %u.%u.%u.%u %u %s %.*s\n",
-        "banner",
-        port,
-        (ip>>24)&0xFF,
-        (ip>>16)&0xFF,
-        (ip>> 8)&0xFF,
-        (ip>> 0)&0xFF,
-        (unsigned)global_now,
-        proto_string(proto),
-        length, px
-        );
+    fmt_init(fb, buf, sizeof(buf));
+    fmt_literal(fb, "banner ");
+    fmt_string(fb, proto_from_ip_proto(ip_proto));
+    fmt_char(fb, ' ');
+    fmt_unsigned(fb, port);
+    fmt_char(fb, ' ');
+    fmt_ipv4(fb, ip);
+    fmt_char(fb, ' ');
+    fmt_unsigned(fb, (unsigned)global_now);
+    fmt_char(fb, ' ');
+    fmt_string(fb, proto_string(proto));
+    fmt_char(fb, ' ');
+
+    /* like the "%.*s" this replaced, stop at an embedded nul */
+    nul = memchr(px, '\0', length);
+    if (nul)
+        length = (unsigned)(nul - px);
+
+    fwrite(buf, 1, fb->length, fp);
+    fwrite(px, 1, length, fp);
+    fputc('\n', fp);
 }
 
 
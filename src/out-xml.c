@@ -1,5 +1,6 @@
 #include "output.h"
 #include "masscan.h"
+#include "string-fmt.h"
 
 
 /****************************************************************************
@@ -60,59 +61,77 @@ static void
 xml_out_status(struct Output *out, FILE *fp, int status, 
                unsigned ip, unsigned port, unsigned reason, unsigned ttl)
 {
-    char reason_buffer[128];
+    char buf[512];
+    struct FmtBuf fb[1];
+
     UNUSEDPARM(out);
-    fprintf(fp, "<host endtime=\"%u\">"
-                    "<address addr=\"%u.%u.%u.%u\" addrtype=\"ipv4\"/>"
+
+    fmt_init(fb, buf, sizeof(buf));
+    fmt_literal(fb, "<host endtime=\"");
+    fmt_unsigned(fb, (unsigned)global_now);
+    fmt_literal(fb, "\">"
+                    "<address addr=\"");
+    fmt_ipv4(fb, ip);
+    fmt_literal(fb, "\" addrtype=\"ipv4\"/>"
                     "<ports>"
-                    "<port protocol=\"tcp\" portid=\"%u\">"
-                    "<state state=\"%s\" reason=\"%s\" reason_ttl=\"%u\"/>"
+                    "<port protocol=\"");
+    fmt_string(fb, proto_from_status(status));
+    fmt_literal(fb, "\" portid=\"");
+    fmt_unsigned(fb, port);
+    fmt_literal(fb, "\">"
+                    "<state state=\"");
+    fmt_string(fb, status_string(status));
+    fmt_literal(fb, "\" reason=\"");
+    fmt_tcpflags(fb, reason);
+    fmt_literal(fb, "\" reason_ttl=\"");
+    fmt_unsigned(fb, ttl);
+    fmt_literal(fb, "\"/>"
                     "</port>"
                     "</ports>"
                 "</host>"
-                "\r\n",
-        (unsigned)global_now,
-        (ip>>24)&0xFF,
-        (ip>>16)&0xFF,
-        (ip>> 8)&0xFF,
-        (ip>> 0)&0xFF,
-        port,
-        status_string(status),
-        reason_string(reason, reason_buffer, sizeof(reason_buffer)),
-        ttl
-        );
+                "\r\n");
+
+    fwrite(buf, 1, fb->length, fp);
 }
 
 /****************************************************************************
  ****************************************************************************/
 static void
-xml_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned port,
-        unsigned proto, const unsigned char *px, unsigned length)
+xml_out_banner(struct Output *out, FILE *fp, unsigned ip, unsigned ip_proto,
+        unsigned port, unsigned proto, const unsigned char *px, unsigned length)
 {
     char banner_buffer[1024];
+    char buf[sizeof(banner_buffer) + 512];
+    struct FmtBuf fb[1];
 
     UNUSEDPARM(out);
 
-    fprintf(fp, "<host endtime=\"%u\">"
-                    "<address addr=\"%u.%u.%u.%u\" addrtype=\"ipv4\"/>"
+    fmt_init(fb, buf, sizeof(buf));
+    fmt_literal(fb, "<host endtime=\"");
+    fmt_unsigned(fb, (unsigned)global_now);
+    fmt_literal(fb, "\">"
+                    "<address addr=\"");
+    fmt_ipv4(fb, ip);
+    fmt_literal(fb, "\" addrtype=\"ipv4\"/>"
                     "<ports>"
-                    "<port protocol=\"tcp\" portid=\"%u\">"
-                    "<service name=\"%s\">"
-                    "<banner>%s</banner>"
+                    "<port protocol=\"");
+    fmt_string(fb, proto_from_ip_proto(ip_proto));
+    fmt_literal(fb, "\" portid=\"");
+    fmt_unsigned(fb, port);
+    fmt_literal(fb, "\">"
+                    "<service name=\"");
+    fmt_string(fb, proto_string(proto));
+    fmt_literal(fb, "\">"
+                    "<banner>");
+    fmt_string(fb, normalize_string(px, length, banner_buffer, sizeof(banner_buffer)));
+    fmt_literal(fb, "</banner>"
                     "</service>"
                     "</port>"
                     "</ports>"
                 "</host>"
-                "\r\n",
-        (unsigned)global_now,
-        (ip>>24)&0xFF,
-        (ip>>16)&0xFF,
-        (ip>> 8)&0xFF,
-        (ip>> 0)&0xFF,
-        port,
-        proto_string(proto),
-        normalize_string(px, length, banner_buffer, sizeof(banner_buffer))
-        );
+                "\r\n");
+
+    fwrite(buf, 1, fb->length, fp);
 }
 
 /****************************************************************************
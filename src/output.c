@@ -25,6 +25,11 @@
 #include "string_s.h"
 #include "logger.h"
 #include "proto-banner1.h"
+#include "pixie-timer.h"
+#include "pixie-tmp.h"
+#include "string-fmt.h"
+#include "out-rotate.h"
+#include "main-worker.h"
 
 #include <limits.h>
 #include <ctype.h>
@@ -52,27 +57,19 @@ status_string(int x)
         case Port_UdpOpen: return "open";
         case Port_UdpClosed: return "closed";
         case Port_IcmpEchoResponse: return "exists";
+        case Port_SctpOpen: return "open";
+        case Port_SctpClosed: return "closed";
         default: return "unknown";
     }
 }
 const char *
 reason_string(int x, char *buffer, size_t sizeof_buffer)
 {
-    sprintf_s(buffer, sizeof_buffer, "%s%s%s%s%s%s%s%s",
-        (x&0x01)?"fin-":"",
-        (x&0x02)?"syn-":"",
-        (x&0x04)?"rst-":"",
-        (x&0x08)?"psh-":"",
-        (x&0x10)?"ack-":"",
-        (x&0x20)?"urg-":"",
-        (x&0x40)?"ece-":"",
-        (x&0x80)?"cwr-":""
-        );
-    if (buffer[0] == '\0')
-        return "none";
-    else
-        buffer[strlen(buffer)-1] = '\0';
-    return buffer;
+    struct FmtBuf fb[1];
+
+    fmt_init(fb, buffer, sizeof_buffer);
+    fmt_tcpflags(fb, x);
+    return fmt_cstr(fb);
 }
 
 const char *
@@ -85,6 +82,13 @@ proto_string(unsigned proto)
     case PROTO_HTTP: return "http";
     case PROTO_FTP1: return "ftp";
     case PROTO_FTP2: return "ftp";
+    case PROTO_DNS_VERSIONBIND: return "dns";
+    case PROTO_SNMP: return "snmp";
+    case PROTO_NTP: return "ntp";
+    case PROTO_NETBIOS: return "netbios";
+    case PROTO_SSDP: return "ssdp";
+    case PROTO_MEMCACHED: return "memcached";
+    case PROTO_MDNS: return "mdns";
     default:
         sprintf_s(tmp, sizeof(tmp), "(%u)", proto);
         return tmp;
@@ -126,12 +130,8 @@ normalize_string(const unsigned char *px, size_t length, char *buf, size_t buf_l
  * construct our own open flag.
  ***************************************************************************/
 FILE *
-open_rotate(struct Output *output, const char *filename)
+output_fopen(const char *filename, unsigned is_append)
 {
-    FILE *fp;
-    const struct Masscan *masscan = output->masscan;
-    unsigned is_append =masscan->nmap.append;
-
 #if defined(WIN32)
     /* PORTABILITY: WINDOWS
      *  This bit of code deals with the fact that on Windows, fopen() opens
@@ -158,24 +158,31 @@ open_rotate(struct Output *output, const char *filename)
                             FILE_ATTRIBUTE_TEMPORARY,
                             NULL);
     if (hFile == INVALID_HANDLE_VALUE) {
-        control_c_pressed = 1;
         return NULL;
     }
 
     fd = _open_osfhandle((intptr_t)hFile, _O_CREAT | _O_RDONLY | _O_TEMPORARY);
     if (fd == -1) {
         perror("_open_osfhandle");
-        control_c_pressed = 1;
         return NULL;
     }
 
-    fp = _fdopen(fd, "w");
-
-
+    return _fdopen(fd, "w");
 #else
-    fp = fopen(filename, is_append?"a":"w");
+    return fopen(filename, is_append?"a":"w");
 #endif
+}
 
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+open_rotate(struct Output *output, const char *filename)
+{
+    FILE *fp;
+    const struct Masscan *masscan = output->masscan;
+    unsigned is_append =masscan->nmap.append;
+
+    fp = output_fopen(filename, is_append);
     if (fp == NULL) {
         fprintf(stderr, "out: could not open file for %s\n", is_append?"appending":"writing");
         perror(filename);
@@ -276,16 +283,33 @@ output_create(const struct Masscan *masscan)
     case Output_Binary:
         out->funcs = &binary_output;
         break;
+    case Output_Binary2:
+        out->funcs = &binary2_output;
+        break;
+    case Output_JSON:
+        out->funcs = &json_output;
+        break;
     default:
         out->funcs = &null_output;
         //masscan->is_interactive = 1;
         break;
     }
 
+    if (out->funcs->create)
+        out->ctx = out->funcs->create(out);
+
+    /*
+     * With --worker, the results go to the coordinator, which writes the
+     * output file instead of us
+     */
+    if (masscan->lease.is_worker)
+        out->remote = worker_output_create(masscan);
+
     /*
      * Open the desired output file
      */
-    if (masscan->nmap.filename[0] && out->funcs != &null_output) {
+    if (masscan->nmap.filename[0] && out->funcs != &null_output
+        && out->remote == NULL) {
         FILE *fp;
 
         fp = open_rotate(out, masscan->nmap.filename);
@@ -298,6 +322,14 @@ output_create(const struct Masscan *masscan)
         out->last_rotate = time(0);
     }
 
+    /*
+     * Start the background thread that does the rotating
+     */
+    if (out->fp && (masscan->rotate_output || masscan->rotate_size
+                    || masscan->rotate_count)) {
+        out->rotator = rotator_create(masscan);
+    }
+
     /*
      * Set the rotation time
      */
@@ -318,30 +350,23 @@ output_create(const struct Masscan *masscan)
 
 
 /***************************************************************************
+ * Create the name of a rotated file, which is the original filename
+ * (without directories), prefixed by when it was started, in the
+ * rotation directory.
  ***************************************************************************/
-FILE *
-output_do_rotate(struct Output *out)
+char *
+output_rotate_filename(const char *dir, const char *filename, time_t last_rotate)
 {
-    const char *dir = out->masscan->rotate_directory;
-    const char *filename = out->masscan->nmap.filename;
     char *new_filename;
     size_t new_filename_size;
+    const char *p;
     struct tm tm;
     int err;
 
-    if (out->fp == NULL)
-        return NULL;
-
-    fflush(out->fp);
-
     /* remove directories from filename */
-    while (strchr(filename, '/') || strchr(filename, '\\')) {
-        filename = strchr(filename, '/');
-        if (*filename == '/')
-            filename++;
-        filename = strchr(filename, '\\');
-        if (*filename == '\\')
-            filename++;
+    for (p = filename; *p; p++) {
+        if (*p == '/' || *p == '\\')
+            filename = p + 1;
     }
 
     new_filename_size =     strlen(dir)
@@ -353,15 +378,15 @@ output_do_rotate(struct Output *out)
                             + 1; /* nul */
 
 
-    err = localtime_s(&tm, &out->last_rotate);
+    err = localtime_s(&tm, &last_rotate);
     if (err != 0) {
         perror("gmtime(): file rotation ended");
-        return out->fp;
+        return NULL;
     }
 
     new_filename = (char*)malloc(new_filename_size);
     if (new_filename == NULL)
-        return out->fp;
+        return NULL;
 
     err = 0;
 again:
@@ -379,38 +404,67 @@ again:
         if (err++ == 0)
             goto again;
     }
-    filename = out->masscan->nmap.filename;
+    return new_filename;
+}
 
-    /*
-     * Move the file
-     */
-    err = rename(filename, new_filename);
-    if (err) {
-        LOG(0, "rename(\"%s\", \"%s\"): failed\n", filename, new_filename);
-        perror("rename()");
-        free(new_filename);
+/***************************************************************************
+ * Whether it's time to rotate, either because the period has passed, or
+ * the file has gotten too big. Since ftell() isn't free, the size is only
+ * checked every so often.
+ ***************************************************************************/
+static int
+is_rotate_due(struct Output *out, time_t now)
+{
+    const struct Masscan *masscan = out->masscan;
+
+    out->rotate_records++;
+    if (now >= out->next_rotate)
+        return 1;
+    if (masscan->rotate_count && out->rotate_records > masscan->rotate_count)
+        return 1;
+    if (masscan->rotate_size && (out->rotate_records & 0xFF) == 0
+        && (uint64_t)ftell(out->fp) >= masscan->rotate_size)
+        return 1;
+    return 0;
+}
+
+/***************************************************************************
+ * Switch to a new file. The slow parts (closing, renaming, and opening
+ * the next file) are done by the background thread in out-rotate.c, so
+ * that we don't block the receive thread on the file system.
+ ***************************************************************************/
+FILE *
+output_do_rotate(struct Output *out, time_t now)
+{
+    FILE *fp;
+
+    if (out->fp == NULL)
+        return NULL;
+
+    fp = rotator_get_spare(out->rotator);
+    if (fp == NULL) {
+        /* The background thread isn't ready, so keep writing this file,
+         * and try again in a second (or a few more records) */
+        if (out->next_rotate <= now)
+            out->next_rotate = now + 1;
         return out->fp;
     }
-    out->next_rotate = next_rotate(time(0), out->period, out->offset);
 
-    LOG(1, "rotated: %s\n", new_filename);
+    /* Write the trailer to the old file, then hand it off */
+    out->funcs->close(out, out->fp);
+    memset(&out->counts, 0, sizeof(out->counts));
+    rotator_submit(out->rotator, out->fp, out->last_rotate);
 
-    /*
-     * Now create a new file
-     */
-    {
-        FILE *fp;
+    /* Write the header to the new file */
+    out->fp = fp;
+    out->funcs->open(out, fp);
+    out->last_rotate = now;
+    out->rotate_records = 1; /* the record that's about to be written */
+    if (out->period)
+        out->next_rotate = next_rotate(now, out->period, out->offset);
+    else
+        out->next_rotate = (time_t)LONG_MAX;
 
-        fp = open_rotate(out, filename);
-        if (fp == NULL) {
-            LOG(0, "rotate: %s: failed: %s\n", filename, strerror_x(errno));
-        } else {
-            close_rotate(out, out->fp);
-            out->fp = fp;
-            out->last_rotate = time(0);
-            LOG(1, "rotate: started new file: %s\n", filename);
-        }
-    }
     return out->fp;
 }
 
@@ -423,6 +477,24 @@ proto_from_status(unsigned status)
         case Port_IcmpEchoResponse: return "icmp";
         case Port_UdpOpen: return "udp";
         case Port_UdpClosed: return "udp";
+        case Port_SctpOpen: return "sctp";
+        case Port_SctpClosed: return "sctp";
+        default: return "err";
+    }
+}
+
+/***************************************************************************
+ * Like proto_from_status(), but for banners, which have the IP protocol
+ * number instead
+ ***************************************************************************/
+const char *
+proto_from_ip_proto(unsigned ip_proto)
+{
+    switch (ip_proto) {
+        case 1: return "icmp";
+        case 6: return "tcp";
+        case 17: return "udp";
+        case 132: return "sctp";
         default: return "err";
     }
 }
@@ -431,46 +503,51 @@ proto_from_status(unsigned status)
 void
 output_report_status(struct Output *out, int status, 
         unsigned ip, unsigned port, unsigned reason, unsigned ttl)
+{
+    output_report_status_at(out, time(0), status, ip, port, reason, ttl);
+}
+
+/***************************************************************************
+ * Same as output_report_status(), but with the time the result was
+ * found, for when we are re-processing old results (--readscan)
+ ***************************************************************************/
+void
+output_report_status_at(struct Output *out, time_t now, int status, 
+        unsigned ip, unsigned port, unsigned reason, unsigned ttl)
 {
     const struct Masscan *masscan = out->masscan;
     FILE *fp = out->fp;
-    time_t now = time(0);
 
     global_now = now;
 
 
     if (masscan->is_interactive || fp == NULL) {
-        if (status == Port_IcmpEchoResponse) {
-            fprintf(stdout, "Discovered %s port %u/%s on %u.%u.%u.%u"
-                    "                               \n",
-                    status_string(status),
-                    port,
-                    proto_from_status(status),
-                    (ip>>24)&0xFF, 
-                    (ip>>16)&0xFF,
-                    (ip>> 8)&0xFF,
-                    (ip>> 0)&0xFF
-                    );
-            
-        } else
-        fprintf(stdout, "Discovered %s port %u/%s on %u.%u.%u.%u"
-                            "                               \n",
-            status_string(status),
-            port,
-            proto_from_status(status),
-            (ip>>24)&0xFF,
-            (ip>>16)&0xFF,
-            (ip>> 8)&0xFF,
-            (ip>> 0)&0xFF
-            );
+        char buf[128];
+        struct FmtBuf fb[1];
+
+        fmt_init(fb, buf, sizeof(buf));
+        fmt_literal(fb, "Discovered ");
+        fmt_string(fb, status_string(status));
+        fmt_literal(fb, " port ");
+        fmt_unsigned(fb, port);
+        fmt_char(fb, '/');
+        fmt_string(fb, proto_from_status(status));
+        fmt_literal(fb, " on ");
+        fmt_ipv4(fb, ip);
+        fmt_literal(fb, "                               \n");
+        fwrite(buf, 1, fb->length, stdout);
     }
 
+    if (out->remote) {
+        worker_output_status(out->remote, now, status, ip, port, reason, ttl);
+        return;
+    }
 
     if (fp == NULL)
         return;
 
-    if (now >= out->next_rotate) {
-        fp = output_do_rotate(out);
+    if (out->rotator && is_rotate_due(out, now)) {
+        fp = output_do_rotate(out, now);
         if (fp == NULL)
             return;
     }
@@ -496,6 +573,14 @@ output_report_status(struct Output *out, int status,
             if (masscan->nmap.open_only)
                 return;
             break;
+        case Port_SctpOpen:
+            out->counts.sctp.open++;
+            break;
+        case Port_SctpClosed:
+            out->counts.sctp.closed++;
+            if (masscan->nmap.open_only)
+                return;
+            break;
         default:
             LOG(0, "unknown status type: %u\n", status);
             if (masscan->nmap.open_only)
@@ -509,44 +594,77 @@ output_report_status(struct Output *out, int status,
 /***************************************************************************
  ***************************************************************************/
 void
-output_report_banner(struct Output *out, unsigned ip, unsigned port,
-                unsigned proto, const unsigned char *px, unsigned length)
+output_idle(struct Output *out, time_t now)
+{
+    if (out->remote)
+        worker_output_idle(out->remote, now);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+output_report_banner(struct Output *out, unsigned ip, unsigned ip_proto,
+                unsigned port, unsigned proto,
+                const unsigned char *px, unsigned length)
+{
+    output_report_banner_at(out, time(0), ip, ip_proto, port, proto,
+                            px, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+output_report_banner_at(struct Output *out, time_t now, unsigned ip,
+                unsigned ip_proto, unsigned port, unsigned proto,
+                const unsigned char *px, unsigned length)
 {
     const struct Masscan *masscan = out->masscan;
     FILE *fp = out->fp;
-    time_t now = time(0);
 
     global_now = now;
 
 
     if (masscan->is_interactive || fp == NULL) {
+        char buf[128];
+        struct FmtBuf fb[1];
         unsigned count;
-        count = fprintf(stdout, "Banner on port %u/tcp on %u.%u.%u.%u: %.*s",
-            port,
-            (ip>>24)&0xFF,
-            (ip>>16)&0xFF,
-            (ip>> 8)&0xFF,
-            (ip>> 0)&0xFF,
-            length, px
-            );
+
+        fmt_init(fb, buf, sizeof(buf));
+        fmt_literal(fb, "Banner on port ");
+        fmt_unsigned(fb, port);
+        fmt_char(fb, '/');
+        fmt_string(fb, proto_from_ip_proto(ip_proto));
+        fmt_literal(fb, " on ");
+        fmt_ipv4(fb, ip);
+        fmt_literal(fb, ": ");
+        fwrite(buf, 1, fb->length, stdout);
+        fwrite(px, 1, length, stdout);
+
+        /* pad to erase the status line */
+        count = fb->length + length;
+        fmt_init(fb, buf, sizeof(buf));
         if (count < 80)
-            fprintf(stdout, "%.*s\n", (int)(79-count),
-"                                                                                    ");
-        else
-            fprintf(stdout, "\n");
+            fmt_pad(fb, ' ', 79 - count);
+        fmt_char(fb, '\n');
+        fwrite(buf, 1, fb->length, stdout);
     }
 
+    if (out->remote) {
+        worker_output_banner(out->remote, now, ip, ip_proto, port, proto,
+                             px, length);
+        return;
+    }
 
     if (fp == NULL)
         return;
 
-    if (now >= out->next_rotate) {
-        fp = output_do_rotate(out);
+    if (out->rotator && is_rotate_due(out, now)) {
+        fp = output_do_rotate(out, now);
         if (fp == NULL)
             return;
     }
 
-    out->funcs->banner(out, fp, ip, port, proto, px, length);
+    out->funcs->banner(out, fp, ip, ip_proto, port, proto, px, length);
 
 }
 
@@ -558,12 +676,276 @@ output_destroy(struct Output *out)
     if (out == NULL)
         return;
 
-    if (out->period)
-        output_do_rotate(out); /*TODO: this leaves an empty file behind */
+    if (out->rotator) {
+        /* The last file is rotated too, by the background thread */
+        if (out->fp) {
+            out->funcs->close(out, out->fp);
+            memset(&out->counts, 0, sizeof(out->counts));
+        }
+        rotator_destroy(out->rotator, out->fp, out->last_rotate);
+        out->fp = NULL;
+    }
 
     if (out->fp)
         close_rotate(out, out->fp);
+    worker_output_destroy(out->remote);
 
+    free(out->ctx);
     free(out);
 }
 
+
+/***************************************************************************
+ * Time how fast one output format can write records. The output goes
+ * to the null device so that we measure the formatting CPU cost rather
+ * than the disk.
+ ***************************************************************************/
+static void
+output_benchmark_type(const struct OutputType *funcs, struct Masscan *masscan)
+{
+    struct Output out[1];
+    FILE *fp;
+    uint64_t start, elapsed;
+    unsigned i;
+    static const unsigned count = 2000000;
+    static const unsigned char banner[] = 
+        "HTTP/1.0 200 OK\r\nServer: Apache/2.2.22 (Ubuntu)\r\n";
+
+#if defined(WIN32)
+    fp = fopen("NUL", "wb");
+#else
+    fp = fopen("/dev/null", "wb");
+#endif
+    if (fp == NULL) {
+        perror("benchmark: null device");
+        return;
+    }
+
+    memset(out, 0, sizeof(out[0]));
+    out->masscan = masscan;
+    out->funcs = funcs;
+    if (funcs->create)
+        out->ctx = funcs->create(out);
+    out->last_rotate = time(0);
+    global_now = out->last_rotate;
+
+    funcs->open(out, fp);
+
+    /* status records */
+    start = pixie_gettime();
+    for (i=0; i<count; i++) {
+        unsigned ip = 0x0a000000 + i * 2654435761U;
+        funcs->status(out, fp, Port_Open, ip, i & 0xFFFF, 0x12, 64);
+    }
+    elapsed = pixie_gettime() - start;
+    fprintf(stderr, "%-8s status: %10.0f records/sec\n",
+            funcs->file_extension,
+            count * 1000000.0 / (elapsed ? elapsed : 1));
+
+    /* banner records */
+    start = pixie_gettime();
+    for (i=0; i<count/4; i++) {
+        unsigned ip = 0x0a000000 + i * 2654435761U;
+        funcs->banner(out, fp, ip, 6, 80, PROTO_HTTP, banner, sizeof(banner)-1);
+    }
+    elapsed = pixie_gettime() - start;
+    fprintf(stderr, "%-8s banner: %10.0f records/sec\n",
+            funcs->file_extension,
+            (count/4) * 1000000.0 / (elapsed ? elapsed : 1));
+
+    funcs->close(out, fp);
+    fclose(fp);
+    free(out->ctx);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+output_benchmark(void)
+{
+    struct Masscan *masscan;
+
+    masscan = (struct Masscan *)malloc(sizeof(*masscan));
+    if (masscan == NULL)
+        return;
+    memset(masscan, 0, sizeof(*masscan));
+
+    output_benchmark_type(&text_output, masscan);
+    output_benchmark_type(&xml_output, masscan);
+    output_benchmark_type(&binary_output, masscan);
+    output_benchmark_type(&binary2_output, masscan);
+    output_benchmark_type(&json_output, masscan);
+
+    free(masscan);
+}
+
+/***************************************************************************
+ * Read back a rotated file, counting the records in it
+ ***************************************************************************/
+static unsigned
+output_selftest_count(const char *filename)
+{
+    FILE *fp;
+    char line[256];
+    unsigned count = 0;
+
+    fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return ~0U;
+    while (fgets(line, sizeof(line), fp)) {
+        if (memcmp(line, "open ", 5) == 0)
+            count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/***************************************************************************
+ * Rotate, waiting for the background thread to have the spare file ready
+ ***************************************************************************/
+static int
+output_selftest_rotate(struct Output *out, time_t now)
+{
+    unsigned i;
+
+    for (i=0; i<5000; i++) {
+        FILE *fp = out->fp;
+
+        if (output_do_rotate(out, now) != fp)
+            return 0;
+        pixie_usleep(1000);
+    }
+    return 1;
+}
+
+/***************************************************************************
+ * Test the rotation triggers (--rotate-count, --rotate-size), then rotate
+ * a file a few times, checking how the rotated files are named. Rotating
+ * twice within the same second must not overwrite the first file.
+ ***************************************************************************/
+int
+output_selftest(void)
+{
+    struct Masscan *masscan;
+    struct Output *out = NULL;
+    struct Output tmp[1];
+    char *names[3] = {0};
+    const char *dir;
+    static const unsigned expected[3] = {2, 1, 1};
+    time_t t0;
+    time_t saved_now = global_now;
+    unsigned i;
+    int failures = 0;
+
+    masscan = (struct Masscan *)malloc(sizeof(*masscan));
+    if (masscan == NULL)
+        return 1;
+    memset(masscan, 0, sizeof(*masscan));
+
+    /* a whole minute, so that bumping the seconds doesn't carry */
+    t0 = 1300000000;
+    t0 -= t0 % 60;
+
+    /*
+     * --rotate-count: the record after the count is due
+     */
+    memset(tmp, 0, sizeof(tmp[0]));
+    tmp->masscan = masscan;
+    tmp->next_rotate = (time_t)LONG_MAX;
+    tmp->fp = tmpfile();
+    if (tmp->fp == NULL) {
+        /* can't test without a temporary file, so skip */
+        free(masscan);
+        return 0;
+    }
+    masscan->rotate_count = 3;
+    for (i=1; i<=3; i++) {
+        if (is_rotate_due(tmp, t0))
+            failures++;
+    }
+    if (!is_rotate_due(tmp, t0))
+        failures++;
+
+    /*
+     * --rotate-size: only checked every 256 records
+     */
+    masscan->rotate_count = 0;
+    masscan->rotate_size = 1000;
+    tmp->rotate_records = 0;
+    for (i=0; i<999; i++)
+        fputc('x', tmp->fp);
+    for (i=1; i<=256; i++) {
+        if (is_rotate_due(tmp, t0))
+            failures++;
+    }
+    fputc('x', tmp->fp);
+    for (i=257; i<512; i++) {
+        if (is_rotate_due(tmp, t0))
+            failures++;
+    }
+    if (!is_rotate_due(tmp, t0))
+        failures++;
+    fclose(tmp->fp);
+    if (failures)
+        goto fail;
+
+    /*
+     * Rotate a real file in the temporary directory, twice in the
+     * same second. The names are worked out before any file exists.
+     */
+    masscan->rotate_size = 0;
+    masscan->rotate_count = 2;
+    masscan->nmap.format = Output_List;
+    pixie_tmp_filename(masscan->nmap.filename,
+                       sizeof(masscan->nmap.filename), "masscan-rotate");
+    strcpy_s(masscan->rotate_directory, sizeof(masscan->rotate_directory),
+             pixie_tmp_directory());
+    dir = masscan->rotate_directory;
+    names[0] = output_rotate_filename(dir, masscan->nmap.filename, t0);
+    names[1] = output_rotate_filename(dir, masscan->nmap.filename, t0 + 1);
+    names[2] = output_rotate_filename(dir, masscan->nmap.filename, t0 + 5);
+    if (names[0] == NULL || names[1] == NULL || names[2] == NULL)
+        goto fail;
+
+    out = output_create(masscan);
+    if (out == NULL || out->rotator == NULL)
+        goto fail;
+    out->last_rotate = t0;
+    output_report_status_at(out, t0, Port_Open, 0x0a000001, 80, 0, 0);
+    output_report_status_at(out, t0, Port_Open, 0x0a000002, 80, 0, 0);
+    if (output_selftest_rotate(out, t0) != 0)
+        failures++;
+    output_report_status_at(out, t0, Port_Open, 0x0a000003, 80, 0, 0);
+    if (output_selftest_rotate(out, t0 + 5) != 0)
+        failures++;
+    output_report_status_at(out, t0 + 5, Port_Open, 0x0a000004, 80, 0, 0);
+    output_destroy(out);
+    out = NULL;
+    global_now = saved_now;
+
+    /* the rotator has finished, so the original name is gone */
+    if (access(masscan->nmap.filename, 0) == 0) {
+        failures++;
+        remove(masscan->nmap.filename);
+    }
+    for (i=0; i<3; i++) {
+        if (output_selftest_count(names[i]) != expected[i])
+            failures++;
+        remove(names[i]);
+    }
+    if (failures)
+        goto fail;
+
+    for (i=0; i<3; i++)
+        free(names[i]);
+    free(masscan);
+    return 0;
+fail:
+    global_now = saved_now;
+    fprintf(stderr, "output: selftest failed\n");
+    output_destroy(out);
+    for (i=0; i<3; i++)
+        free(names[i]);
+    free(masscan);
+    return 1;
+}
@@ -6,6 +6,8 @@
 
 struct Masscan;
 struct Output;
+struct Rotator;
+struct WorkerOutput;
 
 struct OutputType {
     const char *file_extension;
@@ -13,7 +15,7 @@ struct OutputType {
     void (*open)(struct Output *out, FILE *fp);
     void (*close)(struct Output *out, FILE *fp);
     void (*status)(struct Output *out, FILE *fp, int status, unsigned ip, unsigned port, unsigned reason, unsigned ttl);
-    void (*banner)(struct Output *out, FILE *fp, unsigned ip, unsigned port, unsigned proto, const unsigned char *px, unsigned length);
+    void (*banner)(struct Output *out, FILE *fp, unsigned ip, unsigned ip_proto, unsigned port, unsigned proto, const unsigned char *px, unsigned length);
 };
 
 struct Output
@@ -26,10 +28,14 @@ struct Output
 
     FILE *fp;
     const struct OutputType *funcs;
+    void *ctx; /* private data of 'funcs', from its create() function */
     time_t next_rotate;
     time_t last_rotate;
     unsigned period;
     unsigned offset;
+    uint64_t rotate_records; /* records since the last rotate */
+    struct Rotator *rotator; /* background thread, see out-rotate.c */
+    struct WorkerOutput *remote; /* --worker, see main-worker.c */
     struct {
         struct {
             uint64_t open;
@@ -40,6 +46,10 @@ struct Output
             uint64_t open;
             uint64_t closed;
         } udp;
+        struct {
+            uint64_t open;
+            uint64_t closed;
+        } sctp;
         struct {
             uint64_t echo;
             uint64_t timestamp;
@@ -48,6 +58,7 @@ struct Output
 };
 
 const char *proto_from_status(unsigned status);
+const char *proto_from_ip_proto(unsigned ip_proto);
 const char *proto_string(unsigned proto);
 const char *normalize_string(const unsigned char *px, size_t length, char *buf, size_t buf_len);
 
@@ -55,24 +66,73 @@ const char *normalize_string(const unsigned char *px, size_t length, char *buf,
 extern const struct OutputType text_output;
 extern const struct OutputType xml_output;
 extern const struct OutputType binary_output;
+extern const struct OutputType binary2_output;
+extern const struct OutputType json_output;
 extern const struct OutputType null_output;
 
 
 struct Output *output_create(const struct Masscan *masscan);
 void output_destroy(struct Output *output);
 
+/**
+ * Open an output file so that it can be renamed while open (which
+ * matters on Windows), without writing any header.
+ */
+FILE *output_fopen(const char *filename, unsigned is_append);
+
+/**
+ * The name a file is rotated to: in the directory 'dir', the filename
+ * prefixed with the time it was started. The caller must free() it.
+ */
+char *output_rotate_filename(const char *dir, const char *filename, time_t last_rotate);
+
+int json_selftest(void);
+
+/**
+ * Test the size/count rotation triggers, and the naming of rotated files
+ */
+int output_selftest(void);
+
+/**
+ * Measure how many records/second each output format can write, used
+ * by the "--benchmark" option
+ */
+void output_benchmark(void);
+
+/**
+ * Called by the receive thread when no packet arrived. With "--worker",
+ * results are sent to the coordinator in batches, at most once a second,
+ * and this sends a batch that's been waiting that long, even if no more
+ * results come along.
+ */
+void output_idle(struct Output *output, time_t now);
+
 void output_report_status(struct Output *output, int status, unsigned ip, unsigned port, unsigned reason, unsigned ttl);
+void output_report_status_at(struct Output *output, time_t timestamp, int status, unsigned ip, unsigned port, unsigned reason, unsigned ttl);
 
 
+/**
+ * @param ip_proto
+ *      the IP protocol the banner came over, 6 for TCP, 17 for UDP
+ * @param proto
+ *      the application protocol, PROTO_HTTP, etc.
+ */
 typedef void (*OUTPUT_REPORT_BANNER)(
                 struct Output *output, 
-                unsigned ip, unsigned port, 
+                unsigned ip, unsigned ip_proto, unsigned port, 
                 unsigned proto,
                 const unsigned char *px, unsigned length);
 
 void output_report_banner(
                 struct Output *output, 
-                unsigned ip, unsigned port, 
+                unsigned ip, unsigned ip_proto, unsigned port, 
+                unsigned proto,
+                const unsigned char *px, unsigned length);
+
+void output_report_banner_at(
+                struct Output *output, 
+                time_t timestamp,
+                unsigned ip, unsigned ip_proto, unsigned port, 
                 unsigned proto,
                 const unsigned char *px, unsigned length);
 
@@ -0,0 +1,117 @@
+/*
+    portability: memory-mapped files
+*/
+#include "pixie-mmap.h"
+#include "logger.h"
+#include "string_s.h"
+#include "unusedparm.h"
+
+#if defined(WIN32)
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/***************************************************************************
+ ***************************************************************************/
+const unsigned char *
+pixie_mmap_file(const char *filename, uint64_t *r_length)
+{
+#if defined(WIN32)
+    HANDLE hFile;
+    HANDLE hMap;
+    LARGE_INTEGER size;
+    void *px;
+
+    *r_length = 0;
+
+    hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NULL;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0
+        || (uint64_t)size.QuadPart > (size_t)~0) {
+        CloseHandle(hFile);
+        return NULL;
+    }
+
+    hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMap == NULL)
+        return NULL;
+
+    px = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMap); /* the view keeps the mapping alive */
+    if (px == NULL)
+        return NULL;
+
+    *r_length = size.QuadPart;
+    return (const unsigned char *)px;
+#else
+    int fd;
+    struct stat st;
+    void *px;
+
+    *r_length = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size == 0
+        || (uint64_t)st.st_size > (size_t)~0) {
+        close(fd);
+        return NULL;
+    }
+
+    px = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (px == MAP_FAILED) {
+        LOG(1, "mmap(%s): %s\n", filename, strerror_x(errno));
+        return NULL;
+    }
+
+#if defined(MADV_SEQUENTIAL)
+    /* we mostly read files front-to-back, so ask for aggressive read-ahead */
+    madvise(px, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+
+    *r_length = st.st_size;
+    return (const unsigned char *)px;
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pixie_mmap_prefetch(const unsigned char *px, uint64_t length)
+{
+#if defined(MADV_WILLNEED)
+    /* madvise() needs a page-aligned address */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t skew = (size_t)px & (page - 1);
+
+    madvise((void*)(px - skew), (size_t)length + skew, MADV_WILLNEED);
+#else
+    UNUSEDPARM(px);
+    UNUSEDPARM(length);
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pixie_munmap(const unsigned char *px, uint64_t length)
+{
+    if (px == NULL)
+        return;
+#if defined(WIN32)
+    UnmapViewOfFile(px);
+#else
+    munmap((void*)px, (size_t)length);
+#endif
+}
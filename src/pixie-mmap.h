@@ -0,0 +1,35 @@
+/*
+    portability: memory-mapped files
+
+    Reading big scan files and packet captures through stdio means
+    copying every byte from the kernel into our buffers. Mapping the file
+    instead lets us parse it in place.
+*/
+#ifndef PIXIE_MMAP_H
+#define PIXIE_MMAP_H
+#include <stdint.h>
+
+/**
+ * Map an entire file read-only into memory.
+ * @param r_length
+ *      receives the size of the file
+ * @return
+ *      a pointer to the file contents, or NULL on failure (including
+ *      zero-length files, or files too big for the address space), in
+ *      which case the caller should fall back to reading with stdio
+ */
+const unsigned char *pixie_mmap_file(const char *filename, uint64_t *r_length);
+
+/**
+ * Hint that this part of a mapping will be read soon, so that the
+ * operating system can start reading it from disk before we fault on it.
+ * This does nothing where unsupported.
+ */
+void pixie_mmap_prefetch(const unsigned char *px, uint64_t length);
+
+/**
+ * Release a mapping returned by pixie_mmap_file()
+ */
+void pixie_munmap(const unsigned char *px, uint64_t length);
+
+#endif
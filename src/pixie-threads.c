@@ -42,3 +42,20 @@ pixie_begin_thread(
 #error pixie_begin_thread undefined
 #endif
 }
+
+/****************************************************************************
+ ****************************************************************************/
+unsigned
+pixie_cpu_get_count(void)
+{
+#if defined(WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (unsigned)count : 1;
+#else
+    return 1;
+#endif
+}
@@ -11,6 +11,22 @@ size_t pixie_begin_thread(void (*worker_thread)(void*), unsigned flags, void *wo
 
 void pixie_locked_subtract_u32(unsigned *lhs, unsigned rhs); 
 
+/**
+ * The number of CPUs on the system, for deciding how many worker
+ * threads to start.
+ */
+unsigned pixie_cpu_get_count(void);
+
+/**
+ * For data written by one thread and read by others, like counters, so
+ * that two threads never write to the same cache line
+ */
+#if defined(_MSC_VER)
+#define CACHE_ALIGNED __declspec(align(64))
+#else
+#define CACHE_ALIGNED __attribute__((aligned(64)))
+#endif
+
 
 
 #if defined(_MSC_VER)
@@ -0,0 +1,48 @@
+/*
+    portability: temporary files
+
+    Selftests that write real files (rather than using tmpfile()) put
+    them in the temporary directory, not the current directory, which
+    may not be writable, or may be somebody's source tree.
+*/
+#include "pixie-tmp.h"
+#include "string_s.h"
+#include <stdlib.h>
+#include <string.h>
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+pixie_tmp_directory(void)
+{
+    const char *dir;
+
+#if defined(WIN32)
+    dir = getenv("TEMP");
+    if (dir == NULL || dir[0] == '\0')
+        dir = getenv("TMP");
+    if (dir == NULL || dir[0] == '\0')
+        dir = ".";
+#else
+    dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == '\0')
+        dir = "/tmp";
+#endif
+    return dir;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pixie_tmp_filename(char *filename, size_t sizeof_filename, const char *name)
+{
+    const char *dir = pixie_tmp_directory();
+    size_t dir_length = strlen(dir);
+
+    /* don't double up the separator */
+    if (dir_length && (dir[dir_length-1] == '/' || dir[dir_length-1] == '\\'))
+        dir_length--;
+
+    sprintf_s(filename, sizeof_filename, "%.*s/%s-%u.test",
+              (int)dir_length, dir, name, (unsigned)rand());
+}
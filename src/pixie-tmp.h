@@ -0,0 +1,21 @@
+/*
+    portability: temporary files
+*/
+#ifndef PIXIE_TMP_H
+#define PIXIE_TMP_H
+#include <stddef.h>
+
+/**
+ * The system's temporary directory, from $TMPDIR (%TEMP% on Windows)
+ */
+const char *pixie_tmp_directory(void);
+
+/**
+ * The name of a (probably) unused file in the system's temporary
+ * directory, used by the selftests that need a real file rather than
+ * what tmpfile() gives them. The name ends with "<name>-<random>.test".
+ */
+void pixie_tmp_filename(char *filename, size_t sizeof_filename,
+                        const char *name);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+    zlib compatibility layer
+
+    In order to avoid special build hassle, this code links to zlib at
+    runtime instead compiletime, in the same way that we link to PF_RING.
+*/
+#include "pixie-zlib.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32)
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+/*
+ * function prototypes, from <zlib.h>
+ */
+typedef int (*ZLIB_COMPRESS2)(unsigned char *dest,
+                    unsigned long *destLen,
+                    const unsigned char *source,
+                    unsigned long sourceLen,
+                    int level);
+typedef int (*ZLIB_UNCOMPRESS)(unsigned char *dest,
+                    unsigned long *destLen,
+                    const unsigned char *source,
+                    unsigned long sourceLen);
+typedef unsigned long (*ZLIB_COMPRESSBOUND)(unsigned long sourceLen);
+typedef void *(*ZLIB_GZOPEN)(const char *path, const char *mode);
+typedef int (*ZLIB_GZWRITE)(void *file, const void *buf, unsigned len);
+typedef int (*ZLIB_GZCLOSE)(void *file);
+
+static struct {
+    int is_initialized;
+    int is_loaded;
+    ZLIB_COMPRESS2 compress2;
+    ZLIB_UNCOMPRESS uncompress;
+    ZLIB_COMPRESSBOUND compressBound;
+    ZLIB_GZOPEN gzopen;
+    ZLIB_GZWRITE gzwrite;
+    ZLIB_GZCLOSE gzclose;
+} ZLIB;
+
+
+/***************************************************************************
+ ***************************************************************************/
+static void *
+zlib_load(void)
+{
+#if defined(WIN32)
+    return (void*)LoadLibraryA("zlib1.dll");
+#elif defined(__APPLE__)
+    return dlopen("libz.dylib", RTLD_LAZY);
+#else
+    void *h = dlopen("libz.so.1", RTLD_LAZY);
+    if (h == NULL)
+        h = dlopen("libz.so", RTLD_LAZY);
+    return h;
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void *
+zlib_sym(void *h, const char *name)
+{
+#if defined(WIN32)
+    return (void*)GetProcAddress((HMODULE)h, name);
+#else
+    return dlsym(h, name);
+#endif
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_zlib_init(void)
+{
+    void *h;
+
+    /* Two threads racing through here both load the same library, which
+     * is harmless, so we only mark it initialized at the end */
+    if (ZLIB.is_initialized)
+        return ZLIB.is_loaded;
+
+    h = zlib_load();
+    if (h == NULL) {
+        LOG(1, "zlib: not found, data will be stored uncompressed\n");
+        ZLIB.is_initialized = 1;
+        return 0;
+    }
+
+    ZLIB.compress2 = (ZLIB_COMPRESS2)zlib_sym(h, "compress2");
+    ZLIB.uncompress = (ZLIB_UNCOMPRESS)zlib_sym(h, "uncompress");
+    ZLIB.compressBound = (ZLIB_COMPRESSBOUND)zlib_sym(h, "compressBound");
+    ZLIB.gzopen = (ZLIB_GZOPEN)zlib_sym(h, "gzopen");
+    ZLIB.gzwrite = (ZLIB_GZWRITE)zlib_sym(h, "gzwrite");
+    ZLIB.gzclose = (ZLIB_GZCLOSE)zlib_sym(h, "gzclose");
+
+    if (ZLIB.compress2 == NULL || ZLIB.uncompress == NULL
+        || ZLIB.compressBound == NULL) {
+        LOG(1, "zlib: missing symbols, data will be stored uncompressed\n");
+        ZLIB.is_initialized = 1;
+        return 0;
+    }
+
+    LOG(2, "zlib: successfully loaded\n");
+    ZLIB.is_loaded = 1;
+    ZLIB.is_initialized = 1;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+size_t
+pixie_zlib_bound(size_t length)
+{
+    if (!pixie_zlib_init())
+        return length;
+    return ZLIB.compressBound((unsigned long)length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_zlib_compress(unsigned char *dst, size_t *dst_length,
+                    const unsigned char *src, size_t src_length,
+                    int level)
+{
+    unsigned long len = (unsigned long)*dst_length;
+    int err;
+
+    if (!pixie_zlib_init())
+        return -1;
+
+    err = ZLIB.compress2(dst, &len, src, (unsigned long)src_length, level);
+    *dst_length = len;
+    return err;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_zlib_uncompress(unsigned char *dst, size_t *dst_length,
+                      const unsigned char *src, size_t src_length)
+{
+    unsigned long len = (unsigned long)*dst_length;
+    int err;
+
+    if (!pixie_zlib_init())
+        return -1;
+
+    err = ZLIB.uncompress(dst, &len, src, (unsigned long)src_length);
+    *dst_length = len;
+    return err;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_zlib_gzip_file(const char *src_filename, const char *dst_filename,
+                     int level)
+{
+    FILE *fp;
+    void *gz;
+    char mode[4];
+    unsigned char *buf;
+    size_t count;
+    int err = 0;
+
+    if (!pixie_zlib_init() || ZLIB.gzopen == NULL
+        || ZLIB.gzwrite == NULL || ZLIB.gzclose == NULL)
+        return -1;
+
+    fp = fopen(src_filename, "rb");
+    if (fp == NULL)
+        return -1;
+
+    mode[0] = 'w';
+    mode[1] = 'b';
+    mode[2] = (char)('0' + ((level < 0 || level > 9) ? 6 : level));
+    mode[3] = '\0';
+    gz = ZLIB.gzopen(dst_filename, mode);
+    if (gz == NULL) {
+        fclose(fp);
+        return -1;
+    }
+
+    buf = (unsigned char *)malloc(1024 * 1024);
+    if (buf == NULL)
+        err = -1;
+    while (err == 0 && (count = fread(buf, 1, 1024 * 1024, fp)) > 0) {
+        if (ZLIB.gzwrite(gz, buf, (unsigned)count) != (int)count)
+            err = -1;
+    }
+    if (ferror(fp))
+        err = -1;
+
+    if (ZLIB.gzclose(gz) != 0)
+        err = -1;
+    fclose(fp);
+    free(buf);
+    return err;
+}
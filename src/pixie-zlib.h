@@ -0,0 +1,56 @@
+/*
+    zlib compatibility layer
+
+    Like PF_RING, zlib is linked at runtime rather than compiletime, so
+    that the program builds and runs on systems without it (notably
+    Windows). When it isn't found, callers fall back to storing data
+    uncompressed.
+*/
+#ifndef PIXIE_ZLIB_H
+#define PIXIE_ZLIB_H
+#include <stddef.h>
+
+/**
+ * Load the zlib library, if it hasn't been loaded already.
+ * @return
+ *      1 if zlib is available, 0 otherwise
+ */
+int pixie_zlib_init(void);
+
+/**
+ * The largest size that 'length' bytes can compress to.
+ */
+size_t pixie_zlib_bound(size_t length);
+
+/**
+ * Compress a buffer, equivelent to zlib's compress2().
+ * @param dst_length
+ *      on input, the size of the 'dst' buffer, on output, the number
+ *      of compressed bytes
+ * @return
+ *      0 on success, non-zero on failure (including when zlib isn't
+ *      available)
+ */
+int pixie_zlib_compress(unsigned char *dst, size_t *dst_length,
+                        const unsigned char *src, size_t src_length,
+                        int level);
+
+/**
+ * Decompress a buffer, equivelent to zlib's uncompress().
+ * @return
+ *      0 on success, non-zero on failure
+ */
+int pixie_zlib_uncompress(unsigned char *dst, size_t *dst_length,
+                          const unsigned char *src, size_t src_length);
+
+/**
+ * Compress a file into the "gzip" format, like the 'gzip' command-line
+ * program, leaving the original file in place.
+ * @return
+ *      0 on success, non-zero on failure (including when zlib isn't
+ *      available)
+ */
+int pixie_zlib_gzip_file(const char *src_filename, const char *dst_filename,
+                         int level);
+
+#endif
@@ -2,7 +2,7 @@
 7    state machine for receiving banners
 */
 #include "smack.h"
-#include "rawsock-pcapfile.h"
+#include "in-pcap.h"
 #include "proto-preprocess.h"
 #include "proto-banner1.h"
 #include "proto-http.h"
@@ -157,44 +157,33 @@ banner1_destroy(struct Banner1 *b)
 void
 banner1_test(const char *filename)
 {
-    struct PcapFile *cap;
+    struct PcapReader *cap;
+    struct PcapFrame frames[64];
     unsigned link_type;
+    unsigned count;
     
-    cap = pcapfile_openread(filename);
+    cap = pcapreader_open(filename);
     if (cap == NULL) {
         fprintf(stderr, "%s: can't open capture file\n", filename);
         return;
     }
 
-    link_type = pcapfile_datalink(cap);
-
-    for (;;) {
-        int packets_read;
-        unsigned secs;
-        unsigned usecs;
-        unsigned origlength;
-        unsigned length;
-        unsigned char px[65536];
-        struct PreprocessedInfo parsed;
-        unsigned x;
-
-        
-        packets_read = pcapfile_readframe(
-                    cap,    /* capture dump file */
-                    &secs, &usecs,
-                    &origlength, &length,
-                    px, sizeof(px));
-        if (packets_read == 0)
-            break;
-
-        
-        x = preprocess_frame(px, length, link_type, &parsed);
-        if (x == 0)
-            continue;
+    link_type = pcapreader_datalink(cap);
 
+    while ((count = pcapreader_next(cap, frames, 64)) != 0) {
+        unsigned i;
+
+        for (i=0; i<count; i++) {
+            struct PreprocessedInfo parsed;
+            unsigned x;
+
+            x = preprocess_frame(frames[i].px, frames[i].length, link_type, &parsed);
+            if (x == 0)
+                continue;
+        }
     }
 
-    pcapfile_close(cap);
+    pcapreader_close(cap);
 }
 
 /***************************************************************************
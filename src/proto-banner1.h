@@ -12,6 +12,12 @@ enum {
     PROTO_FTP1,
     PROTO_FTP2,
     PROTO_DNS_VERSIONBIND,
+    PROTO_SNMP,
+    PROTO_NTP,
+    PROTO_NETBIOS,
+    PROTO_SSDP,
+    PROTO_MEMCACHED,
+    PROTO_MDNS,
 };
 
 struct Banner1
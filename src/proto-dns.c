@@ -368,7 +368,7 @@ void handle_dns(struct Output *out, const unsigned char *px, unsigned length, st
 
         output_report_banner(
                 out,
-                ip_them, port_them, 
+                ip_them, 17, port_them, 
                 PROTO_DNS_VERSIONBIND,
                 px + offset, txtlen);
 
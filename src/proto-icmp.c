@@ -1,67 +1,152 @@
+/*
+    ICMP responses
+
+    Echo and timestamp replies carry our cookie in the identifier and
+    sequence number, the same as we sent it. Destination unreachables
+    quote the start of the probe that failed, so we check the cookie in
+    that instead: the sequence number for TCP, the cookie in the payload
+    for UDP (if enough of it was quoted), or the IP ID we set on every
+    probe. That way, we only report closed UDP ports, and skip retries
+    to unreachable hosts, because of probes we actually sent.
+*/
 #include "proto-icmp.h"
+#include "proto-udp.h"
 #include "proto-preprocess.h"
 #include "syn-cookie.h"
 #include "logger.h"
 #include "output.h"
 #include "masscan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-
-int
-matches_me(struct Output *out, unsigned ip, unsigned port)
+static unsigned
+get32(const unsigned char *px)
 {
-    unsigned i;
-
-    for (i=0; i<8; i++) {
-        if (ip == out->nics[i].ip_me && port == out->nics[i].port_me)
-            return 1;
-    }
-    return 0;
+    return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3]<<0;
 }
 
-int
-parse_port_unreachable(const unsigned char *px, unsigned length,
-        unsigned *r_ip_me, unsigned *r_ip_them,
-        unsigned *r_port_me, unsigned *r_port_them)
+/***************************************************************************
+ * Check the IP/TCP/UDP/ICMP headers quoted in an ICMP error message, to
+ * see if they are from one of our probes.
+ * @return
+ *      1 if it was our probe, with the target's address, and the port the
+ *      way the transmit thread encodes it (65536+port for UDP, and so on)
+ ***************************************************************************/
+static int
+icmp_quoted_probe(const unsigned char *px, unsigned length,
+                  unsigned *r_ip_them, unsigned *r_port)
 {
-    if (length < 24)
-        return -1;
-    *r_ip_me = px[12]<<24 | px[13]<<16 | px[14]<<8 | px[15];
-    *r_ip_them = px[16]<<24 | px[17]<<16 | px[18]<<8 | px[19];
-    
-    px += (px[0]&0xF)<<2;
-    length -= (px[0]&0xF)<<2;
+    const unsigned char *tr;
+    unsigned header_length;
+    unsigned ip_them;
+    unsigned ip_id;
+    unsigned port;      /* as encoded by the transmit thread */
+    unsigned id_port;   /* as used in the IP ID */
+    unsigned seqno;
+    int is_checked = 0;
 
-    if (length < 4)
-        return -1;
+    /* The IP header, plus at least 8 bytes, is always quoted */
+    if (length < 20 || (px[0]>>4) != 4)
+        return 0;
+    header_length = (px[0]&0xF)<<2;
+    if (header_length < 20 || length < header_length + 8)
+        return 0;
+    ip_id = px[4]<<8 | px[5];
+    ip_them = get32(px + 16);
+    tr = px + header_length;
+    length -= header_length;
 
-    *r_port_me = px[0]<<8 | px[1];
-    *r_port_them = px[2]<<8 | px[3];
+    switch (px[9]) {
+    case 6: /* TCP */
+        id_port = tr[2]<<8 | tr[3];
+        port = id_port;
+        seqno = syn_hash(ip_them, port);
+        if (get32(tr + 4) != seqno)
+            return 0;
+        is_checked = 1;
+        break;
+    case 17: /* UDP */
+        id_port = tr[2]<<8 | tr[3];
+        port = 65536 + id_port;
+        seqno = syn_hash(ip_them, port);
+        {
+            unsigned offset = 0;
+            unsigned field_length = 0;
 
-    return 0;
+            if (udp_cookie_field(id_port, tr + 8, length - 8, 0,
+                                 &offset, &field_length)) {
+                unsigned value = 0;
+                unsigned i;
+
+                for (i=0; i<field_length; i++)
+                    value = value<<8 | tr[8 + offset + i];
+                if (value != udp_cookie(seqno, field_length))
+                    return 0;
+                is_checked = 1;
+            }
+        }
+        break;
+    case 132: /* SCTP */
+        id_port = tr[2]<<8 | tr[3];
+        port = 65536*2 + id_port;
+        seqno = syn_hash(ip_them, port);
+        break;
+    case 1: /* ICMP */
+        if (tr[0] == 8)
+            port = 65536*3 + 0;
+        else if (tr[0] == 13)
+            port = 65536*3 + 1;
+        else
+            return 0;
+        id_port = 1;
+        seqno = syn_hash(ip_them, port);
+        if (get32(tr + 4) != seqno)
+            return 0;
+        is_checked = 1;
+        break;
+    default:
+        return 0;
+    }
+
+    /* Otherwise, the IP ID has 16 bits of the cookie, see
+     * template_set_target() */
+    if (!is_checked && ip_id != ((ip_them ^ id_port ^ seqno) & 0xFFFF))
+        return 0;
+
+    *r_ip_them = ip_them;
+    *r_port = port;
+    return 1;
 }
 
-void handle_icmp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed)
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+handle_icmp(struct Output *out, const unsigned char *px, unsigned length,
+            struct PreprocessedInfo *parsed, struct UnreachableTable *dead,
+            unsigned *r_ip_answered, unsigned *r_port_answered)
 {
     unsigned type = parsed->port_src;
     unsigned code = parsed->port_dst;
+    unsigned offset = parsed->transport_offset;
     unsigned seqno_me;
-    //unsigned ip_me;
     unsigned ip_them;
+    unsigned ip_them2 = 0;
+    unsigned port2 = 0;
 
-    /*ip_me = parsed->ip_dst[0]<<24 | parsed->ip_dst[1]<<16
-            | parsed->ip_dst[2]<< 8 | parsed->ip_dst[3]<<0;*/
     ip_them = parsed->ip_src[0]<<24 | parsed->ip_src[1]<<16
             | parsed->ip_src[2]<< 8 | parsed->ip_src[3]<<0;
+    *r_port_answered = ICMP_NOT_ANSWERED;
 
-    seqno_me = px[parsed->transport_offset+4]<<24
-                | px[parsed->transport_offset+5]<<16
-                | px[parsed->transport_offset+6]<<8
-                | px[parsed->transport_offset+7]<<0;
+    if (length < offset + 8)
+        return 1;
+    seqno_me = get32(px + offset + 4);
 
     switch (type) {
     case 0: /* ICMP echo reply */
-        if (syn_hash(ip_them, 65536*3+0) != seqno_me)
-            return; /* not my response */
+    case 14: /* ICMP timestamp reply */
+        if (syn_hash(ip_them, 65536*3 + (type == 14)) != seqno_me)
+            return 0; /* not my response */
 
         /*
          * Report "open" or "existence" of host
@@ -73,44 +158,141 @@ void handle_icmp(struct Output *out, const unsigned char *px, unsigned length, s
                             0,
                             0,
                             0);
+        *r_ip_answered = ip_them;
+        *r_port_answered = 65536*3 + (type == 14);
         break;
     case 3: /* destination unreachable */
+        if (!icmp_quoted_probe(px + offset + 8, length - offset - 8,
+                               &ip_them2, &port2))
+            return 0; /* not my probe */
+
         switch (code) {
         case 0: /* net unreachable */
+        case 6: /* destination network unknown */
+        case 11: /* net unreachable for type-of-service */
+            LOGip(LOG_DEBUG, ip_them2, port2 & 0xFFFF, "net unreachable\n");
+            if (dead) {
+                unsigned net = ip_them2 & 0xFFFFFF00;
+                dead->nets[unreachable_index(net)] = ~net;
+            }
+            break;
         case 1: /* host unreachable */
-        case 2: /* protocol unreachable */
+        case 7: /* destination host unknown */
+        case 12: /* host unreachable for type-of-service */
+            LOGip(LOG_DEBUG, ip_them2, port2 & 0xFFFF, "host unreachable\n");
+            if (dead)
+                dead->hosts[unreachable_index(ip_them2)] = ~ip_them2;
             break;
         case 3: /* port unreachable */
-            if (length - parsed->transport_offset > 8) {
-                unsigned ip_me2, ip_them2, port_me2, port_them2;
-                int err;
-                
-                err = parse_port_unreachable(
-                    px + parsed->transport_offset + 8,
-                    length - parsed->transport_offset + 8,
-                    &ip_me2, &ip_them2, &port_me2, &port_them2);
-
-                if (err)
-                    return;
-
-                if (!matches_me(out, ip_me2, port_me2))
-                    return;
-
-                output_report_status(
-                                    out,
-                                    Port_UdpClosed,
-                                    ip_them2,
-                                    port_them2,
-                                    0,
-                                    px[parsed->ip_offset + 8]);
-
-            }
-
+            /* The host is there, so there's no point retrying the port,
+             * whatever the protocol */
+            *r_ip_answered = ip_them2;
+            *r_port_answered = port2;
+            if (port2 < 65536 || port2 >= 65536*2)
+                break;
+            output_report_status(
+                                out,
+                                Port_UdpClosed,
+                                ip_them2,
+                                port2 & 0xFFFF,
+                                0,
+                                px[parsed->ip_offset + 8]);
+            break;
+        default:
+            /* Such as "administratively prohibited", which firewalls
+             * send for some ports but not others, so it doesn't mean
+             * the host is gone */
+            break;
         }
         break;
     default:
-	;
+        break;
     }
 
+    return 1;
 }
 
+/***************************************************************************
+ ***************************************************************************/
+int
+icmp_selftest(void)
+{
+    struct UnreachableTable *dead;
+    unsigned char px[20 + 8 + 12];
+    unsigned ip = 0x0A010203;
+    unsigned seqno;
+    unsigned ip_them = 0;
+    unsigned port = 0;
+    unsigned cookie;
+
+    /* A quoted UDP probe to port 53, with only the UDP header: the
+     * cookie is in the IP ID */
+    memset(px, 0, sizeof(px));
+    px[0] = 0x45;
+    px[9] = 17;
+    px[16] = (unsigned char)(ip >> 24);
+    px[17] = (unsigned char)(ip >> 16);
+    px[18] = (unsigned char)(ip >> 8);
+    px[19] = (unsigned char)(ip >> 0);
+    px[23] = 53;
+    seqno = syn_hash(ip, 65536 + 53);
+    px[4] = (unsigned char)((ip ^ 53 ^ seqno) >> 8);
+    px[5] = (unsigned char)((ip ^ 53 ^ seqno) >> 0);
+    if (!icmp_quoted_probe(px, 28, &ip_them, &port)
+        || ip_them != ip || port != 65536 + 53)
+        goto fail;
+    px[5] ^= 1;
+    if (icmp_quoted_probe(px, 28, &ip_them, &port))
+        goto fail;
+
+    /* With the DNS header quoted as well, the transaction ID decides */
+    cookie = udp_cookie(seqno, 2);
+    px[28] = (unsigned char)(cookie >> 8);
+    px[29] = (unsigned char)(cookie >> 0);
+    if (!icmp_quoted_probe(px, sizeof(px), &ip_them, &port))
+        goto fail;
+    px[29] ^= 1;
+    if (icmp_quoted_probe(px, sizeof(px), &ip_them, &port))
+        goto fail;
+
+    /* A quoted TCP SYN to port 80 */
+    memset(px, 0, sizeof(px));
+    px[0] = 0x45;
+    px[9] = 6;
+    memcpy(px + 16, "\x0A\x01\x02\x03", 4);
+    px[23] = 80;
+    seqno = syn_hash(ip, 80);
+    px[24] = (unsigned char)(seqno >> 24);
+    px[25] = (unsigned char)(seqno >> 16);
+    px[26] = (unsigned char)(seqno >> 8);
+    px[27] = (unsigned char)(seqno >> 0);
+    if (!icmp_quoted_probe(px, 28, &ip_them, &port) || port != 80)
+        goto fail;
+    if (icmp_quoted_probe(px, 27, &ip_them, &port))
+        goto fail;
+    px[27] ^= 1;
+    if (icmp_quoted_probe(px, 28, &ip_them, &port))
+        goto fail;
+
+    /* Unreachable hosts and networks */
+    dead = (struct UnreachableTable *)malloc(sizeof(*dead));
+    if (dead == NULL)
+        goto fail;
+    memset(dead, 0, sizeof(*dead));
+    dead->hosts[unreachable_index(ip)] = ~ip;
+    dead->nets[unreachable_index(0xC0A80100)] = ~0xC0A80100;
+    if (!unreachable_lookup(dead, ip)
+        || unreachable_lookup(dead, ip + 1)
+        || !unreachable_lookup(dead, 0xC0A801FE)
+        || unreachable_lookup(dead, 0xC0A80200)
+        || unreachable_lookup(dead, 0)) {
+        free(dead);
+        goto fail;
+    }
+    free(dead);
+
+    return 0;
+fail:
+    fprintf(stderr, "icmp: selftest failed\n");
+    return 1;
+}
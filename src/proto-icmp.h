@@ -3,6 +3,63 @@
 struct PreprocessedInfo;
 struct Output;
 
-void handle_icmp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed);
+/***************************************************************************
+ * Targets that a router told us are unreachable, so that the transmit
+ * thread can skip the retries to them. The receive thread adds entries
+ * and the transmit thread looks them up, without locking. Entries are
+ * overwritten on a collision, so a lookup can miss, but never matches
+ * a target that wasn't added. Networks are tracked as /24s, since the
+ * ICMP message doesn't say how big the unreachable network is.
+ */
+#define UNREACHABLE_TABLE_SIZE 65536
+
+struct UnreachableTable {
+    /* Stored inverted, so that the empty entries, zero, match nothing */
+    volatile unsigned hosts[UNREACHABLE_TABLE_SIZE];
+    volatile unsigned nets[UNREACHABLE_TABLE_SIZE];
+};
+
+static __inline unsigned
+unreachable_index(unsigned ip)
+{
+    unsigned x = ip * 2654435761U;
+    return (x ^ (x >> 16)) & (UNREACHABLE_TABLE_SIZE - 1);
+}
+
+/**
+ * Called by the transmit thread before a retry
+ * @return
+ *      1 if the host, or its /24, was reported unreachable, 0 otherwise
+ */
+static __inline int
+unreachable_lookup(const struct UnreachableTable *dead, unsigned ip)
+{
+    unsigned net = ip & 0xFFFFFF00;
+
+    return dead->hosts[unreachable_index(ip)] == ~ip
+        || dead->nets[unreachable_index(net)] == ~net;
+}
+
+#define ICMP_NOT_ANSWERED 0xFFFFFFFF
+
+/**
+ * Handle an ICMP message: echo and timestamp replies, and destination
+ * unreachables quoting one of our probes.
+ * @param dead
+ *      where to record unreachable hosts and networks, or NULL
+ * @param r_ip_answered, r_port_answered
+ *      the target that this is an answer to, for echo replies and port
+ *      unreachables, with the port the way the transmit thread encodes it,
+ *      or ICMP_NOT_ANSWERED for the port otherwise
+ * @return
+ *      0 if the reply or the quoted probe didn't have our cookie,
+ *      1 otherwise
+ */
+unsigned
+handle_icmp(struct Output *out, const unsigned char *px, unsigned length,
+            struct PreprocessedInfo *parsed, struct UnreachableTable *dead,
+            unsigned *r_ip_answered, unsigned *r_port_answered);
+
+int icmp_selftest(void);
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef PROTO_SCTP_H
+#define PROTO_SCTP_H
+#include <stddef.h>
+struct PreprocessedInfo;
+struct Output;
+
+/**
+ * Handle an SCTP response to our INIT: an INIT-ACK means the port is
+ * open, an ABORT that it's closed.
+ * @return
+ *      1 if the response was accepted, 0 if the verification tag wasn't
+ *      our cookie, or the packet was too short to check it
+ */
+unsigned
+handle_sctp(struct Output *out, const unsigned char *px, unsigned length,
+            struct PreprocessedInfo *parsed);
+
+/**
+ * Build the tables for sctp_checksum(). This must be called at startup,
+ * before the threads that use them are started, since they aren't built
+ * on first use. Calling it again does nothing.
+ */
+void
+sctp_checksum_init(void);
+
+/**
+ * The CRC32c checksum of an SCTP packet, from the start of the SCTP
+ * header, with the checksum field set to zero. The result goes in the
+ * checksum field in little-endian order.
+ */
+unsigned
+sctp_checksum(const void *px, size_t length);
+
+int sctp_selftest(void);
+
+#endif
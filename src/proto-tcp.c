@@ -19,7 +19,6 @@
 #include "output.h"
 #include "string_s.h"
 
-uint64_t global_tcb_count;
 unsigned global_recv_overwhelmed;
 extern time_t global_now;
 
@@ -61,6 +60,8 @@ struct TCP_ConnectionTable {
     unsigned timeout;
 
     uint64_t active_count;
+    struct TCP_Stats *stats;
+    struct TCP_Stats stats_unused;
 
     struct Timeouts *timeouts;
     struct TemplatePacket *pkt_template;
@@ -124,7 +125,8 @@ tcpcon_create_table(    size_t entry_count,
                         struct TemplatePacket *pkt_template,
                         OUTPUT_REPORT_BANNER report_banner,
                         struct Output *out,
-                        unsigned timeout
+                        unsigned timeout,
+                        struct TCP_Stats *stats
                         )
 {
     struct TCP_ConnectionTable *tcpcon;
@@ -132,6 +134,7 @@ tcpcon_create_table(    size_t entry_count,
     tcpcon = (struct TCP_ConnectionTable *)malloc(sizeof(*tcpcon));
     memset(tcpcon, 0, sizeof(*tcpcon));
     tcpcon->timeout = timeout;
+    tcpcon->stats = stats ? stats : &tcpcon->stats_unused;
     if (tcpcon->timeout == 0)
         tcpcon->timeout = 30; /* half a minute before destroying tcb */
 
@@ -207,9 +210,11 @@ tcpcon_destroy_tcb(
     while (*r_entry) {
         if (*r_entry == tcb) {
             if (tcb->banner_length || tcb->banner_proto) {
+                tcpcon->stats->banners++;
                 tcpcon->report_banner(
                     tcpcon->out,
                     tcb->ip_them,
+                    6, /* TCP */
                     tcb->port_them,
                     tcb->banner_proto,
                     tcb->banner,
@@ -226,7 +231,7 @@ tcpcon_destroy_tcb(
             tcb->next = tcpcon->freed_list;
             tcpcon->freed_list = tcb;
             tcpcon->active_count--;
-            global_tcb_count = tcpcon->active_count;
+            tcpcon->stats->destroyed++;
             return;
         } else
             r_entry = &(*r_entry)->next;
@@ -294,7 +299,7 @@ tcpcon_create_tcb(
         timeout_init(tcb->timeout);
 
         tcpcon->active_count++;
-        global_tcb_count = tcpcon->active_count;
+        tcpcon->stats->created++;
     }
 
     return tcb;
@@ -546,6 +551,7 @@ tcpcon_handle(struct TCP_ConnectionTable *tcpcon, struct TCP_Control_Block *tcb,
             LOGip(8, tcb->ip_them, tcb->port_them,
                 "%s                \n",
                 "CONNECTION TIMEOUT---");
+            tcpcon->stats->timeouts++;
             tcpcon_destroy_tcb(tcpcon, tcb);
             return;
         }
@@ -778,6 +784,7 @@ tcpcon_handle(struct TCP_ConnectionTable *tcpcon, struct TCP_Control_Block *tcb,
         tcpcon_send_packet(tcpcon, tcb,
             0x04, 
             0, 0);
+        tcpcon->stats->timeouts++;
         tcpcon_destroy_tcb(tcpcon, tcb);
         break;
     
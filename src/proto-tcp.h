@@ -4,6 +4,7 @@
 struct Adapter;
 struct TCP_Control_Block;
 struct TemplatePacket;
+#include <stdint.h>
 #include "packet-queue.h"
 #include "output.h"
 
@@ -15,6 +16,16 @@ struct TemplatePacket;
 #define TCP_IS_RST(px,i) ((TCP_FLAGS(px,i) & 0x4) == 0x4)
 #define TCP_IS_FIN(px,i) ((TCP_FLAGS(px,i) & 0x1) == 0x1)
 
+/**
+ * What happened to connections, counted as we go
+ */
+struct TCP_Stats {
+    uint64_t created;
+    uint64_t destroyed;
+    uint64_t timeouts;      /* destroyed because they took too long */
+    uint64_t banners;       /* banners sent to the output */
+};
+
 /**
  * Create a TCP connection table (to store TCP control blocks) with
  * the desired initial size.
@@ -26,6 +37,9 @@ struct TemplatePacket;
  *      outstanding connections you'll have). This function will automatically
  *      round this number up to the nearest power of 2, or round it down
  *      if it causes malloc() to not be able to allocate enoug memory.
+ * @param stats
+ *      where to count connections, which is only written by the thread
+ *      using this table, or NULL
  */
 struct TCP_ConnectionTable *
 tcpcon_create_table(    size_t entry_count,
@@ -34,7 +48,8 @@ tcpcon_create_table(    size_t entry_count,
                         struct TemplatePacket *pkt_template,
                         OUTPUT_REPORT_BANNER report_banner,
                         struct Output *out,
-                        unsigned timeout
+                        unsigned timeout,
+                        struct TCP_Stats *stats
                         );
 
 void
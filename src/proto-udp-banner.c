@@ -0,0 +1,786 @@
+/*
+    banners from UDP responses
+
+    Each parser takes the payload of a UDP response and appends a short
+    banner, made of "name=value" fields separated by "; ". For example:
+
+        SNMP        sysDescr=Linux router 2.6.32; sysName=gw
+        NTP         version=4; mode=server; stratum=2; refid=192.0.2.1
+        NetBIOS     name=FILESERVER; workgroup=WORKGROUP; mac=00:0c:29:...
+        SSDP        server=Linux/3.x UPnP/1.0; location=http://...
+        memcached   version=1.4.25; uptime=1234; curr_connections=10
+        mDNS        ptr=_http._tcp.local; a=printer.local 192.0.2.7
+
+    These run in the receive thread for every response, so they're written
+    to be cheap: no memory allocation, no copying beyond the banner, and
+    every read checked against the length. Compressed DNS names follow at
+    most a few pointers. Non-printable characters in the response become
+    '.', so banners are safe to write to text output.
+
+    The parsers are pure functions of the payload, which is what lets
+    "--benchmark" time them over the responses from a packet capture.
+*/
+#include "proto-udp-banner.h"
+#include "proto-banner1.h"
+#include "proto-preprocess.h"
+#include "in-pcap.h"
+#include "pixie-timer.h"
+#include "string-fmt.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DNS_MAX_POINTERS 8
+#define DNS_MAX_RECORDS 32
+
+static unsigned
+get16(const unsigned char *px)
+{
+    return px[0]<<8 | px[1];
+}
+
+/***************************************************************************
+ * Start a new "name=" field
+ ***************************************************************************/
+static void
+banner_field(struct FmtBuf *fb, const char *name)
+{
+    if (fb->length)
+        fmt_literal(fb, "; ");
+    fmt_string(fb, name);
+    fmt_char(fb, '=');
+}
+
+/***************************************************************************
+ * Append text from the response, replacing anything that isn't printable
+ ***************************************************************************/
+static void
+banner_text(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    unsigned i;
+
+    for (i=0; i<length && fb->length < fb->max; i++) {
+        if (isprint(px[i]) && px[i] != ';')
+            fb->buf[fb->length++] = (char)px[i];
+        else
+            fb->buf[fb->length++] = '.';
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+banner_hex(struct FmtBuf *fb, unsigned c)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    fmt_char(fb, hex[(c >> 4) & 0xF]);
+    fmt_char(fb, hex[c & 0xF]);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+ber_next(const unsigned char *px, unsigned length, unsigned offset,
+         unsigned *tag, unsigned *content_length)
+{
+    unsigned len;
+
+    *tag = 0;
+    *content_length = 0;
+    if (offset + 2 > length)
+        return length + 1;
+    *tag = px[offset++];
+    len = px[offset++];
+    if (len & 0x80) {
+        unsigned n = len & 0x7F;
+
+        if (n == 0 || n > 2 || offset + n > length)
+            return length + 1;
+        for (len=0; n; n--)
+            len = len<<8 | px[offset++];
+    }
+    if (offset + len > length)
+        return length + 1;
+    *content_length = len;
+    return offset;
+}
+
+/***************************************************************************
+ * SNMP GetResponse:
+ *  SEQUENCE {version, community, GetResponse {request-id, error-status,
+ *      error-index, SEQUENCE OF SEQUENCE {OID, value}}}
+ * We report the string values of sysDescr.0 and sysName.0.
+ ***************************************************************************/
+static void
+parse_snmp(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    static const unsigned char oid_prefix[] = {0x2b,6,1,2,1,1};
+    unsigned tag = 0;
+    unsigned len = 0;
+    unsigned i;
+    unsigned end;
+    unsigned n;
+
+    i = ber_next(px, length, 0, &tag, &len);
+    if (i > length || tag != 0x30)
+        return;
+    i = ber_next(px, length, i, &tag, &len);    /* version */
+    if (i > length || tag != 0x02)
+        return;
+    i = ber_next(px, length, i + len, &tag, &len);  /* community */
+    if (i > length || tag != 0x04)
+        return;
+    i = ber_next(px, length, i + len, &tag, &len);  /* GetResponse */
+    if (i > length || tag != 0xA2)
+        return;
+    for (n=0; n<3; n++) {
+        i = ber_next(px, length, i, &tag, &len);
+        if (i > length || tag != 0x02)
+            return;
+        i += len;
+    }
+    i = ber_next(px, length, i, &tag, &len);    /* variable-bindings */
+    if (i > length || tag != 0x30)
+        return;
+    end = i + len;
+
+    while (i < end) {
+        unsigned oid;
+        unsigned oid_length = 0;
+        unsigned next;
+
+        i = ber_next(px, length, i, &tag, &len);
+        if (i > length || tag != 0x30)
+            return;
+        next = i + len;
+
+        oid = ber_next(px, length, i, &tag, &oid_length);
+        if (oid > length || tag != 0x06)
+            return;
+        i = ber_next(px, length, oid + oid_length, &tag, &len);
+        if (i > length)
+            return;
+
+        /* 1.3.6.1.2.1.1.1.0 is sysDescr, 1.3.6.1.2.1.1.5.0 is sysName */
+        if (tag == 0x04 && oid_length == 8
+            && memcmp(px + oid, oid_prefix, sizeof(oid_prefix)) == 0
+            && px[oid + 7] == 0) {
+            if (px[oid + 6] == 1) {
+                banner_field(fb, "sysDescr");
+                banner_text(fb, px + i, len);
+            } else if (px[oid + 6] == 5) {
+                banner_field(fb, "sysName");
+                banner_text(fb, px + i, len);
+            }
+        }
+        i = next;
+    }
+}
+
+/***************************************************************************
+ * NTP: the version, mode, and for server responses, the stratum and
+ * reference ID. The reference ID is the upstream server's address, or
+ * for stratum 1, the name of the clock, such as "GPS".
+ ***************************************************************************/
+static void
+parse_ntp(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    static const char *modes[8] = {
+        "reserved", "symmetric-active", "symmetric-passive", "client",
+        "server", "broadcast", "control", "private",
+    };
+    unsigned mode;
+    unsigned stratum;
+
+    if (length < 4)
+        return;
+    mode = px[0] & 7;
+
+    banner_field(fb, "version");
+    fmt_unsigned(fb, (px[0] >> 3) & 7);
+    banner_field(fb, "mode");
+    fmt_string(fb, modes[mode]);
+
+    if ((mode != 4 && mode != 5) || length < 48)
+        return;
+    stratum = px[1];
+    banner_field(fb, "stratum");
+    fmt_unsigned(fb, stratum);
+    banner_field(fb, "refid");
+    if (stratum <= 1) {
+        unsigned n;
+        for (n=0; n<4 && px[12 + n]; n++)
+            ;
+        banner_text(fb, px + 12, n);
+    } else
+        fmt_ipv4(fb, px[12]<<24 | px[13]<<16 | px[14]<<8 | px[15]);
+}
+
+/***************************************************************************
+ * Skip a DNS name, or append it to 'fb' if not NULL, following at most a
+ * few compression pointers.
+ * @return
+ *      the offset after the name in the record, or 'length+1' on error
+ ***************************************************************************/
+static unsigned
+dns_name(struct FmtBuf *fb, const unsigned char *px, unsigned length,
+         unsigned offset)
+{
+    unsigned end = 0;
+    unsigned pointers = 0;
+    unsigned total = 0;
+
+    for (;;) {
+        unsigned len;
+
+        if (offset >= length)
+            return length + 1;
+        len = px[offset];
+
+        if ((len & 0xC0) == 0xC0) {
+            if (offset + 1 >= length || ++pointers > DNS_MAX_POINTERS)
+                return length + 1;
+            if (end == 0)
+                end = offset + 2;
+            offset = (len & 0x3F)<<8 | px[offset + 1];
+            continue;
+        } else if (len & 0xC0)
+            return length + 1;
+
+        if (len == 0)
+            return end ? end : offset + 1;
+        if (offset + 1 + len > length || total + len + 1 > 255)
+            return length + 1;
+        if (fb) {
+            if (total)
+                fmt_char(fb, '.');
+            banner_text(fb, px + offset + 1, len);
+        }
+        total += len + 1;
+        offset += len + 1;
+    }
+}
+
+/***************************************************************************
+ * NetBIOS name service, the response to a node status (NBSTAT) request:
+ * a DNS-like header and name, then a list of 18-byte entries (15 bytes of
+ * name, the suffix, and flags), then the adapter's MAC address.
+ ***************************************************************************/
+static void
+parse_netbios(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    const unsigned char *name = NULL;
+    const unsigned char *group = NULL;
+    unsigned offset;
+    unsigned count;
+    unsigned rdlength;
+    unsigned i;
+
+    if (length < 12 || (px[2] & 0x80) == 0 || get16(px + 6) == 0)
+        return;
+    offset = dns_name(NULL, px, length, 12);
+    if (offset + 11 > length || get16(px + offset) != 0x21)
+        return;
+    rdlength = get16(px + offset + 8);
+    offset += 10;
+    if (offset + rdlength > length)
+        rdlength = length - offset;
+    count = px[offset];
+    if (1 + count * 18 > rdlength)
+        return;
+    offset++;
+
+    for (i=0; i<count; i++) {
+        const unsigned char *entry = px + offset + i * 18;
+        unsigned is_group = entry[16] & 0x80;
+
+        if (entry[15] != 0x00)
+            continue;
+        if (is_group && group == NULL)
+            group = entry;
+        else if (!is_group && name == NULL)
+            name = entry;
+    }
+    if (name == NULL && count)
+        name = px + offset;
+
+    if (name) {
+        unsigned n = 15;
+        while (n && name[n - 1] == ' ')
+            n--;
+        banner_field(fb, "name");
+        banner_text(fb, name, n);
+    }
+    if (group) {
+        unsigned n = 15;
+        while (n && group[n - 1] == ' ')
+            n--;
+        banner_field(fb, "workgroup");
+        banner_text(fb, group, n);
+    }
+
+    /* The MAC address, if the statistics are there and it's not zero */
+    offset += count * 18;
+    if (offset + 6 <= length && 1 + count * 18 + 6 <= rdlength
+        && memcmp(px + offset, "\0\0\0\0\0\0", 6) != 0) {
+        banner_field(fb, "mac");
+        for (i=0; i<6; i++) {
+            if (i)
+                fmt_char(fb, ':');
+            banner_hex(fb, px[offset + i]);
+        }
+    }
+}
+
+/***************************************************************************
+ * Compare a header name, case-insensitively
+ ***************************************************************************/
+static int
+header_is(const unsigned char *line, unsigned length, const char *name)
+{
+    unsigned i;
+
+    for (i=0; name[i]; i++) {
+        if (i >= length || tolower(line[i]) != name[i])
+            return 0;
+    }
+    return i < length && line[i] == ':';
+}
+
+/***************************************************************************
+ * SSDP: an HTTP-like response to M-SEARCH. We report the SERVER,
+ * LOCATION, and USN headers.
+ ***************************************************************************/
+static void
+parse_ssdp(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    static const char *headers[] = {"server", "location", "usn", 0};
+    unsigned offset = 0;
+
+    if (length < 5 || memcmp(px, "HTTP/", 5) != 0)
+        return;
+
+    while (offset < length) {
+        const unsigned char *line = px + offset;
+        unsigned line_length = 0;
+        unsigned i;
+
+        while (offset + line_length < length && line[line_length] != '\n')
+            line_length++;
+        offset += line_length + 1;
+        if (line_length && line[line_length - 1] == '\r')
+            line_length--;
+
+        for (i=0; headers[i]; i++) {
+            unsigned name_length = (unsigned)strlen(headers[i]);
+            unsigned value;
+
+            if (!header_is(line, line_length, headers[i]))
+                continue;
+            for (value = name_length + 1;
+                    value < line_length && line[value] == ' '; value++)
+                ;
+            banner_field(fb, headers[i]);
+            banner_text(fb, line + value, line_length - value);
+            break;
+        }
+    }
+}
+
+/***************************************************************************
+ * memcached: after the 8-byte UDP frame header, the "stats" response is
+ * lines of "STAT <name> <value>". The first datagram has these.
+ ***************************************************************************/
+static void
+parse_memcached(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    static const char *stats[] = {"version", "uptime", "curr_connections", 0};
+    unsigned offset = 8;
+
+    if (length < 8 + 5 || memcmp(px + 8, "STAT ", 5) != 0)
+        return;
+
+    while (offset < length) {
+        const unsigned char *line = px + offset;
+        unsigned line_length = 0;
+        unsigned i;
+
+        while (offset + line_length < length && line[line_length] != '\n')
+            line_length++;
+        offset += line_length + 1;
+        if (line_length && line[line_length - 1] == '\r')
+            line_length--;
+        if (line_length < 5 || memcmp(line, "STAT ", 5) != 0)
+            break;
+
+        for (i=0; stats[i]; i++) {
+            unsigned name_length = (unsigned)strlen(stats[i]);
+
+            if (line_length < 5 + name_length + 1
+                || memcmp(line + 5, stats[i], name_length) != 0
+                || line[5 + name_length] != ' ')
+                continue;
+            banner_field(fb, stats[i]);
+            banner_text(fb, line + 5 + name_length + 1,
+                        line_length - 5 - name_length - 1);
+            break;
+        }
+    }
+}
+
+/***************************************************************************
+ * mDNS: the records in a response to our DNS-SD query, which for a
+ * "_services._dns-sd._udp.local" query are PTRs to the services offered.
+ * We also report A records, which name the host.
+ ***************************************************************************/
+static void
+parse_mdns(struct FmtBuf *fb, const unsigned char *px, unsigned length)
+{
+    unsigned offset = 12;
+    unsigned count;
+    unsigned i;
+
+    if (length < 12 || (px[2] & 0x80) == 0)
+        return;
+
+    for (i=0; i<get16(px + 4); i++) {
+        offset = dns_name(NULL, px, length, offset) + 4;
+        if (offset > length)
+            return;
+    }
+
+    count = get16(px + 6) + get16(px + 8) + get16(px + 10);
+    if (count > DNS_MAX_RECORDS)
+        count = DNS_MAX_RECORDS;
+    for (i=0; i<count; i++) {
+        unsigned name = offset;
+        unsigned type;
+        unsigned rdata;
+        unsigned rdlength;
+
+        offset = dns_name(NULL, px, length, offset);
+        if (offset + 10 > length)
+            return;
+        type = get16(px + offset);
+        rdlength = get16(px + offset + 8);
+        rdata = offset + 10;
+        if (rdata + rdlength > length)
+            return;
+
+        switch (type) {
+        case 12: /* PTR */
+            banner_field(fb, "ptr");
+            dns_name(fb, px, length, rdata);
+            break;
+        case 1: /* A */
+            if (rdlength != 4)
+                break;
+            banner_field(fb, "a");
+            dns_name(fb, px, length, name);
+            fmt_char(fb, ' ');
+            fmt_ipv4(fb, px[rdata]<<24 | px[rdata+1]<<16
+                            | px[rdata+2]<<8 | px[rdata+3]);
+            break;
+        }
+        offset = rdata + rdlength;
+    }
+}
+
+/***************************************************************************
+ * The registry, by port. DNS (port 53) is handled by proto-dns.c.
+ ***************************************************************************/
+static const struct UdpBannerParser parsers[] = {
+    {123,   PROTO_NTP,          "ntp",          parse_ntp},
+    {137,   PROTO_NETBIOS,      "netbios",      parse_netbios},
+    {161,   PROTO_SNMP,         "snmp",         parse_snmp},
+    {1900,  PROTO_SSDP,         "ssdp",         parse_ssdp},
+    {5353,  PROTO_MDNS,         "mdns",         parse_mdns},
+    {11211, PROTO_MEMCACHED,    "memcached",    parse_memcached},
+    {0, 0, 0, 0}
+};
+
+/***************************************************************************
+ ***************************************************************************/
+const struct UdpBannerParser *
+udp_banner_lookup(unsigned port)
+{
+    unsigned i;
+
+    for (i=0; parsers[i].parse; i++) {
+        if (parsers[i].port == port)
+            return &parsers[i];
+    }
+    return NULL;
+}
+
+
+/***************************************************************************
+ * Sample responses, for the selftest, and for the benchmark when there's
+ * no capture file
+ ***************************************************************************/
+static const struct {
+    unsigned port;
+    unsigned length;
+    const char *px;
+    const char *banner;
+} samples[] = {
+    {161, 79,
+        "\x30\x4d\x02\x01\x00\x04\x06public\xa2\x40"
+        "\x02\x04\x12\x34\x56\x78\x02\x01\x00\x02\x01\x00"
+        "\x30\x32"
+        "\x30\x1c\x06\x08\x2b\x06\x01\x02\x01\x01\x01\x00"
+            "\x04\x10" "Linux gw 2.6.32\x01"
+        "\x30\x12\x06\x08\x2b\x06\x01\x02\x01\x01\x05\x00"
+            "\x04\x06" "router",
+        "sysDescr=Linux gw 2.6.32.; sysName=router"},
+    {123, 48,
+        "\x24\x02\x06\xe9\x00\x00\x01\x23\x00\x00\x04\x56\xc0\x00\x02\x01"
+        "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+        "version=4; mode=server; stratum=2; refid=192.0.2.1"},
+    {123, 48,
+        "\x1c\x01\x06\xe9\x00\x00\x00\x00\x00\x00\x00\x00GPS\0"
+        "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0",
+        "version=3; mode=server; stratum=1; refid=GPS"},
+    {137, 99,
+        "\x12\x34\x84\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+        "\x20" "CKAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" "\x00"
+        "\x00\x21\x00\x01\x00\x00\x00\x00\x00\x2b"
+        "\x02"
+        "WORKGROUP      \x00\x84\x00"
+        "FILESERVER     \x00\x04\x00"
+        "\x00\x0c\x29\xaa\xbb\xcc",
+        "name=FILESERVER; workgroup=WORKGROUP; mac=00:0c:29:aa:bb:cc"},
+    {1900, 0xFFFFFFFF,
+        "HTTP/1.1 200 OK\r\n"
+        "CACHE-CONTROL: max-age=1800\r\n"
+        "Location: http://192.0.2.9:1900/desc.xml\r\n"
+        "SERVER: Linux/3.4 UPnP/1.0 MiniUPnPd/1.9\r\n"
+        "ST: upnp:rootdevice\r\n"
+        "\r\n",
+        "location=http://192.0.2.9:1900/desc.xml; server=Linux/3.4 UPnP/1.0 MiniUPnPd/1.9"},
+    {11211, 62,
+        "\x12\x34\x00\x00\x00\x01\x00\x00"
+        "STAT pid 1\r\n"
+        "STAT uptime 99\r\n"
+        "STAT version 1.4.25\r\n"
+        "END\r\n",
+        "uptime=99; version=1.4.25"},
+    {5353, 95,
+        "\x12\x34\x84\x00\x00\x01\x00\x02\x00\x00\x00\x00"
+        /* 12: _services._dns-sd._udp.local PTR */
+        "\x09_services\x07_dns-sd\x04_udp\x05local\x00\x00\x0c\x00\x01"
+        /* 46: PTR _http._tcp.local */
+        "\xc0\x0c\x00\x0c\x00\x01\x00\x00\x00\x0a\x00\x0d"
+            "\x05_http\x04_tcp\xc0\x23"
+        /* 71: A printer.local */
+        "\x07printer\xc0\x23\x00\x01\x80\x01\x00\x00\x00\x78\x00\x04"
+            "\xc0\x00\x02\x07",
+        "ptr=_http._tcp.local; a=printer.local 192.0.2.7"},
+    {0, 0, 0, 0}
+};
+
+/***************************************************************************
+ ***************************************************************************/
+int
+udp_banner_selftest(void)
+{
+    static const unsigned char loop[] =
+        "\x12\x34\x84\x00\x00\x00\x00\x01\x00\x00\x00\x00"
+        "\x00\x00\x0c\x00\x01\x00\x00\x00\x0a\x00\x02\xc0\x17";
+    char buf[UDP_BANNER_MAX];
+    struct FmtBuf fb[1];
+    unsigned i;
+
+    for (i=0; samples[i].port; i++) {
+        const struct UdpBannerParser *parser = udp_banner_lookup(samples[i].port);
+        unsigned length = samples[i].length;
+        unsigned n;
+
+        if (length == 0xFFFFFFFF)
+            length = (unsigned)strlen(samples[i].px);
+        if (parser == NULL)
+            goto fail;
+
+        fmt_init(fb, buf, sizeof(buf));
+        parser->parse(fb, (const unsigned char *)samples[i].px, length);
+        if (strcmp(fmt_cstr(fb), samples[i].banner) != 0) {
+            fprintf(stderr, "udp-banner: %s: \"%s\"\n", parser->name, buf);
+            goto fail;
+        }
+
+        /* Truncated responses produce less, but never read past the end */
+        for (n=0; n<length; n++) {
+            fmt_init(fb, buf, sizeof(buf));
+            parser->parse(fb, (const unsigned char *)samples[i].px, n);
+        }
+    }
+
+    /* A compression pointer to itself stops after a few loops */
+    fmt_init(fb, buf, sizeof(buf));
+    parse_mdns(fb, loop, sizeof(loop) - 1);
+    if (strcmp(fmt_cstr(fb), "ptr=") != 0)
+        goto fail;
+
+    if (udp_banner_lookup(53) != NULL || udp_banner_lookup(161)->proto != PROTO_SNMP)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "udp-banner: selftest failed\n");
+    return 1;
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+struct BenchResponse {
+    unsigned offset;
+    unsigned length;
+};
+
+struct BenchSet {
+    unsigned char *buf;
+    size_t buf_length;
+    size_t buf_max;
+    struct BenchResponse *responses;
+    unsigned count;
+    unsigned max;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+bench_add(struct BenchSet *set, const unsigned char *px, unsigned length)
+{
+    if (set->count >= set->max) {
+        unsigned new_max = set->max * 2 + 64;
+        struct BenchResponse *r;
+
+        r = (struct BenchResponse *)realloc(set->responses,
+                                            new_max * sizeof(r[0]));
+        if (r == NULL)
+            return;
+        set->responses = r;
+        set->max = new_max;
+    }
+    if (set->buf_length + length > set->buf_max) {
+        size_t new_max = set->buf_max * 2 + length + 65536;
+        unsigned char *buf = (unsigned char *)realloc(set->buf, new_max);
+
+        if (buf == NULL)
+            return;
+        set->buf = buf;
+        set->buf_max = new_max;
+    }
+    memcpy(set->buf + set->buf_length, px, length);
+    set->responses[set->count].offset = (unsigned)set->buf_length;
+    set->responses[set->count].length = length;
+    set->count++;
+    set->buf_length += length;
+}
+
+/***************************************************************************
+ * Gather the responses from the capture, by parser. A million per parser
+ * is plenty.
+ ***************************************************************************/
+static unsigned
+bench_read(const char *filename, struct BenchSet *sets)
+{
+    struct PcapReader *r;
+    struct PcapFrame frames[64];
+    unsigned count;
+    unsigned total = 0;
+
+    r = pcapreader_open(filename);
+    if (r == NULL)
+        return 0;
+    while ((count = pcapreader_next(r, frames, 64)) != 0) {
+        unsigned i;
+
+        for (i=0; i<count; i++) {
+            struct PreprocessedInfo parsed;
+            const struct UdpBannerParser *parser;
+            struct BenchSet *set;
+
+            if (!preprocess_frame(frames[i].px, frames[i].length, 1, &parsed))
+                continue;
+            if (parsed.found != FOUND_UDP && parsed.found != FOUND_DNS)
+                continue;
+            parser = udp_banner_lookup(parsed.port_src);
+            if (parser == NULL)
+                continue;
+            set = &sets[parser - parsers];
+            if (set->count >= 1000000
+                || parsed.app_offset + parsed.app_length > frames[i].length)
+                continue;
+            bench_add(set, frames[i].px + parsed.app_offset, parsed.app_length);
+            total++;
+        }
+    }
+    pcapreader_close(r);
+    return total;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+udp_banner_benchmark(const char *filename)
+{
+    struct BenchSet sets[sizeof(parsers)/sizeof(parsers[0])];
+    unsigned i;
+
+    memset(sets, 0, sizeof(sets));
+    if (filename == NULL || bench_read(filename, sets) == 0) {
+        for (i=0; samples[i].port; i++) {
+            const struct UdpBannerParser *parser = udp_banner_lookup(samples[i].port);
+            unsigned length = samples[i].length;
+
+            if (length == 0xFFFFFFFF)
+                length = (unsigned)strlen(samples[i].px);
+            bench_add(&sets[parser - parsers],
+                      (const unsigned char *)samples[i].px, length);
+        }
+    }
+
+    for (i=0; parsers[i].parse; i++) {
+        struct BenchSet *set = &sets[i];
+        uint64_t start, elapsed;
+        uint64_t responses = 0;
+        uint64_t bytes = 0;
+        unsigned checksum = 0;
+        char buf[UDP_BANNER_MAX];
+
+        if (set->count == 0)
+            continue;
+
+        /* Go over the responses until a second has passed */
+        start = pixie_nanotime();
+        do {
+            unsigned j;
+
+            for (j=0; j<set->count; j++) {
+                struct FmtBuf fb[1];
+
+                fmt_init(fb, buf, sizeof(buf));
+                parsers[i].parse(fb, set->buf + set->responses[j].offset,
+                                 set->responses[j].length);
+                checksum += fb->length;
+                bytes += set->responses[j].length;
+            }
+            responses += set->count;
+            elapsed = pixie_nanotime() - start;
+        } while (elapsed < 1000000000);
+
+        if (checksum == 1)
+            fprintf(stderr, "\n");
+        fprintf(stderr, "udp-%-9s parse: %10.0f responses/sec, %8.1f MB/sec\n",
+                parsers[i].name,
+                responses * 1000000000.0 / elapsed,
+                bytes * 1000.0 / elapsed);
+
+        free(set->buf);
+        free(set->responses);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+    banners from UDP responses
+
+    A table of parsers, by port, that turn a UDP response into a short
+    banner for output, such as the "sysDescr" from SNMP or the server
+    name from SSDP. See proto-udp-banner.c.
+*/
+#ifndef PROTO_UDP_BANNER_H
+#define PROTO_UDP_BANNER_H
+struct FmtBuf;
+
+/* The longest banner any of these parsers produce */
+#define UDP_BANNER_MAX 512
+
+struct UdpBannerParser {
+    unsigned port;
+    unsigned proto;         /* PROTO_xxx, for the output */
+    const char *name;
+
+    /**
+     * Parse the UDP payload, appending the banner to 'fb'. Appends
+     * nothing if it doesn't recognize the response. These neither
+     * allocate memory nor read outside [px, px+length).
+     */
+    void (*parse)(struct FmtBuf *fb, const unsigned char *px, unsigned length);
+};
+
+/**
+ * Find the parser for responses from this port
+ * @return
+ *      the parser, or NULL if there isn't one
+ */
+const struct UdpBannerParser *udp_banner_lookup(unsigned port);
+
+/**
+ * Parse a BER tag and length, as used by SNMP, starting at 'offset'.
+ * Also used by proto-udp.c to find the request-id that carries the
+ * cookie in SNMP responses.
+ * @return
+ *      the offset of the contents, or 'length+1' on error, including
+ *      when the contents would go past the end, with the tag and length
+ *      set to 0
+ */
+unsigned
+ber_next(const unsigned char *px, unsigned length, unsigned offset,
+         unsigned *tag, unsigned *content_length);
+
+int udp_banner_selftest(void);
+
+/**
+ * Measure how many responses/second each parser handles, using the
+ * responses in a packet capture, or if there's none, a few samples.
+ * Used by the "--benchmark" option.
+ */
+void udp_banner_benchmark(const char *filename);
+
+#endif
@@ -1,11 +1,28 @@
+/*
+    UDP responses
+
+    Unlike TCP, there's no SYN-cookie in the UDP header, so we put the
+    cookie in the payload instead, for those protocols that have a field
+    the service echoes back to us: the DNS transaction ID, the SNMP
+    request-id, and the NTP transmit timestamp. When all the payloads we
+    send to a port have such a field, we check it in the response, and
+    ignore responses that don't match. This keeps out stray packets, and
+    responses to other scanners.
+*/
 #include "proto-udp.h"
 #include "proto-dns.h"
+#include "proto-udp-banner.h"
+#include "proto-banner1.h"
 #include "proto-preprocess.h"
 #include "syn-cookie.h"
 #include "logger.h"
 #include "output.h"
 #include "masscan.h"
+#include "templ-payloads.h"
+#include "string-fmt.h"
 #include "unusedparm.h"
+#include <stdio.h>
+#include <string.h>
 
 static int
 matches_me(struct Output *out, unsigned ip, unsigned port)
@@ -19,8 +36,99 @@ matches_me(struct Output *out, unsigned ip, unsigned port)
     return 0;
 }
 
+/***************************************************************************
+ * Find the request-id in an SNMP message:
+ *  SEQUENCE {version INTEGER, community OCTET STRING, PDU {request-id ...}}
+ ***************************************************************************/
+static int
+snmp_request_id(const unsigned char *px, unsigned length,
+                unsigned *offset, unsigned *field_length)
+{
+    unsigned tag = 0;
+    unsigned len = 0;
+    unsigned i;
+
+    i = ber_next(px, length, 0, &tag, &len);
+    if (i > length || tag != 0x30)
+        return 0;
+    i = ber_next(px, length, i, &tag, &len);
+    if (i > length || tag != 0x02)
+        return 0;
+    i = ber_next(px, length, i + len, &tag, &len);
+    if (i > length || tag != 0x04)
+        return 0;
+    i = ber_next(px, length, i + len, &tag, &len);
+    if (i > length || tag < 0xA0 || tag > 0xA8)
+        return 0;
+    i = ber_next(px, length, i, &tag, &len);
+    if (i > length || tag != 0x02 || len == 0 || len > 5)
+        return 0;
+
+    *offset = i;
+    *field_length = len;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+udp_cookie_field(unsigned port, const unsigned char *px, unsigned length,
+                 unsigned is_response, unsigned *offset, unsigned *field_length)
+{
+    switch (port) {
+    case 53:
+    case 137:   /* NetBIOS name service */
+    case 5353:  /* mDNS answers unicast queries with the same ID */
+    case 11211: /* the memcached UDP frame header's request ID */
+        if (length < 12)
+            return 0;
+        *offset = 0;
+        *field_length = 2;
+        return 1;
+    case 123:
+        /* Only for client (3) requests, and server (4) responses */
+        if (length < 48 || (px[0] & 7) != (is_response ? 4 : 3))
+            return 0;
+        *offset = is_response ? 28 : 44; /* the low half of the timestamp */
+        *field_length = 4;
+        return 1;
+    case 161:
+        if (!snmp_request_id(px, length, offset, field_length))
+            return 0;
+        /* The agent may encode the request-id in fewer bytes, but our
+         * request needs room for the whole cookie */
+        if (!is_response && *field_length != 4)
+            return 0;
+        return 1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Check the cookie in a response. Our requests have a 2 byte field for
+ * DNS (and the others with DNS-style IDs), and 4 bytes for NTP and SNMP.
+ ***************************************************************************/
+static int
+udp_cookie_matches(unsigned port, const unsigned char *px, unsigned length,
+                   unsigned hash)
+{
+    unsigned offset = 0;
+    unsigned field_length = 0;
+    unsigned value = 0;
+    unsigned i;
+
+    if (!udp_cookie_field(port, px, length, 1, &offset, &field_length))
+        return 0;
+    for (i=0; i<field_length; i++)
+        value = value<<8 | px[offset + i];
+
+    return value == udp_cookie(hash, (port == 123 || port == 161) ? 4 : 2);
+}
 
-void handle_udp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed)
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+handle_udp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed)
 {
     unsigned ip_them;
     unsigned port_them = parsed->port_src;
@@ -28,6 +136,19 @@ void handle_udp(struct Output *out, const unsigned char *px, unsigned length, st
     ip_them = parsed->ip_src[0]<<24 | parsed->ip_src[1]<<16
             | parsed->ip_src[2]<< 8 | parsed->ip_src[3]<<0;
 
+    /*
+     * Verify the cookie, if every payload we sent to this port had one
+     */
+    if (out->masscan && payloads_has_cookie(out->masscan->payloads, port_them)) {
+        unsigned hash = syn_hash(ip_them, port_them + 65536);
+
+        if (!udp_cookie_matches(port_them, px + parsed->app_offset,
+                                parsed->app_length, hash)) {
+            LOGip(LOG_DEBUG, ip_them, port_them, "bad UDP cookie\n");
+            return 0;
+        }
+    }
+
     output_report_status(
                         out,
                         Port_UdpClosed,
@@ -36,10 +157,79 @@ void handle_udp(struct Output *out, const unsigned char *px, unsigned length, st
                         0,
                         0);
 
-    switch (port_them) {
-    case 53:
+    /*
+     * Look for a banner in the response
+     */
+    if (port_them == 53)
         handle_dns(out, px, length, parsed);
-        break;
+    else {
+        const struct UdpBannerParser *parser = udp_banner_lookup(port_them);
+
+        if (parser) {
+            char banner[UDP_BANNER_MAX];
+            struct FmtBuf fb[1];
+
+            fmt_init(fb, banner, sizeof(banner));
+            parser->parse(fb, px + parsed->app_offset, parsed->app_length);
+            if (fb->length)
+                output_report_banner(out, ip_them, 17, port_them,
+                                     parser->proto,
+                                     (const unsigned char *)banner, fb->length);
+        }
     }
 
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+udp_selftest(void)
+{
+    static const unsigned char snmp[] =
+        "\x30\x29\x02\x01\x00\x04\x06public\xa0\x1c"
+        "\x02\x04\x12\x34\x56\x78\x02\x01\x00\x02\x01\x00"
+        "\x30\x0e\x30\x0c\x06\x08\x2b\x06\x01\x02\x01\x01\x01\x00\x05\x00";
+    static const unsigned char snmp_short[] =
+        "\x30\x27\x02\x01\x00\x04\x06public\xa2\x1a"
+        "\x02\x02\x12\x34\x02\x01\x00\x02\x01\x00"
+        "\x30\x0e\x30\x0c\x06\x08\x2b\x06\x01\x02\x01\x01\x01\x00\x05\x00";
+    unsigned char ntp[48];
+    unsigned offset = 0;
+    unsigned field_length = 0;
+
+    /* SNMP: the request needs 4 bytes, the response can have fewer */
+    if (!udp_cookie_field(161, snmp, sizeof(snmp)-1, 0, &offset, &field_length)
+        || offset != 17 || field_length != 4)
+        goto fail;
+    if (udp_cookie_field(161, snmp_short, sizeof(snmp_short)-1, 0, &offset, &field_length))
+        goto fail;
+    if (!udp_cookie_matches(161, snmp_short, sizeof(snmp_short)-1, 0x80001234)
+        || udp_cookie_matches(161, snmp_short, sizeof(snmp_short)-1, 0x80001235))
+        goto fail;
+    if (udp_cookie_field(161, snmp, 20, 1, &offset, &field_length))
+        goto fail;
+
+    /* NTP: a client request, then the server's response */
+    memset(ntp, 0, sizeof(ntp));
+    ntp[0] = 0x23;
+    if (!udp_cookie_field(123, ntp, sizeof(ntp), 0, &offset, &field_length)
+        || offset != 44 || field_length != 4)
+        goto fail;
+    ntp[0] = 0x24;
+    ntp[28] = 0x7F;
+    ntp[31] = 0x01;
+    if (!udp_cookie_matches(123, ntp, sizeof(ntp), 0xFF000001)
+        || udp_cookie_matches(123, ntp, sizeof(ntp), 0x7F000002))
+        goto fail;
+
+    /* DNS: 15 bits of transaction ID */
+    if (!udp_cookie_matches(53, (const unsigned char *)"\x12\x34\x81\x80\0\0\0\0\0\0\0\0",
+                            12, 0xABCD9234))
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "udp: selftest failed\n");
+    return 1;
 }
@@ -3,6 +3,40 @@
 struct PreprocessedInfo;
 struct Output;
 
-void handle_udp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed);
+/**
+ * Handle a UDP response
+ * @return
+ *      1 if the response was accepted, 0 if it didn't have our cookie
+ */
+unsigned handle_udp(struct Output *out, const unsigned char *px, unsigned length, struct PreprocessedInfo *parsed);
+
+/**
+ * The cookie we put in a UDP payload, such as in the DNS transaction ID.
+ * It's the low bits of syn_hash() that fit in the field, but with the top
+ * bit clear, so that it's a positive INTEGER in SNMP.
+ */
+static __inline unsigned
+udp_cookie(unsigned hash, unsigned field_length)
+{
+    return hash & ((1U << (field_length * 8 - 1)) - 1);
+}
+
+/**
+ * Find the field in a UDP payload that can hold our cookie, and which the
+ * service echoes back in its response: the DNS transaction ID, the SNMP
+ * request-id, or the NTP transmit timestamp (which comes back as the
+ * origin timestamp).
+ * @param port
+ *      the service's port number, which tells us the protocol
+ * @param is_response
+ *      whether this is our request or the service's response
+ * @return
+ *      1 if found, with the offset and length of the field
+ */
+int
+udp_cookie_field(unsigned port, const unsigned char *px, unsigned length,
+                 unsigned is_response, unsigned *offset, unsigned *field_length);
+
+int udp_selftest(void);
 
 #endif
@@ -485,6 +485,30 @@ rangelist_pick2(const struct RangeList *targets, uint64_t index, const unsigned
 
     return (unsigned)(targets->list[mid].begin + (index - picker[mid]));
 }
+
+/***************************************************************************
+ * The reverse of rangelist_pick2(): the index of a number, found with a
+ * binary search of the ranges, which are kept sorted.
+ ***************************************************************************/
+uint64_t
+rangelist_index_of(const struct RangeList *targets, unsigned number, const unsigned *picker)
+{
+    unsigned min = 0;
+    unsigned max = targets->count;
+
+    while (min < max) {
+        unsigned mid = min + (max-min)/2;
+
+        if (number < targets->list[mid].begin)
+            max = mid;
+        else if (number > targets->list[mid].end)
+            min = mid + 1;
+        else
+            return (uint64_t)picker[mid] + (number - targets->list[mid].begin);
+    }
+
+    return ~(uint64_t)0;
+}
 int
 regress_pick2()
 {
@@ -529,7 +553,10 @@ regress_pick2()
 
             x = rangelist_pick2(targets, j, picker);
             rangelist_add_range(duplicate, x, x);
+            REGRESS(rangelist_index_of(targets, x, picker) == j);
         }
+        REGRESS(rangelist_index_of(targets, targets->list[0].begin - 1, picker) == ~(uint64_t)0);
+        REGRESS(rangelist_index_of(targets, targets->list[targets->count-1].end + 1, picker) == ~(uint64_t)0);
 
         /* at this point, the two range lists shouild be identical */
         REGRESS(targets->count == duplicate->count);
@@ -579,6 +606,9 @@ rangelist_parse_ports(struct RangeList *ports, const char *string)
                 case 'I': case 'i':
                     proto_offset = 65536*3;
                     break;
+                case 'A': case 'a':
+                    proto_offset = 65536*3 + 2;
+                    break;
                 default:
                     fprintf(stderr, "CONF: bad port charactern = %c\n", p[0]);
                     exit(1);
@@ -110,4 +110,12 @@ void rangelist_pick2_destroy(unsigned *picker);
 
 unsigned rangelist_pick2(const struct RangeList *targets, uint64_t index, const unsigned *picker);
 
+/**
+ * The reverse of rangelist_pick2(): given an IP address or port, find its
+ * index.
+ * @return
+ *      the index, or ~0 if the number isn't in the list
+ */
+uint64_t rangelist_index_of(const struct RangeList *targets, unsigned number, const unsigned *picker);
+
 #endif
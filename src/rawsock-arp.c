@@ -216,25 +216,6 @@ int arp_response(
 
     memset(&request, 0, sizeof(request));
 
-
-    /* Get a buffer for sending the response packet. This thread doesn't
-     * send the packet itself. Instead, it formats a packet, then hands
-     * that packet off to a transmit thread for later transmission. */
-    for (err=1; err; ) {
-        err = rte_ring_sc_dequeue(packet_buffers, (void**)&response);
-        if (err != 0) {
-            //LOG(0, "packet buffers empty (should be impossible)\n");
-            pixie_usleep(100);
-        }
-    }
-
-    /* ARP packets are too short, so increase the packet size to 
-     * the Ethernet minimum */
-    response->length = 60;
-
-    /* Fill the padded area with zeroes to avoid leaking data */
-    memset(response->px, 0, response->length);
-
     /*
      * Parse the response as an ARP packet
      */
@@ -258,6 +239,25 @@ int arp_response(
         return -1;
     }
 
+    /* Get a buffer for sending the response packet. This thread doesn't
+     * send the packet itself. Instead, it formats a packet, then hands
+     * that packet off to a transmit thread for later transmission. This
+     * is done last, since the buffer isn't given back if we return. */
+    for (err=1; err; ) {
+        err = rte_ring_sc_dequeue(packet_buffers, (void**)&response);
+        if (err != 0) {
+            //LOG(0, "packet buffers empty (should be impossible)\n");
+            pixie_usleep(100);
+        }
+    }
+
+    /* ARP packets are too short, so increase the packet size to 
+     * the Ethernet minimum */
+    response->length = 60;
+
+    /* Fill the padded area with zeroes to avoid leaking data */
+    memset(response->px, 0, response->length);
+
     /*
      * Create the response packet
      */
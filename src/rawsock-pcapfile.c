@@ -261,6 +261,8 @@ unsigned pcapfile_percentdone(struct PcapFile *capfile, uint64_t *r_bytes_read)
 
 	if (capfile->fp == NULL)
 		return 100;
+	if (capfile->file_size == 0)
+		return 0; /* pipes have no size */
 	return (unsigned)(capfile->bytes_read*100/capfile->file_size);
 }
 
@@ -610,34 +612,6 @@ struct PcapFile *pcapfile_openread(const char *capfilename)
 		break;
 	}
 
-	/* Read the first frame's timestamp */
-	{
-		int loc;
-		char buf[8];
-        size_t x;
-
-		loc = ftell(fp);
-		if (loc == -1) {
-			fprintf(stderr, "%s: ftell failed (file system error? seen with VMware HGFS bug)\n", capfilename);
-			perror(capfilename);
-			fclose(fp);
-			return 0;
-		}
-		x = fread(buf, 1, 8, fp);
-        if (x != 8) {
-			perror(capfilename);
-			fclose(fp);
-			return 0;
-        }
-		
-		if (fseek(fp, loc, SEEK_SET) != 0) {
-			fprintf(stderr, "%s: fseek failed (file system error?)\n", capfilename);
-			perror(capfilename);
-			fclose(fp);
-			return 0;
-		}
-	}
-
 	/*
 	 * Now that the file is open and we have read in the header,
 	 * allocate a structure that contains this information
@@ -0,0 +1,1004 @@
+/*
+    simulated Internet, for "--adapter sim"
+
+    This answers probes in-process, so that we can measure the entire
+    pipeline (transmit, receive, TCP connections, banners, output) on
+    any machine, without a network or root privileges.
+
+    The transmit thread hands each packet to simnet_send(), which decides
+    what the target would do, builds the response (if any) by reflecting
+    the probe, and queues it on a ring. The receive thread takes it off
+    that ring in simnet_recv() once the round-trip time has passed. The
+    response buffers are recycled through a second ring going the other
+    way, so nothing is allocated after startup.
+
+    Every decision is a hash of the "--seed" and the target, so the same
+    scan gets the same answers every time:
+    - a fraction --sim-open of ports are open: SYN-ACK, UDP reply,
+      SCTP INIT-ACK
+    - a fraction --sim-closed are closed: RST, ICMP port unreachable,
+      SCTP ABORT
+    - the rest are silent
+    - hosts with any open or closed port on a protocol answer pings
+    - ARP requests are always answered
+    - when nothing else is happening, the router broadcasts an ARP now
+      and then, which keeps the receive thread's timers going
+    - a few ports have scripted banners for testing --banners, sent after
+      the handshake (FTP, SSH, SMTP, POP3) or in response to a request
+      (HTTP)
+    Packet loss (--sim-loss) is applied in both directions, and depends
+    upon the order packets were sent, which is deterministic for a plain
+    SYN scan.
+*/
+#include "rawsock-sim.h"
+#include "templ-pkt.h"
+#include "proto-sctp.h"
+#include "packet-queue.h"
+#include "pixie-timer.h"
+#include "logger.h"
+#include "string_s.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The number of responses that can be in flight. At 10-million probes
+ * per second, with 10% of them answered, this is a 64 millisecond RTT. */
+#define SIM_PACKET_COUNT 65536
+
+/* How often there's background traffic when nothing else is going on */
+#define SIM_CHATTER_INTERVAL 100000
+
+/* Responses are small: even a DNS reply is under 100 bytes */
+#define SIM_PACKET_SIZE 240
+
+struct SimPacket {
+    uint64_t due;           /* when to receive, from pixie_gettime() */
+    unsigned length;
+    unsigned char px[SIM_PACKET_SIZE];
+};
+
+enum {
+    SIM_SILENT,
+    SIM_OPEN,
+    SIM_CLOSED,
+};
+
+struct SimNet {
+    struct SimConfig config;
+    uint64_t open_threshold;
+    uint64_t closed_threshold;
+    uint64_t loss_threshold;
+
+    struct SimPacket *packets;
+    PACKET_QUEUE *free_queue;   /* receive thread -> transmit thread */
+    PACKET_QUEUE *pending;      /* transmit thread -> receive thread */
+
+    /* the transmit thread's side */
+    uint64_t sent;
+    uint64_t lost;
+    uint64_t responses;
+    uint64_t overflows;
+
+    /* the receive thread's side */
+    struct SimPacket *held;     /* dequeued, but not yet due */
+    struct SimPacket *last;     /* returned by the last simnet_recv() */
+    uint64_t last_received;
+    unsigned char chatter[60];
+
+    /* for converting pixie_gettime() into packet timestamps */
+    uint64_t time_start;
+    uint64_t clock_start;
+};
+
+/* The MAC address that all simulated hosts answer from */
+static const unsigned char sim_mac[6] = {0x66, 0x55, 0x44, 0x33, 0x22, 0x11};
+
+static const unsigned char http_response[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Server: sim/1.0\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n";
+
+
+/***************************************************************************
+ ***************************************************************************/
+int
+simnet_is_name(const char *ifname)
+{
+    return ifname && strcmp(ifname, "sim") == 0;
+}
+
+/***************************************************************************
+ * The 'splitmix64' finalizer, which is fast and mixes well enough that
+ * the low bits of an IP address affect all the result bits
+ ***************************************************************************/
+static uint64_t
+mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t
+sim_hash(const struct SimNet *sim, uint64_t a, uint64_t b)
+{
+    return mix(mix(sim->config.seed ^ a) + b);
+}
+
+/***************************************************************************
+ * Thresholds are compared with the top 32 bits of a hash
+ ***************************************************************************/
+static uint64_t
+threshold(double fraction)
+{
+    if (fraction <= 0.0)
+        return 0;
+    if (fraction >= 1.0)
+        return 1ULL << 32;
+    return (uint64_t)(fraction * 4294967296.0);
+}
+
+/***************************************************************************
+ * Whether this port is open, closed, or silent. The 'proto' is the IP
+ * protocol number, so that TCP and UDP ports are independent.
+ ***************************************************************************/
+static unsigned
+sim_state(const struct SimNet *sim, unsigned ip, unsigned proto, unsigned port)
+{
+    uint64_t h = sim_hash(sim, ip, proto<<16 | port) >> 32;
+
+    if (h < sim->open_threshold)
+        return SIM_OPEN;
+    if (h - sim->open_threshold < sim->closed_threshold)
+        return SIM_CLOSED;
+    return SIM_SILENT;
+}
+
+/***************************************************************************
+ * The initial sequence number of an open port
+ ***************************************************************************/
+static unsigned
+sim_isn(const struct SimNet *sim, unsigned ip, unsigned port)
+{
+    return (unsigned)sim_hash(sim, ip, 0x1000000 | port);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+sim_is_lost(struct SimNet *sim)
+{
+    if (sim->loss_threshold == 0)
+        return 0;
+    if ((sim_hash(sim, 0x2000000, sim->sent++) >> 32) < sim->loss_threshold) {
+        sim->lost++;
+        return 1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+get16(const unsigned char *px)
+{
+    return px[0]<<8 | px[1];
+}
+static unsigned
+get32(const unsigned char *px)
+{
+    return px[0]<<24 | px[1]<<16 | px[2]<<8 | px[3];
+}
+static void
+put16(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x >> 8);
+    px[1] = (unsigned char)(x >> 0);
+}
+static void
+put32(unsigned char *px, unsigned x)
+{
+    px[0] = (unsigned char)(x >> 24);
+    px[1] = (unsigned char)(x >> 16);
+    px[2] = (unsigned char)(x >> 8);
+    px[3] = (unsigned char)(x >> 0);
+}
+
+/***************************************************************************
+ * Get a free buffer for a response, or NULL if the response is lost on
+ * the way back, or too many are in flight. Only the receive thread puts
+ * buffers back on the free ring.
+ ***************************************************************************/
+static struct SimPacket *
+reply_alloc(struct SimNet *sim)
+{
+    struct SimPacket *p;
+
+    if (sim_is_lost(sim))
+        return NULL;
+    if (rte_ring_sc_dequeue(sim->free_queue, (void**)&p) != 0) {
+        sim->overflows++;
+        return NULL;
+    }
+    return p;
+}
+
+/***************************************************************************
+ * Queue the response. Short frames are padded, as on a real Ethernet.
+ ***************************************************************************/
+static void
+reply_send(struct SimNet *sim, struct SimPacket *p, unsigned length,
+           uint64_t now)
+{
+    if (length < 60) {
+        memset(p->px + length, 0, 60 - length);
+        length = 60;
+    }
+    p->length = length;
+    p->due = now + sim->config.rtt;
+    rte_ring_sp_enqueue(sim->pending, p);
+    sim->responses++;
+}
+
+/***************************************************************************
+ * Fill in the Ethernet and IPv4 headers of a response, reversing the
+ * addresses of the probe.
+ * @return
+ *      the offset of the transport header in the response
+ ***************************************************************************/
+static unsigned
+reply_ip(unsigned char *px, const unsigned char *probe, unsigned offset_ip,
+         unsigned proto, unsigned transport_length, unsigned ip_them)
+{
+    unsigned xsum = 0;
+    unsigned i;
+
+    memcpy(px + 0, probe + 6, 6);
+    memcpy(px + 6, sim_mac, 6);
+    put16(px + 12, 0x0800);
+
+    px += 14;
+    px[0] = 0x45;
+    px[1] = 0;
+    put16(px + 2, 20 + transport_length);
+    put16(px + 4, ip_them ^ get16(probe + offset_ip + 4));
+    put16(px + 6, 0x4000);          /* don't fragment */
+    px[8] = 64 - (ip_them & 0xF);   /* a TTL that's a few hops away */
+    px[9] = (unsigned char)proto;
+    put16(px + 10, 0);
+    memcpy(px + 12, probe + offset_ip + 16, 4);
+    memcpy(px + 16, probe + offset_ip + 12, 4);
+
+    for (i=0; i<20; i += 2)
+        xsum += get16(px + i);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    put16(px + 10, ~xsum);
+
+    return 14 + 20;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+reply_tcp(struct SimNet *sim, const unsigned char *probe,
+          unsigned offset_ip, unsigned offset_tcp, unsigned ip_them,
+          unsigned seqno, unsigned ackno, unsigned flags,
+          const unsigned char *payload, unsigned payload_length,
+          uint64_t now)
+{
+    struct SimPacket *p;
+    unsigned char *px;
+    unsigned offset;
+    unsigned xsum;
+
+    if (20 + 20 + 14 + payload_length > SIM_PACKET_SIZE)
+        return;
+    p = reply_alloc(sim);
+    if (p == NULL)
+        return;
+
+    offset = reply_ip(p->px, probe, offset_ip, 6, 20 + payload_length, ip_them);
+    px = p->px + offset;
+    put16(px + 0, get16(probe + offset_tcp + 2));
+    put16(px + 2, get16(probe + offset_tcp + 0));
+    put32(px + 4, seqno);
+    put32(px + 8, ackno);
+    px[12] = 5 << 4;
+    px[13] = (unsigned char)flags;
+    put16(px + 14, (flags & 0x04) ? 0 : 65535);
+    put16(px + 16, 0);
+    put16(px + 18, 0);
+    memcpy(px + 20, payload, payload_length);
+    px[20 + payload_length] = 0;    /* checksum reads one past odd lengths */
+
+    xsum = tcp_checksum2(p->px, 14, offset, 20 + payload_length);
+    put16(px + 16, ~xsum);
+
+    reply_send(sim, p, offset + 20 + payload_length, now);
+}
+
+/***************************************************************************
+ * The banner a server sends as soon as the connection is established,
+ * for protocols where the server speaks first
+ ***************************************************************************/
+static const char *
+server_hello(unsigned port)
+{
+    switch (port) {
+    case 21:  return "220 ProFTPD 1.3.4a Server (sim) [::ffff:10.0.0.1]\r\n";
+    case 22:  return "SSH-2.0-OpenSSH_6.2p2 Sim-1\r\n";
+    case 25:  return "220 mail.example.com ESMTP Postfix (sim)\r\n";
+    case 110: return "+OK POP3 server ready (sim)\r\n";
+    default:  return NULL;
+    }
+}
+
+/***************************************************************************
+ * TCP is answered statelessly. Because the open port's sequence number
+ * is a hash, we can recognize the ACK of our SYN-ACK without remembering
+ * anything about the connection.
+ ***************************************************************************/
+static void
+sim_tcp(struct SimNet *sim, const unsigned char *px, unsigned length,
+        unsigned offset_ip, unsigned offset_tcp, unsigned ip_them,
+        uint64_t now)
+{
+    unsigned port_them;
+    unsigned seqno;
+    unsigned ackno;
+    unsigned flags;
+    unsigned offset_app;
+    unsigned payload_length;
+    unsigned isn;
+    unsigned ip_length;
+
+    if (offset_tcp + 20 > length)
+        return;
+    port_them = get16(px + offset_tcp + 2);
+    seqno = get32(px + offset_tcp + 4);
+    ackno = get32(px + offset_tcp + 8);
+    flags = px[offset_tcp + 13];
+    offset_app = offset_tcp + (px[offset_tcp + 12] >> 4) * 4;
+
+    /* The frame may be padded, so the payload length comes from the
+     * IP header */
+    ip_length = get16(px + offset_ip + 2);
+    if (offset_ip + ip_length > length || offset_ip + ip_length < offset_app)
+        return;
+    payload_length = offset_ip + ip_length - offset_app;
+
+    if (flags & 0x04)
+        return; /* never respond to RST */
+
+    switch (sim_state(sim, ip_them, 6, port_them)) {
+    case SIM_SILENT:
+        return;
+    case SIM_CLOSED:
+        if ((flags & 0x12) == 0x02)
+            reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                      0, seqno + 1, 0x14, 0, 0, now);
+        return;
+    }
+
+    isn = sim_isn(sim, ip_them, port_them);
+
+    /* SYN */
+    if ((flags & 0x12) == 0x02) {
+        reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                  isn, seqno + 1, 0x12, 0, 0, now);
+        return;
+    }
+
+    /* Everything else must be a part of the connection */
+    if ((flags & 0x10) == 0 || ackno - (isn + 1) > 0x10000)
+        return;
+
+    /* The ACK that completes the handshake: servers that speak first
+     * send their banner, then close */
+    if (payload_length == 0 && (flags & 0x01) == 0 && ackno == isn + 1) {
+        const char *hello = server_hello(port_them);
+        if (hello) {
+            unsigned hello_length = (unsigned)strlen(hello);
+            reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                      isn + 1, seqno, 0x18,
+                      (const unsigned char *)hello, hello_length, now);
+            reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                      isn + 1 + hello_length, seqno, 0x11, 0, 0, now);
+        }
+        return;
+    }
+
+    /* A request: web servers answer it, then close */
+    if (payload_length && ackno == isn + 1
+        && (port_them == 80 || port_them == 8080)) {
+        unsigned response_length = sizeof(http_response) - 1;
+        reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                  isn + 1, seqno + payload_length, 0x18,
+                  http_response, response_length, now);
+        reply_tcp(sim, px, offset_ip, offset_tcp, ip_them,
+                  isn + 1 + response_length, seqno + payload_length, 0x11,
+                  0, 0, now);
+    }
+}
+
+/***************************************************************************
+ * Answer a DNS query with a copy of the query. If it's asking for a TXT
+ * record, like the "version.bind" probe, then add an answer.
+ ***************************************************************************/
+static unsigned
+sim_dns(unsigned char *px, unsigned max, const unsigned char *query,
+        unsigned query_length)
+{
+    static const char version[] = "9.8.sim";
+    unsigned offset;
+    unsigned length;
+
+    if (query_length < 12 || query_length > max)
+        return 0;
+    memcpy(px, query, query_length);
+    px[2] |= 0x80;  /* QR: this is a response */
+    px[3] &= 0x70;  /* RCODE: no error */
+
+    /* Skip the question name */
+    offset = 12;
+    while (offset < query_length && px[offset] && (px[offset] & 0xC0) == 0)
+        offset += px[offset] + 1;
+    if (offset >= query_length)
+        return query_length;
+    offset += (px[offset] & 0xC0) ? 2 : 1;
+    if (get16(px + 4) != 1 || offset + 4 > query_length)
+        return query_length;
+    length = offset + 4;    /* drop anything after the question */
+    put16(px + 6, 0);
+    put16(px + 8, 0);
+    put16(px + 10, 0);
+
+    if (get16(px + offset) != 16 || length + 12 + sizeof(version) > max)
+        return length;
+
+    /* The answer: a pointer back to the question name, then type, class,
+     * TTL, and the text */
+    put16(px + length + 0, 0xC00C);
+    put16(px + length + 2, 16);
+    put16(px + length + 4, get16(px + offset + 2));
+    put32(px + length + 6, 0);
+    put16(px + length + 10, sizeof(version));
+    px[length + 12] = sizeof(version) - 1;
+    memcpy(px + length + 13, version, sizeof(version) - 1);
+    length += 12 + sizeof(version);
+    put16(px + 6, 1);   /* ANCOUNT */
+
+    return length;
+}
+
+/***************************************************************************
+ * Open UDP ports echo the probe back (or answer it, for DNS), closed
+ * ones send back an ICMP port unreachable
+ ***************************************************************************/
+static void
+sim_udp(struct SimNet *sim, const unsigned char *probe, unsigned length,
+        unsigned offset_ip, unsigned offset_udp, unsigned ip_them,
+        uint64_t now)
+{
+    struct SimPacket *p;
+    unsigned char *px;
+    unsigned offset;
+    unsigned port_them;
+    unsigned udp_length;
+    unsigned payload_length;
+    unsigned xsum;
+
+    if (offset_udp + 8 > length)
+        return;
+    port_them = get16(probe + offset_udp + 2);
+    udp_length = get16(probe + offset_udp + 4);
+    if (udp_length < 8 || offset_udp + udp_length > length)
+        return;
+
+    switch (sim_state(sim, ip_them, 17, port_them)) {
+    case SIM_SILENT:
+        return;
+
+    case SIM_CLOSED:
+        /* Type 3 code 3, quoting the IP header and 8 bytes of UDP */
+        p = reply_alloc(sim);
+        if (p == NULL)
+            return;
+        offset = reply_ip(p->px, probe, offset_ip, 1, 8 + 28, ip_them);
+        px = p->px + offset;
+        px[0] = 3;
+        px[1] = 3;
+        put16(px + 2, 0);
+        put32(px + 4, 0);
+        memcpy(px + 8, probe + offset_ip, 20);
+        memcpy(px + 28, probe + offset_udp, 8);
+        xsum = icmp_checksum2(p->px, offset, 8 + 28);
+        put16(px + 2, ~xsum);
+        reply_send(sim, p, offset + 8 + 28, now);
+        return;
+    }
+
+    p = reply_alloc(sim);
+    if (p == NULL)
+        return;
+    offset = 14 + 20;
+    px = p->px + offset;
+    payload_length = udp_length - 8;
+    if (port_them == 53)
+        payload_length = sim_dns(px + 8, SIM_PACKET_SIZE - offset - 9,
+                                 probe + offset_udp + 8, payload_length);
+    else if (payload_length <= SIM_PACKET_SIZE - offset - 9)
+        memcpy(px + 8, probe + offset_udp + 8, payload_length);
+    else
+        payload_length = 0;
+
+    reply_ip(p->px, probe, offset_ip, 17, 8 + payload_length, ip_them);
+    put16(px + 0, port_them);
+    put16(px + 2, get16(probe + offset_udp + 0));
+    put16(px + 4, 8 + payload_length);
+    put16(px + 6, 0);
+    px[8 + payload_length] = 0;
+    xsum = udp_checksum2(p->px, 14, offset, 8 + payload_length);
+    put16(px + 6, ~xsum);
+
+    reply_send(sim, p, offset + 8 + payload_length, now);
+}
+
+/***************************************************************************
+ * SCTP: open ports answer an INIT with an INIT-ACK, and closed ones with
+ * an ABORT, both carrying the initiate tag (our cookie) as the
+ * verification tag
+ ***************************************************************************/
+static void
+sim_sctp(struct SimNet *sim, const unsigned char *probe, unsigned length,
+         unsigned offset_ip, unsigned offset_sctp, unsigned ip_them,
+         uint64_t now)
+{
+    struct SimPacket *p;
+    unsigned char *px;
+    unsigned offset;
+    unsigned chunk_length;
+    unsigned xsum;
+
+    if (offset_sctp + 12 + 20 > length || probe[offset_sctp + 12] != 1)
+        return; /* only INIT */
+
+    switch (sim_state(sim, ip_them, 132, get16(probe + offset_sctp + 2))) {
+    case SIM_OPEN:
+        chunk_length = 20;
+        break;
+    case SIM_CLOSED:
+        chunk_length = 4;
+        break;
+    default:
+        return;
+    }
+
+    p = reply_alloc(sim);
+    if (p == NULL)
+        return;
+    offset = reply_ip(p->px, probe, offset_ip, 132, 12 + chunk_length, ip_them);
+    px = p->px + offset;
+    put16(px + 0, get16(probe + offset_sctp + 2));
+    put16(px + 2, get16(probe + offset_sctp + 0));
+    memcpy(px + 4, probe + offset_sctp + 16, 4);
+    put32(px + 8, 0);
+    if (chunk_length == 20) {
+        px[12] = 2;                     /* INIT-ACK */
+        px[13] = 0;
+        put16(px + 14, 20);
+        put32(px + 16, sim_isn(sim, ip_them, get16(px + 0)) | 1);
+        put32(px + 20, 65536);          /* receive window */
+        put16(px + 24, 10);             /* streams */
+        put16(px + 26, 10);
+        put32(px + 28, sim_isn(sim, ip_them, get16(px + 0)));
+    } else {
+        px[12] = 6;                     /* ABORT */
+        px[13] = 0;
+        put16(px + 14, 4);
+    }
+    xsum = sctp_checksum(px, 12 + chunk_length);
+    px[8] = (unsigned char)(xsum >> 0);
+    px[9] = (unsigned char)(xsum >> 8);
+    px[10] = (unsigned char)(xsum >> 16);
+    px[11] = (unsigned char)(xsum >> 24);
+
+    reply_send(sim, p, offset + 12 + chunk_length, now);
+}
+
+/***************************************************************************
+ * Hosts with something listening answer pings. The identifier and
+ * sequence number (our cookie) are echoed back along with the data.
+ ***************************************************************************/
+static void
+sim_icmp(struct SimNet *sim, const unsigned char *probe, unsigned length,
+         unsigned offset_ip, unsigned offset_icmp, unsigned ip_them,
+         uint64_t now)
+{
+    struct SimPacket *p;
+    unsigned char *px;
+    unsigned offset;
+    unsigned icmp_length;
+    unsigned xsum;
+
+    icmp_length = offset_ip + get16(probe + offset_ip + 2) - offset_icmp;
+    if (offset_icmp + 8 > length || offset_icmp + icmp_length > length)
+        return;
+    if (probe[offset_icmp] != 8)
+        return; /* only echo requests */
+    if (icmp_length + 14 + 20 + 1 > SIM_PACKET_SIZE)
+        return;
+    if (sim_state(sim, ip_them, 1, 0) == SIM_SILENT)
+        return;
+
+    p = reply_alloc(sim);
+    if (p == NULL)
+        return;
+    offset = reply_ip(p->px, probe, offset_ip, 1, icmp_length, ip_them);
+    px = p->px + offset;
+    memcpy(px, probe + offset_icmp, icmp_length);
+    px[0] = 0;
+    put16(px + 2, 0);
+    px[icmp_length] = 0;
+    xsum = icmp_checksum2(p->px, offset, icmp_length);
+    put16(px + 2, ~xsum);
+
+    reply_send(sim, p, offset + icmp_length, now);
+}
+
+/***************************************************************************
+ * Everybody is home: answer an ARP request with a made-up MAC address
+ ***************************************************************************/
+static void
+sim_arp(struct SimNet *sim, const unsigned char *probe, unsigned length,
+        uint64_t now)
+{
+    struct SimPacket *p;
+    unsigned char *px;
+
+    if (length < 14 + 28)
+        return;
+    if (get16(probe + 14 + 6) != 1)
+        return; /* only requests */
+
+    p = reply_alloc(sim);
+    if (p == NULL)
+        return;
+    px = p->px;
+    memcpy(px + 0, probe + 6, 6);
+    memcpy(px + 6, sim_mac, 6);
+    put16(px + 12, 0x0806);
+    px += 14;
+    memcpy(px, probe + 14, 6);          /* hardware/protocol type & size */
+    put16(px + 6, 2);                   /* reply */
+    memcpy(px + 8, sim_mac, 6);
+    memcpy(px + 14, probe + 14 + 24, 4);
+    memcpy(px + 18, probe + 14 + 8, 6);
+    memcpy(px + 24, probe + 14 + 14, 4);
+
+    reply_send(sim, p, 14 + 28, now);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+simnet_send(struct SimNet *sim, const unsigned char *px, unsigned length)
+{
+    unsigned offset_ip = 14;
+    unsigned offset_transport;
+    unsigned ip_them;
+    uint64_t now;
+
+    if (length < 14)
+        return;
+    if (sim_is_lost(sim))
+        return;
+    now = pixie_gettime();
+
+    switch (get16(px + 12)) {
+    case 0x0806:
+        sim_arp(sim, px, length, now);
+        return;
+    case 0x0800:
+        break;
+    default:
+        return;
+    }
+
+    if (length < offset_ip + 20 || (px[offset_ip] >> 4) != 4)
+        return;
+    offset_transport = offset_ip + (px[offset_ip] & 0xF) * 4;
+    if (get16(px + offset_ip + 6) & 0x3FFF)
+        return; /* fragments */
+    ip_them = get32(px + offset_ip + 16);
+
+    switch (px[offset_ip + 9]) {
+    case 1:
+        sim_icmp(sim, px, length, offset_ip, offset_transport, ip_them, now);
+        break;
+    case 6:
+        sim_tcp(sim, px, length, offset_ip, offset_transport, ip_them, now);
+        break;
+    case 17:
+        sim_udp(sim, px, length, offset_ip, offset_transport, ip_them, now);
+        break;
+    case 132:
+        sim_sctp(sim, px, length, offset_ip, offset_transport, ip_them, now);
+        break;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+simnet_recv(struct SimNet *sim, unsigned *length, unsigned *secs,
+            unsigned *usecs, const unsigned char **px)
+{
+    struct SimPacket *p;
+    uint64_t now;
+    uint64_t timestamp;
+
+    /* The caller is done with the last frame */
+    if (sim->last) {
+        rte_ring_sp_enqueue(sim->free_queue, sim->last);
+        sim->last = NULL;
+    }
+
+    /* The ring can't peek, so if the next response isn't due yet, we
+     * hold onto it until it is */
+    if (sim->held == NULL
+        && rte_ring_sc_dequeue(sim->pending, (void**)&sim->held) != 0)
+        sim->held = NULL;
+    p = sim->held;
+    now = pixie_gettime();
+
+    if (p == NULL || p->due > now) {
+        /* A real network is never quiet for long, and the receive thread
+         * depends upon that to run its timers, so when we have nothing
+         * else, there's a broadcast from the router now and then */
+        if (now - sim->last_received >= SIM_CHATTER_INTERVAL) {
+            sim->last_received = now;
+            timestamp = sim->time_start + (now - sim->clock_start);
+            *px = sim->chatter;
+            *length = sizeof(sim->chatter);
+            *secs = (unsigned)(timestamp / 1000000);
+            *usecs = (unsigned)(timestamp % 1000000);
+            return 0;
+        }
+        if (p == NULL)
+            pixie_usleep(100);
+        else
+            pixie_usleep(p->due - now < 1000 ? p->due - now : 1000);
+        return 1;
+    }
+    sim->held = NULL;
+    sim->last = p;
+    sim->last_received = now;
+
+    timestamp = sim->time_start + (p->due - sim->clock_start);
+    *px = p->px;
+    *length = p->length;
+    *secs = (unsigned)(timestamp / 1000000);
+    *usecs = (unsigned)(timestamp % 1000000);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct SimNet *
+simnet_create(const struct SimConfig *config)
+{
+    struct SimNet *sim;
+    unsigned i;
+
+    sim = (struct SimNet *)malloc(sizeof(*sim));
+    if (sim == NULL)
+        return NULL;
+    memset(sim, 0, sizeof(*sim));
+    sim->config = *config;
+
+    /* SCTP replies are checksummed on the transmit threads */
+    sctp_checksum_init();
+    sim->open_threshold = threshold(config->open);
+    sim->closed_threshold = threshold(config->closed);
+    sim->loss_threshold = threshold(config->loss);
+
+    sim->packets = (struct SimPacket *)malloc(SIM_PACKET_COUNT * sizeof(sim->packets[0]));
+    sim->free_queue = rte_ring_create(SIM_PACKET_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    sim->pending = rte_ring_create(SIM_PACKET_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    if (sim->packets == NULL || sim->free_queue == NULL || sim->pending == NULL) {
+        LOG(0, "sim: out of memory\n");
+        exit(1);
+    }
+
+    /* A ring holds one less than its size */
+    for (i=0; i<SIM_PACKET_COUNT-1; i++)
+        rte_ring_sp_enqueue(sim->free_queue, &sim->packets[i]);
+
+    sim->time_start = time(0) * 1000000ULL;
+    sim->clock_start = pixie_gettime();
+    sim->last_received = sim->clock_start;
+
+    /* The router asking for an address nobody has */
+    memset(sim->chatter, 0, sizeof(sim->chatter));
+    memset(sim->chatter, 0xFF, 6);
+    memcpy(sim->chatter + 6, sim_mac, 6);
+    memcpy(sim->chatter + 12, "\x08\x06\x00\x01\x08\x00\x06\x04\x00\x01", 10);
+    memcpy(sim->chatter + 22, sim_mac, 6);
+    memcpy(sim->chatter + 28, "\xc0\x00\x02\xfe", 4);    /* 192.0.2.254 */
+    memcpy(sim->chatter + 38, "\xc0\x00\x02\xfd", 4);    /* 192.0.2.253 */
+
+    LOG(1, "sim: open=%.4f closed=%.4f loss=%.4f rtt=%uus seed=%llu\n",
+        config->open, config->closed, config->loss, config->rtt,
+        (unsigned long long)config->seed);
+    return sim;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+simnet_destroy(struct SimNet *sim)
+{
+    if (sim == NULL)
+        return;
+    LOG(1, "sim: %llu responses, %llu lost, %llu dropped (too many in flight)\n",
+        (unsigned long long)sim->responses,
+        (unsigned long long)sim->lost,
+        (unsigned long long)sim->overflows);
+    free(sim->packets);
+    free(sim->free_queue);
+    free(sim->pending);
+    free(sim);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+sim_probe(unsigned char *px, unsigned proto, unsigned ip_them,
+          unsigned port_them, unsigned flags, unsigned seqno, unsigned ackno)
+{
+    memset(px, 0, 60);
+    memcpy(px + 0, sim_mac, 6);
+    memcpy(px + 6, "\x00\x11\x22\x33\x44\x55", 6);
+    put16(px + 12, 0x0800);
+    px[14] = 0x45;
+    put16(px + 16, 40);
+    px[22] = 255;
+    px[23] = (unsigned char)proto;
+    put32(px + 26, 0x0a000001);
+    put32(px + 30, ip_them);
+    put16(px + 34, 40000);
+    put16(px + 36, port_them);
+    if (proto == 6) {
+        put32(px + 38, seqno);
+        put32(px + 42, ackno);
+        px[46] = 5 << 4;
+        px[47] = (unsigned char)flags;
+    }
+    return 60;
+}
+
+/***************************************************************************
+ * Receive the next response, skipping background chatter
+ ***************************************************************************/
+static int
+sim_reply(struct SimNet *sim, const unsigned char **px)
+{
+    unsigned length, secs, usecs;
+
+    while (simnet_recv(sim, &length, &secs, &usecs, px) == 0) {
+        if (*px != sim->chatter)
+            return length < 60;
+    }
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+simnet_selftest(void)
+{
+    struct SimConfig config;
+    struct SimNet *sim;
+    unsigned char probe[60];
+    unsigned ip;
+    unsigned opened = 0;
+    unsigned closed = 0;
+    unsigned pings = 0;
+    unsigned banners = 0;
+
+    memset(&config, 0, sizeof(config));
+    config.open = 0.25;
+    config.closed = 0.25;
+    config.seed = 1;
+    sim = simnet_create(&config);
+    if (sim == NULL)
+        return 1;
+
+    /* SYNs are answered with SYN-ACK or RST in about the right
+     * proportion, and handshakes on port 22 get a banner */
+    for (ip=0x0a000000; ip<0x0a000000 + 1000; ip++) {
+        const unsigned char *px;
+
+        simnet_send(sim, probe, sim_probe(probe, 6, ip, 22, 0x02, 1234, 0));
+        while (sim_reply(sim, &px) == 0) {
+            if (get32(px + 26) != ip || get16(px + 34) != 22)
+                goto fail;
+            if (get32(px + 42) != 1235)
+                goto fail;
+            if (px[47] == 0x14)
+                closed++;
+            else if (px[47] == 0x12) {
+                unsigned isn = get32(px + 38);
+                opened++;
+                if (isn != sim_isn(sim, ip, 22))
+                    goto fail;
+
+                simnet_send(sim, probe,
+                            sim_probe(probe, 6, ip, 22, 0x10, 1235, isn + 1));
+                if (sim_reply(sim, &px) != 0)
+                    goto fail;
+                if (px[47] != 0x18 || memcmp(px + 54, "SSH-2.0-", 8) != 0)
+                    goto fail;
+                banners++;
+                if (sim_reply(sim, &px) != 0)
+                    goto fail;
+                if (px[47] != 0x11)
+                    goto fail;
+            } else
+                goto fail;
+        }
+    }
+    if (opened < 200 || opened > 300 || closed < 200 || closed > 300)
+        goto fail;
+    if (banners != opened)
+        goto fail;
+
+    /* The same host answers the same way the second time */
+    for (ip=0x0a000000; ip<0x0a000000 + 1000; ip++) {
+        const unsigned char *px;
+
+        simnet_send(sim, probe, sim_probe(probe, 6, ip, 22, 0x02, 1234, 0));
+        while (sim_reply(sim, &px) == 0) {
+            if (px[47] == 0x12)
+                opened--;
+            else
+                closed--;
+        }
+    }
+    if (opened != 0 || closed != 0)
+        goto fail;
+
+    /* Pings */
+    for (ip=0x0a000000; ip<0x0a000000 + 1000; ip++) {
+        const unsigned char *px;
+
+        sim_probe(probe, 1, ip, 0, 0, 0, 0);
+        probe[34] = 8;
+        put32(probe + 38, 0xdeadbeef);
+        simnet_send(sim, probe, 60);
+        while (sim_reply(sim, &px) == 0) {
+            if (px[34] != 0 || get32(px + 38) != 0xdeadbeef)
+                goto fail;
+            if (icmp_checksum2(px, 34, 20) != 0xFFFF)
+                goto fail;
+            pings++;
+        }
+    }
+    if (pings < 400 || pings > 600)
+        goto fail;
+
+    simnet_destroy(sim);
+    return 0;
+fail:
+    fprintf(stderr, "sim: selftest failed\n");
+    simnet_destroy(sim);
+    return 1;
+}
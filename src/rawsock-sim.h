@@ -0,0 +1,49 @@
+/*
+    simulated Internet, for "--adapter sim"
+
+    Instead of a network adapter, probes are answered in-process by a
+    simulated Internet, so that the entire transmit/receive pipeline can
+    be benchmarked and profiled without a network. See rawsock-sim.c.
+*/
+#ifndef RAWSOCK_SIM_H
+#define RAWSOCK_SIM_H
+#include <stdint.h>
+
+struct SimNet;
+
+struct SimConfig {
+    double open;        /* --sim-open: fraction of ports that are open */
+    double closed;      /* --sim-closed: fraction that are closed, and
+                         * respond with RST or port unreachable */
+    double loss;        /* --sim-loss: fraction of packets lost, in each
+                         * direction */
+    unsigned rtt;       /* --sim-rtt: round-trip time, in microseconds */
+    uint64_t seed;      /* which ports are open, and which packets are lost */
+};
+
+/**
+ * Whether this adapter name selects the simulated Internet
+ */
+int simnet_is_name(const char *ifname);
+
+struct SimNet *simnet_create(const struct SimConfig *config);
+
+void simnet_destroy(struct SimNet *sim);
+
+/**
+ * Called by the transmit thread: answer the probe, queuing any response
+ * to be received after the round-trip time
+ */
+void simnet_send(struct SimNet *sim, const unsigned char *px, unsigned length);
+
+/**
+ * Called by the receive thread. The frame is valid until the next call.
+ * @return
+ *      0 if a frame was returned, 1 if nothing was ready in time
+ */
+int simnet_recv(struct SimNet *sim, unsigned *length, unsigned *secs,
+                unsigned *usecs, const unsigned char **px);
+
+int simnet_selftest(void);
+
+#endif
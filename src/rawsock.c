@@ -8,6 +8,10 @@
 #include "templ-pkt.h"
 #include "logger.h"
 #include "main-ptrace.h"
+#include "in-pcap.h"
+#include "rawsock-sim.h"
+#include "main-profile.h"
+#include "pixie-timer.h"
 
 #include "string_s.h"
 
@@ -47,12 +51,27 @@ int pcap_sendqueue_queue(pcap_send_queue *queue,
 #else
 #endif
 
+#define REPLAY_BATCH 64
+
 struct Adapter
 {
     pcap_t *pcap;
     pcap_send_queue *sendq;
     pfring *ring;
     unsigned is_packet_trace:1; /* is --packet-trace option set? */
+
+    /* --replay: frames come from a capture file instead */
+    struct PcapReader *replay;
+    struct PcapFrame replay_frames[REPLAY_BATCH];
+    unsigned replay_count;
+    unsigned replay_index;
+    unsigned is_replay_realtime:1;
+    volatile unsigned is_replay_done;
+    uint64_t replay_start;      /* when we started, from pixie_gettime() */
+    uint64_t replay_first;      /* timestamp of the first frame */
+
+    /* --adapter sim: a simulated Internet answers our probes */
+    struct SimNet *sim;
 };
 
 #define SENDQ_SIZE 65536 * 8
@@ -275,6 +294,12 @@ rawsock_send_packet(
         packet_trace(stdout, packet, length, 1);
     }
 
+    /* SIMULATED */
+    if (adapter->sim) {
+        simnet_send(adapter->sim, packet, length);
+        return 0;
+    }
+
     /* PF_RING */
     if (adapter->ring) {
         int err = PF_RING_ERROR_NO_TX_SLOT_AVAILABLE;
@@ -335,7 +360,49 @@ int rawsock_recv_packet(
     unsigned *usecs,
     const unsigned char **packet)
 {
-    if (adapter->ring) {
+    if (adapter->replay) {
+        const struct PcapFrame *frame;
+
+        if (adapter->replay_index >= adapter->replay_count) {
+            adapter->replay_count = pcapreader_next(adapter->replay,
+                                        adapter->replay_frames, REPLAY_BATCH);
+            adapter->replay_index = 0;
+            if (adapter->replay_count == 0) {
+                adapter->is_replay_done = 1;
+                return 1;
+            }
+        }
+        frame = &adapter->replay_frames[adapter->replay_index];
+
+        /* With --replay-realtime, hold the frame until it's due, like the
+         * read timeout on a real adapter */
+        if (adapter->is_replay_realtime) {
+            uint64_t timestamp = frame->secs * 1000000ULL + frame->usecs;
+            uint64_t now = pixie_gettime();
+
+            if (adapter->replay_start == 0) {
+                adapter->replay_start = now;
+                adapter->replay_first = timestamp;
+            } else if (timestamp > adapter->replay_first
+                && timestamp - adapter->replay_first > now - adapter->replay_start) {
+                uint64_t wait = (timestamp - adapter->replay_first)
+                                - (now - adapter->replay_start);
+                pixie_usleep(wait < 1000 ? wait : 1000);
+                return 1;
+            }
+        }
+        adapter->replay_index++;
+
+        *packet = frame->px;
+        *length = frame->length;
+        *secs = frame->secs;
+        *usecs = frame->usecs;
+
+    } else if (adapter->sim) {
+        if (simnet_recv(adapter->sim, length, secs, usecs, packet) != 0)
+            return 1;
+
+    } else if (adapter->ring) {
         struct pfring_pkthdr hdr;
         int err;
 
@@ -388,24 +455,40 @@ int rawsock_recv_packet(
  *
  * Step 1: format the packet
  * Step 2: send it in a portable manner
+ *
+ * A UDP port with several payloads gets one packet for each of them.
+ * Returns the number of packets sent, or negative on error. The two
+ * steps are timed separately for "--profile".
  ***************************************************************************/
-void
+int
 rawsock_send_probe(
     struct Adapter *adapter,
-    unsigned ip, unsigned port, unsigned seqno, unsigned flush,
-    struct TemplateSet *tmplset)
+    unsigned ip, unsigned port, unsigned seqno,
+    unsigned flush,
+    struct TemplateSet *tmplset,
+    struct Profile *prof)
 {
-    /*
-     * Construct the destination packet
-     */
-    template_set_target(tmplset, ip, port, seqno);
-    if (tmplset->length < 60)
-        tmplset->length = 60;
+    unsigned count = template_variant_count(tmplset, port);
+    unsigned variant;
+    int err = 0;
 
-    /*
-     * Send it
-     */
-    rawsock_send_packet(adapter, tmplset->px, tmplset->length, flush);
+    for (variant=0; variant<count; variant++) {
+        /*
+         * Construct the destination packet
+         */
+        template_set_target(tmplset, ip, port, seqno, variant);
+        if (tmplset->length < 60)
+            tmplset->length = 60;
+        PROFILE_LAP(prof, Profile_Template);
+
+        /*
+         * Send it
+         */
+        if (rawsock_send_packet(adapter, tmplset->px, tmplset->length,
+                                flush && variant + 1 == count) < 0)
+            err = -1;
+        PROFILE_LAP(prof, Profile_Send);
+    }
 
     /*
      * Verify I'm doing the checksum correctly in case I develope a bug
@@ -414,6 +497,8 @@ rawsock_send_probe(
         LOG(2, "IP checksum bad 0x%04x\n", ip_checksum(pkt));
     if (tcp_checksum(pkt) != 0xFFFF)
         LOG(2, "TCP checksum bad 0x%04x\n", tcp_checksum(pkt));*/
+
+    return err ? err : (int)count;
 }
 
 
@@ -542,6 +627,9 @@ rawsock_close_adapter(struct Adapter *adapter)
     if (adapter->sendq) {
         pcap_sendqueue_destroy(adapter->sendq);
     }
+    if (adapter->sim) {
+        simnet_destroy(adapter->sim);
+    }
 
     free(adapter);
 }
@@ -595,7 +683,8 @@ rawsock_init_adapter(const char *adapter_name,
                      unsigned is_pfring, 
                      unsigned is_sendq,
                      unsigned is_packet_trace,
-                     unsigned is_offline)
+                     unsigned is_offline,
+                     const struct SimConfig *sim_config)
 {
     struct Adapter *adapter;
     char errbuf[PCAP_ERRBUF_SIZE];
@@ -607,6 +696,28 @@ rawsock_init_adapter(const char *adapter_name,
     if (is_offline)
         return adapter;
 
+    /*----------------------------------------------------------------
+     * SIMULATED
+     *  With "--adapter sim", there's no network adapter, just the
+     *  simulated Internet in rawsock-sim.c
+     *----------------------------------------------------------------*/
+    if (simnet_is_name(adapter_name)) {
+        struct SimConfig defaults;
+
+        if (sim_config == NULL) {
+            memset(&defaults, 0, sizeof(defaults));
+            defaults.open = 0.01;
+            defaults.closed = 0.10;
+            sim_config = &defaults;
+        }
+        adapter->sim = simnet_create(sim_config);
+        if (adapter->sim == NULL) {
+            free(adapter);
+            return 0;
+        }
+        return adapter;
+    }
+
     /*----------------------------------------------------------------
      * PORTABILITY: WINDOWS
      * If is all digits index, then look in indexed list
@@ -736,6 +847,76 @@ rawsock_init_adapter(const char *adapter_name,
 
 
 
+/***************************************************************************
+ ***************************************************************************/
+struct Adapter *
+rawsock_init_replay(const char *filename,
+                    unsigned is_realtime,
+                    unsigned is_packet_trace)
+{
+    struct Adapter *adapter;
+
+    adapter = (struct Adapter *)malloc(sizeof(*adapter));
+    if (adapter == NULL)
+        return 0;
+    memset(adapter, 0, sizeof(*adapter));
+    adapter->is_packet_trace = is_packet_trace;
+    adapter->is_replay_realtime = is_realtime;
+
+    adapter->replay = pcapreader_open(filename);
+    if (adapter->replay == NULL) {
+        free(adapter);
+        return 0;
+    }
+    if (pcapreader_datalink(adapter->replay) != 1)
+        LOG(0, "replay: %s: link type %u, only Ethernet is supported\n",
+            filename, pcapreader_datalink(adapter->replay));
+
+    return adapter;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+rawsock_is_replay_done(const struct Adapter *adapter)
+{
+    return adapter->is_replay_done;
+}
+
+/***************************************************************************
+ * How many received frames the kernel has dropped because we weren't
+ * reading them fast enough. Only libpcap keeps track of this.
+ ***************************************************************************/
+uint64_t
+rawsock_get_drops(struct Adapter *adapter)
+{
+    struct pcap_stat stats;
+
+    if (adapter == NULL || adapter->pcap == NULL || adapter->replay)
+        return 0;
+    if (pcap_stats(adapter->pcap, &stats) != 0)
+        return 0;
+    return (uint64_t)stats.ps_drop + stats.ps_ifdrop;
+}
+
+
+/***************************************************************************
+ * The link type of the frames we receive, for the header of a "--pcap"
+ * capture. PF_RING and the simulated network are always Ethernet.
+ ***************************************************************************/
+unsigned
+rawsock_datalink(struct Adapter *adapter)
+{
+    if (adapter == NULL)
+        return 1;
+    if (adapter->replay)
+        return pcapreader_datalink(adapter->replay);
+    if (adapter->pcap == NULL || adapter->ring || adapter->sim)
+        return 1;
+    return (unsigned)pcap_datalink(adapter->pcap);
+}
+
+
 /***************************************************************************
  * for testing when two Windows adapters have the same name. Sometimes
  * the \Device\NPF_ string is prepended, sometimes not.
@@ -813,7 +994,7 @@ rawsock_selftest_if(const char *ifname)
             (unsigned char)(router_ipv4>>0));
 
 
-        adapter = rawsock_init_adapter(ifname, 0, 0, 0, 0);
+        adapter = rawsock_init_adapter(ifname, 0, 0, 0, 0, 0);
         if (adapter == 0) {
             printf("adapter[%s]: failed\n", ifname);
             return -1;
@@ -4,8 +4,11 @@
 #ifndef RAWSOCK_H
 #define RAWSOCK_H
 #include <stdio.h>
+#include <stdint.h>
 struct Adapter;
 struct TemplateSet;
+struct SimConfig;
+struct Profile;
 #include "packet-queue.h"
 
 
@@ -37,6 +40,10 @@ void rawsock_init();
  * @param is_offline
  *      Whether the --offline parameter was set on the command-line. If so,
  *      then no network adapter will actually be opened.
+ * @param sim_config
+ *      If the adapter name is "sim", then instead of a network adapter,
+ *      a simulated Internet with these settings answers our probes, or
+ *      with the defaults if NULL.
  * @return
  *      a fully instantiated network adapter
  */
@@ -45,15 +52,56 @@ rawsock_init_adapter(const char *adapter_name,
                      unsigned is_pfring, 
                      unsigned is_sendq,
                      unsigned is_packet_trace,
-                     unsigned is_offline);
+                     unsigned is_offline,
+                     const struct SimConfig *sim_config);
+
+/**
+ * Instead of a network adapter, "receive" the frames from a capture file,
+ * for "--replay". Transmitted packets are discarded.
+ * @param is_realtime
+ *      Whether to deliver frames with the timing they were captured
+ *      with, rather than as fast as possible
+ * @return
+ *      the adapter, or NULL if the file couldn't be opened
+ */
+struct Adapter *
+rawsock_init_replay(const char *filename,
+                    unsigned is_realtime,
+                    unsigned is_packet_trace);
+
+/**
+ * Whether a "--replay" adapter has returned every frame in the file
+ */
+int rawsock_is_replay_done(const struct Adapter *adapter);
+
+/**
+ * The number of received frames the kernel dropped because we didn't
+ * read them fast enough, or 0 if the adapter can't tell us. Called by
+ * the receive thread.
+ */
+uint64_t rawsock_get_drops(struct Adapter *adapter);
+
+/**
+ * The link type of received frames (1 for Ethernet), as libpcap's
+ * pcap_datalink() reports it
+ */
+unsigned rawsock_datalink(struct Adapter *adapter);
 
 void rawsock_list_adapters();
 
-void
+/**
+ * Send the probe for this target, which is one packet, or one for each
+ * payload of a UDP port with several
+ * @return
+ *      the number of packets sent, or negative on error
+ */
+int
 rawsock_send_probe(
     struct Adapter *adapter,
-    unsigned ip, unsigned port, unsigned seqno, unsigned flush,
-    struct TemplateSet *tmplset);
+    unsigned ip, unsigned port, unsigned seqno,
+    unsigned flush,
+    struct TemplateSet *tmplset,
+    struct Profile *prof);
 
 unsigned rawsock_get_adapter_ip(const char *ifname);
 int rawsock_get_adapter_mac(const char *ifname, unsigned char *mac);
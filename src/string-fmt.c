@@ -0,0 +1,367 @@
+/*
+    fast formatting of numbers and addresses
+
+    See string-fmt.h for the rationale. The two tricks here are:
+    - IPv4 octets are looked up in a 256 entry table of strings, rather
+      than being converted digit-by-digit
+    - larger numbers are converted two digits at a time using a table
+      of the 100 digit-pairs "00" through "99", which halves the number
+      of (slow) divide operations
+*/
+#include "string-fmt.h"
+#include "pixie-timer.h"
+#include "string_s.h"
+#include <stdio.h>
+#include <string.h>
+
+/***************************************************************************
+ * The strings "0" through "255", for formatting IPv4 octets
+ ***************************************************************************/
+static const char fmt_octets[256][4] = {
+    "0",   "1",   "2",   "3",   "4",   "5",   "6",   "7",
+    "8",   "9",   "10",  "11",  "12",  "13",  "14",  "15",
+    "16",  "17",  "18",  "19",  "20",  "21",  "22",  "23",
+    "24",  "25",  "26",  "27",  "28",  "29",  "30",  "31",
+    "32",  "33",  "34",  "35",  "36",  "37",  "38",  "39",
+    "40",  "41",  "42",  "43",  "44",  "45",  "46",  "47",
+    "48",  "49",  "50",  "51",  "52",  "53",  "54",  "55",
+    "56",  "57",  "58",  "59",  "60",  "61",  "62",  "63",
+    "64",  "65",  "66",  "67",  "68",  "69",  "70",  "71",
+    "72",  "73",  "74",  "75",  "76",  "77",  "78",  "79",
+    "80",  "81",  "82",  "83",  "84",  "85",  "86",  "87",
+    "88",  "89",  "90",  "91",  "92",  "93",  "94",  "95",
+    "96",  "97",  "98",  "99",  "100", "101", "102", "103",
+    "104", "105", "106", "107", "108", "109", "110", "111",
+    "112", "113", "114", "115", "116", "117", "118", "119",
+    "120", "121", "122", "123", "124", "125", "126", "127",
+    "128", "129", "130", "131", "132", "133", "134", "135",
+    "136", "137", "138", "139", "140", "141", "142", "143",
+    "144", "145", "146", "147", "148", "149", "150", "151",
+    "152", "153", "154", "155", "156", "157", "158", "159",
+    "160", "161", "162", "163", "164", "165", "166", "167",
+    "168", "169", "170", "171", "172", "173", "174", "175",
+    "176", "177", "178", "179", "180", "181", "182", "183",
+    "184", "185", "186", "187", "188", "189", "190", "191",
+    "192", "193", "194", "195", "196", "197", "198", "199",
+    "200", "201", "202", "203", "204", "205", "206", "207",
+    "208", "209", "210", "211", "212", "213", "214", "215",
+    "216", "217", "218", "219", "220", "221", "222", "223",
+    "224", "225", "226", "227", "228", "229", "230", "231",
+    "232", "233", "234", "235", "236", "237", "238", "239",
+    "240", "241", "242", "243", "244", "245", "246", "247",
+    "248", "249", "250", "251", "252", "253", "254", "255",
+};
+
+/***************************************************************************
+ * The number of characters in each of the above strings
+ ***************************************************************************/
+#define OCTET_LENGTH(n) (1 + ((n) >= 10) + ((n) >= 100))
+
+/***************************************************************************
+ * The 100 digit-pairs "00" through "99"
+ ***************************************************************************/
+static const char fmt_digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899"
+    ;
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_init(struct FmtBuf *fb, char *buf, size_t max)
+{
+    fb->buf = buf;
+    fb->length = 0;
+    fb->max = (unsigned)max;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_append(struct FmtBuf *fb, const void *str, size_t length)
+{
+    if (fb->length + length > fb->max)
+        length = fb->max - fb->length;
+    memcpy(fb->buf + fb->length, str, length);
+    fb->length += (unsigned)length;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_string(struct FmtBuf *fb, const char *str)
+{
+    fmt_append(fb, str, strlen(str));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_char(struct FmtBuf *fb, char c)
+{
+    if (fb->length < fb->max)
+        fb->buf[fb->length++] = c;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_pad(struct FmtBuf *fb, char c, unsigned count)
+{
+    if (fb->length + count > fb->max)
+        count = fb->max - fb->length;
+    memset(fb->buf + fb->length, c, count);
+    fb->length += count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+fmt_utoa(char *buf, unsigned x)
+{
+    char tmp[16];
+    unsigned i = sizeof(tmp);
+    unsigned length;
+
+    while (x >= 100) {
+        unsigned r = (x % 100) * 2;
+        x /= 100;
+        tmp[--i] = fmt_digit_pairs[r + 1];
+        tmp[--i] = fmt_digit_pairs[r + 0];
+    }
+    if (x >= 10) {
+        tmp[--i] = fmt_digit_pairs[x*2 + 1];
+        tmp[--i] = fmt_digit_pairs[x*2 + 0];
+    } else
+        tmp[--i] = (char)('0' + x);
+
+    length = sizeof(tmp) - i;
+    memcpy(buf, tmp + i, length);
+    return length;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_unsigned(struct FmtBuf *fb, unsigned x)
+{
+    char tmp[16];
+    unsigned length;
+
+    length = fmt_utoa(tmp, x);
+    fmt_append(fb, tmp, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_unsigned_width(struct FmtBuf *fb, unsigned x, unsigned width)
+{
+    char tmp[16];
+    unsigned length;
+
+    length = fmt_utoa(tmp, x);
+    if (length < width)
+        fmt_pad(fb, ' ', width - length);
+    fmt_append(fb, tmp, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_u64(struct FmtBuf *fb, uint64_t x)
+{
+    char tmp[24];
+    unsigned i = sizeof(tmp);
+
+    if (x <= 0xFFFFFFFF) {
+        fmt_unsigned(fb, (unsigned)x);
+        return;
+    }
+
+    while (x) {
+        tmp[--i] = (char)('0' + (unsigned)(x % 10));
+        x /= 10;
+    }
+    fmt_append(fb, tmp + i, sizeof(tmp) - i);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+fmt_ipv4_str(char *buf, unsigned ip)
+{
+    unsigned length = 0;
+    unsigned i;
+
+    for (i=0; i<4; i++) {
+        unsigned octet = (ip >> (24 - 8*i)) & 0xFF;
+        const char *str = fmt_octets[octet];
+
+        /* copy all 3 bytes, which is faster than branching on the length,
+         * then only advance by the real length */
+        buf[length + 0] = str[0];
+        buf[length + 1] = str[1];
+        buf[length + 2] = str[2];
+        length += OCTET_LENGTH(octet);
+        buf[length++] = '.';
+    }
+    buf[--length] = '\0';
+
+    return length;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_ipv4(struct FmtBuf *fb, unsigned ip)
+{
+    char tmp[16];
+    unsigned length;
+
+    length = fmt_ipv4_str(tmp, ip);
+    fmt_append(fb, tmp, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+fmt_tcpflags(struct FmtBuf *fb, unsigned flags)
+{
+    static const char names[8][4] = {
+        "fin", "syn", "rst", "psh", "ack", "urg", "ece", "cwr"
+    };
+    unsigned i;
+    unsigned count = 0;
+
+    for (i=0; i<8; i++) {
+        if ((flags & (1<<i)) == 0)
+            continue;
+        if (count++)
+            fmt_char(fb, '-');
+        fmt_append(fb, names[i], 3);
+    }
+    if (count == 0)
+        fmt_literal(fb, "none");
+}
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+fmt_cstr(struct FmtBuf *fb)
+{
+    if (fb->max == 0)
+        return "";
+    if (fb->length >= fb->max)
+        fb->length = fb->max - 1;
+    fb->buf[fb->length] = '\0';
+    return fb->buf;
+}
+
+
+/***************************************************************************
+ * Compare the results against what printf() produces
+ ***************************************************************************/
+int
+fmt_selftest(void)
+{
+    static const unsigned numbers[] = {
+        0, 1, 9, 10, 11, 99, 100, 101, 255, 999, 1000, 65535, 99999,
+        100000, 1234567, 4294967295U
+    };
+    static const unsigned ips[] = {
+        0, 0x01020304, 0x0a00ff01, 0x7f000001, 0xc0a80164, 0x646463ff,
+        0xFFFFFFFF
+    };
+    char buf[64];
+    char expected[64];
+    struct FmtBuf fb[1];
+    unsigned i;
+
+    for (i=0; i<sizeof(numbers)/sizeof(numbers[0]); i++) {
+        fmt_init(fb, buf, sizeof(buf));
+        fmt_unsigned(fb, numbers[i]);
+        fmt_unsigned_width(fb, numbers[i], 7);
+        fmt_u64(fb, numbers[i] * 1000000ULL);
+        sprintf_s(expected, sizeof(expected), "%u%7u%llu",
+            numbers[i], numbers[i], (unsigned long long)numbers[i] * 1000000ULL);
+        if (strcmp(fmt_cstr(fb), expected) != 0)
+            goto fail;
+    }
+
+    for (i=0; i<sizeof(ips)/sizeof(ips[0]); i++) {
+        unsigned ip = ips[i];
+        unsigned length;
+
+        length = fmt_ipv4_str(buf, ip);
+        sprintf_s(expected, sizeof(expected), "%u.%u.%u.%u",
+            (ip>>24)&0xFF, (ip>>16)&0xFF, (ip>>8)&0xFF, (ip>>0)&0xFF);
+        if (strcmp(buf, expected) != 0 || length != strlen(expected))
+            goto fail;
+    }
+
+    fmt_init(fb, buf, sizeof(buf));
+    fmt_tcpflags(fb, 0x12);
+    fmt_char(fb, ' ');
+    fmt_tcpflags(fb, 0);
+    if (strcmp(fmt_cstr(fb), "syn-ack none") != 0)
+        goto fail;
+
+    /* must truncate rather than overflow */
+    fmt_init(fb, buf, 8);
+    fmt_literal(fb, "0123456789");
+    fmt_ipv4(fb, 0xFFFFFFFF);
+    fmt_pad(fb, ' ', 100);
+    if (fb->length != 8 || strcmp(fmt_cstr(fb), "0123456") != 0)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "fmt: selftest failed\n");
+    return 1;
+}
+
+/***************************************************************************
+ * Compare the speed of formatting IPv4 addresses with printf()
+ ***************************************************************************/
+void
+fmt_benchmark(void)
+{
+    static const unsigned count = 10000000;
+    char buf[32];
+    uint64_t start, elapsed;
+    unsigned i;
+    unsigned total = 0;
+
+    start = pixie_gettime();
+    for (i=0; i<count; i++) {
+        unsigned ip = i * 2654435761U;
+        sprintf_s(buf, sizeof(buf), "%u.%u.%u.%u",
+            (ip>>24)&0xFF, (ip>>16)&0xFF, (ip>>8)&0xFF, (ip>>0)&0xFF);
+        total += buf[0];
+    }
+    elapsed = pixie_gettime() - start;
+    fprintf(stderr, "%-8s ipv4:   %10.0f addresses/sec\n", "printf",
+            count * 1000000.0 / (elapsed ? elapsed : 1));
+
+    start = pixie_gettime();
+    for (i=0; i<count; i++) {
+        unsigned ip = i * 2654435761U;
+        fmt_ipv4_str(buf, ip);
+        total += buf[0];
+    }
+    elapsed = pixie_gettime() - start;
+    fprintf(stderr, "%-8s ipv4:   %10.0f addresses/sec\n", "fmt",
+            count * 1000000.0 / (elapsed ? elapsed : 1));
+
+    if (total == 0)
+        fprintf(stderr, "\n"); /* keep the compiler from optimizing away */
+}
@@ -0,0 +1,98 @@
+/*
+    fast formatting of numbers and addresses
+
+    The output writers format every result with an IP address, a port,
+    and a timestamp. Going through printf() for these dominates CPU when
+    a scan finds millions of open ports. These functions append to a
+    fixed-capacity buffer instead, which is then written with a single
+    fwrite(). When the buffer fills up, output is silently truncated,
+    so callers size the buffer for the largest record they write.
+*/
+#ifndef STRING_FMT_H
+#define STRING_FMT_H
+#include <stdint.h>
+#include <stddef.h>
+
+struct FmtBuf {
+    char *buf;
+    unsigned length;
+    unsigned max;
+};
+
+/**
+ * Start appending to the buffer 'buf' of size 'max'. The buffer is NOT
+ * nul terminated as we go, use fmt_cstr() when a C string is needed.
+ */
+void fmt_init(struct FmtBuf *fb, char *buf, size_t max);
+
+/**
+ * Append raw bytes, truncating if the buffer is full
+ */
+void fmt_append(struct FmtBuf *fb, const void *str, size_t length);
+
+/**
+ * Append a string literal, whose length is known at compile time
+ */
+#define fmt_literal(fb, str) fmt_append(fb, str, sizeof(str)-1)
+
+/**
+ * Append a nul-terminated string
+ */
+void fmt_string(struct FmtBuf *fb, const char *str);
+
+/**
+ * Append a single character
+ */
+void fmt_char(struct FmtBuf *fb, char c);
+
+/**
+ * Append 'count' copies of the character 'c', such as for space-padding
+ * columns.
+ */
+void fmt_pad(struct FmtBuf *fb, char c, unsigned count);
+
+/**
+ * Append an unsigned number in decimal
+ */
+void fmt_unsigned(struct FmtBuf *fb, unsigned x);
+void fmt_u64(struct FmtBuf *fb, uint64_t x);
+
+/**
+ * Append an unsigned number in decimal, right-justified in a field
+ * of 'width' characters, like printf("%5u").
+ */
+void fmt_unsigned_width(struct FmtBuf *fb, unsigned x, unsigned width);
+
+/**
+ * Append an IPv4 address in dotted-decimal notation
+ */
+void fmt_ipv4(struct FmtBuf *fb, unsigned ip);
+
+/**
+ * Append TCP flags as a string like "syn-ack", or "none" if none
+ * are set.
+ */
+void fmt_tcpflags(struct FmtBuf *fb, unsigned flags);
+
+/**
+ * Nul-terminate the buffer (truncating the last character if necessary)
+ * and return it as a C string.
+ */
+const char *fmt_cstr(struct FmtBuf *fb);
+
+/**
+ * Format an IPv4 address into 'buf', which must be at least 16 bytes,
+ * returning the length of the string (not counting the nul terminator).
+ */
+unsigned fmt_ipv4_str(char *buf, unsigned ip);
+
+/**
+ * Convert an unsigned number to decimal at 'buf', which must be at least
+ * 10 bytes. Returns the number of digits. No nul terminator is written.
+ */
+unsigned fmt_utoa(char *buf, unsigned x);
+
+int fmt_selftest(void);
+void fmt_benchmark(void);
+
+#endif
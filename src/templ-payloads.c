@@ -8,23 +8,37 @@
     extracting just the payloads, associated them with the destination
     UDP port.
 
+    A port can have several payloads, such as from an "nmap-payloads" file
+    that lists more than one for a port, and each probe picks one of them.
+    Payloads read from files replace the built-in ones for the same port.
+    Where a payload has a field for our cookie (see proto-udp.c), that
+    field is zeroed here, so that the partial checksum doesn't include it.
  */
 #include "templ-payloads.h"
-#include "rawsock-pcapfile.h"   /* for reading payloads from pcap files */
+#include "in-pcap.h"            /* for reading payloads from pcap files */
 #include "proto-preprocess.h"   /* parse packets */
 #include "ranges.h"             /* for parsing IP addresses */
 #include "logger.h"
+#include "proto-udp.h"         /* for finding the cookie field */
 
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
 
+/* More than this for one port are ignored, such as when reading a packet
+ * capture with many different requests to the same port */
+#define PAYLOADS_PER_PORT_MAX 16
+
 struct Payload {
     unsigned port;
     unsigned source_port; /* not used yet */
     unsigned length;
     unsigned xsum;
+    unsigned is_builtin;
+    unsigned cookie_offset;
+    unsigned cookie_length; /* 0 if there's no room for a cookie */
+    struct Payload *next;   /* the next payload for the same port */
     unsigned char buf[1];
 };
 struct Payload2 {
@@ -39,6 +53,10 @@ struct NmapPayloads {
     unsigned count;
     unsigned max;
     struct Payload **list;
+
+    /* Direct lookup by port number, pointing into the list above, to the
+     * first of the payloads for the port */
+    struct Payload *index[65536];
 };
 
 struct Payload2 hard_coded_payloads[] = {
@@ -57,7 +75,7 @@ struct Payload2 hard_coded_payloads[] = {
         "\x30\x0c"
         "\x06\x08\x2b\x06\x01\x02\x01\x01\x05\x00" /*sysDesc*/
         "\x05\x00"},
-    {53, 65536, 38, 0,
+    {53, 65536, 30, 0,
             "\x50\xb6"  /* transaction id */
             "\x01\x20"  /* quer y*/
             "\x00\x01"  /* query = 1 */
@@ -65,9 +83,9 @@ struct Payload2 hard_coded_payloads[] = {
             "\x07" "version"  "\x04" "bind" "\x00"
             "\x00\x10" /* TXT */
             "\x00\x03" /* CHAOS */
-                                
-    
-    "\x00\x00" /* transaction ID */
+    },
+    {53, 65536, 31, 0,
+        "\x00\x00" /* transaction ID */
         "\x01\x00" /* standard query */
         "\x00\x01\x00\x00\x00\x00\x00\x00" /* 1 query */
         "\x03" "www" "\x05" "yahoo" "\x03" "com" "\x00"
@@ -85,6 +103,46 @@ struct Payload2 hard_coded_payloads[] = {
         "Accept: application/sdp\r\n"
         "Content-Length: 0\r\n"
     },
+    {123, 65536, 48, 0,
+        "\xe3"      /* version 4, mode 3 (client) */
+        "\x00\x04\xfa"
+        "\x00\x01\x00\x00" "\x00\x01\x00\x00"
+        "\x00\x00\x00\x00"
+        "\x00\x00\x00\x00\x00\x00\x00\x00" /* reference timestamp */
+        "\x00\x00\x00\x00\x00\x00\x00\x00" /* origin timestamp */
+        "\x00\x00\x00\x00\x00\x00\x00\x00" /* receive timestamp */
+        "\x00\x00\x00\x00\x00\x00\x00\x00" /* transmit timestamp = cookie */
+    },
+    {137, 65536, 50, 0,
+        "\x00\x00" /* transaction ID */
+        "\x00\x10" /* query */
+        "\x00\x01\x00\x00\x00\x00\x00\x00" /* 1 query */
+        "\x20" "CKAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA" "\x00" /* name = "*" */
+        "\x00\x21" /* NBSTAT */
+        "\x00\x01" /* IN */
+    },
+    {1900, 65536, 0xFFFFFFFF, 0,
+        "M-SEARCH * HTTP/1.1\r\n"
+        "HOST: 239.255.255.250:1900\r\n"
+        "MAN: \"ssdp:discover\"\r\n"
+        "MX: 1\r\n"
+        "ST: ssdp:all\r\n"
+        "\r\n"
+    },
+    {5353, 65536, 46, 0,
+        "\x00\x00" /* transaction ID */
+        "\x00\x00" /* standard query */
+        "\x00\x01\x00\x00\x00\x00\x00\x00" /* 1 query */
+        "\x09" "_services" "\x07" "_dns-sd" "\x04" "_udp" "\x05" "local" "\x00"
+        "\x00\x0c\x00\x01" /* PTR IN */
+    },
+    {11211, 65536, 15, 0,
+        "\x00\x00" /* request ID */
+        "\x00\x00" /* sequence number */
+        "\x00\x01" /* 1 datagram */
+        "\x00\x00"
+        "stats\r\n"
+    },
 
     {0,0,0,0,0}
 };
@@ -114,33 +172,62 @@ partial_checksum(const unsigned char *px, size_t icmp_length)
 }
 
 /***************************************************************************
- * If we have the port, return the payload
+ * If we have the port, return the payload. This is a direct lookup in the
+ * index, then a walk down the (short) list of payloads for the port.
  ***************************************************************************/
-int
+unsigned
 payloads_lookup(
         const struct NmapPayloads *payloads, 
         unsigned port, 
+        unsigned index,
         const unsigned char **px, 
         unsigned *length, 
         unsigned *source_port, 
-        uint64_t *xsum)
+        uint64_t *xsum,
+        unsigned *cookie_offset,
+        unsigned *cookie_length)
 {
-    unsigned i;
+    const struct Payload *p;
+    unsigned count = 0;
+
     if (payloads == 0)
         return 0;
     
-    port &= 0xFFFF;
-
-    for (i=0; i<payloads->count; i++) {
-        if (payloads->list[i]->port == port) {
-            *px = payloads->list[i]->buf;
-            *length = payloads->list[i]->length;
-            *source_port = payloads->list[i]->source_port;
-            *xsum = payloads->list[i]->xsum;
-            return 1;
-        }
+    for (p = payloads->index[port & 0xFFFF]; p; p = p->next)
+        count++;
+    if (count == 0)
+        return 0;
+
+    for (p = payloads->index[port & 0xFFFF]; index % count; index--)
+        p = p->next;
+
+    *px = p->buf;
+    *length = p->length;
+    *source_port = p->source_port;
+    *xsum = p->xsum;
+    *cookie_offset = p->cookie_offset;
+    *cookie_length = p->cookie_length;
+    return count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+payloads_has_cookie(const struct NmapPayloads *payloads, unsigned port)
+{
+    const struct Payload *p;
+
+    if (payloads == 0)
+        return 0;
+
+    p = payloads->index[port & 0xFFFF];
+    if (p == NULL)
+        return 0;
+    for ( ; p; p = p->next) {
+        if (p->cookie_length == 0)
+            return 0;
     }
-    return 0;
+    return 1;
 }
 
 
@@ -165,8 +252,7 @@ payloads_destroy(struct NmapPayloads *payloads)
 /***************************************************************************
  * We read lots of UDP payloads from the files. However, we probably
  * aren't using most, or even any, of them. Therefore, we use this
- * function to remove the ones we won't be using. This makes lookups
- * faster, ideally looking up only zero or one rather than twenty.
+ * function to remove the ones we won't be using, to save memory.
  ***************************************************************************/
 void
 payloads_trim(struct NmapPayloads *payloads, const struct RangeList *ports)
@@ -177,6 +263,7 @@ payloads_trim(struct NmapPayloads *payloads, const struct RangeList *ports)
         struct Payload *p = payloads->list[i-1];
 
         if (!rangelist_is_contains(ports, p->port + 65536)) {
+            payloads->index[p->port] = NULL;
             free(p);
             memmove(payloads->list + i - 1,
                     payloads->list + i, 
@@ -358,18 +445,54 @@ get_next_line(FILE *fp, unsigned *line_number, char *line, size_t sizeof_line)
 
 
 /***************************************************************************
+ * Remove all the payloads for the port
+ ***************************************************************************/
+static void
+payload_remove_port(struct NmapPayloads *payloads, unsigned port)
+{
+    unsigned i;
+
+    for (i=payloads->count; i>0; i--) {
+        struct Payload *p = payloads->list[i-1];
+
+        if (p->port == port) {
+            free(p);
+            memmove(payloads->list + i - 1,
+                    payloads->list + i, 
+                    (payloads->count - i) * sizeof(payloads->list[0]));
+            payloads->count--;
+        }
+    }
+    payloads->index[port] = NULL;
+}
+
+/***************************************************************************
+ * Add the payload for each of the ports.
+ * @return
+ *      the number added, not counting duplicates
  ***************************************************************************/
 static unsigned
 payload_add(struct NmapPayloads *payloads,
             const unsigned char *buf, size_t length, 
-            struct RangeList *ports, unsigned source_port)
+            struct RangeList *ports, unsigned source_port,
+            unsigned is_builtin)
 {
-    unsigned count = 1;
-    struct Payload *p;
+    unsigned count = 0;
     uint64_t port_count = rangelist_count(ports);
     uint64_t i;
 
     for (i=0; i<port_count; i++) {
+        unsigned port = rangelist_pick(ports, i) & 0xFFFF;
+        struct Payload *p;
+        struct Payload **r;
+        unsigned n = 0;
+
+        /* Payloads we read replace the built-in ones, but add to each
+         * other */
+        if (!is_builtin && payloads->index[port]
+            && payloads->index[port]->is_builtin)
+            payload_remove_port(payloads, port);
+
         /* grow the list if we need to */
         if (payloads->count + 1 > payloads->max) {
             unsigned new_max = payloads->max*2 + 1;
@@ -382,38 +505,50 @@ payload_add(struct NmapPayloads *payloads,
             payloads->max = new_max;
         }
 
-        /* allocate space for this record */
+        /* allocate space for this record, with the cookie field zeroed */
         p = (struct Payload *)malloc(sizeof(p[0]) + length);
-        p->port = rangelist_pick(ports, i);
+        memset(p, 0, sizeof(p[0]));
+        p->port = port;
         p->source_port = source_port;
         p->length = (unsigned)length;
+        p->is_builtin = is_builtin;
         memcpy(p->buf, buf, length);
-        p->xsum = partial_checksum(buf, length);
+        if (udp_cookie_field(port, p->buf, p->length, 0,
+                             &p->cookie_offset, &p->cookie_length))
+            memset(p->buf + p->cookie_offset, 0, p->cookie_length);
+        p->xsum = partial_checksum(p->buf, length);
+
+        /* skip duplicates, such as the same request captured many times */
+        for (r = &payloads->index[port]; *r; r = &(*r)->next) {
+            if ((*r)->length == p->length
+                && memcmp((*r)->buf, p->buf, p->length) == 0)
+                break;
+            n++;
+        }
+        if (*r || n >= PAYLOADS_PER_PORT_MAX) {
+            free(p);
+            continue;
+        }
+        *r = p;
 
-        /* insert in sorted order */
+        /* insert in sorted order, after the others for this port */
         {
             unsigned j;
 
             for (j=0; j<payloads->count; j++) {
-                if (p->port <= payloads->list[j]->port)
+                if (p->port < payloads->list[j]->port)
                     break;
             }
 
-            if (j < payloads->count) {
-                if (p->port == payloads->list[j]->port) {
-                    free(payloads->list[j]);
-                    count = 0; /* don't increment count */
-                } else
-                    memmove(payloads->list + j + 1,
-                            payloads->list + j, 
-                            (payloads->count-j) * sizeof(payloads->list[0]));
-            }
+            memmove(payloads->list + j + 1,
+                    payloads->list + j, 
+                    (payloads->count-j) * sizeof(payloads->list[0]));
             payloads->list[j] = p;
-
-            payloads->count += count;
+            payloads->count++;
         }
+        count++;
     }
-    return count; /* zero or one */
+    return count;
 }
 
 /***************************************************************************
@@ -423,83 +558,76 @@ void
 payloads_read_pcap(const char *filename, 
                    struct NmapPayloads *payloads)
 {
-    struct PcapFile *pcap;
+    struct PcapReader *pcap;
+    struct PcapFrame frames[64];
+    unsigned frame_count;
     unsigned count = 0;
  
     LOG(2, "payloads:'%s': opening packet capture\n", filename);
 
-    pcap = pcapfile_openread(filename);
+    pcap = pcapreader_open(filename);
     if (pcap == NULL) {
         fprintf(stderr, "payloads: can't read from file '%s'\n", filename);
         return;
     }
 
 
-    for (;;) {
-        unsigned x;
-        unsigned captured_length;
-        unsigned char buf[65536];
-        struct PreprocessedInfo parsed;
-        struct RangeList ports[1];
-        struct Range range[1];
-
-        /*
-         * Read the next packet from the capture file
-         */
-        {
-            unsigned time_secs;
-            unsigned time_usecs;
-            unsigned original_length;
-
-            x = pcapfile_readframe(pcap, 
-                    &time_secs, &time_usecs,
-                    &original_length, &captured_length,
-                    buf, (unsigned)sizeof(buf));
-        }
-        if (!x)
-            break;
+    /*
+     * Read the packets from the capture file, a batch at a time
+     */
+    while ((frame_count = pcapreader_next(pcap, frames, 64)) != 0) {
+        unsigned i;
 
-        /*
-         * Parse the packet up to its headers
-         */
-        x = preprocess_frame(buf, captured_length, 1, &parsed);
-        if (!x)
-            continue; /* corrupt packet */
+        for (i=0; i<frame_count; i++) {
+            const unsigned char *buf = frames[i].px;
+            unsigned x;
+            struct PreprocessedInfo parsed;
+            struct RangeList ports[1];
+            struct Range range[1];
+
+            /*
+             * Parse the packet up to its headers
+             */
+            x = preprocess_frame(buf, frames[i].length, 1, &parsed);
+            if (!x)
+                continue; /* corrupt packet */
+
+            /*
+             * Make sure it has UDP
+             */
+            switch (parsed.found) {
+            case FOUND_DNS:
+            case FOUND_UDP:
+                break;
+            default:
+                continue;
+            }
 
-        /*
-         * Make sure it has UDP
-         */
-        switch (parsed.found) {
-        case FOUND_DNS:
-        case FOUND_UDP:
-            break;
-        default:
-            continue;
+            /*
+             * Kludge: mark the port in the format the API wants
+             */
+            ports->list = range;
+            ports->count = 1;
+            ports->max = 1;
+            range->begin = parsed.port_dst;
+            range->end = range->begin;
+
+            /*
+             * Now we've completely parsed the record, so add it to our
+             * list of payloads
+             */
+            count += payload_add(   payloads, 
+                                    buf + parsed.app_offset, 
+                                    parsed.app_length,
+                                    ports, 
+                                    0x10000,
+                                    0);
         }
-
-        /*
-         * Kludge: mark the port in the format the API wants
-         */
-        ports->list = range;
-        ports->count = 1;
-        ports->max = 1;
-        range->begin = parsed.port_dst;
-        range->end = range->begin;
-
-        /*
-         * Now we've completely parsed the record, so add it to our
-         * list of payloads
-         */
-        count += payload_add(   payloads, 
-                                buf + parsed.app_offset, 
-                                parsed.app_length,
-                                ports, 
-                                0x10000);
     }
 
     LOG(2, "payloads:'%s': imported %u unique payloads\n", filename, count);
     LOG(2, "payloads:'%s': closed packet capture\n", filename);
-    pcapfile_close(pcap);
+    pcapreader_close(pcap);
 }
 
 /***************************************************************************
@@ -574,7 +702,7 @@ payloads_read_file(FILE *fp, const char *filename,
          * Now we've completely parsed the record, so add it to our
          * list of payloads
          */
-        payload_add(payloads, buf, buf_length, ports, source_port);
+        payload_add(payloads, buf, buf_length, ports, source_port, 0);
 
         rangelist_free(ports);
     }
@@ -639,7 +767,8 @@ payloads_create()
                     (const unsigned char*)hard_coded_payloads[i].buf,
                     length,
                     &list,
-                    hard_coded_payloads[i].source_port);
+                    hard_coded_payloads[i].source_port,
+                    1);
     }
     return payloads;
 }
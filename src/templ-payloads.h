@@ -25,21 +25,46 @@ void
 payloads_read_pcap(const char *filename, struct NmapPayloads *payloads);
 
 /**
- * Called to remove any payloads that aren't be used in the scan. This makes
- * lookups faster when generating packets.
+ * Called to remove any payloads that aren't be used in the scan.
  */
 void
 payloads_trim(struct NmapPayloads *payloadsd, const struct RangeList *ports);
 
-int
+/**
+ * Find a payload for a UDP port. This is a direct lookup in a table
+ * indexed by port number.
+ * @param index
+ *      which of the port's payloads to return, wrapping around when there
+ *      are fewer than this, so that each probe can pick a different one
+ * @param xsum
+ *      the partial checksum of the payload, to be added to the UDP
+ *      checksum
+ * @param cookie_offset
+ *      the offset in the payload of the field for our cookie, which is
+ *      zero in the payload
+ * @param cookie_length
+ *      the length of that field, or 0 if there isn't one
+ * @return
+ *      the number of payloads for the port, 0 if there are none
+ */
+unsigned
 payloads_lookup(
                 const struct NmapPayloads *payloads, 
                 unsigned port, 
+                unsigned index,
                 const unsigned char **px, 
                 unsigned *length, 
                 unsigned *source_port, 
-                uint64_t *xsum);
+                uint64_t *xsum,
+                unsigned *cookie_offset,
+                unsigned *cookie_length);
 
+/**
+ * Whether all the payloads for the port have a cookie, so that the
+ * receive thread should check for it in responses
+ */
+int
+payloads_has_cookie(const struct NmapPayloads *payloads, unsigned port);
 
 
 #endif
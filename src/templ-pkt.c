@@ -14,6 +14,8 @@
 #include "proto-preprocess.h"
 #include "logger.h"
 #include "templ-payloads.h"
+#include "proto-udp.h"
+#include "proto-sctp.h"
 #include "unusedparm.h"
 
 #include <assert.h>
@@ -71,18 +73,27 @@ static unsigned char default_sctp_template[] =
     "\x08\x00"      /* Etenrent type: IPv4 */
     "\x45"          /* IP type */
     "\x00"
-    "\x00\x1c"      /* total length = 40 bytes */
+    "\x00\x34"      /* total length = 52 bytes */
     "\x00\x00"      /* identification */
     "\x00\x00"      /* fragmentation flags */
-    "\xFF\x11"      /* TTL=255, proto=UDP */
+    "\xFF\x84"      /* TTL=255, proto=SCTP */
     "\xFF\xFF"      /* checksum */
     "\0\0\0\0"      /* source address */
     "\0\0\0\0"      /* destination address */
 
     "\xfe\xdc"      /* source port */
     "\0\0"          /* destination port */
+    "\0\0\0\0"      /* verification tag = 0 for INIT */
     "\0\0\0\0"      /* checksum */
-    "\0\0\0\0"      /* length */
+
+    "\x01"          /* chunk type = INIT */
+    "\x00"          /* flags */
+    "\x00\x14"      /* chunk length = 20 bytes */
+    "\0\0\0\0"      /* initiate tag = ???? */
+    "\x00\x01\x00\x00" /* advertised receive window */
+    "\x00\x0a"      /* outbound streams */
+    "\x08\x00"      /* inbound streams */
+    "\0\0\0\0"      /* initial TSN */
 ;
 
 
@@ -144,23 +155,17 @@ static unsigned char default_icmp_timestamp_template[] =
 
 
 static unsigned char default_arp_template[] =
-    "\0\1\2\3\4\5"  /* Ethernet: destination */
+    "\xff\xff\xff\xff\xff\xff"  /* Ethernet: destination (broadcast) */
     "\6\7\x8\x9\xa\xb"  /* Ethernet: source */
-    "\x08\x00"      /* Etenrent type: IPv4 */
-    "\x45"          /* IP type */
-    "\x00"
-    "\x00\x1c"      /* total length = 40 bytes */
-    "\x00\x00"      /* identification */
-    "\x00\x00"      /* fragmentation flags */
-    "\xFF\x11"      /* TTL=255, proto=UDP */
-    "\xFF\xFF"      /* checksum */
-    "\0\0\0\0"      /* source address */
-    "\0\0\0\0"      /* destination address */
-
-    "\xfe\xdc"      /* source port */
-    "\0\0"          /* destination port */
-    "\0\0\0\0"      /* checksum */
-    "\0\0\0\0"      /* length */
+    "\x08\x06"      /* Ethernet type: ARP */
+    "\x00\x01"      /* hardware type: Ethernet */
+    "\x08\x00"      /* protocol type: IPv4 */
+    "\x06\x04"      /* hardware and protocol address lengths */
+    "\x00\x01"      /* opcode: request */
+    "\0\0\0\0\0\0"  /* sender hardware address */
+    "\0\0\0\0"      /* sender protocol address */
+    "\0\0\0\0\0\0"  /* target hardware address */
+    "\0\0\0\0"      /* target protocol address */
 ;
 
 
@@ -410,30 +415,156 @@ tcp_create_packet(
 }
 
 /***************************************************************************
+ * Build the template for a UDP port that has a payload. This is a copy of
+ * the UDP template with the payload appended, and with the payload's
+ * partial checksum already added. Both the UDP length field and the length
+ * in the pseudo-header grow by the length of the payload. The IP checksum
+ * is the same as the original, since "template_set_target()" adds the
+ * payload length to it.
+ ***************************************************************************/
+static struct TemplatePacket *
+udp_template_create(const struct TemplatePacket *tmpl,
+                    const unsigned char *payload, unsigned payload_length,
+                    uint64_t payload_xsum,
+                    unsigned cookie_offset, unsigned cookie_length)
+{
+    struct TemplatePacket *tmpl2;
+    unsigned char *px;
+    unsigned udp_length = tmpl->offset_app - tmpl->offset_tcp + payload_length;
+    uint64_t xsum;
+
+    tmpl2 = (struct TemplatePacket *)malloc(sizeof(*tmpl2));
+    if (tmpl2 == NULL)
+        return NULL;
+    memcpy(tmpl2, tmpl, sizeof(*tmpl2));
+    tmpl2->udp_ports = NULL;
+    tmpl2->next = NULL;
+    tmpl2->length = tmpl->offset_app + payload_length;
+    if (cookie_length) {
+        tmpl2->cookie_offset = tmpl->offset_app + cookie_offset;
+        tmpl2->cookie_length = cookie_length;
+    }
+    tmpl2->packet = (unsigned char *)malloc(tmpl2->length + 1);
+    if (tmpl2->packet == NULL) {
+        free(tmpl2);
+        return NULL;
+    }
+    px = tmpl2->packet;
+    memcpy(px, tmpl->packet, tmpl->offset_app);
+    memcpy(px + tmpl->offset_app, payload, payload_length);
+    px[tmpl2->offset_tcp + 4] = (unsigned char)(udp_length >> 8);
+    px[tmpl2->offset_tcp + 5] = (unsigned char)(udp_length >> 0);
+
+    xsum = (uint64_t)tmpl->checksum_tcp
+            + (uint64_t)2 * payload_length
+            + payload_xsum;
+    xsum = (xsum >> 16) + (xsum & 0xFFFF);
+    xsum = (xsum >> 16) + (xsum & 0xFFFF);
+    xsum = (xsum >> 16) + (xsum & 0xFFFF);
+    tmpl2->checksum_tcp = (unsigned)xsum;
+
+    return tmpl2;
+}
+
+/***************************************************************************
+ * Find the template for this UDP port, building it if this is the first
+ * time we've seen the port. If the port has several payloads, 'variant'
+ * picks one.
+ ***************************************************************************/
+static struct TemplatePacket *
+udp_template(struct TemplatePacket *tmpl, unsigned port, unsigned variant)
+{
+    struct TemplatePacket *tmpl2;
+
+    if (tmpl->udp_ports == NULL) {
+        tmpl->udp_ports = (struct TemplatePacket **)
+                            calloc(65536, sizeof(tmpl->udp_ports[0]));
+        if (tmpl->udp_ports == NULL)
+            return tmpl;
+    }
+
+    tmpl2 = tmpl->udp_ports[port];
+    if (tmpl2 == NULL) {
+        struct TemplatePacket **r = &tmpl->udp_ports[port];
+        unsigned count = 1;
+        unsigned i;
+
+        for (i=0; i<count; i++) {
+            const unsigned char *px2 = 0;
+            unsigned length2 = 0;
+            unsigned source_port2 = 0x1000;
+            uint64_t xsum2 = 0;
+            unsigned cookie_offset2 = 0;
+            unsigned cookie_length2 = 0;
+
+            count = payloads_lookup(tmpl->payloads,
+                                    port,
+                                    i,
+                                    &px2,
+                                    &length2,
+                                    &source_port2,
+                                    &xsum2,
+                                    &cookie_offset2,
+                                    &cookie_length2);
+            if (count == 0)
+                break;
+            *r = udp_template_create(tmpl, px2, length2, xsum2,
+                                     cookie_offset2, cookie_length2);
+            if (*r == NULL)
+                break;
+            (*r)->variant_count = count;
+            r = &(*r)->next;
+        }
+
+        /* No payloads, or out of memory */
+        if (tmpl->udp_ports[port] == NULL)
+            tmpl->udp_ports[port] = tmpl;
+        tmpl2 = tmpl->udp_ports[port];
+    }
+
+    for ( ; variant && tmpl2->next; variant--)
+        tmpl2 = tmpl2->next;
+    return tmpl2;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+template_variant_count(struct TemplateSet *tmplset, unsigned port)
+{
+    struct TemplatePacket *tmpl;
+
+    if (port < 65536 || port >= 65536*2)
+        return 1;
+    tmpl = udp_template(&tmplset->pkts[Proto_UDP], port & 0xFFFF, 0);
+    return tmpl->variant_count ? tmpl->variant_count : 1;
+}
+
+/***************************************************************************
+ * Throw away the per-port UDP templates, because the original they were
+ * copied from has changed
  ***************************************************************************/
 static void
-udp_payload_fixup(struct TemplatePacket *tmpl, unsigned port, unsigned seqno)
+udp_template_flush(struct TemplatePacket *tmpl)
 {
-    const unsigned char *px2 = 0;
-    unsigned length2 = 0;
-    unsigned source_port2 = 0x1000;
-    uint64_t xsum2 = 0;
-    unsigned char *px = tmpl->packet;
-
-    UNUSEDPARM(seqno);
-
-    payloads_lookup(tmpl->payloads,
-                    port,
-                    &px2,
-                    &length2,
-                    &source_port2,
-                    &xsum2);
-
-    memcpy( px+tmpl->offset_app,
-            px2,
-            length2);
-
-    tmpl->length = tmpl->offset_app + length2;
+    unsigned i;
+
+    if (tmpl->udp_ports == NULL)
+        return;
+    for (i=0; i<65536; i++) {
+        struct TemplatePacket *tmpl2 = tmpl->udp_ports[i];
+
+        if (tmpl2 == tmpl)
+            continue;
+        while (tmpl2) {
+            struct TemplatePacket *next = tmpl2->next;
+            free(tmpl2->packet);
+            free(tmpl2);
+            tmpl2 = next;
+        }
+    }
+    free(tmpl->udp_ports);
+    tmpl->udp_ports = NULL;
 }
 
 
@@ -445,7 +576,7 @@ void
 template_set_target(
     struct TemplateSet *tmplset, 
     unsigned ip, unsigned port, 
-    unsigned seqno)
+    unsigned seqno, unsigned variant)
 {
     unsigned char *px;
     unsigned offset_ip;
@@ -463,9 +594,8 @@ template_set_target(
     if (port < 65536)
         tmpl = &tmplset->pkts[Proto_TCP];
     else if (port < 65536*2) {
-        tmpl = &tmplset->pkts[Proto_UDP];
         port &= 0xFFFF;
-        udp_payload_fixup(tmpl, port, seqno);
+        tmpl = udp_template(&tmplset->pkts[Proto_UDP], port, variant);
     } else if (port < 65536*3) {
         tmpl = &tmplset->pkts[Proto_SCTP];
         port &= 0xFFFF;
@@ -488,6 +618,17 @@ template_set_target(
     offset_tcp = tmpl->offset_tcp;
     ip_id = ip ^ port ^ seqno;
 
+    /* ARP has no IP header, just the address we're asking about */
+    if (tmpl->proto == Proto_ARP) {
+        px[offset_ip+24] = (unsigned char)((ip >> 24) & 0xFF);
+        px[offset_ip+25] = (unsigned char)((ip >> 16) & 0xFF);
+        px[offset_ip+26] = (unsigned char)((ip >>  8) & 0xFF);
+        px[offset_ip+27] = (unsigned char)((ip >>  0) & 0xFF);
+        tmplset->px = tmpl->packet;
+        tmplset->length = tmpl->length;
+        return;
+    }
+
     /*
      * Fill in the empty fields in the IP header and then re-calculate
      * the checksum.
@@ -544,25 +685,51 @@ template_set_target(
     case Proto_UDP:
         px[offset_tcp+ 2] = (unsigned char)(port >> 8);
         px[offset_tcp+ 3] = (unsigned char)(port & 0xFF);
-        px[offset_tcp+ 4] = (unsigned char)((tmpl->length - tmpl->offset_app + 8)>>8);
-        px[offset_tcp+ 5] = (unsigned char)((tmpl->length - tmpl->offset_app + 8)&0xFF);
-        
-        px[offset_tcp+6] = (unsigned char)(0);
-        px[offset_tcp+7] = (unsigned char)(0);
-        xsum = udp_checksum(tmpl);
-        /*xsum += (uint64_t)tmpl->checksum_tcp
+
+        xsum += (uint64_t)tmpl->checksum_tcp
                 + (uint64_t)ip
-                + (uint64_t)port
-                + (uint64_t)2*(tmpl->length - tmpl->offset_app);
+                + (uint64_t)port;
+
+        /* Stamp the cookie into the payload, a byte at a time, since it
+         * may not be aligned on a 16-bit boundary */
+        if (tmpl->cookie_length) {
+            unsigned cookie = udp_cookie(seqno, tmpl->cookie_length);
+            unsigned j;
+
+            for (j=tmpl->cookie_length; j>0; j--) {
+                unsigned offset = tmpl->cookie_offset + j - 1;
+                unsigned char c = (unsigned char)cookie;
+
+                px[offset] = c;
+                xsum += ((offset - offset_tcp) & 1) ? c : (c << 8);
+                cookie >>= 8;
+            }
+        }
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
         xsum = (xsum >> 16) + (xsum & 0xFFFF);
-        printf("%04x\n", xsum);*/
         xsum = ~xsum;
+        if ((xsum & 0xFFFF) == 0)
+            xsum = 0xFFFF; /* zero means "no checksum" in UDP */
         px[offset_tcp+6] = (unsigned char)(xsum >>  8);
         px[offset_tcp+7] = (unsigned char)(xsum >>  0);
         break;
     case Proto_SCTP:
+        px[offset_tcp+ 2] = (unsigned char)(port >> 8);
+        px[offset_tcp+ 3] = (unsigned char)(port & 0xFF);
+        px[offset_tcp+16] = (unsigned char)(seqno >> 24);
+        px[offset_tcp+17] = (unsigned char)(seqno >> 16);
+        px[offset_tcp+18] = (unsigned char)(seqno >>  8);
+        px[offset_tcp+19] = (unsigned char)(seqno >>  0);
+
+        /* A CRC, not the Internet checksum, so it's calculated over the
+         * whole thing each time */
+        memset(px + offset_tcp + 8, 0, 4);
+        xsum = sctp_checksum(px + offset_tcp, tmpl->length - offset_tcp);
+        px[offset_tcp+ 8] = (unsigned char)(xsum >>  0);
+        px[offset_tcp+ 9] = (unsigned char)(xsum >>  8);
+        px[offset_tcp+10] = (unsigned char)(xsum >> 16);
+        px[offset_tcp+11] = (unsigned char)(xsum >> 24);
         break;
     case Proto_ICMP_ping:
     case Proto_ICMP_timestamp:
@@ -651,6 +818,8 @@ _template_init(
      */
     if (parsed.found == FOUND_ARP) {
         memcpy((char*)parsed.ip_src - 6, mac_source, 6);
+        memset(px+0, 0xFF, 6);
+        tmpl->length = (unsigned)packet_size;
         tmpl->proto = Proto_ARP;
         return;
     }
@@ -691,10 +860,17 @@ _template_init(
         tmpl->proto = Proto_TCP;
         break;
     case 17: /* UDP */
+        memset(px + tmpl->offset_tcp + 2, 0, 2); /* destination port */
         memset(px + tmpl->offset_tcp + 6, 0, 2); /* checksum */
         tmpl->checksum_tcp = udp_checksum(tmpl);
         tmpl->proto = Proto_UDP;
         break;
+    case 132: /* SCTP */
+        memset(px + tmpl->offset_tcp + 2, 0, 2); /* destination port */
+        memset(px + tmpl->offset_tcp + 16, 0, 4); /* initiate tag */
+        tmpl->offset_app = tmpl->length; /* the INIT chunk is all header */
+        tmpl->proto = Proto_SCTP;
+        break;
     }
 }
 
@@ -723,6 +899,7 @@ template_packet_init(
     templset->pkts[Proto_UDP].payloads = payloads;
 
     /* [SCTP] */
+    sctp_checksum_init();
     _template_init( &templset->pkts[Proto_SCTP],
                     source_ip, source_mac, router_mac,
                     default_sctp_template,
@@ -786,14 +963,18 @@ template_set_source_port(struct TemplateSet *tmplset, unsigned port)
 {
     int i;
 
-    for (i=0; i<2; i++) {
+    for (i=0; i<3; i++) {
         struct TemplatePacket *tmpl = &tmplset->pkts[i];
         unsigned char *px = tmpl->packet;
         unsigned offset = tmpl->offset_tcp;
 
         px[offset+0] = (unsigned char)(port>>8);
         px[offset+1] = (unsigned char)(port>>0);
-        tmpl->checksum_tcp = tcp_checksum(tmpl);
+        if (tmpl->proto == Proto_UDP) {
+            tmpl->checksum_tcp = udp_checksum(tmpl);
+            udp_template_flush(tmpl);
+        } else if (tmpl->proto == Proto_TCP)
+            tmpl->checksum_tcp = tcp_checksum(tmpl);
     }
 
 }
@@ -813,10 +994,142 @@ template_set_ttl(struct TemplateSet *tmplset, unsigned ttl)
 
         px[offset+8] = (unsigned char)(ttl);
         tmpl->checksum_ip = tcp_checksum(tmpl);
+        if (tmpl->proto == Proto_UDP)
+            udp_template_flush(tmpl);
+    }
+}
+
+
+
+/***************************************************************************
+ * Check that the checksums we calculate incrementally for UDP match those
+ * calculated over the entire packet, for ports both with and without
+ * payloads. Odd-length payloads, and cookies at odd offsets, are the
+ * tricky ones.
+ ***************************************************************************/
+static int
+template_selftest_udp(void)
+{
+    static const unsigned ports[] = {53, 161, 5060, 1234, 161, 53, 0};
+    struct TemplateSet tmplset[1];
+    struct NmapPayloads *payloads;
+    unsigned i;
+    int failures = 0;
+
+    payloads = payloads_create();
+    template_packet_init(
+            tmplset,
+            0x12345678,
+            (const unsigned char*)"\x00\x11\x22\x33\x44\x55",
+            (const unsigned char*)"\x66\x55\x44\x33\x22\x11",
+            payloads
+            );
+    template_set_source_port(tmplset, 0xFEDC);
+
+    for (i=0; ports[i]; i++) {
+        struct TemplatePacket *tmpl = &tmplset->pkts[Proto_UDP];
+        const unsigned char *payload = 0;
+        unsigned payload_length = 0;
+        unsigned source_port = 0;
+        uint64_t payload_xsum = 0;
+        unsigned cookie_offset = 0;
+        unsigned cookie_length = 0;
+        unsigned char px[2048];
+        unsigned ip = 0xC0A80000 + i * 0x01010101;
+        unsigned seqno = 0x9E3779B9 * (i + 1);
+        unsigned variant;
+
+        variant = i % template_variant_count(tmplset, 65536 + ports[i]);
+        payloads_lookup(payloads, ports[i], variant, &payload, &payload_length,
+                        &source_port, &payload_xsum,
+                        &cookie_offset, &cookie_length);
+
+        template_set_target(tmplset, ip, 65536 + ports[i], seqno, variant);
+        if (tmplset->length != tmpl->offset_app + payload_length
+            || tmplset->length > sizeof(px) - 1) {
+            failures++;
+            continue;
+        }
+        memcpy(px, tmplset->px, tmplset->length);
+        px[tmplset->length] = 0xA5; /* checksums read one past odd lengths */
+
+        if (px[tmpl->offset_tcp+2] != (ports[i] >> 8)
+            || px[tmpl->offset_tcp+3] != (ports[i] & 0xFF)
+            || px[tmpl->offset_ip+16] != (ip >> 24)
+            || px[tmpl->offset_ip+19] != (ip & 0xFF))
+            failures++;
+        if (cookie_length) {
+            unsigned cookie = 0;
+            unsigned j;
+
+            for (j=0; j<cookie_length; j++)
+                cookie = cookie<<8 | px[tmpl->offset_app + cookie_offset + j];
+            if (cookie != udp_cookie(seqno, cookie_length))
+                failures++;
+        } else if (ports[i] == 53 || ports[i] == 161)
+            failures++;
+        if (icmp_checksum2(px, tmpl->offset_ip,
+                           tmpl->offset_tcp - tmpl->offset_ip) != 0xFFFF)
+            failures++;
+        if (udp_checksum2(px, tmpl->offset_ip, tmpl->offset_tcp,
+                          tmplset->length - tmpl->offset_tcp) != 0xFFFF)
+            failures++;
     }
+
+    payloads_destroy(payloads);
+    if (failures)
+        fprintf(stderr, "template: udp checksum failed\n");
+    return failures;
 }
 
+/***************************************************************************
+ * An SCTP INIT must have a good IP checksum, the cookie as the initiate
+ * tag, and the CRC32c over the SCTP packet
+ ***************************************************************************/
+static int
+template_selftest_sctp(void)
+{
+    struct TemplateSet tmplset[1];
+    struct TemplatePacket *tmpl;
+    unsigned char *px;
+    unsigned offset;
+    unsigned xsum = 0;
+    unsigned crc;
+    unsigned i;
+    int failures = 0;
+
+    template_packet_init(
+            tmplset,
+            0x12345678,
+            (const unsigned char*)"\x00\x11\x22\x33\x44\x55",
+            (const unsigned char*)"\x66\x55\x44\x33\x22\x11",
+            0
+            );
+    template_set_target(tmplset, 0x0A000001, 65536*2 + 80, 0xDEADBEEF, 0);
+    tmpl = &tmplset->pkts[Proto_SCTP];
+    px = tmpl->packet;
+    offset = tmpl->offset_tcp;
+
+    for (i=tmpl->offset_ip; i<offset; i += 2)
+        xsum += px[i]<<8 | px[i+1];
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    failures += (xsum != 0xFFFF);
+
+    failures += (px[offset+2]<<8 | px[offset+3]) != 80;
+    failures += px[offset+12] != 1;
+    failures += (unsigned)(px[offset+16]<<24 | px[offset+17]<<16
+                | px[offset+18]<<8 | px[offset+19]) != 0xDEADBEEF;
 
+    crc = px[offset+8] | px[offset+9]<<8 | px[offset+10]<<16
+        | (unsigned)px[offset+11]<<24;
+    memset(px + offset + 8, 0, 4);
+    failures += crc != sctp_checksum(px + offset, tmpl->length - offset);
+
+    if (failures)
+        fprintf(stderr, "template: sctp failed\n");
+    return failures;
+}
 
 /***************************************************************************
  ***************************************************************************/
@@ -835,13 +1148,25 @@ template_selftest()
             );
     failures += tmplset->pkts[Proto_TCP].proto  != Proto_TCP;
     failures += tmplset->pkts[Proto_UDP].proto  != Proto_UDP;
-    //failures += tmplset->pkts[Proto_SCTP].proto != Proto_SCTP;
+    failures += tmplset->pkts[Proto_SCTP].proto != Proto_SCTP;
     failures += tmplset->pkts[Proto_ICMP_ping].proto != Proto_ICMP_ping;
     //failures += tmplset->pkts[Proto_ICMP_timestamp].proto != Proto_ICMP_timestamp;
-    //failures += tmplset->pkts[Proto_ARP].proto  != Proto_ARP;
+    failures += tmplset->pkts[Proto_ARP].proto  != Proto_ARP;
+
+    /* An ARP request, broadcast, asking who has the target's address */
+    template_set_target(tmplset, 0x0A000001, 65536*3+2, 0, 0);
+    if (tmplset->length != 42
+        || memcmp(tmplset->px + 0, "\xff\xff\xff\xff\xff\xff", 6) != 0
+        || memcmp(tmplset->px + 12, "\x08\x06", 2) != 0
+        || memcmp(tmplset->px + 22, "\x00\x11\x22\x33\x44\x55", 6) != 0
+        || memcmp(tmplset->px + 28, "\x12\x34\x56\x78", 4) != 0
+        || memcmp(tmplset->px + 38, "\x0A\x00\x00\x01", 4) != 0)
+        failures++;
 
     if (failures)
         fprintf(stderr, "template: failed\n");
+
+    failures += template_selftest_udp();
+    failures += template_selftest_sctp();
     return failures;
 }
-
@@ -39,6 +39,19 @@ struct TemplatePacket {
     unsigned ip_id;
     enum TemplateProtocol proto;
     struct NmapPayloads *payloads;
+
+    /* UDP only: a template for each port, with the payload for that port
+     * already in place and included in "checksum_tcp". These are built
+     * the first time a port is used. Ports without a payload point back
+     * to this template. When a port has several payloads, there's a
+     * template for each, linked by "next". */
+    struct TemplatePacket **udp_ports;
+    struct TemplatePacket *next;
+    unsigned variant_count;
+
+    /* UDP only: where in the packet to put the cookie, if anywhere */
+    unsigned cookie_offset;
+    unsigned cookie_length;
 };
 
 struct TemplateSet
@@ -103,12 +116,23 @@ template_packet_init(
  *      will create from SYN-cookies. Other protocols may use this in a
  *      different manner. For example, if the UDP port is 161, then
  *      this will be the transaction ID of the SNMP request template.
+ * @param variant
+ *      When a UDP port has several payloads, which one to send, from 0
+ *      to template_variant_count() - 1
  */
 void
 template_set_target(
     struct TemplateSet *templset,
     unsigned ip, unsigned port, 
-    unsigned seqno);
+    unsigned seqno, unsigned variant);
+
+/**
+ * How many payloads there are for this port (encoded the same way as for
+ * template_set_target()), each of which is sent with every probe. This
+ * is 1 except for UDP ports with several payloads.
+ */
+unsigned
+template_variant_count(struct TemplateSet *templset, unsigned port);
 
 
 /**
@@ -124,6 +148,18 @@ tcp_create_packet(
         const unsigned char *payload, size_t payload_length,
         unsigned char *px, size_t px_length);
 
+/**
+ * Checksums over a packet, including the pseudo-header for TCP and UDP.
+ * These return the sum, which needs to be inverted before being put in
+ * the packet. Odd lengths read one byte past the end.
+ */
+unsigned tcp_checksum2(const unsigned char *px, unsigned offset_ip,
+              unsigned offset_tcp, size_t tcp_length);
+unsigned udp_checksum2(const unsigned char *px, unsigned offset_ip,
+              unsigned offset_tcp, size_t tcp_length);
+unsigned icmp_checksum2(const unsigned char *px,
+              unsigned offset_icmp, size_t icmp_length);
+
 void
 template_packet_trace(struct TemplateSet *tmplset, 
     unsigned ip, unsigned port, double timestamp_start);
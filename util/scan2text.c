@@ -28,6 +28,8 @@
     Some record types currently produced by the program:
     1 - STATUS (minimal open/closed port record)
     2 - BANNER (banner for a port)
+    5 - BANNER (banner for a port over UDP, etc., with a byte for the IP
+        protocol after the IPv4 address)
     109 - FILEHEADER (the file header record)
  
     The FILEHEADER record is the first header in the file. It's contents are 
@@ -448,6 +450,8 @@ parse_file(const char *filename)
             case 3: /* BANNER */
                 parse_banner(buf, bytes_read);
                 break;
+            case 5: /* BANNER, not TCP */
+                break;
             case 'm': /* FILEHEADER */
                 //goto end;
                 break;